@@ -41,6 +41,10 @@ begbss:
 # 0x306 - /dev/hd6 - 第2个盘的第1个分区
 .equ ROOT_DEV,  0x301           # 指定 /dev/fda 为系统镜像所在的设备
 
+# SWAP_DEV: 交换设备号，0 表示不使用交换分区
+# 0x302 - /dev/hd2 - 第1个盘的第2个分区，需先写入 "SWAP-SPACE" 签名（mkswap）才会被启用
+.equ SWAP_DEV,  0x302
+
 .equ ENDSEG, SYSSEG + SYSSIZE   # system 停止加载的段地址
 
 ljmp $BOOTSEG, $_start   # 长跳转,修改 cs = 0x7c0, ip = _start
@@ -289,7 +293,11 @@ msg1:
     .byte 13, 10, 13, 10  #13 回车，10 换行
 
 
-.= 508                  # 等价于 .org 表示补零到地址 508
+.= 506                  # 等价于 .org 表示补零到地址 506
+
+swap_dev:
+    .word SWAP_DEV
+
 
 root_dev:
     .word ROOT_DEV
@@ -2,7 +2,7 @@
 # 创建页目录表，页表，缓冲区，GDT，IDT，跳转到main函数执行
 
 .text
-.globl idt, gdt, pg_dir, tmp_floppy_area
+.globl idt, gdt, pg_dir, tmp_floppy_area, x86_capability
 pg_dir:             # 页目录将会保存在这里，最后会覆盖掉startup_32内容
 
 .globl startup_32
@@ -106,7 +106,7 @@ setup_gdt:
     ret
 
 # Linus 将内核内存页表直接放在页目录之后，使用 4 个表来寻址16MB的物理内存
-# 如果你有多于 16MB 内存，就需要在这里进行扩充修改
+# 多于 16MB 的内存(最多 1GB - 4MB)由 mm/memory.c 中的 mem_init() 在主内存区开始处分配页表进行映射
 # 每个页表长 4Kb，每个页表项需要 4 字节，因此每个页表可以存放 1024 个表项，
 # 如果一个页表项寻址 4KB，则一个页表可寻址 4MB 物理内存
 # Make place for pg directory
@@ -231,15 +231,75 @@ setup_paging:
 	subl $0x1000, %eax              # 每填好一项，物理内存地址值减0x1000
 	jge 1b                          # 如果小于0则说明全添写好
 
+	cld
+	# 如果 CPU 支持 4MB 页(PSE)，内核空间改用 4MB 页直接映射，页目录项 PS(位7)=1,
+	# 页目录项中即是 4MB 物理页的地址。一个 TLB 项就可以覆盖 4MB，减少内核访问缓冲区
+	# 和 mem_map 时的 TLB 缺失。若还支持全局页(PGE)，再设置 G(位8)，重新加载 cr3
+	# (invalidate()、任务切换)时这些 TLB 项不会被刷新。内核空间的映射从不改变，可以这样做。
+	# pg0-pg3 仍然填好，不支持 PSE 的 CPU 照旧使用它们。
+	call check_cpuid
+	testl $X86_FEATURE_PSE, x86_capability
+	je 3f
+	movl $0x87, %eax                # PS | U/S | R/W | P
+	testl $X86_FEATURE_PGE, x86_capability
+	je 2f
+	orl $0x100, %eax                # G
+2:	movl %eax, pg_dir
+	addl $0x400000, %eax
+	movl %eax, pg_dir+4
+	addl $0x400000, %eax
+	movl %eax, pg_dir+8
+	addl $0x400000, %eax
+	movl %eax, pg_dir+12
+	movl %cr4, %eax
+	orl $0x10, %eax                 # CR4.PSE, 位4
+	movl %eax, %cr4
+3:
 	# 设置页目录表基址寄存器cr3的值，指向页目录表。cr3 中保存的是页目录表的物理地址
 	xorl %eax, %eax                 # 页表目录表在 0x0000 处
 	movl %eax, %cr3                 # cr3 - page directory start
 
 	# Then enable paging
 	movl %cr0, %eax
-	orl $0x80000000, %eax			# Set the paging bit, 31 位
+	orl $0x80010000, %eax			# Set the paging bit, 31 位; WP 位 16: 内核写只读页面同样引起写保护异常
 	movl %eax, %cr0					# ENABLE PAGING NOW!
-	ret
+	# 开启分页以后再打开全局页(CR4.PGE, 位7)
+	testl $X86_FEATURE_PGE, x86_capability
+	je 4f
+	movl %cr4, %eax
+	orl $0x80, %eax
+	movl %eax, %cr4
+4:	ret
+
+# 检测 CPU 是否支持 cpuid 指令(能否改变 EFLAGS 中的 ID 位，位21)，
+# 若支持则把 cpuid 功能 1 返回的特性标志(edx)保存到 x86_capability 中，否则为 0
+X86_FEATURE_PSE = 0x0008            # 4MB 页
+X86_FEATURE_PGE = 0x2000            # 全局页
+check_cpuid:
+	movl $0, x86_capability
+	pushfl
+	popl %eax
+	movl %eax, %ecx
+	xorl $0x200000, %eax
+	pushl %eax
+	popfl
+	pushfl
+	popl %eax
+	pushl %ecx                      # 恢复原来的 EFLAGS
+	popfl
+	xorl %ecx, %eax
+	testl $0x200000, %eax
+	je 1f
+	pushl %ebx                      # cpuid 会改变 ebx
+	movl $1, %eax
+	cpuid
+	movl %edx, x86_capability
+	popl %ebx
+1:	ret
+
+.align 4
+x86_capability:
+	.long 0
 
 # 本程序到此结束
 
@@ -266,14 +326,14 @@ idt_descr:
 .align 2
 .word 0
 gdt_descr:
-    .word 256*8-1                   # gdt表限长，这里全局表长度为2KB（0x7ff即可），每个8字节，所以256项
+    .word 260*8-1                   # gdt表限长，每个8字节，共260项: 4项 + 128个任务各2项(NR_TASKS)
     .long gdt                       # gdt表基地址
 	.align 8
 
 idt:
     .fill 256, 8, 0         # idt is uninitialized
 
-# 废弃setup中gdt，重新创建gdt，其段限长均设置为 16MB
+# 废弃setup中gdt，重新创建gdt，其段限长均设置为 1GB
 # 原来 gdt 所在 0x90200...位置处，会在设计缓冲区时被覆盖
 
 # 全局描述符表结构
@@ -295,32 +355,35 @@ idt:
 #		   B=1使用32位操作数，堆栈指针用ESP，B=0时使用16位操作数，堆栈指针用SP
 #
 # 所以:
-#     G = 1, AVL = 1, P = 1, DPL = 00, S = 1, limit = 16M
+#     G = 1, AVL = 1, P = 1, DPL = 00, S = 1, limit = 1GB
 #
 #      64                         32
-#      |  00c0   |   9a00/9200    |
-#      |  0000   |    0fff        |
+#      |  00c3   |   9a00/9200    |
+#      |  0000   |    ffff        |
+#
+# 内核段覆盖 USER_BASE 以下的整个 1GB 内核空间(包括 0x3ffff000 处的 APIC 寄存器)，
+# 16MB 以上内存的页表在 mem_init() 中建立
 #
 gdt:
     # Empty Entry (FIRST ENTRY)
 	.quad 0x0000000000000000            # 空项
 	# BaseAddress = 0x00000000
-	# Limit = 0xfff
+	# Limit = 0x3ffff
 	# Granularity = 1 means 4KB Segment limit are 4KB unit
 	# TYPE = 0xA Executable Read
 	# DPL = 0x00 S = 1 P = 1
 	# Code Segment
-	.quad 0x00c09a0000000fff            # 代码段描述符, 16MB
+	.quad 0x00c39a000000ffff            # 代码段描述符, 1GB
 	# BaseAddress = 0x00000000
-	# Limit = 0xfff
+	# Limit = 0x3ffff
 	# Granularity = 1 means 4KB Segment limit are 4KB unit
 	# TYPE = 0x2 Read/Write
 	# DPL = 0x00 S = 1 P = 1
 	# Data Segment
-	.quad 0x00c0920000000fff            # 数据段描述符, 16MB
+	.quad 0x00c392000000ffff            # 数据段描述符, 1GB
 	# Temporaray
 	.quad 0x0000000000000000            # 系统调用段描述符, 没有用
-	.fill 252, 8, 0                     # 预留 252 项空间，用于放置创建任务的局部描述符（LDT）和
+	.fill 256, 8, 0                     # 预留 256 项空间，用于放置创建任务的局部描述符（LDT）和
                                         # 对应的任务状态段 TSS 的描述符
 
 ####################################################################################################
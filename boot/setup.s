@@ -64,6 +64,43 @@ _start:
 	int $0x15
 	mov %ax, %ds:2
 
+# 取系统内存分布图(E820)
+# 0x88 号功能最多只能报告 64MB 扩展内存，并且不能反映内存空洞。
+# Comment for routine 0x15 service 0xe820
+# EAX = 0000E820h
+# EBX = continuation value or 0 to start at beginning of map
+# ECX = size of buffer for result, in bytes (should be >= 20 bytes)
+# EDX = 534D4150h ('SMAP')
+# ES:DI = buffer for result
+# on return:
+# CF clear if successful, EAX = 534D4150h ('SMAP')
+# EBX = next offset, or 0 if this was the last entry
+# 每项 20 字节: 基地址(8 字节)，长度(8 字节)，类型(4 字节，1 为可用内存)
+# 表项保存在 0x90A00 开始处(最多 32 项)，项数保存在 0x901E8 字节处。
+# BIOS 不支持时项数为 0，内核仍然使用上面的扩展内存大小。
+	movb $0, %ds:0x1e8
+	push %es
+	mov %ds, %ax
+	mov %ax, %es
+	mov $0x0a00, %di
+	xorl %ebx, %ebx
+e820_loop:
+	movl $0x0000e820, %eax
+	movl $20, %ecx
+	movl $0x534d4150, %edx
+	int $0x15
+	jc e820_done
+	cmpl $0x534d4150, %eax
+	jne e820_done
+	incb %ds:0x1e8
+	add $20, %di
+	cmpb $32, %ds:0x1e8
+	jae e820_done
+	testl %ebx, %ebx
+	jne e820_loop
+e820_done:
+	pop %es
+
 # 取显卡显示模式
 # Comment for routine 10 service 0xf
 # AH = 0F
@@ -9,7 +9,7 @@
 // 变量end是由编译时的连接程序ld生成，用于表明内核代码的末端，即指明内核模块某段位置。
 // 也可以从编译内核时生成的System.map文件中查出。这里用它来表明高速缓冲区开始于内核
 // 代码某段位置。
-// buffer_wait等变量是等待空闲缓冲块而睡眠的任务队列头指针。它与缓冲块头部结构中b_wait
+// buffer_wait等变量是等待空闲缓冲块而睡眠的任务等待队列(见 linux/wait.h)。它与缓冲块头部结构中b_wait
 // 指针的租用不同。当任务申请一个缓冲块而正好遇到系统缺乏可用空闲缓冲块时，当前任务
 // 就会被添加到buffer_wait睡眠等待队列中。而b_wait则是专门供等待指定缓冲块(即b_wait
 // 对应的缓冲块)的任务使用的等待队列头指针。
@@ -18,7 +18,7 @@ extern int end;
 struct buffer_head * start_buffer = (struct buffer_head *) &end;
 struct buffer_head * hash_table[NR_HASH];           // NR_HASH ＝ 307项
 static struct buffer_head * free_list;              // 空闲缓冲块链表头指针
-static struct task_struct * buffer_wait = NULL;     // 等待空闲缓冲块而睡眠的任务队列
+static struct wait_queue * buffer_wait = NULL;      // 等待空闲缓冲块而睡眠的任务队列(独占等待)
 
 // 下面定义系统缓冲区中含有的缓冲块个数。这里，NR_BUFFERS是一个定义在linux/fs.h中的
 // 宏，其值即使变量名nr_buffers，并且在fs.h文件中声明为全局变量。大写名称通常都是一个
@@ -72,6 +72,7 @@ int sync_dev(int dev) {
     // 需要再次判断一下该缓冲块是否还是指定设备的缓冲块。
 	bh = start_buffer;
 	for (i = 0 ; i < NR_BUFFERS ; i++, bh++) {
+		cond_resched();                     // 缓冲块很多，每块之前是一个抢占点
 		if (bh->b_dev != dev)               // 不是设备dev的缓冲块则继续
 			continue;
 		wait_on_buffer(bh);                     // 等待缓冲区解锁
@@ -86,6 +87,7 @@ int sync_dev(int dev) {
     // 而又变脏的缓冲块与设备中数据同步。
 	bh = start_buffer;
 	for (i=0 ; i<NR_BUFFERS ; i++,bh++) {
+		cond_resched();
 		if (bh->b_dev != dev)
 			continue;
 		wait_on_buffer(bh);
@@ -214,8 +216,9 @@ repeat:
     // 如果循环检查发现所有缓冲块都正在被使用(所有缓冲块的头部引用计数都 > 0)中，
     // 则睡眠等待有空闲缓冲块可用。当有空闲缓冲块可用时本进程会被明确的唤醒。
     // 然后我们跳转到函数开始处重新查找空闲缓冲块。
+    // 这里是独占等待: 释放一个缓冲块只唤醒一个等待者，而不是让所有等待者都回来重新查找。
 	if (!bh) {
-		sleep_on(&buffer_wait);
+		sleep_on_exclusive(&buffer_wait);
 		goto repeat;
 	}
     // 执行到这里，说明我们已经找到了一个比较合适的空闲缓冲块了。于是先等待该缓冲区解锁。
@@ -253,14 +256,15 @@ repeat:
 }
 
 // 释放指定缓冲块。
-// 等待该缓冲块解锁。然后引用计数递减1，并明确地唤醒等待空闲缓冲块的进程。
+// 等待该缓冲块解锁。然后引用计数递减1，引用计数为 0 时(缓冲块空闲)唤醒一个等待空闲缓冲块的进程。
 void brelse(struct buffer_head * buf) {
 	if (!buf)
 		return;
 	wait_on_buffer(buf);
 	if (!(buf->b_count--))
 		panic("Trying to free free buffer");
-	wake_up(&buffer_wait);
+	if (!buf->b_count)
+		wake_up(&buffer_wait);
 }
 
 
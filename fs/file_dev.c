@@ -1,6 +1,7 @@
 #include <errno.h>
 #include <linux/sched.h>
 #include <linux/kernel.h>
+#include <linux/mm.h>
 #include <asm/segment.h>
 #include <serial_debug.h>
 
@@ -12,11 +13,25 @@
 int file_read(struct m_inode * inode, struct file *filp, char * buf, int count) {
     int left, chars, nr = 0;
     struct buffer_head * bh;
+    unsigned long page;
 
     if ((left = count) <= 0)
         return 0;
 
     while (left) {
+        // 被映射的文件页面在页面缓存中时从页面读取: MAP_SHARED 映射写入的数据在 munmap() 之前
+        // 只在页面中，缓冲区里是旧的。逻辑块不跨页面，本次读取的字节都在这一页内
+        if ((page = filemap_get_page(inode, (unsigned long) filp->f_pos / PAGE_SIZE))) {
+            char * p = (char *) (page + (unsigned long) filp->f_pos % PAGE_SIZE);
+            chars = MIN(BLOCK_SIZE - filp->f_pos % BLOCK_SIZE, left);
+            filp->f_pos += chars;
+            left -= chars;
+            while (chars-->0) {
+                put_fs_byte(*(p++), buf++);
+            }
+            free_page(page);                                    // 复制期间持有引用，缺页回收不会释放该页
+            continue;
+        }
         if ((nr = bmap(inode, (filp->f_pos)/BLOCK_SIZE))) {      // 计算出文件当前指针所在的数据块号
             if (!(bh = bread(inode->i_dev, nr)))
                 break;
@@ -18,7 +18,7 @@ static void write_inode(struct m_inode * inode);
 static inline void lock_inode(struct m_inode * inode) {
 	cli();
 	while (inode->i_lock)
-		sleep_on(&inode->i_wait);
+		sleep_on_exclusive(&inode->i_wait);     // 解锁时只有一个能锁上，独占等待
 	inode->i_lock = 1;
 	sti();
 }
@@ -48,6 +48,7 @@ void sync_inodes() {
     // 缓冲区管理程序buffer.c会在适当时机将他们写入盘中。
     inode = 0+inode_table;
     for (i = 0; i < NR_INODE; i++, inode++) {
+        cond_resched();
         wait_on_inode(inode);
         if (inode->i_dirt && !inode->i_pipe)     // 被修改且不是管道节点
             write_inode(inode);
@@ -31,7 +31,7 @@ int ROOT_DEV = 0;       // 根文件系统设备号
 static void lock_super(struct super_block * sb) {
     cli();
     while (sb->s_lock)
-        sleep_on(&(sb->s_wait));
+        sleep_on_exclusive(&(sb->s_wait));     // 解锁时只有一个能锁上，独占等待
     sb->s_lock = 1;
     sti();
 }
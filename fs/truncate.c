@@ -53,6 +53,7 @@ void truncate(struct m_inode * inode) {
     // 首先判断指定i节点的有效性，如果不是常规文件或者是目录文件，则返回
     if (!(S_ISREG(inode->i_mode) || S_ISDIR(inode->i_mode)))
         return;
+    invalidate_inode_pages(inode);              // 页面缓存中该文件的页面已经失效
 
     // 释放7个直接逻辑块
     for (i = 0; i < 7; i++) {
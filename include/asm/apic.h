@@ -0,0 +1,52 @@
+#ifndef _ASM_APIC_H
+#define _ASM_APIC_H
+
+// 本地 APIC，见 kernel/smp.c
+// 每个 CPU 有一个本地 APIC，寄存器映射在同一个物理地址(通常是 0xFEE00000)，访问的总是本 CPU 自己的 APIC。
+// 内核把它映射到内核空间最后一页 APIC_BASE(页目录项 255，禁止缓存)，在第一次 fork 之前完成，
+// 所有进程的页目录都从 pg_dir 复制到这一项。system_call.s 中的 APIC_EOI 与这里一致
+#define APIC_BASE       0x3ffff000ul
+
+#define APIC_ID         0x020           // 本地 APIC ID，位 24-31
+#define APIC_TPR        0x080           // 任务优先级，0 表示接受所有中断
+#define APIC_EOI        0x0b0           // 写 0 结束中断
+#define APIC_SVR        0x0f0           // 伪中断向量
+#define     APIC_SVR_ENABLE     0x100   // 软件允许 APIC
+#define APIC_ESR        0x280           // 错误状态
+#define APIC_ICR        0x300           // 中断命令寄存器低 32 位，写入时发出 IPI
+#define     APIC_DM_FIXED       0x000
+#define     APIC_DM_NMI         0x400
+#define     APIC_DM_INIT        0x500
+#define     APIC_DM_STARTUP     0x600
+#define     APIC_DM_EXTINT      0x700
+#define     APIC_ICR_BUSY       0x1000  // 上一个 IPI 还没有发送出去
+#define     APIC_INT_ASSERT     0x4000
+#define     APIC_INT_LEVELTRIG  0x8000
+#define     APIC_DEST_ALLBUT    0xc0000 // 发给除自己以外的所有 CPU
+#define APIC_ICR2       0x310           // 中断命令寄存器高 32 位，位 24-31 是目标 APIC ID
+#define APIC_LVTT       0x320           // 本地定时器
+#define     APIC_LVT_TIMER_PERIODIC 0x20000
+#define APIC_LVT0       0x350           // LINT0 引脚
+#define APIC_LVT1       0x360           // LINT1 引脚
+#define APIC_LVTERR     0x370           // 错误中断
+#define     APIC_LVT_MASKED     0x10000
+#define APIC_TMICT      0x380           // 定时器初始计数值
+#define APIC_TMCCT      0x390           // 定时器当前计数值
+#define APIC_TDCR       0x3e0           // 定时器分频
+#define     APIC_TDR_DIV_16     0x3
+
+// 8259A 占用 0x20-0x2f，系统调用 0x80
+#define LOCAL_TIMER_VECTOR      0x30    // 本地 APIC 定时器，应用处理器的时钟中断
+#define RESCHEDULE_VECTOR       0x31    // 让目标 CPU 重新调度
+#define INVALIDATE_TLB_VECTOR   0x32    // 让目标 CPU 刷新 TLB
+#define SPURIOUS_APIC_VECTOR    0xff    // 低 4 位必须全为 1
+
+static inline unsigned long apic_read(unsigned long reg) {
+    return *(volatile unsigned long *) (APIC_BASE + reg);
+}
+
+static inline void apic_write(unsigned long reg, unsigned long v) {
+    *(volatile unsigned long *) (APIC_BASE + reg) = v;
+}
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef _ASM_DIV64_H
+#define _ASM_DIV64_H
+
+// 64 位数除以 32 位数，商不超过 32 位(没有 libgcc 的 __udivdi3)
+static inline unsigned long div64_32(unsigned long long n, unsigned long d) {
+    unsigned long high = (unsigned long)(n >> 32), low = (unsigned long) n, q;
+
+    if (!d)
+        return 0;
+    high %= d;
+    __asm__("divl %2" : "=a" (q), "+d" (high) : "rm" (d), "0" (low));
+    return q;
+}
+
+// 64 位数除以 32 位数，商为 64 位
+static inline unsigned long long div_u64(unsigned long long n, unsigned long d) {
+    unsigned long high = (unsigned long)(n >> 32);
+
+    if (!d)
+        return 0;
+    return ((unsigned long long) (high / d) << 32) |
+        div64_32(((unsigned long long) (high % d) << 32) | (unsigned long) n, d);
+}
+
+#endif
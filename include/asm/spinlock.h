@@ -0,0 +1,30 @@
+#ifndef _ASM_SPINLOCK_H
+#define _ASM_SPINLOCK_H
+
+// 自旋锁，用于多个 CPU 之间的互斥。lock 为 1 表示已被持有。
+// 目前只有大内核锁 kernel_flag 使用(kernel/smp.c): lock_kernel() 用 spin_trylock() 获取，
+// 失败时开着中断只读等待，以便响应刷新 TLB 的处理器间中断。
+// 故意不提供关中断自旋的 spin_lock(): 持锁方可能正在等待本 CPU 响应刷新 TLB 的 IPI，会死锁。
+// fs、块设备等仍由大内核锁加 cli/sti 保护，没有更细粒度的锁
+typedef struct {
+    volatile unsigned long lock;
+} spinlock_t;
+
+// 自旋等待时的提示(pause 指令)，降低功耗，超线程时让出执行资源
+#define cpu_relax() __asm__ volatile("rep ; nop" ::: "memory")
+
+// 尝试获取，成功返回 1。xchg 访问内存时总是锁总线
+static inline int spin_trylock(spinlock_t *l) {
+    unsigned long old = 1;
+
+    __asm__ volatile("xchgl %0, %1" : "+r" (old), "+m" (l->lock) :: "memory");
+    return old == 0;
+}
+
+// x86 的写操作不会与之前的读写重排，释放只需一次普通的写
+static inline void spin_unlock(spinlock_t *l) {
+    __asm__ volatile("" ::: "memory");
+    l->lock = 0;
+}
+
+#endif
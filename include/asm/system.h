@@ -8,6 +8,14 @@
 #define nop()  __asm__ volatile("nop"::)
 #define iret() __asm__ volatile("iret"::)
 
+// 保存/恢复标志寄存器，用于可能在关中断状态下调用的代码中临时关中断
+#define save_flags(x) __asm__ volatile("pushfl ; popl %0" : "=r" (x) :: "memory")
+#define restore_flags(x) __asm__ volatile("pushl %0 ; popfl" :: "r" (x) : "memory")
+
+// 读时间戳计数器(64 位)，CPU 需支持 X86_FEATURE_TSC
+#define rdtscll(val) \
+    __asm__ volatile("rdtsc" : "=A" (val))
+
 // 下面这个宏是通用的设置门描述符的宏，参数分别为
 // gate_addr: IDT 描述符的地址
 // type: 门类型 0xE: 中断门，OxF: 陷阱门
@@ -60,7 +60,7 @@ struct buffer_head {
 	unsigned char b_dirt;		/* 0-clean,1-dirty */						// 修改标志
 	unsigned char b_count;		/* users using this block */				// 使用的用户数
 	unsigned char b_lock;		/* 0 - ok, 1 -locked */						// 缓冲区是否被锁定
-	struct task_struct * b_wait;											// 指向等待该缓冲区解锁的任务
+	struct wait_queue * b_wait; 											// 等待该缓冲区解锁的任务队列
 	struct buffer_head * b_prev;											// hash 队列上前一块（这4个指针用于缓冲区的管理）
 	struct buffer_head * b_next;
 	struct buffer_head * b_prev_free;										// 空闲表上前一块
@@ -113,7 +113,7 @@ struct m_inode {
                                                                             // 直接（0-6）、间接（7）或双重间接（8）逻辑块号
                                                                             // 对于设备特殊文件名的i节点，其zone[0]中存放的是该文件名所指设备的设备号
 /* these are in memory also */
-	struct task_struct * i_wait;											// 等待该 i 节点的进程
+	struct wait_queue * i_wait; 											// 等待该 i 节点的进程队列
 	unsigned long i_atime;													// 最后访问时间
 	unsigned long i_ctime;													// i 节点自身修改时间
 	unsigned short i_dev;													// i 节点所在的设备号
@@ -154,7 +154,7 @@ struct super_block {
 	struct m_inode * s_isup;												// 被安装文件系统根目录i节点（super i）
 	struct m_inode * s_imount;												// 该文件系统被安装到的i节点
 	unsigned long s_time;													// 修改时间
-	struct task_struct * s_wait;											// 等待该超级块的进程的指针
+	struct wait_queue * s_wait; 											// 等待该超级块的进程队列
 	unsigned char s_lock;													// 锁定标志
 	unsigned char s_rd_only;												// 只读标志
 	unsigned char s_dirt;													// 已修改（脏）标志
@@ -188,6 +188,7 @@ extern void truncate(struct m_inode * inode);
 extern struct buffer_head * get_hash_table(int dev, int block);
 extern void sync_inodes(void);
 extern void ll_rw_block(int rw, struct buffer_head * bh);
+extern int ll_rw_page(int rw, int dev, int nr, char * buffer);
 extern void brelse(struct buffer_head * buf);
 extern struct buffer_head * bread(int dev,int block);
 extern int new_block(int dev);
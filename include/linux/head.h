@@ -7,6 +7,18 @@ typedef struct desc_struct {
 
 extern unsigned long pg_dir[1024];
 extern desc_table idt, gdt;
+extern unsigned long x86_capability;   // cpuid 功能 1 的特性标志(edx), 由 head.s 设置
+
+#define X86_FEATURE_TSC 0x0010          // 支持 rdtsc 指令
+#define X86_FEATURE_PSE 0x0008          // 支持 4MB 页
+#define X86_FEATURE_APIC 0x0200         // 有本地 APIC
+#define X86_FEATURE_PGE 0x2000          // 支持全局页
+#define X86_FEATURE_FXSR 0x01000000     // 支持 fxsave/fxrstor
+#define X86_FEATURE_SSE2 0x04000000     // 支持 SSE2 指令
+
+#define PAGE_PSE    0x080               // 页目录项 PS 位，4MB 页
+#define PAGE_GLOBAL 0x100               // G 位，全局页
+#define PAGE_PREFAULT 0x200             // 页表项软件可用位: fault-around 预先映射的页面(mm/memory.c)
 
 
 #endif
@@ -14,6 +14,7 @@ int get_cursor();
 void update_cursor(int row, int col);
 void panic(const char *str);
 void verify_area(void *addr,unsigned int size);
+int do_exit(long code);                 // 终止当前进程，不返回，kernel/exit.c
 
 extern int video_x, video_y;
 
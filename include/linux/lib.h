@@ -1,3 +1,5 @@
 char getchar();
 int getline(char *str);
-int printf(char *fmt, ...);
\ No newline at end of file
+int printf(char *fmt, ...);
+void *malloc(unsigned int size);
+void free(void *ptr);
\ No newline at end of file
@@ -3,11 +3,165 @@
 
 #define PAGE_SIZE 4096
 
+#define LOW_MEM 0x100000ul                      // 内存低1MB，是系统代码所在，主内存区页面从这里开始管理
+#define MAP_NR(addr) (((addr) - LOW_MEM) >> 12) // 计算物理地址映射的页号
+
+// 物理页面描述结构，1MB 以上每个物理页面对应一项，组成 mem_map[] 数组
+struct page {
+    unsigned short count;       // 引用计数(被映射或使用的次数)，0 表示空闲
+    unsigned short flags;       // 页面标志 PG_*
+    struct page *next;          // 空闲链表或 LRU 等链表中的下一项
+    struct page *prev;          // 链表中的上一项
+    unsigned long index;        // 由页面的使用者解释，例如页面所映射的线性地址，或页面在文件中的页号
+    struct page *hash_next;     // 页面缓存散列链表中的下一项(mm/filemap.c)
+    unsigned short dev;         // 页面缓存页面所属文件的设备号和 i 节点号
+    unsigned short ino;
+    unsigned long *pgd;         // LRU 页面: 映射它的进程的页目录，与 index(线性地址)一起找回页表项(mm/swap.c)
+};
+
+// struct page.flags
+#define PG_reserved 0x0001      // 保留页面(缓冲区、内核页表、mem_map 本身等)，不参与分配和引用计数
+#define PG_lru      0x0002      // 页面在 LRU 链表上(用户空间页面，可以被换出)
+#define PG_active   0x0004      // 页面在 active 链表上，否则在 inactive 链表上
+#define PG_ksm      0x0008      // 相同页面合并后的只读共享页面(mm/ksm.c)
+#define PG_cache    0x0010      // 页面缓存中的文件页面(mm/filemap.c)，不在 LRU 链表上
+#define PG_shm      0x0020      // 共享内存段的页面(mm/shm.c)，不在 LRU 链表上
+
+extern struct page *mem_map;
+extern unsigned long nr_free_pages;
+extern unsigned long nr_shared_pages;   // 引用计数大于 1 的页面数，由 get_page()/free_page() 维护
+extern unsigned long nr_pgtable_pages;  // 进程的页表和页目录页面数
+
+// 物理地址与页面描述结构之间的转换
+#define phys_to_page(addr) (mem_map + MAP_NR(addr))
+#define page_address(page) (LOW_MEM + ((unsigned long)((page) - mem_map) << 12))
+#define page_count(page) ((page)->count)
+
+// 增加页面的引用计数，保留页面不计数。减少引用计数使用 free_page()
+static inline void get_page(struct page *page) {
+    if (!(page->flags & PG_reserved) && ++page->count == 2)
+        nr_shared_pages++;
+}
+
+// 每个进程有自己的页目录(tss.cr3)。USER_BASE 以下是内核空间，各页目录的这部分目录项都从 pg_dir 复制，
+// 共享内核的页表；任务 0 以外的进程的用户空间都从线性地址 USER_BASE 开始，最长 TASK_SIZE
+#define USER_BASE 0x40000000ul  // 1GB
+#define TASK_SIZE 0xc0000000ul  // 3GB，到线性地址空间末尾
+
+// 地址空间的驻留页面数(RSS)，即用户空间中存在的页表项数。保存在页目录页面的 struct page 的 index 中，
+// 共用页目录的任务(vfork 的父子进程)共用这个计数。任务 0 的 pg_dir 不在主内存区，不计数
+#define pgd_rss(pgd) (phys_to_page((unsigned long)(pgd))->index)
+static inline void add_rss(unsigned long *pgd, long n) {
+    if ((unsigned long) pgd >= LOW_MEM)
+        pgd_rss(pgd) += (unsigned long) n;
+}
+
+// 原子地清除页表项中的位 bits。其他 CPU 可能同时在置该页表项的 A/D 位，普通的读-改-写会丢失它们
+static inline void pte_clear_bits(unsigned long *pte, unsigned long bits) {
+    __asm__ volatile("lock; andl %1, %0" : "+m" (*pte) : "r" (~bits) : "memory");
+}
+
+// 映射区: 文件映射(mmap)或共享内存段(shmat)。地址都是进程空间中的逻辑地址(相对于段基址)，页面的整数倍
+#define NR_MMAP 8               // 每个进程最多的映射区数
+#define VM_SHM 0x0100           // vm_flags: 共享内存段，vm_pgoff 为段号
+struct m_inode;
+struct vm_area_struct {
+    unsigned long vm_start;     // 映射区开始地址
+    unsigned long vm_end;       // 映射区结束地址(不含)
+    unsigned long vm_pgoff;     // vm_start 对应的文件页号
+    unsigned short vm_flags;    // MAP_SHARED / MAP_PRIVATE [| VM_SHM]，0 表示空闲项
+    unsigned short vm_prot;     // PROT_*
+    struct m_inode *vm_inode;   // 映射的文件
+};
+
+// 交换项(不存在且不为 0 的页表项)，见 mm/swap.c
+#define SWP_TYPE_DISK 0         // 交换设备
+#define SWP_TYPE_ZRAM 1         // 压缩内存(mm/zram.c)
+#define SWP_ENTRY(type, offset) (((unsigned long)(type) << 1) | ((unsigned long)(offset) << 12))
+#define SWP_TYPE(entry) (((entry) >> 1) & 0x3f)
+#define SWP_OFFSET(entry) ((entry) >> 12)
+#define SWAP_MAX_PAGES 8192     // 最多使用 32MB 交换空间
+#define ZRAM_MAX_PAGES 4096     // zram 最多保存的页面数
+
+// 空闲页面低于 FREE_PAGES_LOW 时开始回收，回收到 FREE_PAGES_HIGH
+#define FREE_PAGES_LOW 8
+#define FREE_PAGES_HIGH 32
+#define SWAP_CLUSTER 16         // 每次从 active 链表移到 inactive 链表的页面数
+
+extern int SWAP_DEV;
+
 /* extern */ unsigned long get_free_page(void);
-/* extern */ unsigned long put_page(unsigned long page, unsigned long address);
+struct task_struct;
+/* extern */ unsigned long put_page(struct task_struct *tsk, unsigned long page, unsigned long address);
 /* extern */ void free_page(unsigned long addr);
 /* extern */ void calc_mem(void);
+void flush_tlb_all(void);
 void do_no_page(unsigned long error_code, unsigned long address);
 void mm_print_pageinfo(unsigned long addr);
+void unmap_page_range(unsigned long from, unsigned long size);
+void put_shared_page(unsigned long page, unsigned long address, int writable);
+int new_page_dir(struct task_struct *p);
+void free_page_dir(struct task_struct *p);
+
+// mm/page_ops.c
+extern int sse2_page_ops;
+void copy_page(unsigned long from, unsigned long to);
+void clear_page(unsigned long page);
+void copy_page_rep(unsigned long from, unsigned long to);
+void clear_page_rep(unsigned long page);
+void copy_page_sse2(unsigned long from, unsigned long to);
+void clear_page_sse2(unsigned long page);
+void page_ops_init(void);
+
+// mm/mm_bench.c
+void mm_bench(void);
+
+// mm/swap.c
+extern unsigned long nr_active_pages, nr_inactive_pages;
+extern int nr_swap_pages;
+void lru_cache_add(struct task_struct *tsk, unsigned long addr, unsigned long address);
+void lru_cache_del(struct page *page);
+void swap_duplicate(unsigned long entry);
+void swap_free(unsigned long entry);
+void swap_in(unsigned long *pte, unsigned long address);
+int try_to_free_pages(int count);
+void check_free_pages(void);
+void init_swapping(void);
+void swap_stat(void);
+
+// mm/zram.c
+extern unsigned long zram_pool_limit;
+int zram_store(unsigned long page);
+void zram_load(unsigned long nr, unsigned long page);
+void zram_duplicate(unsigned long nr);
+void zram_free(unsigned long nr);
+void zram_init(void);
+void zram_stat(void);
+
+// mm/filemap.c
+extern unsigned long nr_cache_pages;
+unsigned long filemap_get_page(struct m_inode *inode, unsigned long index);
+unsigned long filemap_cached_page(struct vm_area_struct *vma, unsigned long address);
+unsigned long filemap_nopage(struct vm_area_struct *vma, unsigned long address);
+void filemap_sync_page(struct m_inode *inode, unsigned long index, unsigned long page);
+int shrink_page_cache(int count);
+void invalidate_inode_pages(struct m_inode *inode);
+
+// mm/mmap.c
+struct vm_area_struct *find_vma(struct task_struct *p, unsigned long addr);
+struct vm_area_struct *get_vma_slot(void);
+unsigned long get_unmapped_area(unsigned long addr, unsigned long len);
+void exit_mmap(void);
+
+// mm/shm.c
+unsigned long shm_nopage(struct vm_area_struct *vma, unsigned long address);
+void shm_open(struct vm_area_struct *vma);
+void shm_close(struct vm_area_struct *vma);
+
+// mm/ksm.c
+#define KSM_INTERVAL 20         // 每 20 个滴答扫描一批页面
+extern int ksm_pages_to_scan;
+void ksm_scan(void);
+void ksm_stat(void);
 
 #endif
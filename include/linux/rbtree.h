@@ -0,0 +1,42 @@
+#ifndef _RBTREE_H
+#define _RBTREE_H
+
+#ifndef NULL
+#define NULL ((void *)(0))
+#endif
+
+// 红黑树，见 kernel/rbtree.c
+// 节点嵌在使用者的结构中，用 rb_entry() 取得结构指针。树不比较关键字: 使用者自己从根向下查找插入位置，
+// 用 rb_link_node() 链入，再调用 rb_insert_color() 重新平衡。插入和删除都是 O(log n)。
+struct rb_node {
+    struct rb_node *rb_parent;
+    int rb_color;
+    struct rb_node *rb_left;
+    struct rb_node *rb_right;
+};
+
+struct rb_root {
+    struct rb_node *rb_node;
+};
+
+#define RB_RED      0
+#define RB_BLACK    1
+
+#define RB_ROOT ((struct rb_root) {NULL})
+#define rb_entry(ptr, type, member) \
+    ((type *) ((char *) (ptr) - (unsigned long) (&((type *) 0)->member)))
+
+// 把节点 node 链到 parent 的子节点位置 *link 上(红色)，之后要调用 rb_insert_color()
+static inline void rb_link_node(struct rb_node *node, struct rb_node *parent, struct rb_node **link) {
+    node->rb_parent = parent;
+    node->rb_color = RB_RED;
+    node->rb_left = node->rb_right = NULL;
+    *link = node;
+}
+
+extern void rb_insert_color(struct rb_node *node, struct rb_root *root);   // 插入后重新平衡
+extern void rb_erase(struct rb_node *node, struct rb_root *root);          // 删除节点
+extern struct rb_node *rb_first(struct rb_root *root);                     // 最左(最小)的节点
+extern struct rb_node *rb_next(struct rb_node *node);                      // 中序的下一个节点
+
+#endif
@@ -6,8 +6,8 @@
 #ifndef _SCHED_H
 #define _SCHED_H
 
-// 最多有 64 个进程（任务）同时处于系统中
-#define NR_TASKS 64
+// 最多有 128 个进程（任务）同时处于系统中，受 GDT 大小限制(每个任务占 2 项，见 boot/head.s)
+#define NR_TASKS 128
 // 时钟频率 100 hz
 #define HZ 100
 
@@ -17,7 +17,13 @@
 #include <linux/mm.h>
 #include <linux/head.h>
 #include <linux/fs.h>
+#include <linux/timer.h>
+#include <linux/wait.h>
+#include <linux/rbtree.h>
+#include <linux/smp.h>
 #include <signal.h>
+#include <sched.h>
+#include <sys/schedstat.h>
 
 // 定义任务状态
 // 可中断等待状态: 如果产生某种中断，或其他进程给这个进程发送特定信号等，仍然有可能将这个进程的状态改设为就绪状态，
@@ -29,12 +35,19 @@
 #define TASK_ZOMBIE 3               // 僵死状态，已经停止运行，但父进程还没发信号
 #define TASK_STOPPED 4              // 已停止
 
+// nice 值的范围，nice 越小权重越大，得到的 CPU 时间越多，见 kernel/sched_fair.c
+#define MIN_NICE (-20)
+#define MAX_NICE 19
+#define NICE_0_LOAD 1024                    // nice 为 0 的任务的权重
+// 实时优先级 1..MAX_RT_PRIO-1，见 kernel/sched_rt.c
+#define MAX_RT_PRIO 100
+
 #ifndef NULL
 #define NULL ((void *)(0))
 #endif
 
-extern int copy_page_tables(unsigned long from, unsigned long to, unsigned long size);
-extern int free_page_tables(unsigned long from, unsigned long size);
+extern int copy_page_tables(struct task_struct *p, unsigned long from, unsigned long to, unsigned long size);
+extern int free_page_tables(struct task_struct *tsk, unsigned long from, unsigned long size);
 extern void schedule(void);
 
 typedef int (*fn_ptr)();
@@ -79,16 +92,32 @@ struct tss_struct {
     struct i387_struct i387;            /* 16 high bits zero */
 };
 
+// 任务切换时保存的内核态现场，见 switch_to
+struct thread_struct {
+    unsigned long esp;                  // 切换出去时的内核栈指针
+    unsigned long eip;                  // 切换回来时继续执行的地址
+};
+
+// 调度统计(kernel/sched.c)，时间戳为时间戳计数器的值
+struct sched_info {
+    struct schedstat stat;              // 累计值
+    unsigned long long last_arrival;    // 最近一次开始运行的时刻
+    unsigned long long last_queued;     // 最近一次进入就绪队列(被唤醒或被切换出去时仍就绪)的时刻，0 表示不在等待
+    unsigned long long last_sleep;      // 最近一次开始睡眠的时刻，0 表示没有睡眠过
+    unsigned long woken;                // 被唤醒后还没有运行，开始运行时把等待时间记入唤醒延迟直方图
+};
+
 // 进程描述符
 struct task_struct {
 	// --- 硬编码部分，下面的不应该修改 ---
     long state;                         // 运行状态 -1 不可运行，0 可运行（就绪）, >0 已停止
-    long counter;                       // 运行时间计数（递减），运行时间片
-    long priority;                      // 优先级，开始运行时 counter = priority，越大运行越长
+    long counter;                       // 运行时间计数（递减），运行时间片。只有 SCHED_RR 的实时任务使用
+    long priority;                      // 开始运行时 counter = priority。公平调度类不使用，按 nice 分配 CPU 时间
 
     long signal;                        // 信号，是位图，每个比特代表一种信号，信号值=位偏移值+1
     struct sigaction sigaction[32];     // 信号执行属性结构，对应信号将要执行的操作和标志信息
     unsigned long blocked;              // 进程信号屏蔽码（对应信号位图）
+    long need_resched;                  // 需要重新调度，返回用户态前和抢占点检查(system_call.s 中也使用)
 	// --- 硬编码部分结束 ---
     int exit_code;                      // 退出码，其父进程会取
     unsigned long start_code;           // 代码段地址
@@ -128,16 +157,72 @@ struct task_struct {
     struct file * filp[NR_OPEN];        // 进程使用的文件表结构
 
     struct desc_struct ldt[3];          // 本任务的局部表描述符。0 空，1 代码段cs，2 数据段和堆栈段 ds&ss
-    struct tss_struct tss;               // 本进程的任务状态段信息结构
+    struct tss_struct tss;               // 本进程的任务状态段信息结构。软件切换只使用 esp0、cr3、ldt 和 i387，
+                                        // 其余字段是 fork 时用户态寄存器的副本(见 fork.c copy_thread)
+    unsigned long flags;                // 进程标志 PF_*
+    struct wait_queue *vfork_wait;      // vfork 的父进程在此等待子进程退出
+    unsigned long min_flt;              // 不需要读盘的缺页次数
+    unsigned long maj_flt;              // 需要读盘的缺页次数
+    unsigned long cmin_flt, cmaj_flt;   // 已等待过的子进程的缺页次数
+    struct vm_area_struct mmap[NR_MMAP];    // 文件映射区(mm/mmap.c)
+    int nr;                             // 在任务数组 task[] 中的下标
+    int on_rq;                          // 在就绪队列中(包括正在运行的任务)
+    const struct sched_class *sched_class;  // 所属的调度类
+    struct timer_list alarm_timer;      // 报警定时器，到期时刻为 alarm(kernel/timer.c)
+    struct thread_struct thread;        // 内核态现场，任务切换时保存和恢复
+    struct sched_info sched_info;       // 调度统计
+    // 公平调度类(kernel/sched_fair.c)
+    int nice;                           // nice 值 MIN_NICE..MAX_NICE
+    unsigned long weight;               // nice 对应的权重
+    struct rb_node run_node;            // 按 vruntime 排序的红黑树中的节点，正在运行时不在树中
+    unsigned long long vruntime;        // 虚拟运行时间: 实际运行时间 * NICE_0_LOAD / weight
+    unsigned long long exec_start;      // 上次累计运行时间的时刻(sched_clock)
+    unsigned long long sum_exec_runtime;        // 累计运行时间
+    unsigned long long prev_sum_exec_runtime;   // 本次被选中运行时的 sum_exec_runtime
+    // 实时调度类(kernel/sched_rt.c)
+    int policy;                         // 调度策略 SCHED_NORMAL/SCHED_FIFO/SCHED_RR
+    int rt_priority;                    // 实时优先级 1..MAX_RT_PRIO-1，普通任务为 0
+    struct task_struct *run_next, *run_prev;    // 同一优先级的就绪实时任务的双向循环链表
+    int preempt_count;                  // 禁止抢占的嵌套计数，不为 0 时 cond_resched() 不调度
+    int processor;                      // 所在的 CPU: 正在这个 CPU 上运行，或在它的就绪队列中
+    int lock_depth;                     // 大内核锁的嵌套深度(kernel/smp.c)，不在运行的任务总是大于 0
 };
 
+// 调度类。schedule() 从优先级最高的类(sched_class_highest)开始，沿 next 依次询问，
+// 都没有就绪任务时运行空闲任务(任务 0，不属于任何类的就绪队列)。调用时都已关中断
+struct sched_class {
+    const struct sched_class *next;                     // 优先级更低的下一个类
+    void (*enqueue_task)(struct task_struct *p, int wakeup);    // 加入就绪队列，wakeup 表示刚被唤醒
+    void (*dequeue_task)(struct task_struct *p);                // 移出就绪队列(睡眠或退出)
+    void (*check_preempt_curr)(struct task_struct *p);  // 同类的 p 被唤醒，是否抢占当前任务
+    struct task_struct *(*pick_next_task)(void);        // 选出下一个运行的任务
+    void (*put_prev_task)(struct task_struct *p);       // 仍然就绪的任务 p 被切换出去(或重新选择)之前
+    void (*task_tick)(struct task_struct *p);           // 时钟中断，p 是当前任务
+    void (*task_new)(struct task_struct *p);            // fork 出的新任务第一次加入就绪队列之前
+    void (*set_curr_task)(struct task_struct *p);       // 正在运行的任务 p 刚换到本类(已经加入就绪队列)
+    void (*migrate_task)(struct task_struct *p, int cpu);   // 不在就绪队列中的 p 将移到 CPU cpu(p->processor 仍是原来的)
+};
+
+extern const struct sched_class rt_sched_class;         // kernel/sched_rt.c
+extern const struct sched_class fair_sched_class;       // kernel/sched_fair.c
+#define sched_class_highest (&rt_sched_class)
+
+
+// 进程标志 task_struct.flags
+#define PF_VFORK    0x00000001          // vfork 创建的子进程，借用父进程的地址空间
+
+// copy_process() 的 clone_flags 参数，system_call.s 中有相同定义
+#define CLONE_VFORK 0x01                // 借用父进程的地址空间，父进程等待子进程退出
+#define CLONE_SPAWN 0x02                // 从指定入口开始执行，使用新的用户栈
+
 // 设置第1个任务表
 // 基址Base = 0, 段长limit = 0x9ffff（640KB）
 // 因为 G 设置 1, limit = 0x9ffff / 4KB = 0x9ffff >> 12 = 0x9f
 #define INIT_TASK \
 /* state info */ {0, 15, 15, \
 /* signals */    0, {{}, }, 0, \
-/* exit_code, brk */    0, 0, 0, 0, 0, 0, \
+/* need_resched */ 0, \
+/* exit_code, brk */    0, 0, 0, 0xA0000, 0xA0000, 0, \
 /* pid */    0, -1, 0, 0, 0, \
 /* uid */    0, 0, 0, 0, 0, 0, \
 /* alarm, etc... */   0, 0, 0, 0, 0, 0, \
@@ -154,26 +239,104 @@ struct task_struct {
         0, 0, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, \
         _LDT(0), 0x80000000, \
         {} \
-    } \
+    }, \
+/* flags */ 0, NULL, \
+/* min_flt */ 0, 0, 0, 0, \
+/* mmap */ {}, \
+/* nr, on_rq, class */ 0, 0, &fair_sched_class, \
+/* alarm_timer */ {}, \
+/* thread */ {0, 0}, \
+/* sched_info */ {}, \
+/* nice, weight */ 0, NICE_0_LOAD, \
+/* run_node */ {}, \
+/* vruntime etc */ 0, 0, 0, 0, \
+/* policy, rt_priority */ SCHED_NORMAL, 0, \
+/* run_next, run_prev */ NULL, NULL, \
+/* preempt_count */ 0, \
+/* processor, lock_depth */ 0, 1 \
 }
 
 extern struct task_struct *task[NR_TASKS];          // 任务指针数组
 extern struct task_struct *last_task_used_math;     // 上一个使用过协处理器的进程
-extern struct task_struct *current;                 // 当前进程
+extern struct tss_struct init_tss[NR_CPUS];         // 每个 CPU 使用的唯一的任务状态段，kernel/sched.c
+extern long user_stack[PAGE_SIZE >> 2];             // 初始化期间 main() 的栈，之后是任务 0 的用户栈
 extern long volatile jiffies;                       // 开机开始算起的滴答数（10ms/滴答）
 extern long startup_time;                             // 开机时间。从1970 开始计时的秒数
+extern unsigned long tsc_khz;                       // 时间戳计数器的频率，sched_init() 中测定，没有 TSC 时为 0
+extern struct schedstat sched_total;                // 整个系统的调度统计，kernel/sched.c
+extern int nr_running;                              // 所有 CPU 的就绪队列中的任务数
+extern unsigned long long sched_clock_per_tick;     // 每个滴答的 sched_clock() 单位数
+
+// 当前任务。任务结构和它的内核栈在同一页中，esp 所在页的开头就是正在本 CPU 上运行的任务，
+// 每个 CPU 用各自的栈，不需要按 CPU 区分的全局变量(system_call.s 中同样计算)。
+// 只有初始化期间 main() 在 user_stack 上运行，这时是任务 0
+static inline struct task_struct *get_current(void) {
+    unsigned long esp;
+
+    __asm__("movl %%esp, %0" : "=r" (esp));
+    esp &= ~(unsigned long) (PAGE_SIZE - 1);
+    if (esp == (unsigned long) user_stack)
+        return task[0];
+    return (struct task_struct *) esp;
+}
+#define current get_current()
+
+// 每个 CPU 的运行队列(kernel/sched.c)。各调度类的就绪队列在各自的文件中，同样每个 CPU 一份，
+// 由任务的 processor 选择。所有调度数据都在大内核锁的保护下修改
+struct rq {
+    int nr_running;                     // 本 CPU 上就绪的任务数(各类之和，包括正在运行的任务)
+    struct task_struct *curr;           // 正在本 CPU 上运行的任务
+    struct task_struct *idle;           // 本 CPU 的空闲任务，CPU 0 是任务 0
+    long next_balance;                  // 下一次周期性负载均衡的时刻(jiffies)
+    unsigned long nr_migrations;        // 从其他 CPU 迁移过来的任务数
+};
+
+extern struct rq runqueues[NR_CPUS];
+#define cpu_rq(cpu) (&runqueues[(cpu)])
+#define this_rq() cpu_rq(smp_processor_id())
+// 空闲任务(任务 0 和各应用处理器的空闲任务)的进程号都是 0，不在任何就绪队列中
+#define is_idle_task(p) ((p)->pid == 0)
 
 #define CURRENT_TIME (startup_time + jiffies / HZ)     // 当前时间（秒数）
 
-extern void add_timer(long *jiffies, void(*fn)(void));          // 添加定时器，kernel/sched.c
-extern void sleep_on(struct task_struct **p);                   // 不可中断的等待睡眠，kernel/sched.c
-extern void interruptible_sleep_on(struct task_struct **p);     // 可中断的等待睡眠
-extern void wake_up(struct task_struct **p);                    // 明确唤醒睡眠的进程
+extern int wake_up_process(struct task_struct *p);              // 置任务 p 为就绪状态并加入就绪队列，kernel/sched.c
+extern void wake_up_new_task(struct task_struct *p);            // fork 出的新任务第一次加入就绪队列
+extern unsigned long long sched_clock(void);                    // 调度用的时钟: TSC 周期，没有 TSC 时为微秒(按滴答)
+extern int cond_resched(void);                                  // 抢占点: need_resched 置位时让出 CPU，kernel/sched.c
+extern void resched_task(struct task_struct *p);                // 请求正在运行的任务 p 重新调度，p 在其他 CPU 上时发送 IPI
+extern void do_local_timer(long cpl);                           // 应用处理器的时钟中断(本地 APIC 定时器)
+extern struct task_struct *pick_migrate_task_fair(int cpu);     // 负载均衡: 选出 CPU cpu 上可以迁移的任务，kernel/sched_fair.c
+extern void set_user_nice(struct task_struct *p, int nice);     // 修改任务的 nice 值，kernel/sched_fair.c
+extern void __sched_setscheduler(struct task_struct *p, int policy, int prio);  // 修改调度策略，参数已检查
+extern void signal_wake_up(struct task_struct *p);              // 任务 p 有了未阻塞的信号，唤醒可中断睡眠
+extern void cpu_idle(void);                                     // 空闲任务等待中断，可能停止周期时钟
+extern void tick_nohz_timer_added(unsigned long expires);       // 新定时器比单次定时更早到期时唤醒 CPU 0
 extern void show_task_info(struct task_struct *task);
+extern void release_vfork(struct task_struct *p);               // 唤醒 vfork 的父进程，kernel/fork.c
+extern void sched_bench(void);                                  // 任务切换的性能测试，kernel/sched_bench.c
+extern void schedstat_dump(void);                               // 把调度统计输出到串口，kernel/schedstat.c
+
+// 禁止/允许抢占，可以嵌套。内核代码只在抢占点(cond_resched()、preempt_enable())让出 CPU，
+// 禁止抢占期间这些抢占点不调度，也不能睡眠(例如借用了 xmm 寄存器，见 mm/page_ops.c)
+#define preempt_disable() do { \
+    current->preempt_count++; \
+    __asm__ volatile("" ::: "memory"); \
+} while (0)
+#define preempt_enable_no_resched() do { \
+    __asm__ volatile("" ::: "memory"); \
+    current->preempt_count--; \
+} while (0)
+#define preempt_enable() do { \
+    preempt_enable_no_resched(); \
+    if (current->need_resched) \
+        cond_resched(); \
+} while (0)
 
 /*
  * 在GDT表中寻找第1个TSS的入口。0 没有用nul，1 代码段cs，2 数据段ds，3 系统调用syscall
  * 4 任务状态段TSS0，5 局部表LTD0，6 任务状态段TSS1，等
+ * 任务切换由软件完成(见 switch_to)，每个 CPU 只使用一个任务状态段: CPU n 使用 TSSn 描述符项(init_tss[n])，
+ * 其余的 TSS 描述符项不再使用，LDT 描述符项仍然每个任务一个
  */
 // 全局表中第1个任务状态段（TSS）描述符的选择符索引号
 #define FIRST_TSS_ENTRY 4
@@ -186,41 +349,40 @@ extern void show_task_info(struct task_struct *task);
 #define ltr(n) __asm__ volatile("ltr %%ax"::"a" (_TSS(n)))
 #define lldt(n) __asm__ volatile("lldt %%ax"::"a" (_LDT(n)))
 
-// 取出当前的任务号，是任务数组中的索引值，和进程号 pid 不同
-#define str(n) \
-__asm__ volatile("str %%ax\n\t" /* 将任务寄存器中TSS段的选择符复制到ax中 */ \
-        "subl %2, %%eax\n\t" /* eax - FIRST_TSS_ENTRY*8 -> eax */ \
-        "shrl $4, %%eax\n\t" /* eax/16 -> eax = 当前任务号 */ \
-        : "=a" (n) \
-        : "a" (0), "i" (FIRST_TSS_ENTRY << 3))
-
-// 将切换当前任务到任务nr，即n。首先检测任务n不是当前任务，如果是则什么都不做退出。
-// 如果切换到的任务上次运行使用过数学协处理器， 则需要复位控制寄存器 cr0 中的TS标志
-// 跳转到一个任务的 TSS 段选择符组成的地址会造成 cpu 进行任务切换操作
-// __tmp 临时数据结构，用于组建远跳转指令操作数，
-// 内存间跳转指令使用6字节操作数作为跳转目的地的长指针
-// 其格式为：jmp 16位段选择符: 32位偏移值。但在内存中操作数的表示顺序与这里正好相反。
-// __tmp.a - 32位偏移地址
-// __tmp.b - 低16位新TSS段的选择符
-// 输入: %0 - 指向 __tmp
-//       %1 - 指向 __tmp.b 处，用于存放新 TSS 的选择符
-//       dx - 新任务n的TSS段选择符
-//       ecx - 新任务n的任务结构指针task[n]
-
-#define switch_to(n) {\
-struct {long a, b;} __tmp; \
-__asm__ volatile("cmpl %%ecx, current\n\t" /* 任务n是当前任务吗？（current == task[n]?）*/ \
-        "je 1f\n\t" /* 是，则什么都不做，退出*/ \
-        "movw %%dx, %1\n\t" /* 将新任务TSS的16位选择符存入__tmp.b中 */ \
-        "xchgl %%ecx, current\n\t" /* current = task[n]; ecx = 被切换出的任务 */ \
-        "ljmp *%0\n\t" /* 长跳跃到新的TSS选择符 *&__temp，造成任务切换 */ \
-        "cmpl %%ecx, last_task_used_math\n\t" /* 原任务上次使用过协处理器吗 */ \
-        "jne 1f\n\t" /* 没有则跳转，退出 */ \
-        "clts\n\t" /* 使用过，则清cr0中的任务切换标志TS */ \
-        "1:" \
-        ::"m" (*&__tmp.a), "m" (*&__tmp.b), \
-        "d" (_TSS(n)), "c" ((long) task[n])); \
-}
+// 从任务 prev 切换到任务 next(prev != next)，在 schedule() 中关中断调用。
+// 原来用 ljmp 到任务的 TSS 选择符，由 CPU 保存和恢复整个 TSS(所有寄存器、段寄存器、LDT、CR3)，开销很大。
+// 现在由软件切换: 在 prev 的内核栈上压入 C 函数调用需要保存的寄存器(ebx, esi, edi, ebp)和 fs, gs，
+// 把 esp 和返回地址(标号 1)保存在 prev->thread 中，换到 next 的内核栈，压入 next->thread.eip 后
+// 跳到 __switch_to()(kernel/sched.c)，它更新本 CPU 的 TSS 中的 esp0，只在不同时才重新加载 LDT 和 CR3，
+// 返回时就到了 next 上次切换出去的标号 1 处(新进程则是 system_call.s 中的 ret_from_fork)，
+// 弹出 next 的寄存器。fs 和 gs 在加载 LDT 之后弹出，重新从新的 LDT 中取得描述符。
+// eax - prev, edx - next (__switch_to 使用寄存器传参)
+#define switch_to(prev, next) do { \
+    unsigned long __d0, __d1; \
+    __asm__ volatile("pushl %%ebx\n\t" \
+        "pushl %%esi\n\t" \
+        "pushl %%edi\n\t" \
+        "pushl %%ebp\n\t" \
+        "push %%fs\n\t" \
+        "push %%gs\n\t" \
+        "movl %%esp, %0\n\t" /* 保存 prev 的栈指针 */ \
+        "movl %4, %%esp\n\t" /* 换到 next 的内核栈 */ \
+        "movl $1f, %1\n\t" /* prev 被切换回来时从标号 1 处继续 */ \
+        "pushl %5\n\t" /* __switch_to 返回到 next 的 eip */ \
+        "jmp __switch_to\n" \
+        "1:\t" \
+        "pop %%gs\n\t" \
+        "pop %%fs\n\t" \
+        "popl %%ebp\n\t" \
+        "popl %%edi\n\t" \
+        "popl %%esi\n\t" \
+        "popl %%ebx" \
+        : "=m" ((prev)->thread.esp), "=m" ((prev)->thread.eip), \
+          "=a" (__d0), "=d" (__d1) \
+        : "m" ((next)->thread.esp), "m" ((next)->thread.eip), \
+          "2" (prev), "3" (next) \
+        : "ecx", "memory"); \
+} while (0)
 
 // 设置位于addr处描述符中各基地址字段（基地址是base）
 // %0 - 地址addr偏移2
@@ -309,5 +471,10 @@ static inline unsigned long _get_base(char *addr) {
     __limit; \
     })
 
+// 任务 tsk 的页目录中线性地址 address 对应的目录项指针。
+// 每个任务的页目录地址保存在 TSS 的 cr3 中，任务切换时由 CPU 自动加载。任务 0 使用 pg_dir
+#define PAGE_DIR_OFFSET(tsk, address) \
+    ((unsigned long *) ((unsigned long) (tsk)->tss.cr3 + (((address) >> 20) & 0xffc)))
+
 
 #endif
@@ -0,0 +1,26 @@
+#ifndef _SMP_H
+#define _SMP_H
+
+// 多处理器支持，见 kernel/smp.c
+#define NR_CPUS 8                               // 最多支持的 CPU 数，CPU 的集合用 unsigned long 的位图表示
+
+extern int smp_num_cpus;                        // 已经启动的 CPU 数(包括引导处理器)，为 1 时与单处理器相同
+extern volatile unsigned long cpu_online_map;   // 已经启动的 CPU 的位图
+extern unsigned long cpu_apicid[NR_CPUS];       // 逻辑 CPU 号对应的本地 APIC ID
+
+// 当前 CPU 号。任务只有不在运行时才会被迁移到其他 CPU，所以运行中的任务的 processor 就是它所在的 CPU
+#define smp_processor_id() (current->processor)
+
+extern void smp_scan_config(void);              // 查找 MP 配置表或 ACPI MADT，得到 CPU 列表
+extern void smp_boot_cpus(void);                // 启动应用处理器
+extern void smp_send_reschedule(int cpu);       // 让 CPU cpu 重新调度(发送 IPI)
+extern void smp_flush_tlb(void);                // 让其他 CPU 刷新 TLB，等待它们完成
+
+// 大内核锁: 进入内核(系统调用、中断、异常)时获取，返回时释放，同一时刻只有一个 CPU 在执行内核代码。
+// 同一任务可以嵌套获取(task_struct.lock_depth)，任务切换时锁留给下一个任务
+extern void lock_kernel(void);
+extern void unlock_kernel(void);
+extern int release_kernel_lock(void);           // 空闲时暂时完全释放，返回嵌套深度
+extern void reacquire_kernel_lock(int depth);
+
+#endif
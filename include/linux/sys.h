@@ -6,6 +6,23 @@
 extern int sys_setup();
 extern int sys_exit();
 extern int sys_fork();
+extern int sys_vfork();
+extern int sys_spawn();
+extern int sys_mmap();
+extern int sys_munmap();
+extern int sys_shmget();
+extern int sys_shmat();
+extern int sys_shmdt();
+extern int sys_shmctl();
+extern int sys_getrusage();
+extern int sys_meminfo();
+extern int sys_schedstat();
+extern int sys_nice();
+extern int sys_setpriority();
+extern int sys_getpriority();
+extern int sys_sched_setscheduler();
+extern int sys_sched_getscheduler();
+extern int sys_sched_getparam();
 extern int sys_read();
 extern int sys_open();
 extern int sys_close();
@@ -20,6 +37,7 @@ extern int sys_sgetmask(void);
 extern int sys_ssetmask(int newMask);
 extern int sys_alarm(long seconds);
 extern int sys_sleep(long seconds);
+extern int sys_brk(unsigned long end_data_seg);
 
 // Just for debug use
 extern int tty_read(unsigned channel, char *buf, int nr);
@@ -61,7 +79,7 @@ fn_ptr sys_call_table[] = {
     stub_syscall,
     stub_syscall,
     stub_syscall,
-    stub_syscall,
+    sys_nice,     // 34
     stub_syscall,
     stub_syscall,
     sys_kill,     // 37
@@ -72,7 +90,7 @@ fn_ptr sys_call_table[] = {
     stub_syscall,
     stub_syscall,
     stub_syscall,
-    stub_syscall,
+    sys_brk,      // 45
     stub_syscall,
     stub_syscall,
     stub_syscall,
@@ -101,7 +119,23 @@ fn_ptr sys_call_table[] = {
     stub_syscall,
     serial_debugstr,    // 调试
     tty_read,
-    _user_tty_write
+    _user_tty_write,
+    sys_vfork,          // 75
+    sys_spawn,
+    sys_mmap,
+    sys_munmap,
+    sys_shmget,
+    sys_shmat,          // 80
+    sys_shmdt,
+    sys_shmctl,
+    sys_getrusage,
+    sys_meminfo,
+    sys_schedstat,      // 85
+    sys_setpriority,
+    sys_getpriority,
+    sys_sched_setscheduler,     // 88
+    sys_sched_getscheduler,
+    sys_sched_getparam
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,25 @@
+#ifndef _TIMER_H
+#define _TIMER_H
+
+// 内核定时器，见 kernel/timer.c
+// 到期时刻 expires 以 jiffies 计，到期时在时钟中断中(关中断)调用 function(data)，之后定时器不再挂入。
+// 定时器结构由使用者提供(例如嵌在 task_struct 中，或在栈上)，释放前必须 del_timer()。
+struct timer_list {
+    struct timer_list *next;            // 时间轮槽链表中的下一项
+    struct timer_list **pprev;          // 指向前一项的 next(或槽的表头)，NULL 表示定时器没有挂入
+    unsigned long expires;              // 到期时刻(jiffies)
+    void (*function)(unsigned long);    // 到期时调用的函数
+    unsigned long data;                 // 传给 function 的参数
+};
+
+#define init_timer(timer) ((timer)->next = NULL, (timer)->pprev = NULL)
+#define timer_pending(timer) ((timer)->pprev != NULL)
+
+extern void add_timer(struct timer_list *timer);                        // 挂入定时器
+extern int del_timer(struct timer_list *timer);                         // 取消定时器，返回是否挂入过
+extern int mod_timer(struct timer_list *timer, unsigned long expires);  // 修改到期时刻(没有挂入时挂入)
+extern void run_timers(void);                                           // 处理到期的定时器，do_timer() 调用
+extern unsigned long next_timer_interrupt(unsigned long max);           // 到下一个定时器到期的滴答数
+extern long schedule_timeout(long timeout);                             // 可中断地睡眠 timeout 个滴答
+
+#endif
@@ -11,7 +11,7 @@ int _user_tty_write(unsigned channel, char *buf, int nr);
 // tty 字符缓冲队列数据结构
 struct tty_queue {
     char buf[TTY_BUF_SIZE];
-    struct task_struct *wait_proc;      // 等待该s缓冲区的进程列表
+    struct wait_queue *wait_proc;       // 等待该缓冲区的进程队列
     unsigned long head;
     unsigned long tail;
 };
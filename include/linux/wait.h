@@ -0,0 +1,32 @@
+#ifndef _WAIT_H
+#define _WAIT_H
+
+// 等待队列，见 kernel/sched.c
+// 原来的 sleep_on() 只在队列头保存最后一个睡眠的任务，其余任务通过各自栈上的 tmp 连成隐式的链，
+// wake_up() 唤醒链头后由它依次唤醒其余所有任务。现在每个等待者在自己的栈上提供一个 wait_queue 项，
+// 挂在队列头指向的双向循环链表中:
+//     非独占等待者挂在链表头部，wake_up() 唤醒所有的非独占等待者;
+//     独占等待者挂在链表尾部，wake_up() 只唤醒其中第一个真正在睡眠的(wake-one)，
+//     用于等待一个可以被任一等待者占用的资源(空闲缓冲块、空闲请求项、解锁)，避免惊群。
+// 队列头只是一个指针，NULL 表示空队列，所以结构中的队列头清零即完成初始化。
+// 被唤醒的任务在 sleep_on 返回前自己把项从队列中摘下。
+struct wait_queue {
+    struct task_struct *task;           // 等待的任务
+    unsigned long flags;                // WQ_FLAG_EXCLUSIVE
+    struct wait_queue *next;
+    struct wait_queue *prev;
+};
+
+#define WQ_FLAG_EXCLUSIVE 0x01ul        // 独占等待，每次 wake_up() 只唤醒一个
+
+#define waitqueue_active(q) (*(q) != NULL)
+
+extern void add_wait_queue(struct wait_queue **q, struct wait_queue *wait);            // 非独占，挂在头部
+extern void add_wait_queue_exclusive(struct wait_queue **q, struct wait_queue *wait);  // 独占，挂在尾部
+extern void remove_wait_queue(struct wait_queue **q, struct wait_queue *wait);
+extern void sleep_on(struct wait_queue **q);                    // 不可中断的等待睡眠(非独占)
+extern void sleep_on_exclusive(struct wait_queue **q);          // 不可中断的独占等待睡眠
+extern void interruptible_sleep_on(struct wait_queue **q);      // 可中断的等待睡眠(非独占)
+extern void wake_up(struct wait_queue **q);     // 唤醒所有非独占等待者和一个独占等待者
+
+#endif
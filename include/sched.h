@@ -0,0 +1,22 @@
+#ifndef _POSIX_SCHED_H
+#define _POSIX_SCHED_H
+
+// 调度策略，见 kernel/sched_rt.c
+#define SCHED_NORMAL    0                   // 普通任务，由公平调度类按 nice 值分配 CPU
+#define SCHED_FIFO      1                   // 实时任务，一直运行到睡眠、让出或被更高优先级的实时任务抢占
+#define SCHED_RR        2                   // 实时任务，同一优先级的任务按时间片轮转
+
+// 实时优先级的范围，越大越优先。普通任务的实时优先级为 0
+#define SCHED_RT_PRIO_MIN   1
+#define SCHED_RT_PRIO_MAX   99
+
+struct sched_param {
+    int sched_priority;                     // 实时优先级
+};
+
+// pid 为 0 表示当前进程。设置实时策略需要超级用户权限
+int sched_setscheduler(int pid, int policy, const struct sched_param * param);
+int sched_getscheduler(int pid);
+int sched_getparam(int pid, struct sched_param * param);
+
+#endif
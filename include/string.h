@@ -333,14 +333,84 @@ __asm__("testl %1,%1\n\t"
 return __res;
 }
 
-inline void * memcpy(void * dest,const void * src, int n)
+/*
+ * memcpy/memset 按长度分类处理: 长度是编译时常数时(__builtin_constant_p)，16 字节以内
+ * 直接展开成几次字(4 字节)/半字/字节传送，更长的用 rep movsl/stosl 再接固定的几条尾部指令;
+ * 长度不是常数时先按字传送，余下的 0-3 个字节再按字节传送。
+ * 整页的复制和清零见 mm/page_ops.c (copy_page/clear_page)。
+ */
+inline void * __memcpy(void * to, const void * from, int n)
 {
-__asm__("cld\n\t"
-	"rep\n\t"
-	"movsb"
-	::"c" (n),"S" (src),"D" (dest)
-	);
-return dest;
+int d0, d1, d2;
+__asm__ volatile("cld\n\t"
+	"rep ; movsl\n\t"
+	"movl %4,%%ecx\n\t"
+	"andl $3,%%ecx\n\t"
+	"jz 1f\n\t"
+	"rep ; movsb\n"
+	"1:"
+	:"=&c" (d0),"=&D" (d1),"=&S" (d2)
+	:"0" (n/4),"g" (n),"1" ((long) to),"2" ((long) from)
+	:"memory");
+return to;
+}
+
+inline void * __constant_memcpy(void * to, const void * from, int n)
+{
+int d0, d1, d2;
+switch (n) {
+	case 0:
+		return to;
+	case 1:
+		*(unsigned char *)to = *(const unsigned char *)from;
+		return to;
+	case 2:
+		*(unsigned short *)to = *(const unsigned short *)from;
+		return to;
+	case 4:
+		*(unsigned long *)to = *(const unsigned long *)from;
+		return to;
+	case 8:
+		*(unsigned long *)to = *(const unsigned long *)from;
+		*(1+(unsigned long *)to) = *(1+(const unsigned long *)from);
+		return to;
+	case 12:
+		*(unsigned long *)to = *(const unsigned long *)from;
+		*(1+(unsigned long *)to) = *(1+(const unsigned long *)from);
+		*(2+(unsigned long *)to) = *(2+(const unsigned long *)from);
+		return to;
+	case 16:
+		*(unsigned long *)to = *(const unsigned long *)from;
+		*(1+(unsigned long *)to) = *(1+(const unsigned long *)from);
+		*(2+(unsigned long *)to) = *(2+(const unsigned long *)from);
+		*(3+(unsigned long *)to) = *(3+(const unsigned long *)from);
+		return to;
+}
+#define COMMON(x) \
+__asm__ volatile("cld\n\t" \
+	"rep ; movsl" \
+	x \
+	:"=&c" (d0),"=&D" (d1),"=&S" (d2) \
+	:"0" (n/4),"1" ((long) to),"2" ((long) from) \
+	:"memory");
+switch (n % 4) {
+	case 0: COMMON(""); return to;
+	case 1: COMMON("\n\tmovsb"); return to;
+	case 2: COMMON("\n\tmovsw"); return to;
+	default: COMMON("\n\tmovsw\n\tmovsb"); return to;
+}
+#undef COMMON
+}
+
+#define memcpy(t, f, n) \
+(__builtin_constant_p(n) ? \
+ __constant_memcpy((t),(f),(n)) : \
+ __memcpy((t),(f),(n)))
+
+// 供取函数地址或用括号禁止宏展开的调用者使用
+inline void * (memcpy)(void * dest,const void * src, int n)
+{
+return __memcpy(dest, src, n);
 }
 
 inline void * memmove(void * dest,const void * src, int n)
@@ -392,14 +462,75 @@ __asm__("cld\n\t"
 return __res;
 }
 
-inline void * memset(void * s,char c,int count)
+// 按字填充，pattern 是 c 重复 4 次的 32 位值
+inline void * __memset(void * s,char c,int count)
 {
-__asm__("cld\n\t"
-	"rep\n\t"
-	"stosb"
-	::"a" (c),"D" (s),"c" (count)
-	);
+int d0, d1;
+unsigned long pattern = 0x01010101UL * (unsigned char) c;
+__asm__ volatile("cld\n\t"
+	"rep ; stosl\n\t"
+	"movl %3,%%ecx\n\t"
+	"andl $3,%%ecx\n\t"
+	"jz 1f\n\t"
+	"rep ; stosb\n"
+	"1:"
+	:"=&c" (d0),"=&D" (d1)
+	:"a" (pattern),"g" (count),"0" (count/4),"1" ((long) s)
+	:"memory");
 return s;
 }
 
+inline void * __constant_count_memset(void * s,char c,int count)
+{
+int d0, d1;
+unsigned long pattern = 0x01010101UL * (unsigned char) c;
+switch (count) {
+	case 0:
+		return s;
+	case 1:
+		*(unsigned char *)s = (unsigned char) pattern;
+		return s;
+	case 2:
+		*(unsigned short *)s = (unsigned short) pattern;
+		return s;
+	case 4:
+		*(unsigned long *)s = pattern;
+		return s;
+	case 8:
+		*(unsigned long *)s = pattern;
+		*(1+(unsigned long *)s) = pattern;
+		return s;
+	case 16:
+		*(unsigned long *)s = pattern;
+		*(1+(unsigned long *)s) = pattern;
+		*(2+(unsigned long *)s) = pattern;
+		*(3+(unsigned long *)s) = pattern;
+		return s;
+}
+#define COMMON(x) \
+__asm__ volatile("cld\n\t" \
+	"rep ; stosl" \
+	x \
+	:"=&c" (d0),"=&D" (d1) \
+	:"a" (pattern),"0" (count/4),"1" ((long) s) \
+	:"memory");
+switch (count % 4) {
+	case 0: COMMON(""); return s;
+	case 1: COMMON("\n\tstosb"); return s;
+	case 2: COMMON("\n\tstosw"); return s;
+	default: COMMON("\n\tstosw\n\tstosb"); return s;
+}
+#undef COMMON
+}
+
+#define memset(s, c, count) \
+(__builtin_constant_p(count) ? \
+ __constant_count_memset((s),(c),(count)) : \
+ __memset((s),(c),(count)))
+
+inline void * (memset)(void * s,char c,int count)
+{
+return __memset(s, c, count);
+}
+
 #endif
@@ -0,0 +1,18 @@
+#ifndef _SYS_MEMINFO_H
+#define _SYS_MEMINFO_H
+
+// 系统内存使用情况，单位都是页面。各项都是内核随分配和释放维护的计数，读取时不扫描内存
+struct meminfo {
+    unsigned long total_pages;              // 主内存区(1MB 以上)的页面数
+    unsigned long free_pages;               // 空闲页面
+    unsigned long cached_pages;             // 页面缓存中的文件页面
+    unsigned long shared_pages;             // 被多次引用的页面(fork 后写时复制共享、被映射的缓存页面等)
+    unsigned long pgtable_pages;            // 进程的页表和页目录
+    unsigned long active_pages;             // LRU active 链表上的页面
+    unsigned long inactive_pages;           // LRU inactive 链表上的页面
+    unsigned long swap_free_pages;          // 交换设备上的空闲页面
+};
+
+int meminfo(struct meminfo * info);
+
+#endif
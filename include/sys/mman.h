@@ -0,0 +1,32 @@
+#ifndef _SYS_MMAN_H
+#define _SYS_MMAN_H
+
+#include <sys/types.h>
+
+// 映射区的保护属性。页面总是可读的，写保护只用于写时复制，不会因为写只读映射而发送信号
+#define PROT_NONE   0
+#define PROT_READ   1                       // 可读
+#define PROT_WRITE  2                       // 可写
+#define PROT_EXEC   4                       // 可执行
+
+#define MAP_SHARED  1                       // 写入的内容对其他映射者可见，并写回文件
+#define MAP_PRIVATE 2                       // 写时复制，写入的内容不写回文件
+#define MAP_TYPE    0x0f                    // 映射类型屏蔽码
+#define MAP_FIXED   0x10                    // 必须映射在 addr 处(不支持)
+
+#define MAP_FAILED  ((void *) -1)
+
+// 系统调用 mmap 的参数块(参数多于 3 个寄存器，通过 ebx 传入指针)
+struct mmap_arg_struct {
+    unsigned long addr;
+    unsigned long len;
+    unsigned long prot;
+    unsigned long flags;
+    unsigned long fd;
+    unsigned long offset;
+};
+
+void * mmap(void * addr, size_t len, int prot, int flags, int fd, off_t offset);
+int munmap(void * addr, size_t len);
+
+#endif
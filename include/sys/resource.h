@@ -0,0 +1,27 @@
+#ifndef _SYS_RESOURCE_H
+#define _SYS_RESOURCE_H
+
+// getrusage 的 who 参数
+#define RUSAGE_SELF     0                   // 当前进程
+#define RUSAGE_CHILDREN (-1)                // 已经被等待(wait)过的子进程的累计值
+
+// 进程的资源使用情况。时间的单位是滴答(1/HZ 秒)，内存的单位是页面
+struct rusage {
+    long ru_utime;                          // 用户态运行时间
+    long ru_stime;                          // 内核态运行时间
+    long ru_rss;                            // 驻留页面数(子进程为 0)
+    long ru_minflt;                         // 不需要读盘的缺页次数(包括写时复制)
+    long ru_majflt;                         // 需要读盘(交换设备、zram 或文件)的缺页次数
+};
+
+// setpriority/getpriority 的 which 参数
+#define PRIO_PROCESS    0                   // who 是进程号
+#define PRIO_PGRP       1                   // who 是进程组号
+#define PRIO_USER       2                   // who 是用户 id
+
+int getrusage(int who, struct rusage * usage);
+int nice(int increment);                        // 增加当前进程的 nice 值(-20..19，越大得到的 CPU 时间越少)
+int setpriority(int which, int who, int prio);  // 设置进程的 nice 值
+int getpriority(int which, int who);            // 取进程的 nice 值，出错返回 -1(nice 也可能是 -1，要检查 errno)
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef _SYS_SCHEDSTAT_H
+#define _SYS_SCHEDSTAT_H
+
+// 唤醒延迟直方图的项数: 第 0 项 < 1us，第 i 项 [2^(i-1), 2^i) us，最后一项是更长的延迟
+#define SCHED_HIST_SIZE 20
+
+// schedstat 的 pid 参数
+#define SCHEDSTAT_ALL   (-1)                // 整个系统(包括已经退出的进程)的累计值
+
+// 调度统计。时间的单位是时间戳计数器的周期(tsc_khz 个周期为 1ms)，CPU 不支持 TSC 时都是 0。
+// 在每次任务切换和唤醒时维护
+struct schedstat {
+    unsigned long long run_time;            // 运行时间
+    unsigned long long run_delay;           // 就绪但在就绪队列中等待的时间
+    unsigned long long sleep_time;          // 睡眠时间
+    unsigned long pcount;                   // 被调度运行的次数
+    unsigned long nvcsw;                    // 主动切换次数(睡眠)
+    unsigned long nivcsw;                   // 被动切换次数(时间片用完或被抢占)
+    unsigned long nr_wakeups;               // 被唤醒的次数
+    unsigned long wakeup_hist[SCHED_HIST_SIZE];     // 从唤醒到开始运行的延迟的直方图
+    unsigned long tsc_khz;                  // 时间戳计数器的频率(kHz)，只在返回给用户时填写
+};
+
+// pid 为 0 取当前进程，SCHEDSTAT_ALL 取整个系统。st 为 NULL 时把所有任务的统计输出到串口
+int schedstat(int pid, struct schedstat * st);
+
+#endif
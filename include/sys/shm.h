@@ -0,0 +1,35 @@
+#ifndef _SYS_SHM_H
+#define _SYS_SHM_H
+
+#include <sys/types.h>
+
+#define IPC_PRIVATE ((key_t) 0)             // 创建新的段，不能按键值查找
+
+// shmget 的标志
+#define IPC_CREAT   00001000                // 不存在时创建
+#define IPC_EXCL    00002000                // 与 IPC_CREAT 一起使用，已存在时出错
+
+// shmctl 的命令
+#define IPC_RMID    0                       // 删除段(最后一个进程脱离时才真正释放)
+#define IPC_STAT    2                       // 取段的信息
+
+// shmat 的标志
+#define SHM_RDONLY  010000                  // 只读连接
+
+#define SHMMNI      16                      // 系统中最多的段数
+#define SHMMAX      (1024 * 4096)           // 段的最大长度(4MB)
+
+struct shmid_ds {
+    key_t shm_key;                          // 键值
+    size_t shm_segsz;                       // 段长度(字节)
+    pid_t shm_cpid;                         // 创建者的进程号
+    pid_t shm_lpid;                         // 最后一次连接或脱离的进程号
+    unsigned long shm_nattch;               // 当前连接数
+};
+
+int shmget(key_t key, size_t size, int shmflg);
+void * shmat(int shmid, const void * shmaddr, int shmflg);
+int shmdt(const void * shmaddr);
+int shmctl(int shmid, int cmd, struct shmid_ds * buf);
+
+#endif
@@ -30,6 +30,7 @@ typedef unsigned short umode_t;
 typedef unsigned char nlink_t;
 typedef int daddr_t;
 typedef long off_t;
+typedef long key_t;                 // IPC 键值(shmget)
 typedef unsigned char u_char;
 typedef unsigned short ushort;
 
@@ -19,8 +19,10 @@
 #define __NR_sleep      10
 #define __NR_alarm      27
 #define __NR_pause      29
+#define __NR_nice       34
 #define __NR_kill       37
 #define __NR_dup        41
+#define __NR_brk        45
 #define __NR_sigaction  67
 #define __NR_sgetmask   68
 #define __NR_ssetmask   69
@@ -30,6 +32,23 @@
 #define __NR_user_tty_read 73
 #define __NR_user_tty_write 74
 
+#define __NR_vfork      75
+#define __NR_spawn      76
+#define __NR_mmap       77
+#define __NR_munmap     78
+#define __NR_shmget     79
+#define __NR_shmat      80
+#define __NR_shmdt      81
+#define __NR_shmctl     82
+#define __NR_getrusage  83
+#define __NR_meminfo    84
+#define __NR_schedstat  85
+#define __NR_setpriority 86
+#define __NR_getpriority 87
+#define __NR_sched_setscheduler 88
+#define __NR_sched_getscheduler 89
+#define __NR_sched_getparam 90
+
 /* 例如
 static inline int fork(void) {
     long __res;
@@ -117,5 +136,9 @@ int read(int fildes, char * buf, off_t count);
 
 int open(const char * filename, int flag, ...);
 int close(int fildes);
+pid_t vfork(void);
+pid_t spawn(void * entry, long arg);
+int brk(void * end_data_segment);
+void * sbrk(ptrdiff_t increment);
 
 #endif
\ No newline at end of file
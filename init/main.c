@@ -38,8 +38,11 @@ static inline _syscall1(int, sleep, long, seconds)
 // 由于内核代码段被映射到从物理地址零开始的地方，因此这些线性地址
 // 正好也是对应的物理地址。这些指定地址处内存值的含义请参见setup程序读取并保存的参数。
 #define EXT_MEM_K (*(unsigned short *)0x90002)
+#define E820_NR (*(unsigned char *)0x901E8)
+#define E820_MAP ((struct e820entry *)0x90A00)
 #define DRIVE_INFO (*(struct drive_info *)0x90080)
 #define ORIG_ROOT_DEV (*(unsigned short *)0x901FC)
+#define ORIG_SWAP_DEV (*(unsigned short *)0x901FA)
 
 // 移动到用户模式
 // 所使用的方法是模拟中断调用返回过程，即利用 iret 指令来实现特权级的变更和堆栈的切换
@@ -73,18 +76,63 @@ __asm__ ("movl %%esp,%%eax\n\t" /* 保存堆栈指针esp到eax寄存器中 */\
 int mmtest_main(void);
 void signal_demo_main(void);
 void sched_abcd_demo(void);
+static void abcd_worker(long n);
 void ls_demo(void);
+static void spawn_return_test(void);
 
 struct drive_info { char dummy[32]; } drive_info;       // 用于存放硬盘参数表信息
 
+// setup.s 用 BIOS int 0x15 E820 功能取得的内存分布表项
+struct e820entry {
+    unsigned long addr_lo, addr_hi;     // 起始地址
+    unsigned long size_lo, size_hi;     // 长度
+    unsigned long type;                 // 类型，1 为可用内存
+};
+
+#define MAX_MEMORY (USER_BASE - 0x400000)   // 内核空间 1GB，最后 4MB(页目录项 255)留给 APIC 等的映射窗口(kernel/smp.c)
+
+// 计算物理内存容量
+// 优先使用 E820 表中包含 1MB 地址的可用内存区的末端(主内存区必须连续)，
+// 若 BIOS 不支持 E820，则使用扩展内存大小 1MB + EXT_MEM_K。
+// 必须在 buffer_init() 覆盖 0x90000 开始的参数区之前调用。
+static unsigned long detect_memory(void) {
+    struct e820entry *e = E820_MAP;
+    unsigned long end = 0;
+    int i;
+
+    for (i = 0; i < E820_NR; i++, e++) {
+        if (e->type != 1 || e->addr_hi)
+            continue;
+        if (e->addr_lo > 0x100000 || e->addr_lo + e->size_lo <= 0x100000)
+            continue;
+        end = e->addr_lo + e->size_lo;
+        if (e->size_hi || end < e->addr_lo)     // 超过 4GB
+            end = 0xfffff000;
+    }
+    if (!end)
+        end = (1 << 20) + ((unsigned long)EXT_MEM_K << 10);
+    if (end > MAX_MEMORY)
+        end = MAX_MEMORY;
+    return end & 0xfffff000;
+}
+
 int main() {
     ROOT_DEV = ORIG_ROOT_DEV;            // 根设备号ROOT_DEV, 已在前面包含进的fs.h文件中声明为 extern int
+    SWAP_DEV = ORIG_SWAP_DEV;            // 交换设备号，在 mm.h 中声明，sys_setup() 中初始化
     drive_info = DRIVE_INFO;
-    buffer_memory_end = 1*1024*1024;     // 设置缓冲区末端=1Mb
+    memory_end = detect_memory();
+    // 根据内存大小设置高速缓冲区末端
+    if (memory_end > 12*1024*1024)
+        buffer_memory_end = 4*1024*1024;
+    else if (memory_end > 6*1024*1024)
+        buffer_memory_end = 2*1024*1024;
+    else
+        buffer_memory_end = 1*1024*1024;     // 设置缓冲区末端=1Mb
     main_memory_start = buffer_memory_end;
     video_init();
     trap_init();
     sched_init();
+    smp_scan_config();                  // 查找其他处理器，必须在 buffer_init() 覆盖扩展 BIOS 数据区之前
     tty_init();
 	buffer_init(buffer_memory_end);     // 缓冲管理初始化，建内存链表等。(fs/buffer.c)
     blk_dev_init();                     // 块设备初始化,kernel/blk_drv/ll_rw_blk.c
@@ -92,8 +140,8 @@ int main() {
     sti();              // 所有初始化完成开启中断
     printk("Welcome to Linux0.1 Kernel Mode(NO)\n");
 
-    // 初始化物理页内存, 将 1MB - 16MB 地址空间的内存进行初始
-    memory_end = 0x300000;
+    // 初始化物理页内存, 将主内存区 main_memory_start - memory_end 的内存进行初始
+    printk("Memory: %dKB\n", memory_end >> 10);
     mem_init(main_memory_start, memory_end);
 
     // 中断实验
@@ -103,6 +151,17 @@ int main() {
     // 内存实验
     // mmtest_main();
 
+    // 整页复制/清零和写时复制缺页的性能测试(mm/mm_bench.c)
+    // mm_bench();
+
+    // 硬件任务切换与软件任务切换的性能测试(kernel/sched_bench.c)
+    // sched_bench();
+
+    // 启动其他处理器(kernel/smp.c)。到这里为止内核只在 CPU 0 上运行，一直持有大内核锁，
+    // 进入用户态之前释放，此后由系统调用和中断的入口获取
+    smp_boot_cpus();
+    unlock_kernel();
+
     // 在Linux 0.11中，除进程0外，所有进程都是由一个已有进程在用户态下完成创建的。
     // 为了遵守这个规则，在进程0正式创建进程1之前，要将进程0由内核态转变为用户态，
     // 方法是调用move_to_user_mode函数，模仿中断返回动作，实现进程0的特权级从内核态转变为用户态。
@@ -154,13 +213,17 @@ void init() {
 	printf("Free mem: %d bytes\n", memory_end - main_memory_start);
 
     ls_demo();
+    spawn_return_test();
 
-    // 下面fork()用于创建一个子进程(任务2)
-    if(!(pid = fork())) {
+    // 下面vfork()用于创建一个子进程(任务2)
+    // 子进程借用本进程的地址空间，不复制页表，本进程睡眠到子进程退出为止。
+    // 因此子进程不能从 init() 返回，只能调用 _exit() 退出(目前还没有 execve)。
+    if(!(pid = vfork())) {
         close(0);
         if (open("/etc/rc", O_RDONLY, 0)) {
             _exit(1);
         }
+        _exit(0);
     }
 
     if(pid > 0) {
@@ -195,6 +258,7 @@ void ls_demo() {
 void sched_abcd_demo() {
     // Here init process (pid = 2) will
     // print AABB randomly
+    long i;
 
     char buf[100] = "TTY";
     printf("Welcome to the OS, your are current at %x\n", sched_abcd_demo);
@@ -210,33 +274,39 @@ void sched_abcd_demo() {
     sleep(1);
     printf(".0\n");
 
-    if(!fork()) {
-      while(1) {
-            sys_debug("A");
-            printf("A");
-            sleep(1);
-        }
-    }
-    if(!fork()) {
-        while(1) {
-            sys_debug("B");
-            printf("B");
-            sleep(2);
-        }
-    }
-    if(!fork()) {
-        while(1) {
-            sys_debug("C");
-            printf("C");
-            sleep(3);
-        }
+    // 4 个子进程用 spawn() 直接从 abcd_worker(n) 开始执行，n = 0..3 分别打印 A B C D
+    for (i = 0; i < 4; i++)
+        spawn(abcd_worker, i);
+    while(1);
+}
+
+// spawn() 的入口函数返回时，子进程执行内核放在栈顶的退出代码，以返回值为退出码退出
+static long spawn_return_worker(long n) {
+    return n + 1;
+}
+
+// 检查入口函数返回的 spawn 子进程: 父进程应该等到它以退出码 42 退出
+static void spawn_return_test(void) {
+    int pid, status = 0;
+
+    if ((pid = spawn(spawn_return_worker, 41)) < 0) {
+        printf("spawn return test: spawn failed\n");
+        return;
     }
-    if(!fork()) {
-        while(1) {
-            sys_debug("D");
-            printf("D");
-            sleep(4);
-        }
+    while (pid != wait(&status));
+    printf("spawn return test: %s (exit code %d)\n",
+        ((status >> 8) & 0xff) == 42 ? "ok" : "FAILED", (status >> 8) & 0xff);
+}
+
+// spawn() 创建的子进程入口，每隔 n+1 秒打印一次字母 'A'+n
+static void abcd_worker(long n) {
+    char s[2];
+
+    s[0] = (char)('A' + n);
+    s[1] = 0;
+    while(1) {
+        sys_debug(s);
+        printf(s);
+        sleep(n + 1);
     }
-    while(1);
 }
@@ -38,8 +38,12 @@ no_error_code:                      # 无出错号处理的入口
     mov %dx, %ds
     mov %dx, %es
     mov %dx, %fs
+    pushl %eax                      # 获取大内核锁(kernel/smp.c)，返回前释放
+    call lock_kernel
+    popl %eax
     call *%eax                      # * 号表示调用操作数指定地址处的函数，称为间接调用，即调用 do_divide_error()
     addl $8, %esp                   # 相当于两次pop，弹出c函数两个参数
+    call unlock_kernel
     pop %fs
     pop %es
     pop %ds
@@ -149,8 +153,10 @@ error_code:
 	mov %ax, %ds
 	mov %ax, %es
 	mov %ax, %fs
+	call lock_kernel		# 获取大内核锁(kernel/smp.c)，返回前释放
 	call *%ebx				# 间接调用, %ebx 中存放的就是要调用的C函数的地址
 	addl $8, %esp			# 丢弃入栈的2个用作C函数的参数。
+	call unlock_kernel
 	pop %fs
 	pop %es
 	pop %ds
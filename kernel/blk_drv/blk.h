@@ -16,7 +16,7 @@
 /*
  下面是 request 结构的一个扩展形式，因而当实现以后，我们
  就可以在分页请求中使用同样的request结构。在分页处理中，
- bh 是 NULL，而 waiting 则用于等待读/写的完成。
+ bh 是 NULL，而 waiting 则用于等待读/写的完成，uptodate 用于取回读/写的结果。
  下面是请求队列中项的结构。其中如果字段 dev=-1，则表示队列中该项没有被使用。
  字段cmd可取常量 READ(0)或WRITE(1)(定义在include/linux/fs.h)。
 */
@@ -28,6 +28,7 @@ struct request {
 	unsigned long nr_sectors;                   // 读/写扇区数
 	char * buffer;                              // 数据缓冲区
 	struct task_struct * waiting;               // 任务等待操作执行完成的地方
+	int * uptodate;                             // 分页请求: 完成时置 1(成功)或 0(出错)，缓冲块请求为 NULL
 	struct buffer_head * bh;                    // 缓冲区头指针
 	struct request * next;                      // 指向下一请求项
 };
@@ -51,7 +52,7 @@ struct blk_dev_struct {
 };
 
 extern struct blk_dev_struct blk_dev[NR_BLK_DEV];
-extern struct task_struct * wait_for_request;
+extern struct wait_queue * wait_for_request;
 
 #ifdef MAJOR_NR                                 // 主设备号
 
@@ -85,10 +86,17 @@ static inline void end_request(int uptodate) {
     }
 	if (!uptodate) {
 		printk(DEVICE_NAME " I/O error\n\r");
-		printk("dev %04x, block %d\n\r", CURRENT->dev,
-			CURRENT->bh->b_blocknr);
+		if (CURRENT->bh)                        // 分页请求没有缓冲块，只能打印扇区号
+			printk("dev %04x, block %d\n\r", CURRENT->dev,
+				CURRENT->bh->b_blocknr);
+		else
+			printk("dev %04x, sector %d\n\r", CURRENT->dev,
+				CURRENT->sector);
 	}
-	wake_up(&CURRENT->waiting);
+	if (CURRENT->uptodate)                      // 分页请求没有缓冲块，结果交给等待的进程
+		*CURRENT->uptodate = uptodate;
+	if (CURRENT->waiting)                       // 分页请求的进程在等待
+		wake_up_process(CURRENT->waiting);
 	wake_up(&wait_for_request);
 	CURRENT->dev = -1;
 	CURRENT = CURRENT->next;
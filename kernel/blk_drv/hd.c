@@ -26,6 +26,13 @@ inb_p(0x71); \
 static int recalibrate = 0;         // 重新校正标志
 static int reset = 0;               // 复位标志
 
+// 发出命令后等待硬盘中断的最长时间(滴答数)。超时由 hd_timer 处理，见 hd_times_out()
+#define HD_TIMEOUT	(5 * HZ)
+static struct timer_list hd_timer;
+
+// 设置硬盘中断时调用的函数，同时(重新)开始计算超时
+#define SET_INTR(x) (do_hd = (x), mod_timer(&hd_timer, (unsigned long) jiffies + HD_TIMEOUT))
+
 // 硬盘信息结构 (Harddisk information struct)。
 // 各字段分别是磁头数、每磁道扇区数、柱面数、写前预补偿柱面号、磁头着陆区柱面号、控制字节。
 struct hd_i_struct {
@@ -45,6 +52,9 @@ static struct hd_struct {
 #define port_read(port, buf, nr) \
 __asm__("cld;rep;insw"::"d" (port),"D" (buf),"c" (nr))
 
+#define port_write(port, buf, nr) \
+__asm__("cld;rep;outsw"::"d" (port),"S" (buf),"c" (nr))
+
 extern void hd_interrupt(void);
 extern void rd_load(void);
 
@@ -113,6 +123,7 @@ int sys_setup(void * BIOS) {
     if (NR_HD)
 		printk("Partition table%s ok.\n",(NR_HD>1)?"s":"");
 	rd_load();
+	init_swapping();
 	mount_root();
     return 0;
 }
@@ -126,6 +137,35 @@ static int controller_ready(void) {
 	return (retries);
 }
 
+// 等待硬盘控制器就绪(不忙且驱动器就绪)。返回 0 表示就绪
+static int drive_busy(void) {
+	unsigned int i;
+
+	for (i = 0; i < 10000; i++)
+		if (READY_STAT == (inb_p(HD_STATUS) & (BUSY_STAT|READY_STAT)))
+			break;
+	i = inb(HD_STATUS);
+	i &= BUSY_STAT | READY_STAT | SEEK_STAT;
+	if (i == (READY_STAT | SEEK_STAT))
+		return(0);
+	printk("HD controller times out\n\r");
+	return(1);
+}
+
+// 复位硬盘控制器: 向控制寄存器写入复位位(4)，稍等后写回正常的控制字节，然后等待控制器就绪
+static void reset_controller(void) {
+	int i;
+
+	outb(4, HD_CMD);
+	for (i = 0; i < 100; i++)
+		nop();
+	outb(hd_info[0].ctl & 0x0f, HD_CMD);
+	if (drive_busy())
+		printk("HD-controller still busy\n\r");
+	if ((i = inb(HD_ERROR)) != 1)
+		printk("HD-controller reset failed: %x\n\r", i);
+}
+
 // 检测硬盘执行命令后的状态
 static int win_result(void) {
 	int i = inb_p(HD_STATUS);
@@ -163,7 +203,7 @@ static void read_intr(void) {
     CURRENT->buffer += 512;
     CURRENT->sector++;
     if (--CURRENT->nr_sectors) {
-        do_hd = &read_intr;         // 等待硬盘在读出另1个扇区数据后发出中断并再次调用本函数
+        SET_INTR(&read_intr);       // 等待硬盘在读出另1个扇区数据后发出中断并再次调用本函数
         return;
     }
     // 全部扇区读完
@@ -172,9 +212,24 @@ static void read_intr(void) {
 }
 
 // 写操作中断调用函数
+// 写命令发出且第1个扇区数据送出后，硬盘每写完一个扇区就产生一次中断
 static void write_intr(void) {
-    s_printk("write_intr()\n");
-
+    // s_printk("write_intr()\n");
+    if (win_result()) {
+        bad_rw_inter();
+        do_hd_request();
+        return;
+    }
+    // 还有扇区要写，则把下一扇区数据送到数据寄存器
+    if (--CURRENT->nr_sectors) {
+        CURRENT->sector++;
+        CURRENT->buffer += 512;
+        SET_INTR(&write_intr);
+        port_write(HD_DATA, CURRENT->buffer, 256);
+        return;
+    }
+    end_request(1);
+    do_hd_request();
 }
 
 static void hd_out(unsigned int drive, unsigned int nsect, unsigned int sect,
@@ -188,7 +243,7 @@ static void hd_out(unsigned int drive, unsigned int nsect, unsigned int sect,
 		panic("Trying to write bad sector");
 	if (!controller_ready())
 		panic("HD controller not ready");
-	do_hd = intr_addr;                          // 硬盘中断发生时将调用的c函数指针 do_hd
+	SET_INTR(intr_addr);                        // 硬盘中断发生时将调用的c函数指针 do_hd
 	outb_p(hd_info[drive].ctl, HD_CMD);         // 向控制寄存器输出控制字节
 	port = HD_DATA;                             // 置dx为数据寄存器端口(0x1f0)
 	outb_p(hd_info[drive].wpcom>>2, ++port);    // 参数:写预补偿柱面号(需除4)
@@ -200,6 +255,20 @@ static void hd_out(unsigned int drive, unsigned int nsect, unsigned int sect,
 	outb(cmd,++port);                           // 命令:硬盘控制命令
 }
 
+// 复位和重新校正命令的中断处理函数: 出错时按一次读写错误计数，然后继续处理当前请求项
+static void recal_intr(void) {
+	if (win_result())
+		bad_rw_inter();
+	do_hd_request();
+}
+
+// 复位控制器，并重新设置硬盘 nr 的参数(WIN_SPECIFY)，完成后由 recal_intr() 继续处理请求项
+static void reset_hd(unsigned int nr) {
+	reset_controller();
+	hd_out(nr, (unsigned int) hd_info[nr].sect, (unsigned int) hd_info[nr].sect,
+		(unsigned int) hd_info[nr].head - 1, (unsigned int) hd_info[nr].cyl, WIN_SPECIFY, &recal_intr);
+}
+
 //// 执行硬盘读写请求操作。
 // 该函数根据设备当前请求项中的设备号和起始扇区号信息首先计算得到对应硬盘上的柱面号、当前磁道中扇区号、磁头号数据，
 // 然后再根据请求项中的命令(READ/WRITE)对硬盘发送相应读/写命令。
@@ -218,7 +287,7 @@ void do_hd_request(void) {
     dev = MINOR(CURRENT->dev);          // 子设备号即对应硬盘上各分区
 	block = CURRENT->sector;            // 请求的起始扇区
 
-    if (dev >= (unsigned int)(5*NR_HD) || block + 2 > (unsigned int)hd[dev].nr_sects) {   // 一次要求读写一块数据（2个扇区）
+    if (dev >= (unsigned int)(5*NR_HD) || block + CURRENT->nr_sectors > (unsigned int)hd[dev].nr_sects) {   // 缓冲块为2个扇区，分页请求为8个扇区
         end_request(0);
         goto repeat;
     }
@@ -238,22 +307,56 @@ void do_hd_request(void) {
 	sec++;                              // 对计数所得当前磁道扇区号进行调整
 	nsect = CURRENT->nr_sectors;        // 欲读写的扇区数
 
+    // 复位之后还要重新校正(磁头回到 0 柱面)，两步都在中断中完成后再回到这里发出读写命令
     if (reset) {
-        // TODO:
+        reset = 0;
+        recalibrate = 1;
+        reset_hd(dev);
+        return;
     }
 
     if (recalibrate) {
-        // TODO:
+        recalibrate = 0;
+        hd_out(dev, (unsigned int) hd_info[dev].sect, 0, 0, 0, WIN_RESTORE, &recal_intr);
+        return;
     }
 
     if (CURRENT->cmd == WRITE) {
-        // TODO:
+        // 发出写命令后循环查询 DRQ 标志，等控制器准备好接收数据再写入第1个扇区
+        hd_out(dev, nsect, sec, head, cyl, WIN_WRITE, &write_intr);
+        for (i = 0; i < 3000 && !(r = inb_p(HD_STATUS) & DRQ_STAT); i++)
+            /* nothing */ ;
+        if (!r) {
+            bad_rw_inter();
+            goto repeat;
+        }
+        port_write(HD_DATA, CURRENT->buffer, 256);
 	} else if (CURRENT->cmd == READ) {
 		hd_out(dev, nsect, sec, head, cyl, WIN_READ, &read_intr);
 	} else
 		panic("unknown hd-command");
 }
 
+// 硬盘超时: 发出命令后 HD_TIMEOUT 个滴答内没有中断。在时钟中断中调用。
+// do_hd 为空说明期间中断已经到达并且没有新的命令在等待(定时器没有取消，到期时忽略)。
+// 否则按一次读写错误处理，复位控制器后重新执行当前请求项(驱动器没有响应，不复位会一直挂住)
+static void hd_times_out(unsigned long data) {
+    /* Only for emit the warning! */
+    unsigned long tmp = data;
+    data = tmp;
+    /* End */
+
+    if (!do_hd)
+        return;
+    do_hd = NULL;
+    printk("HD timeout\n");
+    if (!CURRENT)
+        return;
+    bad_rw_inter();
+    reset = 1;
+    do_hd_request();
+}
+
 void unexpected_hd_interrupt(void) {
     printk("Unexpected HD interrupt\n");
 }
@@ -268,6 +371,8 @@ void unexpected_hd_interrupt(void) {
 void hd_init() {
     s_printk("hd_init()\n");
     blk_dev[MAJOR_NR].request_fn = DEVICE_REQUEST;      // do_hd_request()
+    init_timer(&hd_timer);
+    hd_timer.function = hd_times_out;
 	set_intr_gate(0x2E, &hd_interrupt);
 	outb_p(inb_p(0x21)&0xfb, 0x21);                      // 复位接联的主8259A int2的屏蔽位
 	outb(inb_p(0xA1)&0xbf, 0xA1);                        // 复位硬盘中断请求屏蔽位(在从片上)
@@ -8,8 +8,8 @@
 // 请求项数组队列, 32 个
 struct request request[NR_REQUEST];
 
-// 用于在请求数组没有空闲项时进程的临时等待处
-struct task_struct * wait_for_request = NULL;
+// 用于在请求数组没有空闲项时进程的临时等待处(独占等待，释放一个请求项只唤醒一个进程)
+struct wait_queue * wait_for_request = NULL;
 
 /*  blk_dev_struct is:
  *	do_request-address
@@ -29,8 +29,8 @@ struct blk_dev_struct blk_dev[NR_BLK_DEV] = {
 // 如果指定的缓冲块已经被其他任务锁定，则使自己睡眠(不可中断地等待)，直到被执行解锁缓冲块的任务明确地唤醒。
 static inline void lock_buffer(struct buffer_head * bh) {
 	cli();
-	while (bh->b_lock)                      // 如果缓冲区已被锁定则睡眠，直到缓冲区解锁
-		sleep_on(&bh->b_wait);
+	while (bh->b_lock)                      // 如果缓冲区已被锁定则睡眠，直到缓冲区解锁(独占等待，解锁时只有一个能锁上)
+		sleep_on_exclusive(&bh->b_wait);
 	bh->b_lock = 1;                         // 立刻锁定该缓冲区
 	sti();
 }
@@ -131,7 +131,7 @@ repeat:
 			unlock_buffer(bh);
 			return;
 		}
-		sleep_on(&wait_for_request);
+		sleep_on_exclusive(&wait_for_request);
 		goto repeat;
 	}
 /* fill up the request-info, and add it to the queue */
@@ -145,11 +145,53 @@ repeat:
 	req->nr_sectors = 2;                // 本请求项需要读写的扇区数
 	req->buffer = bh->b_data;           // 请求项缓冲区指针指向需要读写的数据缓冲区
 	req->waiting = NULL;                // 任务等待操作执行完成的地方
+	req->uptodate = NULL;               // 结果记录在缓冲块的 b_uptodate 中
 	req->bh = bh;                       // 缓冲块头指针
 	req->next = NULL;                   // 指向下一项请求
 	add_request(major+blk_dev, req);
 }
 
+// 低层页面读写函数(Low Level Read Write Page)，交换设备以页面为单位读写
+// 分页请求不经过高速缓冲区: 请求项的 bh 为空，数据直接读写到 buffer 指定的页面。
+// 一页占 8 个扇区，所以起始扇区是 page << 3。发出请求的进程以不可中断状态睡眠，
+// 由 end_request() 通过 waiting 字段唤醒，并通过 uptodate 字段取回结果。
+// 返回 1 表示读写成功，0 表示出错(设备不存在或多次重试后仍然失败)，此时页面内容不可用。
+int ll_rw_page(int rw, int dev, int page, char * buffer) {
+	struct request * req;
+	unsigned int major = MAJOR(dev);
+	int uptodate = 0;
+
+	if (major >= NR_BLK_DEV || !(blk_dev[major].request_fn)) {
+		printk("Trying to read nonexistent block-device\n\r");
+		return 0;
+	}
+	if (rw != READ && rw != WRITE)
+		panic("Bad block dev command, must be R/W");
+repeat:
+	req = request + NR_REQUEST;
+	while (--req >= request)
+		if (req->dev < 0)
+			break;
+	if (req < request) {
+		sleep_on_exclusive(&wait_for_request);
+		goto repeat;
+	}
+	req->dev = dev;
+	req->cmd = rw;
+	req->errors = 0;
+	req->sector = (unsigned long)page << 3;
+	req->nr_sectors = 8;
+	req->buffer = buffer;
+	req->waiting = current;
+	req->uptodate = &uptodate;
+	req->bh = NULL;
+	req->next = NULL;
+	current->state = TASK_UNINTERRUPTIBLE;      // 先置睡眠状态，再加入请求，避免丢失唤醒
+	add_request(major+blk_dev, req);
+	schedule();
+	return uptodate;
+}
+
 // 低层读写数据块
 void ll_rw_block(int rw, struct buffer_head * bh) {
 	int major;
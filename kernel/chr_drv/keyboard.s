@@ -3,27 +3,27 @@
 .text
 .global keyboard_interrupt
 
+# 保存与系统调用相同的现场，从 ret_from_intr(kernel/system_call.s)退出，
+# 这样键盘输入唤醒的任务在返回用户态时就能抢占当前任务
 keyboard_interrupt:
-	pushl %eax
-	pushl %ebx
-	pushl %ecx
-	pushl %edx
 	push %ds
 	push %es
+	push %fs
+	pushl %edx
+	pushl %ecx
+	pushl %ebx
+	pushl %eax
 	movl $0x10, %eax                # 将 ds、es 段寄存器置为内核数据段
 	mov %ax, %ds
 	mov %ax, %es
-	xor %al, %al
+	movl $0x17, %eax                # fs 指向局部数据段(用户程序的数据段)
+	mov %ax, %fs
+	call lock_kernel                # 获取大内核锁，从 ret_from_intr 返回前释放
+	xorl %eax, %eax
 	inb $0x60, %al                  # 读取扫描码
-	push %ax
+	pushl %eax
 	movb $0x20, %al                 # 向 8259 中断芯片发送 EOI (中断结束)信号
 	outb %al, $0x20
 	call do_keyboard_interrupt
-	pop  %ax
-	pop  %es
-	pop  %ds
-	popl %edx
-	popl %ecx
-	popl %ebx
-	popl %eax
-	iret
+	addl $4, %esp
+	jmp ret_from_intr
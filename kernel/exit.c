@@ -47,10 +47,12 @@ static inline int send_sig(long sig, struct task_struct* p, int priv) {
     // 如果强制发送标志置位，或者当前进程的有效用户标识符(euid)就是指定进程的euid（也即是自己）,
     // 或者当前进程是超级用户，则向进程 p 发送信号 sig，即在进程 p 位图中添加该信号，否则出错退出。
     // 其中suser()定义为(current->euid==0)，用于判断是否是超级用户。
-    if(priv || current->euid == p->euid /*|| suser() */) // 目前我们没有对用户的权限检查
+    if(priv || current->euid == p->euid /*|| suser() */) { // 目前我们没有对用户的权限检查
         p->signal |= (1<<(sig - 1));    // sig = (1 ~ 32) 所以减1
-    else
+        signal_wake_up(p);              // 唤醒可中断睡眠的 p
+    } else {
         return -EPERM;
+    }
     return 0;
 }
 
@@ -97,6 +99,7 @@ static void tell_father(int pid) {
                 continue;
             }
             task[i]->signal |= (1 << (SIGCHLD - 1));
+            signal_wake_up(task[i]);            // 父进程可能在 waitpid() 中睡眠
             return;
         }
     }
@@ -108,11 +111,22 @@ static void tell_father(int pid) {
 // 该函数将把当前进程置为TASK_ZOMBIE状态，然后去执行调度函数schedule()，不再返回。
 // 参数 code 是退出状态码，或称为错误码。
 int do_exit(long code) {
-    s_printk("do_exit(%d), pid = %d\n", code, current->pid);
+    s_printk("do_exit(%d), pid = %d, min_flt = %d, maj_flt = %d\n",
+        code, current->pid, current->min_flt, current->maj_flt);
     int i;
-    // 首先释放当前进程代码段和数据段所占的内存页。
-    free_page_tables(get_base(current->ldt[1]),get_limit(0x0f));
-	free_page_tables(get_base(current->ldt[2]),get_limit(0x17));
+    // 取消报警定时器，任务结构释放后定时器不能再挂在时间轮上
+    del_timer(&current->alarm_timer);
+    current->alarm = 0;
+    // 首先放回文件映射区(写回修改过的共享页面)，然后释放当前进程代码段和数据段所占的内存页和页目录。
+    // vfork 的子进程借用的是父进程的地址空间，不能释放，只需唤醒父进程。
+    exit_mmap();
+    if (current->flags & PF_VFORK) {
+        release_vfork(current);
+    } else {
+        free_page_tables(current, get_base(current->ldt[1]),get_limit(0x0f));
+        free_page_tables(current, get_base(current->ldt[2]),get_limit(0x17));
+        free_page_dir(current);                 // 以后使用内核页目录 pg_dir
+    }
     // 如果当前进程有子进程，就将子进程的 father 置为 1 (其父进程改为进程1，即init进程)。
     // 如果该子进程已经处于僵死(ZOMBIE)状态，则向进程1发送子进程中止信号 SIGCHLD。
     for (i = 0; i < NR_TASKS; i++) {
@@ -224,6 +238,8 @@ repeat:
             case TASK_ZOMBIE:
                 current->cutime += (*p)->utime;
                 current->cstime += (*p)->stime;
+                current->cmin_flt += (*p)->min_flt + (*p)->cmin_flt;
+                current->cmaj_flt += (*p)->maj_flt + (*p)->cmaj_flt;
                 flag = (*p)->pid;                   // 临时保存子进程pid
                 code = (*p)->exit_code;             // 取子进程的退出码
                 release(*p);
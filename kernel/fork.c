@@ -4,10 +4,12 @@
 #include <asm/system.h>
 #include <linux/mm.h>
 #include <linux/kernel.h>
+#include <string.h>
 #include <serial_debug.h>
 
 
 extern void write_verify(unsigned long address);
+extern void ret_from_fork(void);
 
 long last_pid = 0;		// 最新进程号，其值会由 get_empty_process() 生成
 
@@ -46,14 +48,13 @@ void verify_area(void *addr, unsigned int size) {
 }
 
 // 复制内存页表
-// nr: 新任务号
 // p: 新任务数据结构指针
 // 操作成功返回 0，否则返回错误号
-// 该函数为新任务在线性地址空间中设置代码段和数据段基址、限长，并复制页表。
+// 该函数为新任务分配页目录，设置代码段和数据段基址、限长，并复制页表。
 // 由于Linux系统采用了写时复制(copy on write)技术，因此这里仅为新进程设置自己的页目录表项和页表项，
 // 而没有实际为新进程分配物理内存页面。此时新进程与其父进程共享所有内存页面。
 // 操作成功返回0，否则返回出错号。
-int copy_mem(int nr, struct task_struct *p) {
+int copy_mem(struct task_struct *p) {
 	unsigned long old_data_base, new_data_base, data_limit;
     unsigned long old_code_base, new_code_base, code_limit;
 
@@ -71,23 +72,109 @@ int copy_mem(int nr, struct task_struct *p) {
     if(data_limit < code_limit)										// 否则内核显示出错信息，并停止运行。
         panic("bad data limit");
 
- 	// 然后设置创建中的新进程在线性地址空间中的基地址等于(64MB * 其任务号)，
+ 	// 然后为新进程分配自己的页目录(内核空间的目录项与其他进程共享)。
+    // 每个进程都有独立的线性地址空间，用户空间的基地址都是 USER_BASE，
     // 并用该值设置新进程局部描述符表中段描述符中的基地址。接着设置新进程
     // 的页目录表项和页表项，即复制当前进程(父进程)的页目录表项和页表项。
     // 此时子进程共享父进程的内存页面。正常情况下copy_page_tables()返回0，
-    // 否则表示出错，则释放刚申请的页表项。
-	new_data_base = new_code_base = (unsigned int)nr * 0x4000000; // 64MB * nr
+    // 否则表示出错，则释放刚申请的页表项和页目录。
+    if (new_page_dir(p))
+        return -1;
+    new_data_base = new_code_base = USER_BASE;
     p->start_code = new_code_base;
     set_base(p->ldt[1], new_code_base);
     set_base(p->ldt[2], new_data_base);
-    if(copy_page_tables(old_data_base, new_data_base, data_limit)) {
+    if(copy_page_tables(p, old_data_base, new_data_base, data_limit)) {
         printk("free_page_tables: from copy_mem\n");
-        free_page_tables(new_data_base, data_limit);
+        free_page_tables(p, new_data_base, data_limit);
+        free_page_dir(p);
         return -1;
     }
     return 0;
 }
 
+// spawn 的内存设置
+// 子进程先像 fork 一样共享父进程的页表(写时复制，页表本身也是延迟复制的)，
+// 然后把代码段和数据段限长各增加一页，在新增的这一页映射一个新的物理页面作为子进程的用户栈。
+// 这一页在父进程的段限长之外，因此不会与父进程的任何页面重叠。
+// 栈页面的最高 16 字节放一小段退出代码(spawn_exit_code)，其下是参数 arg 和指向这段代码的返回地址:
+// 入口函数返回时执行 exit(返回值)，而不是跳到地址 0 处执行任意的内容。
+// 返回: 子进程的用户栈指针，出错返回 0
+#define SPAWN_EXIT_SIZE 16
+
+static const unsigned char spawn_exit_code[SPAWN_EXIT_SIZE] = {
+	0x89, 0xc3,							// movl %eax, %ebx		入口函数的返回值作为退出码
+	0xb8, 0x01, 0x00, 0x00, 0x00,		// movl $__NR_exit, %eax
+	0xcd, 0x80,							// int $0x80			不返回
+	0xf4,								// hlt(万一返回，特权指令引起保护异常)
+};
+
+static unsigned long spawn_mem(struct task_struct *p, unsigned long arg) {
+	unsigned long data_limit, page, *sp;
+
+	data_limit = get_limit(0x17);
+	if (data_limit + PAGE_SIZE > TASK_SIZE)			// 超出任务的用户空间
+		return 0;
+	if (copy_mem(p))
+		return 0;
+	if (!(page = get_free_page()))
+		goto bad;
+	memcpy((void *)(page + PAGE_SIZE - SPAWN_EXIT_SIZE), spawn_exit_code, SPAWN_EXIT_SIZE);
+	sp = (unsigned long *)(page + PAGE_SIZE - SPAWN_EXIT_SIZE);
+	*--sp = arg;
+	*--sp = data_limit + PAGE_SIZE - SPAWN_EXIT_SIZE;		// 返回地址: 退出代码的段内偏移
+	if (!put_page(p, page, p->start_code + data_limit)) {
+		free_page(page);
+		goto bad;
+	}
+	set_limit(p->ldt[1], data_limit + PAGE_SIZE);
+	set_limit(p->ldt[2], data_limit + PAGE_SIZE);
+	// 子进程的堆从新栈页面之上开始，sbrk 不会覆盖栈
+	p->end_data = p->brk = data_limit + PAGE_SIZE;
+	return data_limit + PAGE_SIZE - SPAWN_EXIT_SIZE - 8;
+bad:
+	free_page_tables(p, p->start_code, data_limit);
+	free_page_dir(p);
+	return 0;
+}
+
+// vfork 的子进程退出(以后还有 execve 替换映像)时调用，
+// 子进程不再使用父进程的地址空间，唤醒等待的父进程
+void release_vfork(struct task_struct *p) {
+	if (!(p->flags & PF_VFORK))
+		return;
+	p->flags &= (unsigned long)~PF_VFORK;
+	wake_up(&p->vfork_wait);
+}
+
+// 在子进程的内核栈顶构造它第一次被调度时的现场，寄存器的值取自上面设置的 p->tss:
+// switch_to 跳到 ret_from_fork(system_call.s)，它弹出 gs, fs, ebp, edi, esi, ebx，
+// 再从 ret_from_syscall 返回用户态(弹出 eax..ds，iret)，与父进程的系统调用返回相同
+static void copy_thread(struct task_struct *p) {
+	unsigned long *sp = (unsigned long *) (PAGE_SIZE + (long) p);
+
+	*--sp = (unsigned long) p->tss.ss;			// iret 弹出
+	*--sp = (unsigned long) p->tss.esp;
+	*--sp = (unsigned long) p->tss.eflags;
+	*--sp = (unsigned long) p->tss.cs;
+	*--sp = (unsigned long) p->tss.eip;
+	*--sp = (unsigned long) p->tss.ds;			// ret_from_syscall 弹出
+	*--sp = (unsigned long) p->tss.es;
+	*--sp = (unsigned long) p->tss.fs;
+	*--sp = (unsigned long) p->tss.edx;
+	*--sp = (unsigned long) p->tss.ecx;
+	*--sp = (unsigned long) p->tss.ebx;
+	*--sp = (unsigned long) p->tss.eax;
+	*--sp = (unsigned long) p->tss.ebx;			// ret_from_fork 弹出
+	*--sp = (unsigned long) p->tss.esi;
+	*--sp = (unsigned long) p->tss.edi;
+	*--sp = (unsigned long) p->tss.ebp;
+	*--sp = (unsigned long) p->tss.fs;
+	*--sp = (unsigned long) p->tss.gs;
+	p->thread.esp = (unsigned long) sp;
+	p->thread.eip = (unsigned long) ret_from_fork;
+}
+
 // 复制进程
 // 下面是主要的fork子程序。它复制系统进程信息（task[n]）
 // 并且设置必要的寄存器。它还整个地复制数据段。
@@ -98,9 +185,12 @@ int copy_mem(int nr, struct task_struct *p) {
 // 1. CPU 执行中断指令压入的用户栈地址SS, ESP, 标志寄存器 EFLAGS 和返回地址 CS:EIP
 // 2. 刚进入 system_call 时压栈的寄存器 ds, es, fs, edx, ecx, ebx
 // 3. 调用 sys_fork 函数时,压入的函数返回地址(用参数 none 表示)
-// 4. 在调用copy_process()之前压入栈的 gs, esi, edi, ebp 和 eax(nr) 值
+// 4. 在调用copy_process()之前压入栈的 gs, esi, edi, ebp, ebx(clone_flags) 和 eax(nr) 值
 //    其中 nr 是调用find_empty_process() 分配的任务数组项号
-int copy_process(int nr,long ebp,long edi,long esi,long gs,long none,
+// clone_flags 为 0 时是普通的 fork;
+// CLONE_VFORK: 子进程直接使用父进程的 LDT 基址，不复制页表，父进程睡眠到子进程退出;
+// CLONE_SPAWN: 子进程从 ebx 指定的入口开始执行，参数为 ecx，使用新的用户栈。
+int copy_process(int nr,long clone_flags,long ebp,long edi,long esi,long gs,long none,
 		long ebx,long ecx,long edx,
 		long fs,long es,long ds,
 		long eip,long cs,long eflags,long esp,long ss)
@@ -137,15 +227,28 @@ int copy_process(int nr,long ebp,long edi,long esi,long gs,long none,
 	p->counter = p->priority;				// 运行时间片值
 	p->signal = 0;							// 信号位图置0, 4个字节32位
 	p->alarm = 0;							// 报警定时值(滴答数)
+	init_timer(&p->alarm_timer);			// 复制来的可能是父进程挂入的定时器
 	p->leader = 0;		/* process leadership doesn't inherit */
 	p->utime = p->stime = 0;				// 用户态和核心态运行时间
 	p->cutime = p->cstime = 0;				// 子进程用户态和和核心态运行时间
 	p->start_time = jiffies;				// 进程开始运行时间(当前时间滴答数）
+	p->flags = 0;
+	p->vfork_wait = NULL;
+	p->min_flt = p->maj_flt = 0;
+	p->cmin_flt = p->cmaj_flt = 0;
+	p->nr = nr;
+	p->on_rq = 0;							// 复制来的是父进程的就绪队列状态，nice、调度策略和调度类继承父进程
+	p->sum_exec_runtime = p->prev_sum_exec_runtime = 0;
+	p->run_next = p->run_prev = NULL;
+	p->preempt_count = 0;
+	p->need_resched = 0;
+	p->lock_depth = 1;						// 第一次运行时从 schedule() 得到大内核锁，在 restore_all 释放
+	memset(&p->sched_info, 0, sizeof(p->sched_info));	// 调度统计从零开始
  	// 再修改任务状态段TSS数据，由于系统给任务结构p分配了1页新内存，所以(PAGE_SIZE+
     // (long)p)让esp0正好指向该页顶端。ss0:esp0用作程序在内核态执行时的栈。另外，
     // 每个任务在GDT表中都有两个段描述符，一个是任务的TSS段描述符，另一个是任务的LDT
     // 表描述符。下面语句就是把GDT中本任务LDT段描述符和选择符保存在本任务的TSS段中。
-    // 当CPU执行切换任务时，会自动从TSS中把LDT段描述符的选择符加载到ldtr寄存器中。
+    // 任务切换时由 __switch_to() 把TSS中LDT段描述符的选择符加载到ldtr寄存器中。
 	p->tss.back_link = 0;
 	p->tss.esp0 = PAGE_SIZE + (long) p;		// esp0 指向页顶端, ss0:esp0 用作程序在内核态执行时的栈
 	p->tss.ss0 = 0x10;						// 内核态栈的段选择符(与内核数据段相同)
@@ -179,7 +282,17 @@ int copy_process(int nr,long ebp,long edi,long esi,long gs,long none,
 	// 复制进程页表
 	// 即在线性地址空间中设置新任务代码段和数据段描述符中的基址和限长，并复制页表。
     // 如果出错(返回值不是0)，则复位任务数组中相应项并释放为该新任务分配的用于任务结构的内存页。
-	if (copy_mem(nr,p)) {
+	// vfork 的子进程与父进程使用相同的 LDT 和页目录(tss.cr3，已由上面的结构复制得到)，不需要复制页表
+	if (clone_flags & CLONE_VFORK) {
+		p->flags |= PF_VFORK;
+	} else if (clone_flags & CLONE_SPAWN) {
+		if (!(p->tss.esp = (long)spawn_mem(p, (unsigned long)ecx))) {
+			task[nr] = NULL;
+			free_page((unsigned long) p);
+			return -1;
+		}
+		p->tss.eip = ebx;
+	} else if (copy_mem(p)) {
 		task[nr] = NULL;
 		free_page((unsigned long) p);
 		return -1;
@@ -191,6 +304,13 @@ int copy_process(int nr,long ebp,long edi,long esi,long gs,long none,
 	for (i = 0; i<NR_OPEN; i++)
 		if ((f = p->filp[i]))
 			f->f_count++;
+	// 子进程继承父进程的映射区(页表中的映射已经复制)，同样引用映射的文件和共享内存段
+	for (i = 0; i < NR_MMAP; i++) {
+		if (p->mmap[i].vm_inode)
+			p->mmap[i].vm_inode->i_count++;
+		if (p->mmap[i].vm_flags & VM_SHM)
+			shm_open(&p->mmap[i]);
+	}
 	if (current->pwd)
 		current->pwd->i_count++;
 	if (current->root)
@@ -204,11 +324,19 @@ int copy_process(int nr,long ebp,long edi,long esi,long gs,long none,
     // set_tss_desc() 和 set_ldt_desc() 在 system.h 中定义。"gdt+(nr<<1)+FIRST_TSS_ENTRY"是
     // 任务 nr 的TSS描述符项在全局表中的地址。因为每个任务占用GDT表中2项，
     // 因此上式中要包括'(nr<<1)'.程序然后把新进程设置成就绪态。
-    // 另外在任务切换时，任务寄存器 tr 由 CPU 自动加载。最后返回新进程号。
-	set_tss_desc(gdt+(nr<<1)+FIRST_TSS_ENTRY,&(p->tss));
+    // 现在任务切换由软件完成，只设置 LDT 描述符，并在子进程内核栈上构造切换现场。最后返回新进程号。
 	set_ldt_desc(gdt+(nr<<1)+FIRST_LDT_ENTRY,&(p->ldt));
-	p->state = TASK_RUNNING;	/* do this last, just in case */   // 就绪状态，可以被OS调度
-	return last_pid; 	// 父进程返回儿子的 pid
+	copy_thread(p);
+	// 复制页表时有抢占点，其间其他进程的 fork 会改变 last_pid，所以返回子进程自己的 pid
+	i = (int) p->pid;
+	wake_up_new_task(p);	/* do this last, just in case */   // 就绪状态，加入就绪队列，可以被OS调度
+	// vfork: 子进程正在使用父进程的用户栈，父进程必须等它退出后才能返回用户态。
+	// p 在子进程成为僵死进程后仍然有效，因为只有父进程(在这里睡眠)才会释放它。
+	if (clone_flags & CLONE_VFORK) {
+		while (p->flags & PF_VFORK)
+			sleep_on(&p->vfork_wait);
+	}
+	return i; 	// 父进程返回儿子的 pid
 
 	// 进程1创建完成，这使得进程1已经具备进程0的全部能力，它可以在主机中正常运行了。接下来进程0要切换到进程1。
 }
@@ -221,7 +349,7 @@ int find_empty_process(void) {
 	// 首先获取新的进程号。如果last_pid增1后超出进程号的整数表示范围，
     // 则重新从1开始使用pid号。然后在任务数组中搜索刚设置的pid号是否已经被任何任务使用。
     // 如果是则跳转到函数开始出重新获得一个pid号。接着在任务数组中为新任务寻找一个空闲项，
-    // 并返回项号。last_pid是一个全局变量，不用返回。如果此时任务数组中64个项已经被全部
+    // 并返回项号。last_pid是一个全局变量，不用返回。如果此时任务数组中 NR_TASKS 个项已经被全部
     // 占用，则返回出错码。
 	// repeat:
 	// 	if ((++last_pid)<0) last_pid=1;			// 超出正数范围
@@ -232,6 +360,10 @@ int find_empty_process(void) {
 	// 		return i;
 	// return -1;
 
+	// 新进程马上需要任务结构和页表页面，空闲页面不足时先回收。
+	// 回收可能睡眠，所以要在选定任务号和进程号之前进行
+	check_free_pages();
+
 	long tmp = last_pid;    // 记录最初起始进程号，用于标记循环结束
 
     while(1) {
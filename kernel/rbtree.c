@@ -0,0 +1,247 @@
+/*
+ *  红黑树
+ *
+ *  每个节点是红色或黑色; 根是黑色; 红色节点的子节点都是黑色; 从任一节点到其下所有空位置的路径上
+ *  黑色节点数相同。因此最长路径不超过最短路径的两倍，树高为 O(log n)。
+ *  插入的节点是红色，可能违反"红色节点的子节点是黑色": 叔节点是红色时把颜色上推，否则旋转一到两次。
+ *  删除黑色节点会使一条路径少一个黑色节点，由 __rb_erase_color() 通过重新着色和最多三次旋转补上。
+ *  算法与 Linux 的 lib/rbtree.c 相同。
+ */
+
+#include <linux/rbtree.h>
+
+#define rb_is_red(r)    ((r)->rb_color == RB_RED)
+#define rb_is_black(r)  ((r)->rb_color == RB_BLACK)
+
+// 左旋: node 的右子节点 right 取代 node 的位置，node 成为 right 的左子节点
+static void __rb_rotate_left(struct rb_node *node, struct rb_root *root) {
+    struct rb_node *right = node->rb_right;
+    struct rb_node *parent = node->rb_parent;
+
+    if ((node->rb_right = right->rb_left))
+        right->rb_left->rb_parent = node;
+    right->rb_left = node;
+    right->rb_parent = parent;
+    if (parent) {
+        if (node == parent->rb_left)
+            parent->rb_left = right;
+        else
+            parent->rb_right = right;
+    } else {
+        root->rb_node = right;
+    }
+    node->rb_parent = right;
+}
+
+// 右旋: 与左旋对称
+static void __rb_rotate_right(struct rb_node *node, struct rb_root *root) {
+    struct rb_node *left = node->rb_left;
+    struct rb_node *parent = node->rb_parent;
+
+    if ((node->rb_left = left->rb_right))
+        left->rb_right->rb_parent = node;
+    left->rb_right = node;
+    left->rb_parent = parent;
+    if (parent) {
+        if (node == parent->rb_right)
+            parent->rb_right = left;
+        else
+            parent->rb_left = left;
+    } else {
+        root->rb_node = left;
+    }
+    node->rb_parent = left;
+}
+
+void rb_insert_color(struct rb_node *node, struct rb_root *root) {
+    struct rb_node *parent, *gparent, *uncle, *tmp;
+
+    while ((parent = node->rb_parent) && rb_is_red(parent)) {
+        gparent = parent->rb_parent;            // 父节点是红色，一定不是根
+        if (parent == gparent->rb_left) {
+            uncle = gparent->rb_right;
+            if (uncle && rb_is_red(uncle)) {    // 叔节点红色: 父、叔变黑，祖父变红，从祖父继续
+                uncle->rb_color = RB_BLACK;
+                parent->rb_color = RB_BLACK;
+                gparent->rb_color = RB_RED;
+                node = gparent;
+                continue;
+            }
+            if (parent->rb_right == node) {     // 先转成 node 是左子节点的情况
+                __rb_rotate_left(parent, root);
+                tmp = parent;
+                parent = node;
+                node = tmp;
+            }
+            parent->rb_color = RB_BLACK;
+            gparent->rb_color = RB_RED;
+            __rb_rotate_right(gparent, root);
+        } else {
+            uncle = gparent->rb_left;
+            if (uncle && rb_is_red(uncle)) {
+                uncle->rb_color = RB_BLACK;
+                parent->rb_color = RB_BLACK;
+                gparent->rb_color = RB_RED;
+                node = gparent;
+                continue;
+            }
+            if (parent->rb_left == node) {
+                __rb_rotate_right(parent, root);
+                tmp = parent;
+                parent = node;
+                node = tmp;
+            }
+            parent->rb_color = RB_BLACK;
+            gparent->rb_color = RB_RED;
+            __rb_rotate_left(gparent, root);
+        }
+    }
+    root->rb_node->rb_color = RB_BLACK;
+}
+
+// 删除黑色节点后，经过 node(可能为空，父节点是 parent)的路径少了一个黑色节点，重新平衡
+static void __rb_erase_color(struct rb_node *node, struct rb_node *parent, struct rb_root *root) {
+    struct rb_node *other;
+
+    while ((!node || rb_is_black(node)) && node != root->rb_node) {
+        if (parent->rb_left == node) {
+            other = parent->rb_right;
+            if (rb_is_red(other)) {
+                other->rb_color = RB_BLACK;
+                parent->rb_color = RB_RED;
+                __rb_rotate_left(parent, root);
+                other = parent->rb_right;
+            }
+            if ((!other->rb_left || rb_is_black(other->rb_left)) &&
+                    (!other->rb_right || rb_is_black(other->rb_right))) {
+                other->rb_color = RB_RED;
+                node = parent;
+                parent = node->rb_parent;
+            } else {
+                if (!other->rb_right || rb_is_black(other->rb_right)) {
+                    other->rb_left->rb_color = RB_BLACK;
+                    other->rb_color = RB_RED;
+                    __rb_rotate_right(other, root);
+                    other = parent->rb_right;
+                }
+                other->rb_color = parent->rb_color;
+                parent->rb_color = RB_BLACK;
+                other->rb_right->rb_color = RB_BLACK;
+                __rb_rotate_left(parent, root);
+                node = root->rb_node;
+                break;
+            }
+        } else {
+            other = parent->rb_left;
+            if (rb_is_red(other)) {
+                other->rb_color = RB_BLACK;
+                parent->rb_color = RB_RED;
+                __rb_rotate_right(parent, root);
+                other = parent->rb_left;
+            }
+            if ((!other->rb_left || rb_is_black(other->rb_left)) &&
+                    (!other->rb_right || rb_is_black(other->rb_right))) {
+                other->rb_color = RB_RED;
+                node = parent;
+                parent = node->rb_parent;
+            } else {
+                if (!other->rb_left || rb_is_black(other->rb_left)) {
+                    other->rb_right->rb_color = RB_BLACK;
+                    other->rb_color = RB_RED;
+                    __rb_rotate_left(other, root);
+                    other = parent->rb_left;
+                }
+                other->rb_color = parent->rb_color;
+                parent->rb_color = RB_BLACK;
+                other->rb_left->rb_color = RB_BLACK;
+                __rb_rotate_right(parent, root);
+                node = root->rb_node;
+                break;
+            }
+        }
+    }
+    if (node)
+        node->rb_color = RB_BLACK;
+}
+
+void rb_erase(struct rb_node *node, struct rb_root *root) {
+    struct rb_node *child, *parent, *old, *left;
+    int color;
+
+    if (!node->rb_left) {
+        child = node->rb_right;
+    } else if (!node->rb_right) {
+        child = node->rb_left;
+    } else {
+        // 有两个子节点: 用右子树中最小的节点(后继)取代 node 的位置，实际删除的是后继原来的位置
+        old = node;
+        node = node->rb_right;
+        while ((left = node->rb_left))
+            node = left;
+        if (old->rb_parent) {
+            if (old->rb_parent->rb_left == old)
+                old->rb_parent->rb_left = node;
+            else
+                old->rb_parent->rb_right = node;
+        } else {
+            root->rb_node = node;
+        }
+        child = node->rb_right;
+        parent = node->rb_parent;
+        color = node->rb_color;
+        if (parent == old) {
+            parent = node;
+        } else {
+            if (child)
+                child->rb_parent = parent;
+            parent->rb_left = child;
+            node->rb_right = old->rb_right;
+            old->rb_right->rb_parent = node;
+        }
+        node->rb_parent = old->rb_parent;
+        node->rb_color = old->rb_color;
+        node->rb_left = old->rb_left;
+        old->rb_left->rb_parent = node;
+        goto fixup;
+    }
+    parent = node->rb_parent;
+    color = node->rb_color;
+    if (child)
+        child->rb_parent = parent;
+    if (parent) {
+        if (parent->rb_left == node)
+            parent->rb_left = child;
+        else
+            parent->rb_right = child;
+    } else {
+        root->rb_node = child;
+    }
+fixup:
+    if (color == RB_BLACK)
+        __rb_erase_color(child, parent, root);
+}
+
+struct rb_node *rb_first(struct rb_root *root) {
+    struct rb_node *n = root->rb_node;
+
+    if (!n)
+        return NULL;
+    while (n->rb_left)
+        n = n->rb_left;
+    return n;
+}
+
+struct rb_node *rb_next(struct rb_node *node) {
+    struct rb_node *parent;
+
+    if (node->rb_right) {                       // 右子树中最左的节点
+        node = node->rb_right;
+        while (node->rb_left)
+            node = node->rb_left;
+        return node;
+    }
+    // 否则向上找到第一个从左子树上来的祖先
+    while ((parent = node->rb_parent) && node == parent->rb_right)
+        node = parent;
+    return parent;
+}
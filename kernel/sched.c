@@ -1,12 +1,15 @@
 /*
  * 内核进程调度管理
  */
+#include <errno.h>
 #include <linux/sched.h>
 #include <linux/kernel.h>
 #include <linux/mm.h>
 #include <linux/sys.h>
 #include <asm/system.h>
 #include <asm/io.h>
+#include <asm/segment.h>
+#include <asm/div64.h>
 #include <serial_debug.h>
 
 // #define DEBUG
@@ -23,17 +26,18 @@ extern int system_call(void);
 // 定义任务联合体
 // 每个任务(进程)在内核态运行时都有自己的内核态堆栈。这里定义了任务的内核态堆栈结构
 // 因为一个任务的数据结构与其内核态堆栈在同一内存页中，所以从堆栈段寄存器ss可以获得其数据段选择符
+// 当前任务由 esp 所在的页得到(get_current())，所以 init_task 和 user_stack 都要按页对齐
 union task_union {
     struct task_struct task;
     char stack[PAGE_SIZE];
 };
-static union task_union init_task = {INIT_TASK,};   // 定义初始任务的数据 sched.h
+static union task_union init_task __attribute__((aligned(PAGE_SIZE))) = {INIT_TASK,};  // 定义初始任务的数据 sched.h
 
-long user_stack[PAGE_SIZE >> 2];
+long user_stack[PAGE_SIZE >> 2] __attribute__((aligned(PAGE_SIZE)));
 long startup_time = 0;                                      // 开机时间，从1970开始计时的秒数
-struct task_struct *current = &(init_task.task);            // 当前任务指针（初始化指针任务0）
 struct task_struct *last_task_used_math = NULL;             // 处理过协处理任务的指针
 struct task_struct *task[NR_TASKS] = {&(init_task.task),};  // 定义任务指针数组
+struct tss_struct init_tss[NR_CPUS];                        // 每个 CPU 一个任务状态段，只用到 ss0:esp0
 
 // PC机8253定时芯片的输入时钟频率约为1.193180MHz. Linux内核希望定时器发出中断的频率是
 // 100Hz，也即没10ms发出一次时钟中断。因此这里的LATCH是设置8253芯片的初值。
@@ -52,88 +56,387 @@ struct {
     short b;
 } stack_start = {&user_stack[PAGE_SIZE >> 2], 0x10};
 
-// 首先把当前任务置为不可中断的等待状态(只能由wake_up函数来唤醒)，并让睡眠队列头指针指向当前任务，执行调度函数，直到明确的唤醒时才会返回，该任务重新开始执行。
-// 因为如果没有被唤醒(即state置0)是不可能被调度的，调度算法只会选出”状态为0”的进程进行调度运行
-// 该函数提供了进程与中断处理程序之间的同步机制
-// p: 等待任务队列头指针
-void sleep_on(struct task_struct **p) {
-    struct task_struct *tmp;
-    if (!p)                                     // 若指针无效，则退出。（指针所指对象可以是NULL， 但是指针本身不应该是0)
+/*
+ * 就绪队列和调度类
+ *
+ * 原来的 schedule() 每次都扫描整个任务数组两遍: 一遍检查报警和信号，一遍找 counter 最大的就绪任务，
+ * 所有就绪任务的 counter 都用完时还要重新计算每个任务的 counter，开销随 NR_TASKS 线性增长。
+ *
+ * 现在就绪任务由所属的调度类(struct sched_class，见 sched.h)管理，核心部分只负责:
+ *  - enqueue_task()/dequeue_task(): 加入/移出所属类的就绪队列，维护 on_rq 和 nr_running;
+ *  - schedule(): 仍然就绪的当前任务交还给它的类(put_prev_task)，再从优先级最高的类开始选出下一个任务;
+ *  - 唤醒时判断是否抢占当前任务，时钟中断时调用当前任务所属类的 task_tick。
+ * 类按优先级排列: 实时调度类(kernel/sched_rt.c)的 SCHED_FIFO/SCHED_RR 任务按静态优先级运行，
+ * 总是先于普通任务; 普通任务属于公平调度类(kernel/sched_fair.c)，按虚拟运行时间和 nice 值分配 CPU。
+ *
+ * 正在运行的任务的 on_rq 仍然为 1。任务睡眠时只需设置 state 再调用 schedule()，由 schedule() 把它移出队列;
+ * 唤醒任务要调用 wake_up_process() 放回队列，不能只设置 state。任务 0 是空闲任务，不在就绪队列中，
+ * 没有其他就绪任务时运行。队列会在中断处理程序中被修改(唤醒)，操作队列时要关中断。
+ *
+ * 抢占: 唤醒了更高优先级的任务或时间片用完时置 need_resched，在以下地方检查:
+ *  - 系统调用、时钟中断和其他硬件中断返回用户态之前(system_call.s);
+ *  - 内核中的抢占点 cond_resched()，放在可能运行很久的循环中(同步缓冲区、释放页表、回收页面等)。
+ * 内核代码不在任意位置被抢占: 从 Linux 0.11 继承来的代码靠"内核态不被抢占"保证任务之间的互斥
+ * (例如扫描缓冲区、i 节点表和修改页表时都没有加锁)，只有在循环中已知一致的位置才能让出 CPU。
+ * 因此繁重的内核工作中被唤醒的任务最多等待两个抢占点之间的一段时间。
+ * preempt_count 不为 0(preempt_disable())或关中断时抢占点不调度。
+ *
+ * 多处理器: 每个 CPU 有自己的运行队列(struct rq)和各类的就绪队列，任务在 p->processor 的队列中，
+ * schedule() 只从本 CPU 的队列中选择。唤醒时优先放到空闲的 CPU 上(select_task_rq())，
+ * fork 出的任务放到就绪任务最少的 CPU 上; 本 CPU 空闲时从最忙的 CPU 拉一个任务过来(load_balance())，
+ * 忙的 CPU 也每 BALANCE_INTERVAL 个滴答检查一次负载是否失衡。need_resched 是每个任务的标志，
+ * 要调度的任务在其他 CPU 上运行时由 resched_task() 发送处理器间中断。
+ * 所有调度数据由大内核锁保护(kernel/smp.c)，关中断只是防止本 CPU 的中断处理程序重入。
+ */
+int nr_running = 0;                             // 所有 CPU 的就绪队列中的任务数
+struct rq runqueues[NR_CPUS] = {{0, &init_task.task, &init_task.task, 0, 0},};
+unsigned long long sched_clock_per_tick = 1000000 / HZ;
+
+// 调度用的时钟: 时间戳计数器的值; 没有 TSC 时用 jiffies 换算成微秒，只有滴答的精度
+unsigned long long sched_clock(void) {
+    unsigned long long t;
+
+    if (!tsc_khz)
+        return (unsigned long long) jiffies * (1000000 / HZ);
+    rdtscll(t);
+    return t;
+}
+
+static void enqueue_task(struct task_struct *p, int wakeup) {
+    p->sched_class->enqueue_task(p, wakeup);
+    p->on_rq = 1;
+    cpu_rq(p->processor)->nr_running++;
+    nr_running++;
+}
+
+static void dequeue_task(struct task_struct *p) {
+    p->sched_class->dequeue_task(p);
+    p->on_rq = 0;
+    cpu_rq(p->processor)->nr_running--;
+    nr_running--;
+}
+
+// 请求任务 p 重新调度。p 正在其他 CPU 上运行时发送处理器间中断，让那个 CPU 尽快检查 need_resched
+// (它可能在空闲中 hlt，或者在用户态运行，要等到下一个滴答才进入内核)
+void resched_task(struct task_struct *p) {
+    int cpu = p->processor;
+
+    if (p->need_resched)
         return;
-    if (current == &(init_task.task))           // 当前任务是0，则死机
-        panic("task[0] trying to sleep");
-    tmp = *p;                                   // 让tmp指向已经在等待队列的任务(如果有的话)
-    *p = current;                               // 把当前任务插入到 *p 的等待队列中
-    current->state = TASK_UNINTERRUPTIBLE;      // 将当前任务置为不可中断的等待状态
-    schedule();                                 // 执行重新调度
-    *p = tmp;                                   // 只有当这个等待任务被唤醒时，调度程序才返回到这里，表示本进程已被明确唤醒（就绪态）
-    if (tmp)                                    // 肯能存在多个任务此时被唤醒，那么如果还存在等待任务，则将状态设置为”就绪
-        tmp->state = TASK_RUNNING;
+    p->need_resched = 1;
+    if (cpu != smp_processor_id() && p == cpu_rq(cpu)->curr)
+        smp_send_reschedule(cpu);
 }
 
-void schedule(void) {
-    int i, next, c;
-    struct task_struct **p;         // 任务结构指针的指针
-
-    // 进入schedule函数后，先对所有进程进行第-次遍历信号检测，
-    // 如果发现哪个进程接收到了指定的信号，而且该进程还是可中断等待状态，那么就将该进程设置为就绪状态。
-    // 如果进程处于不可中断等待状态，即使它收到了信号，状态也不会改变。
-    // 从任务数组中最后一个任务开始循环检测 alarm。在循环时跳过空指针项。
-    for(p = &LAST_TASK; p > &FIRST_TASK; --p) {
-        if (*p) {
-            // 如果设置过任务的定时值alarm，并且已经过期(alarm<jiffies)，则在
-            // 信号位图中置SIGALRM信号，即向任务发送SIGALARM信号。然后清alarm。
-            // 该信号的默认操作是终止进程。jiffies是系统从开机开始算起的滴答数(10ms/滴答)。
-            if ((*p)->alarm && (*p)->alarm < jiffies) {
-                (*p)->signal |= (1 << (SIGALRM-1));
-#ifdef DEBUG
-                s_printk("process get SIGALRM pid: %d signal: 0x%x mask: 0x%x blockable= 0x%x\n", \
-                       (*p)->pid, (*p)->signal, (*p)->blocked, _BLOCKABLE);
-#endif
-                (*p)->alarm = 0;
-            }
-            // 如果信号位图中除被阻塞的信号外还有其他信号，并且任务处于可中断状态，
-            // 则置任务为就绪状态。其中'~(_BLOCKABLE & (*p)->blocked)'用于忽略被阻塞的信号，
-            // 但 SIGKILL 和 SIGSTOP 不能被阻塞。
-            if(((unsigned long)((*p)->signal) & (unsigned long)(((unsigned long)(_BLOCKABLE) & (~(*p)->blocked))))  \
-                        && (unsigned long)((*p)->state) \
-                        == TASK_INTERRUPTIBLE) {
-                (*p)->state = TASK_RUNNING;
-            }
+// 任务 p 进入 CPU p->processor 的就绪队列后，判断是否抢占那里的当前任务: 当前是空闲任务，
+// 或者 p 属于优先级更高的类时抢占，同一类时由该类决定
+static void check_preempt_curr(struct task_struct *p) {
+    struct task_struct *curr = cpu_rq(p->processor)->curr;
+    const struct sched_class *class;
+
+    if (is_idle_task(curr)) {
+        resched_task(curr);
+        return;
+    }
+    if (p->sched_class == curr->sched_class) {
+        p->sched_class->check_preempt_curr(p);
+        return;
+    }
+    for (class = sched_class_highest; class; class = class->next) {
+        if (class == curr->sched_class)
+            return;
+        if (class == p->sched_class) {
+            resched_task(curr);
+            return;
         }
     }
+}
+
+// 把不在就绪队列中、也不在运行的任务 p 移到 CPU cpu，由所属的类调整与队列有关的状态
+static void set_task_cpu(struct task_struct *p, int cpu) {
+    if (p->processor == cpu)
+        return;
+    p->sched_class->migrate_task(p, cpu);
+    p->processor = cpu;
+}
+
+#define cpu_online(cpu) (cpu_online_map & (1ul << (cpu)))
 
-    // 从后往前遍历任务，找到就绪任务剩余执行时间counter最大的任务，切换并运行
-    while (1) {
-        c = -1;
-        next = 0;
-        i = NR_TASKS;
-        p = &task[NR_TASKS];
-        // 这段代码也是从任务数组的最后一个任务开始循环处理，并跳过不含任务的数组槽。
-        // 比较每个就绪状态任务的counter (任务运行时间的递减滴答计数)值，哪一个值大，说明运行时间还不长，
-        // next就指向哪个的任务号。
-        while (--i) {               // 跳过任务 0
-            if (!*(--p))            // 跳过不含任务的数组槽
-                continue;
-            if ((*p)->state == TASK_RUNNING && (*p)->counter > c) {  // 找出任务运行时间的递减滴答计数最大的，运行时间不长
-                c = (*p)->counter;
-                next = i;
-            }
+// 为被唤醒的任务 p 选择 CPU: 原来的 CPU 空闲时留在那里(缓存中可能还有它的数据)，
+// 否则找一个空闲的 CPU，都不空闲时仍用原来的 CPU
+static int select_task_rq(struct task_struct *p) {
+    int cpu, prev = p->processor;
+
+    if (!cpu_rq(prev)->nr_running)
+        return prev;
+    for (cpu = 0; cpu < NR_CPUS; cpu++)
+        if (cpu_online(cpu) && !cpu_rq(cpu)->nr_running)
+            return cpu;
+    return prev;
+}
+
+// fork 出的新任务放到就绪任务最少的 CPU 上
+static int select_task_rq_fork(void) {
+    int cpu, best = smp_processor_id();
+
+    for (cpu = 0; cpu < NR_CPUS; cpu++)
+        if (cpu_online(cpu) && cpu_rq(cpu)->nr_running < cpu_rq(best)->nr_running)
+            best = cpu;
+    return best;
+}
+
+/*
+ * 负载均衡(工作窃取)
+ *
+ * 由需要任务的一方发起: CPU 空闲时在 schedule() 中、忙时在时钟中断中每 BALANCE_INTERVAL 个滴答一次，
+ * 找出就绪任务最多的 CPU，从它的公平调度类队列中拉一个正在等待的任务到本 CPU。
+ * 空闲时只要对方有两个以上就绪任务就拉; 不空闲时要相差两个以上，否则任务会在两个 CPU 之间来回迁移。
+ * 实时任务只在唤醒和 fork 时选择 CPU，不在这里迁移。返回拉过来的任务，没有时返回 NULL
+ */
+#define BALANCE_INTERVAL (HZ / 10)
+
+static struct task_struct *load_balance(int this_cpu, int idle) {
+    struct task_struct *p;
+    int cpu, busiest = -1, max = 1;
+
+    for (cpu = 0; cpu < NR_CPUS; cpu++) {
+        if (cpu == this_cpu || !cpu_online(cpu))
+            continue;
+        if (cpu_rq(cpu)->nr_running > max) {
+            max = cpu_rq(cpu)->nr_running;
+            busiest = cpu;
         }
-        // 如果有任务 counter > 0 或者没有可运行的任务，此时 c 仍然等于-1，next = 0，则退出
-        // 否则根据每个任务的优先值，更新每个任务的 counter 值，然后重新比较,
-        // counter 值的计算方式为 counter = counter/2 + priority，注意这里计算不考虑进程的状态
-        if (c) break;               // 注意: if(-1) 返回 true
-        for(p = &LAST_TASK; p > &FIRST_TASK; p--) {    // 跳过任务 0
-            if (*p) {
-                (*p)->counter = ((*p)->counter >> 1) + (*p)->priority;
-            }
+    }
+    if (busiest < 0 || (!idle && max - cpu_rq(this_cpu)->nr_running < 2))
+        return NULL;
+    if (!(p = pick_migrate_task_fair(busiest)))
+        return NULL;
+    dequeue_task(p);
+    set_task_cpu(p, this_cpu);
+    enqueue_task(p, 0);
+    cpu_rq(this_cpu)->nr_migrations++;
+    return p;
+}
+
+/*
+ * 调度统计(schedstats)
+ *
+ * utime/stime 只是时钟中断时按滴答采样。这里在每次任务切换和唤醒时读时间戳计数器，
+ * 累计每个任务的运行时间、在就绪队列中等待的时间和睡眠时间，统计主动/被动切换次数，
+ * 并把从唤醒到开始运行的延迟按 2 的幂(微秒)记入直方图。同时累计到整个系统的 sched_total。
+ * 没有 TSC 时(tsc_khz 为 0)不统计。结果由 schedstat() 系统调用取得(kernel/schedstat.c)。
+ */
+unsigned long tsc_khz = 0;                      // 时间戳计数器的频率，sched_init() 中用 8253 通道 2 测定
+static unsigned long tsc_mhz = 1;
+struct schedstat sched_total;                   // 整个系统的累计值，包括已经退出的任务
+
+// 延迟 cycles 在直方图中的项: 第 0 项 < 1us，第 i 项 [2^(i-1), 2^i) us
+static unsigned long sched_hist_index(unsigned long long cycles) {
+    unsigned long us, i;
+
+    if ((unsigned long) (cycles >> 32) >= tsc_mhz)      // 商超过 32 位
+        return SCHED_HIST_SIZE - 1;
+    us = div64_32(cycles, tsc_mhz);
+    for (i = 0; us && i < SCHED_HIST_SIZE - 1; i++)
+        us >>= 1;
+    return i;
+}
+
+// 任务 p 被唤醒，放回就绪队列时调用(已关中断)
+static void sched_info_wakeup(struct task_struct *p) {
+    struct sched_info *si = &p->sched_info;
+    unsigned long long now, delta;
+
+    if (!tsc_khz)
+        return;
+    rdtscll(now);
+    if (si->last_sleep) {
+        delta = now - si->last_sleep;
+        si->stat.sleep_time += delta;
+        sched_total.sleep_time += delta;
+    }
+    si->last_queued = now;
+    si->woken = 1;
+    si->stat.nr_wakeups++;
+    sched_total.nr_wakeups++;
+}
+
+// schedule() 从 prev 切换到 next 之前调用(已关中断)。prev 仍在就绪队列中说明是被动切换(时间片用完或被抢占)，
+// 否则是睡眠或退出。任务 0 是空闲任务，不在就绪队列中，切换出去时不算睡眠
+static void sched_info_switch(struct task_struct *prev, struct task_struct *next) {
+    struct sched_info *si = &prev->sched_info;
+    unsigned long long now, delta;
+    unsigned long i;
+
+    if (!tsc_khz)
+        return;
+    rdtscll(now);
+    delta = now - si->last_arrival;
+    si->stat.run_time += delta;
+    sched_total.run_time += delta;
+    if (prev->on_rq) {
+        si->stat.nivcsw++;
+        sched_total.nivcsw++;
+        si->last_queued = now;
+    } else if (!is_idle_task(prev)) {
+        si->stat.nvcsw++;
+        sched_total.nvcsw++;
+        si->last_sleep = now;
+    }
+
+    si = &next->sched_info;
+    if (si->last_queued) {
+        delta = now - si->last_queued;
+        si->stat.run_delay += delta;
+        sched_total.run_delay += delta;
+        if (si->woken) {
+            i = sched_hist_index(delta);
+            si->stat.wakeup_hist[i]++;
+            sched_total.wakeup_hist[i]++;
+            si->woken = 0;
+        }
+        si->last_queued = 0;
+    }
+    si->last_arrival = now;
+    si->stat.pcount++;
+    sched_total.pcount++;
+}
+
+// 置任务 p 为就绪状态，不在就绪队列中时加入所属类的就绪队列，需要时请求重新调度(抢占当前任务)。
+// 返回 p 原来是否处于睡眠状态(wake_up() 据此判断独占等待者是否真的被唤醒)。可以在中断处理程序中调用
+int wake_up_process(struct task_struct *p) {
+    unsigned long flags;
+    int ret;
+
+    save_flags(flags);
+    cli();
+    ret = p->state != TASK_RUNNING;
+    p->state = TASK_RUNNING;
+    if (!p->on_rq) {
+        sched_info_wakeup(p);
+        // 正在其他 CPU 上运行的任务(还没有切换出去)不能迁移
+        if (smp_num_cpus > 1 && p != cpu_rq(p->processor)->curr)
+            set_task_cpu(p, select_task_rq(p));
+        enqueue_task(p, 1);
+        check_preempt_curr(p);
+    }
+    restore_flags(flags);
+    return ret;
+}
+
+// fork 出的新任务第一次加入就绪队列，先选择 CPU，再由所属的类确定它的初始位置
+void wake_up_new_task(struct task_struct *p) {
+    unsigned long flags;
+
+    save_flags(flags);
+    cli();
+    p->state = TASK_RUNNING;
+    set_task_cpu(p, select_task_rq_fork());
+    p->sched_class->task_new(p);
+    sched_info_wakeup(p);
+    enqueue_task(p, 0);
+    check_preempt_curr(p);
+    restore_flags(flags);
+}
+
+// 任务 p 的未阻塞信号，SIGKILL 和 SIGSTOP 不能被阻塞
+#define signal_pending(p) \
+    ((unsigned long) (p)->signal & (unsigned long) _BLOCKABLE & ~(p)->blocked)
+
+// 给任务 p 发送信号之后调用: 如果 p 处于可中断等待状态，并且有未阻塞的信号，则唤醒它。
+// 如果处于不可中断等待状态，即使它收到了信号，状态也不会改变。
+// 原来这一检查在每次 schedule() 时对所有任务进行
+void signal_wake_up(struct task_struct *p) {
+    if (p->state == TASK_INTERRUPTIBLE && signal_pending(p))
+        wake_up_process(p);
+}
+
+// 从本 CPU 的队列中按类的优先级选出下一个任务
+static struct task_struct *pick_next_task(void) {
+    const struct sched_class *class;
+    struct task_struct *next;
+
+    for (class = sched_class_highest; class; class = class->next)
+        if ((next = class->pick_next_task()))
+            return next;
+    return NULL;
+}
+
+void schedule(void) {
+    static int warned = 0;
+    struct task_struct *prev = current, *next;
+    int cpu = prev->processor;
+    struct rq *rq = cpu_rq(cpu);
+    unsigned long flags;
+
+    // 在 preempt_disable() 的区域内睡眠是错误的: 只报告一次，并清零计数，
+    // 否则该任务以后的抢占点都不会再调度
+    if (prev->preempt_count) {
+        if (!warned) {
+            warned = 1;
+            printk("schedule: task %d preempt_count %d\n", prev->pid, prev->preempt_count);
         }
+        prev->preempt_count = 0;
+    }
+    save_flags(flags);
+    cli();
+    prev->need_resched = 0;
+    // 当前任务不再就绪时移出就绪队列。处于可中断等待状态但已经有未阻塞的信号时不睡眠(例如 pause() 之前信号已经到达)
+    if (prev->state != TASK_RUNNING && prev->on_rq) {
+        if (prev->state == TASK_INTERRUPTIBLE && signal_pending(prev))
+            prev->state = TASK_RUNNING;
+        else
+            dequeue_task(prev);
     }
-    // s_printk("Scheduler select task %d\n", next);
-    // 若没有任务可运行时，next为0，会去执行任务0。此时任务0仅执行pause()系统调用，并又会调用本函数
-    // s_printk("[%d] Scheduler select task %d\n", jiffies, next);
-    switch_to(next);
+    // 仍然就绪的当前任务交还给所属的类，再从优先级最高的类开始选择(可能又选中 prev)
+    if (prev->on_rq)
+        prev->sched_class->put_prev_task(prev);
+    next = pick_next_task();
+    // 本 CPU 没有任务可运行时先从其他 CPU 拉一个过来
+    if (!next && smp_num_cpus > 1 && load_balance(cpu, 1))
+        next = pick_next_task();
+    // 若没有任务可运行，则去执行本 CPU 的空闲任务。任务0仅执行pause()系统调用，并又会调用本函数
+    if (!next)
+        next = rq->idle;
+    // s_printk("[%d] Scheduler select task %d\n", jiffies, next->nr);
+    // 切换回来时恢复本任务调用 schedule() 之前的中断标志。大内核锁随切换交给 next
+    if (next != prev) {
+        rq->curr = next;
+        sched_info_switch(prev, next);
+        switch_to(prev, next);
+    }
+    restore_flags(flags);
+}
+
+// 抢占点，在内核中可能运行很久的循环里调用，调用处的数据必须处于一致的状态。
+// 有更高优先级的任务等待运行时让出 CPU; 禁止抢占、关中断(临界区中)或当前任务正准备睡眠时不调度。
+// 返回是否调度过
+int cond_resched(void) {
+    unsigned long flags;
+
+    if (!current->need_resched || current->preempt_count || current->state != TASK_RUNNING)
+        return 0;
+    save_flags(flags);
+    if (!(flags & 0x200))                   // IF 为 0
+        return 0;
+    schedule();
+    return 1;
+}
+
+// 任务切换的后半部分，由 switch_to 跳转过来(不是调用)，返回到 next->thread.eip。
+// 参数用寄存器传递: eax - prev, edx - next。
+// 只需要更新本 CPU 的 TSS 中的 esp0(next 从用户态进入内核时使用的栈)，LDT 和页目录不同时才重新加载。
+// 硬件任务切换总是置位 CR0.TS，这里保持同样的行为: 切换到上次使用协处理器的任务时才清除 TS
+void __attribute__((regparm(2))) __switch_to(struct task_struct *prev, struct task_struct *next) {
+    init_tss[next->processor].esp0 = next->tss.esp0;
+    if (next->tss.cr3 != prev->tss.cr3)
+        __asm__ volatile("mov %0, %%cr3" :: "r" (next->tss.cr3) : "memory");
+    if (next->tss.ldt != prev->tss.ldt)
+        __asm__ volatile("lldt %%ax" :: "a" (next->tss.ldt));
+    if (next == last_task_used_math)
+        __asm__ volatile("clts");
+    else
+        __asm__ volatile("mov %%cr0, %%eax ; orl $8, %%eax ; mov %%eax, %%cr0" ::: "eax");
 }
 
 void show_task_info(struct task_struct *task) {
@@ -148,47 +451,133 @@ void show_task_info(struct task_struct *task) {
     // s_printk("tss.eip = 0x%x\n", current->eip);
 }
 
-// 唤醒 *p 指向的任务
-// *p 是任务等待队列的头指针
-// 由于新等待任务是插在头部的，所以唤醒的是最后进入的等待队列的任务
-void wake_up(struct task_struct **p) {
-    if (p && *p) {
-        (**p).state = TASK_RUNNING;                // 置为就绪(可运行)状态TASK_RUNNING.
-        *p = NULL;
+/*
+ * 等待队列(见 include/linux/wait.h)
+ *
+ * 队列头 *q 指向双向循环链表的第一项，非独占项在前，独占项在后。
+ * 中断处理程序会遍历队列(unlock_buffer() 等在中断中调用 wake_up())，所以修改队列时要关中断。
+ */
+
+// 把等待项 wait 挂在队列 *q 的尾部(独占)，调用时已关中断
+static inline void __add_wait_queue_tail(struct wait_queue **q, struct wait_queue *wait) {
+    struct wait_queue *head = *q;
+
+    if (!head) {
+        *q = wait->next = wait->prev = wait;
+    } else {
+        wait->next = head;
+        wait->prev = head->prev;
+        head->prev->next = wait;
+        head->prev = wait;
+    }
+}
+
+// 把等待项 wait 挂在队列 *q 的头部(非独占)，调用时已关中断。循环链表中挂在尾部再把表头指向它即可
+static inline void __add_wait_queue(struct wait_queue **q, struct wait_queue *wait) {
+    __add_wait_queue_tail(q, wait);
+    *q = wait;
+}
+
+// 把等待项 wait 从队列 *q 中摘下，调用时已关中断
+static inline void __remove_wait_queue(struct wait_queue **q, struct wait_queue *wait) {
+    if (wait->next == wait) {
+        *q = NULL;
+    } else {
+        wait->prev->next = wait->next;
+        wait->next->prev = wait->prev;
+        if (*q == wait)
+            *q = wait->next;
     }
+    wait->next = wait->prev = NULL;
+}
+
+void add_wait_queue(struct wait_queue **q, struct wait_queue *wait) {
+    unsigned long flags;
+
+    save_flags(flags);
+    cli();
+    wait->flags &= ~WQ_FLAG_EXCLUSIVE;
+    __add_wait_queue(q, wait);
+    restore_flags(flags);
+}
+
+void add_wait_queue_exclusive(struct wait_queue **q, struct wait_queue *wait) {
+    unsigned long flags;
+
+    save_flags(flags);
+    cli();
+    wait->flags |= WQ_FLAG_EXCLUSIVE;
+    __add_wait_queue_tail(q, wait);
+    restore_flags(flags);
 }
 
-// 将当前任务置为可中断的等待状态，并放入*p指定的等待队列中。
-void interruptible_sleep_on(struct task_struct **p) {
-    struct task_struct *tmp;
-    // 若指针无效，则退出。(指针所指向的对象可以是NULL，但指针本身不会为0)。
-    // 如果当前任务是任务0，则死机。
-    if (!p)
+void remove_wait_queue(struct wait_queue **q, struct wait_queue *wait) {
+    unsigned long flags;
+
+    save_flags(flags);
+    cli();
+    __remove_wait_queue(q, wait);
+    restore_flags(flags);
+}
+
+// 把当前任务置为 state 状态并挂入等待队列 *q，执行调度，直到被 wake_up() 明确唤醒(或可中断睡眠时收到信号)。
+// 等待项在当前任务的栈上，返回前摘下。从设置状态到调度一直关中断，
+// 所以调用者在关中断下检查条件再调用本函数时不会丢失唤醒。该函数提供了进程与中断处理程序之间的同步机制
+static void __sleep_on(struct wait_queue **q, long state, unsigned long exclusive) {
+    struct wait_queue wait;
+    unsigned long flags;
+
+    if (!q)                                     // 若指针无效，则退出。（指针所指对象可以是NULL， 但是指针本身不应该是0)
         return;
-    if (current == &(init_task.task))
+    if (is_idle_task(current))                  // 当前任务是空闲任务，则死机
         panic("task[0] trying to sleep");
-    // 让 tmp 指向已经在等待队列上的任务(如果有的话)，例如 inode->i_wait。
-    // 并且将睡眠队列头的等待指针指向当前任务。这样就把当前任务插入到了 *p 的等待队列中。
-    // 然后将当前任务置为可中断的等待状态，并执行重新调度。
-    tmp = *p;
-    *p = current;
-repeat: current->state = TASK_INTERRUPTIBLE;
+    wait.task = current;
+    wait.flags = exclusive;
+    save_flags(flags);
+    cli();
+    current->state = state;
+    if (exclusive)
+        __add_wait_queue_tail(q, &wait);
+    else
+        __add_wait_queue(q, &wait);
     schedule();
-    // 只有当这个等待任务被唤醒时，程序才又会回到这里，标志进程已被明确的唤醒执行。
-    // 如果等待队列中还有等待任务，并且队列头指针所指向的任务不是当前任务时，
-    // 则将该等待任务置为可运行的就绪状态，并重新执行调度程序。
-    // 当指针 *p 所指向的不是当前任务时，表示在当前任务被被放入队列后，又有新的任务被插入等待队列前部。因此我们先唤醒他们，而让自己仍然等等。
-    // 等待这些后续进入队列的任务被唤醒执行时来唤醒本任务。于是去执行重新调度。
-    if (*p && *p != current) {
-        (**p).state = TASK_RUNNING;
-        goto repeat;
-    }
-    // 下一句代码有误：应该是 *p = tmp, 让队列头指针指向其余等待任务，否则在当前任务之前插入
-    // 等待队列的任务均被抹掉了。当然同时也需要删除下面行数中同样的语句
-    *p = tmp;
-    if (tmp) {
-        tmp->state = TASK_RUNNING;
-    }
+    __remove_wait_queue(q, &wait);
+    restore_flags(flags);
+}
+
+// 不可中断的等待睡眠，只能由 wake_up() 唤醒
+void sleep_on(struct wait_queue **q) {
+    __sleep_on(q, TASK_UNINTERRUPTIBLE, 0);
+}
+
+// 不可中断的独占等待睡眠，wake_up() 每次只唤醒一个独占等待者
+void sleep_on_exclusive(struct wait_queue **q) {
+    __sleep_on(q, TASK_UNINTERRUPTIBLE, WQ_FLAG_EXCLUSIVE);
+}
+
+// 可中断的等待睡眠，收到未阻塞的信号时也会返回
+void interruptible_sleep_on(struct wait_queue **q) {
+    __sleep_on(q, TASK_INTERRUPTIBLE, 0);
+}
+
+// 唤醒等待队列 *q 中的所有非独占等待者，以及第一个仍在睡眠的独占等待者。
+// 已被唤醒但还没运行到摘下等待项的独占等待者不计在内，否则这次唤醒会落空。
+// 可以在中断处理程序中调用
+void wake_up(struct wait_queue **q) {
+    struct wait_queue *wait, *head;
+    unsigned long flags;
+
+    if (!q || !*q)
+        return;
+    save_flags(flags);
+    cli();
+    wait = head = *q;
+    do {
+        if (wake_up_process(wait->task) && (wait->flags & WQ_FLAG_EXCLUSIVE))
+            break;
+        wait = wait->next;
+    } while (wait != head);
+    restore_flags(flags);
 }
 
 // pause() 系统调用，转换当前任务状态为可中断的等待状态，并重新调度
@@ -200,7 +589,13 @@ repeat: current->state = TASK_INTERRUPTIBLE;
 // 使之仍然具备运行的能力。这种意义，适用于Linux0.11中的全部进程。
 // 不可中断等待状态: 只有内核代码中明确表示将该进程设置为就绪状态，它才能被唤醒。
 // 除此之外，没有任何办法将其唤醒。
+// 任务 0 是空闲任务，不睡眠: 没有就绪任务时在 cpu_idle() 中 hlt，然后重新调度
 int sys_pause(void) {
+    if (is_idle_task(current)) {
+        cpu_idle();
+        schedule();
+        return 0;
+    }
     current->state = TASK_INTERRUPTIBLE;
     schedule();
     return 0;
@@ -212,47 +607,318 @@ int sys_pause(void) {
 // 它是系统开机起到设置定时操作时系统滴答值jiffies和转换成滴答单位的定时值之和，即'jiffies + HZ*定时秒值'。
 // 而参数给出的是以秒为单位的定时值，因此本函数的主要操作是进行两种单位的转换。
 // 其中常数 HZ = 100，是内核系统运行频率。seconds是新的定时时间值，单位：秒。
+// 报警定时器 alarm_timer 到期时调用，向任务发送SIGALARM信号。该信号的默认操作是终止进程。
+static void alarm_timeout(unsigned long data) {
+    struct task_struct *p = (struct task_struct *) data;
+
+    p->signal |= (1 << (SIGALRM-1));
+#ifdef DEBUG
+    s_printk("process get SIGALRM pid: %d signal: 0x%x mask: 0x%x blockable= 0x%x\n", \
+           p->pid, p->signal, p->blocked, _BLOCKABLE);
+#endif
+    p->alarm = 0;
+    signal_wake_up(p);
+}
+
 int sys_alarm(long seconds) {
     int old = current->alarm;
     if (old) {
         old = (old - jiffies) / HZ;
     }
+    // 原来由 schedule() 每次检查所有任务的 alarm，现在由时间轮上的定时器到期时发送信号
+    del_timer(&current->alarm_timer);
     current->alarm = (seconds > 0) ? (jiffies + HZ * seconds) : 0;
+    if (current->alarm) {
+        current->alarm_timer.function = alarm_timeout;
+        current->alarm_timer.data = (unsigned long) current;
+        mod_timer(&current->alarm_timer, (unsigned long) current->alarm);
+    }
     return old;
 }
 
+// nice() 系统调用，把当前任务的 nice 值增加 increment(结果限制在 MIN_NICE..MAX_NICE)。
+// 原来的 sys_nice() 减小 priority(时间片)，现在改变的是公平调度类中的权重。只有超级用户能提高优先级
+int sys_nice(long increment) {
+    if (increment < 0 && !suser())
+        return -EPERM;
+    if (increment < MIN_NICE - MAX_NICE)        // 避免溢出
+        increment = MIN_NICE - MAX_NICE;
+    else if (increment > MAX_NICE - MIN_NICE)
+        increment = MAX_NICE - MIN_NICE;
+    set_user_nice(current, current->nice + (int) increment);
+    return 0;
+}
+
+// 修改任务 p 的调度策略和实时优先级，参数和权限已经检查。
+// p 在就绪队列中时从原来的类移到新的类(作为刚被唤醒的任务加入); p 正在运行时先交还给原来的类，
+// 加入新的类后再由新的类设为正在运行，并请求重新调度(可能有优先级更高的任务了)
+void __sched_setscheduler(struct task_struct *p, int policy, int prio) {
+    unsigned long flags;
+    int on_rq, running;
+
+    save_flags(flags);
+    cli();
+    on_rq = p->on_rq;
+    running = (p == cpu_rq(p->processor)->curr);
+    if (on_rq) {
+        if (running)
+            p->sched_class->put_prev_task(p);
+        dequeue_task(p);
+    }
+    p->policy = policy;
+    p->rt_priority = prio;
+    p->sched_class = policy == SCHED_NORMAL ? &fair_sched_class : &rt_sched_class;
+    if (policy == SCHED_RR)
+        p->counter = p->priority;
+    if (on_rq) {
+        enqueue_task(p, 1);
+        if (running)
+            p->sched_class->set_curr_task(p);
+        else
+            check_preempt_curr(p);
+    }
+    if (running)
+        resched_task(p);
+    restore_flags(flags);
+}
+
+// 按进程号找任务，pid 为 0 表示当前任务
+static struct task_struct *find_task_by_pid(int pid) {
+    int i;
+
+    if (!pid)
+        return current;
+    for (i = 0; i < NR_TASKS; i++)
+        if (task[i] && task[i]->pid == pid)
+            return task[i];
+    return NULL;
+}
+
+// 设置进程 pid 的调度策略和实时优先级(SCHED_NORMAL 时必须为 0)。
+// 只有超级用户能设置实时策略，只能修改有效用户相同的进程
+int sys_sched_setscheduler(int pid, int policy, struct sched_param *param) {
+    struct task_struct *p;
+    int prio;
+
+    if (!param || policy < SCHED_NORMAL || policy > SCHED_RR)
+        return -EINVAL;
+    prio = (int) get_fs_long((char *) &param->sched_priority);
+    if (policy == SCHED_NORMAL ? prio != 0 : (prio < SCHED_RT_PRIO_MIN || prio > SCHED_RT_PRIO_MAX))
+        return -EINVAL;
+    if (!(p = find_task_by_pid(pid)))
+        return -ESRCH;
+    if (policy != SCHED_NORMAL && !suser())
+        return -EPERM;
+    if (p->uid != current->euid && p->euid != current->euid && !suser())
+        return -EPERM;
+    __sched_setscheduler(p, policy, prio);
+    return 0;
+}
+
+// 取进程 pid 的调度策略
+int sys_sched_getscheduler(int pid) {
+    struct task_struct *p;
+
+    if (!(p = find_task_by_pid(pid)))
+        return -ESRCH;
+    return p->policy;
+}
+
+// 取进程 pid 的实时优先级
+int sys_sched_getparam(int pid, struct sched_param *param) {
+    struct task_struct *p;
+
+    if (!param)
+        return -EINVAL;
+    if (!(p = find_task_by_pid(pid)))
+        return -ESRCH;
+    verify_area(param, sizeof(*param));
+    put_fs_long((unsigned long) p->rt_priority, (unsigned long *) &param->sched_priority);
+    return 0;
+}
+
+/*
+ * 空闲时停止周期时钟(tickless idle)
+ *
+ * 8253 平时工作在方式 3(方波)，每 10ms 一次时钟中断，即使所有任务都在睡眠。
+ * 没有就绪任务时，空闲任务查看时间轮，到下一个定时器到期还有 n(>1) 个滴答时把通道 0 改为方式 0
+ * (计数到 0 时产生一次中断)，计数值 n*LATCH，然后 hlt 等待中断，中间的 n-1 次时钟中断被省掉。
+ *  - 单次定时到期: do_timer() 把 jiffies 补上 n-1 个滴答，恢复方式 3;
+ *  - 其他中断(键盘、硬盘)先到达: cpu_idle() 读出计数器的剩余值，按已经过去的整滴答数补上 jiffies，恢复方式 3。
+ * 8253 的计数器只有 16 位，一次最多停 NOHZ_MAX_TICKS 个滴答(约 55ms)。
+ * 滴答的相位在恢复周期方式时会偏移不到一个滴答。
+ * 停止期间其他 CPU 挂入了更早到期的定时器时，由 tick_nohz_timer_added() 发处理器间中断唤醒 CPU 0。
+ */
+#define NOHZ_MAX_TICKS (0xffff / LATCH)
+
+static int nohz_enabled = 1;                // 置 0 则空闲时只 hlt，不停止周期时钟
+static int tick_stopped = 0;                // 通道 0 处于单次定时方式
+static unsigned long idle_ticks;            // 单次定时的滴答数
+static unsigned long nohz_expires;          // 单次定时到期时的 jiffies
+unsigned long nohz_ticks_saved = 0;         // 统计: 省掉的时钟中断次数
+
+// 通道0，方式3，二进制计数，每 LATCH 个输入时钟一次中断
+static void pit_periodic(void) {
+    outb_p(0x36, 0x43);                     /* binary, mode 3, LSB/MSB, ch 0 */
+    outb_p(LATCH & 0xFF, 0x40);             /* LSB */
+    outb_p(LATCH >> 8, 0x40);               /* MSB */
+}
+
+// 通道0，方式0，计数 count 个输入时钟后产生一次中断
+static void pit_oneshot(unsigned long count) {
+    outb_p(0x30, 0x43);                     /* binary, mode 0, LSB/MSB, ch 0 */
+    outb_p(count & 0xFF, 0x40);
+    outb_p((count >> 8) & 0xFF, 0x40);
+}
+
+// 锁存并读出通道 0 的当前计数值
+static unsigned long pit_read(void) {
+    unsigned long lo, hi;
+
+    outb_p(0x00, 0x43);                     /* latch ch 0 */
+    lo = inb_p(0x40);
+    hi = inb_p(0x40);
+    return lo | (hi << 8);
+}
+
+// 单次定时结束(时钟中断或提前被其他中断唤醒)，已经过去 ticks 个滴答，时钟中断本身还要加 1 个
+static void tick_nohz_restart(unsigned long ticks) {
+    jiffies += (long) ticks;
+    nohz_ticks_saved += ticks;
+    tick_stopped = 0;
+    pit_periodic();
+}
+
+// 定时器挂入或修改后由 add_timer()/mod_timer() 调用(已关中断)。CPU 0 停止了周期时钟而新定时器
+// 比单次定时更早到期时，发处理器间中断把 CPU 0 从 hlt 唤醒: cpu_idle() 恢复周期时钟，
+// 下次空闲时按新的时间轮重新计算。CPU 0 停止周期时钟后只可能在唤醒它的中断处理中挂入定时器，
+// 中断返回后 cpu_idle() 同样会恢复周期时钟，不需要处理
+void tick_nohz_timer_added(unsigned long expires) {
+    if (tick_stopped && smp_processor_id() != 0 && (long) (expires - nohz_expires) < 0)
+        smp_send_reschedule(0);
+}
+
+// 用 8253 通道 2 测定时间戳计数器的频率: 通道 2 以方式 0 计数 CALIBRATE_LATCH 个输入时钟(50ms)，
+// 计数到 0 时输出变高(端口 0x61 的位 5)，其间 TSC 增加的值除以 50 即 kHz。调用时还没有开中断
+#define CALIBRATE_MS 50
+#define CALIBRATE_LATCH (1193180 / (1000 / CALIBRATE_MS))
+
+static void calibrate_tsc(void) {
+    unsigned long long t0, t1;
+
+    if (!(x86_capability & X86_FEATURE_TSC))
+        return;
+    outb((inb(0x61) & ~0x02) | 0x01, 0x61); // 通道 2 门控打开，扬声器关闭
+    outb_p(0xb0, 0x43);                     /* binary, mode 0, LSB/MSB, ch 2 */
+    outb_p(CALIBRATE_LATCH & 0xff, 0x42);
+    outb_p(CALIBRATE_LATCH >> 8, 0x42);
+    rdtscll(t0);
+    while (!(inb(0x61) & 0x20))
+        ;
+    rdtscll(t1);
+    tsc_khz = div64_32(t1 - t0, CALIBRATE_MS);
+    if (tsc_khz >= 1000)
+        tsc_mhz = tsc_khz / 1000;
+    current->sched_info.last_arrival = t1;  // 任务 0 从这里开始计运行时间
+}
+
+// 空闲任务在 sys_pause()(任务 0)或 start_secondary()(应用处理器)中调用: 本 CPU 没有就绪任务时 hlt 等待中断。
+// 8253 只给 CPU 0 产生时钟中断，只有 CPU 0 停止周期时钟。hlt 期间释放大内核锁，让其他 CPU 进入内核
+void cpu_idle(void) {
+    unsigned long n, left, elapsed;
+    int depth;
+
+    cli();
+    if (this_rq()->nr_running || current->need_resched) {
+        sti();
+        return;
+    }
+    if (smp_processor_id() == 0 && nohz_enabled && (n = next_timer_interrupt(NOHZ_MAX_TICKS)) > 1) {
+        idle_ticks = n;
+        nohz_expires = (unsigned long) jiffies + n;
+        tick_stopped = 1;
+        pit_oneshot(n * LATCH);
+    }
+    depth = release_kernel_lock();
+    // sti 之后的一条指令执行完才响应中断，所以在检查和 hlt 之间到达的中断不会丢失
+    __asm__ volatile("sti ; hlt");
+    cli();
+    reacquire_kernel_lock(depth);
+    if (tick_stopped && smp_processor_id() == 0) {
+        // 被其他中断唤醒。计数器已经减到 0 并回绕(时钟中断还没有处理)时按 n-1 个滴答计算
+        left = pit_read();
+        elapsed = idle_ticks * LATCH;
+        elapsed = left < elapsed ? (elapsed - left) / LATCH : idle_ticks - 1;
+        tick_nohz_restart(elapsed);
+    }
+    sti();
+}
+
 // 时钟中断处理函数
 // 在 system_call.s 中被调用
 // cpl 是当前特权级别 0 或 3, 是时钟中断发生时正被执行的代码选择符中的特权级
 // 对于一个进程由于执行时间片用完时，则进行任务切换，并执行一个计时更新工作
+// 每个 CPU 的时钟中断都调用: 计时，周期性负载均衡，由当前任务所属的类决定是否用完了时间片
+static void scheduler_tick(long cpl) {
+    struct task_struct *p;
+    struct rq *rq = this_rq();
+
+    if (!cpl) {
+        current->stime++;   // 系统运行时间
+    } else {
+        current->utime++;   // 用户运行时间
+    }
+    if (is_idle_task(current)) {            // 空闲任务没有时间片，有任务被唤醒时 need_resched 已经置位
+        if (current->need_resched && cpl)
+            schedule();
+        return;
+    }
+    // 空闲的 CPU 会在 schedule() 中自己来拉任务，忙的 CPU 定期检查是否有 CPU 比自己忙得多
+    if (smp_num_cpus > 1 && (long) (jiffies - rq->next_balance) >= 0) {
+        rq->next_balance = jiffies + BALANCE_INTERVAL;
+        if ((p = load_balance(smp_processor_id(), 0)))
+            check_preempt_curr(p);
+    }
+    // 由当前任务所属的类决定是否用完了时间片(需要时置 need_resched)
+    current->sched_class->task_tick(current);
+    if (!current->need_resched || !cpl)     // 内核程序在下一个抢占点或返回用户态时调度
+        return;
+    schedule();                             // 执行调度
+}
+
 int counter = 0;
 long volatile jiffies = 0;
 void do_timer(long cpl) {
+    if (tick_stopped)                       // 单次定时到期，补上省掉的滴答
+        tick_nohz_restart(idle_ticks - 1);
     // counter++;
     // if(counter == 10){
     //     printk("CPL = %d Jiffies = %d\n", cpl, jiffies);
     //     counter = 0;
     // }
-    if (!cpl) {
-        current->stime++;   // 系统运行时间
-    } else {
-        current->utime++;   // 用户运行时间
-    }
-    if ((--current->counter) > 0) return;   // 如果进程运行时间还没完，则退出。
-    current->counter = 0;
-    if(!cpl) return;                        // 内核程序，不依赖 counter 进行调度
-    schedule();                             // 执行调度
+    run_timers();           // 处理到期的定时器(报警、睡眠超时、硬盘超时等)
+    // 相同页面合并扫描只在中断了用户态程序时进行，见 mm/ksm.c
+    if (cpl && ksm_pages_to_scan && !(jiffies % KSM_INTERVAL))
+        ksm_scan();
+    scheduler_tick(cpl);
+}
+
+// 应用处理器的时钟中断(本地 APIC 定时器)，在 system_call.s 中被调用。jiffies 和定时器只由 CPU 0 处理
+void do_local_timer(long cpl) {
+    scheduler_tick(cpl);
 }
 
 // 内核调度程序的初始化子程序
 void sched_init() {
-    int divisor = 1193180/HZ;
-
     int i;
     struct desc_struct *p;  // 描述符表结构指针
 
     // 把任务状态描述符表和局部数据描述符表挂接到全局描述符表GDT中
-    set_tss_desc(gdt+FIRST_TSS_ENTRY, &(init_task.task.tss));
+    // CPU 0 的任务状态段，I/O 位图偏移超出段限长(不允许用户态访问端口)。其他 CPU 的在 smp_boot_cpus() 中设置
+    init_tss[0].esp0 = PAGE_SIZE + (long) &init_task;
+    init_tss[0].ss0 = 0x10;
+    init_tss[0].trace_bitmap = 0x80000000;
+    set_tss_desc(gdt+FIRST_TSS_ENTRY, &init_tss[0]);
     set_ldt_desc(gdt+FIRST_LDT_ENTRY, &(init_task.task.ldt));
 
     // 清任务数组和描述符表项(注意 i=1 开始，所以初始任务的描述符还在)
@@ -275,9 +941,10 @@ void sched_init() {
     // 初始化8253定时器。通道0，选择工作方式3，二进制计数方式。
     // 通道0的输出引脚接在中断控制主芯片的IRQ0上，它每10毫秒发出一个IRQ0请求。
     // LATCH是初始定时计数值。
-    outb_p(0x36, 0x43);                     /* binary, mode 3, LSB/MSB, ch 0 */
-    outb_p(divisor & 0xFF, 0x40);           /* LSB */
-    outb_p(divisor >> 8, 0x40);             /* MSB */
+    pit_periodic();
+    calibrate_tsc();
+    if (tsc_khz)
+        sched_clock_per_tick = (unsigned long long) tsc_khz * (1000 / HZ);
 
     // 设置时钟中断处理程序句柄(设置时钟中断门)。修改中断控制器屏蔽码，允许时钟中断。
     // 然后设置系统调用中断门。这两个设置中断描述符表 IDT 中描述符在宏定义在文件 include/asm/system.h中
@@ -0,0 +1,124 @@
+/*
+ *  任务切换的性能测试
+ *
+ *  用时间戳计数器测量 SWITCH_ROUNDS 次来回切换的平均耗时(时钟周期/次切换):
+ *      1. ljmp 硬件任务切换: 在 CPU NR_CPUS 的 TSS 描述符项处(不会有这个 CPU)放一个临时的 TSS，两边互相 ljmp，
+ *         CPU 每次保存和加载整个 TSS(包括 LDT 和 CR3);
+ *      2. 软件切换(switch_to)，两个任务的 LDT 和页目录不同，每次都重新加载 LDT 和 CR3，相当于不同进程之间的切换;
+ *      3. 软件切换，两个任务使用相同的 LDT 和页目录，相当于 vfork 的父子进程之间的切换。
+ *  另一方是一个临时的任务结构(不在任务数组和就绪队列中)，只在内核态运行一个来回切换的循环。
+ *  测试时关中断。在 main() 中 mem_init() 之后、move_to_user_mode() 之前调用 sched_bench()。
+ */
+
+#include <linux/sched.h>
+#include <linux/kernel.h>
+#include <linux/head.h>
+#include <linux/mm.h>
+#include <asm/system.h>
+#include <asm/div64.h>
+
+#define SWITCH_ROUNDS 10000
+
+static struct task_struct *bench_task;          // 软件切换的另一方
+static struct tss_struct bench_tss;             // 硬件切换的另一方
+
+// 长跳转到 TSS 选择符 sel，引起硬件任务切换
+static inline void ljmp_tss(unsigned long sel) {
+    struct {long a, b;} __tmp;
+
+    __tmp.a = 0;
+    __tmp.b = (long) sel;
+    __asm__ volatile("ljmp *%0" :: "m" (__tmp) : "memory");
+}
+
+static void hw_bench_thread(void) {
+    for (;;)
+        ljmp_tss(_TSS(0));
+}
+
+static void sw_bench_thread(void) {
+    for (;;)
+        switch_to(bench_task, task[0]);
+}
+
+static unsigned long bench_hw(void) {
+    unsigned long long t0, t1;
+    int i;
+
+    bench_tss.eip = (long) hw_bench_thread;
+    bench_tss.eflags = 0x2;                     // 关中断
+    bench_tss.esp = (long) bench_task + PAGE_SIZE;
+    bench_tss.cs = 0x08;
+    bench_tss.ds = bench_tss.es = bench_tss.ss = bench_tss.fs = bench_tss.gs = 0x10;
+    bench_tss.cr3 = bench_task->tss.cr3;
+    bench_tss.ldt = bench_task->tss.ldt;
+    bench_tss.trace_bitmap = 0x80000000;
+    set_tss_desc(gdt + FIRST_TSS_ENTRY + 2 * NR_CPUS, &bench_tss);
+    // 切换回来时 CPU 从 init_tss[0] 加载 CR3 和 LDT(切换出去时不保存这两项)
+    init_tss[0].cr3 = current->tss.cr3;
+    init_tss[0].ldt = current->tss.ldt;
+
+    rdtscll(t0);
+    for (i = 0; i < SWITCH_ROUNDS; i++)
+        ljmp_tss(_TSS(NR_CPUS));
+    rdtscll(t1);
+
+    init_tss[0].cr3 = 0;
+    init_tss[0].ldt = 0;
+    gdt[FIRST_TSS_ENTRY + 2 * NR_CPUS].a = gdt[FIRST_TSS_ENTRY + 2 * NR_CPUS].b = 0;
+    return div64_32(t1 - t0, 2 * SWITCH_ROUNDS);
+}
+
+static unsigned long bench_sw(void) {
+    unsigned long long t0, t1;
+    int i;
+
+    bench_task->thread.esp = (unsigned long) bench_task + PAGE_SIZE;
+    bench_task->thread.eip = (unsigned long) sw_bench_thread;
+    rdtscll(t0);
+    for (i = 0; i < SWITCH_ROUNDS; i++)
+        switch_to(task[0], bench_task);
+    rdtscll(t1);
+    return div64_32(t1 - t0, 2 * SWITCH_ROUNDS);
+}
+
+void sched_bench(void) {
+    unsigned long flags, cr0, hw, sw, sw_same, *dir;
+    int i;
+
+    if (!(x86_capability & X86_FEATURE_TSC)) {
+        printk("sched_bench: no TSC\n");
+        return;
+    }
+    if (current != task[0] || task[1]) {
+        printk("sched_bench: must run before fork\n");
+        return;
+    }
+    if (!(bench_task = (struct task_struct *) get_free_page()) || !(dir = (unsigned long *) get_free_page()))
+        panic("sched_bench: out of memory");
+    // 另一方使用任务 1 的 LDT 描述符项和一份内核页目录的副本
+    *bench_task = *current;
+    bench_task->tss.esp0 = PAGE_SIZE + (long) bench_task;
+    for (i = 0; i < 1024; i++)
+        dir[i] = pg_dir[i];
+    bench_task->tss.cr3 = (long) dir;
+    bench_task->tss.ldt = _LDT(1);
+    set_ldt_desc(gdt + FIRST_LDT_ENTRY + 2, &(bench_task->ldt));
+
+    save_flags(flags);
+    cli();
+    __asm__ volatile("mov %%cr0, %0" : "=r" (cr0));
+    hw = bench_hw();
+    sw = bench_sw();
+    bench_task->tss.cr3 = current->tss.cr3;
+    bench_task->tss.ldt = current->tss.ldt;
+    sw_same = bench_sw();
+    __asm__ volatile("mov %0, %%cr0" :: "r" (cr0));    // 两种切换都会置位 TS
+    restore_flags(flags);
+
+    gdt[FIRST_LDT_ENTRY + 2].a = gdt[FIRST_LDT_ENTRY + 2].b = 0;
+    free_page((unsigned long) dir);
+    free_page((unsigned long) bench_task);
+    printk("context switch: ljmp tss %d cycles, switch_to %d cycles (%d without cr3/ldt reload)\n",
+        hw, sw, sw_same);
+}
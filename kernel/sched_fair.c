@@ -0,0 +1,309 @@
+/*
+ *  公平调度类
+ *
+ *  原来的调度按 counter/priority 轮转，所有任务的 priority 都是 15，没有办法让批处理任务少占 CPU。
+ *  现在每个任务有一个虚拟运行时间 vruntime: 运行 delta 时间，vruntime 增加 delta * NICE_0_LOAD / weight，
+ *  权重 weight 由 nice 值查表得到。总是运行 vruntime 最小的任务，于是各任务得到的 CPU 时间与权重成正比。
+ *
+ *  就绪任务按 vruntime 排在红黑树中(kernel/rbtree.c)，并记住最左的节点，选择下一个任务是 O(1)，
+ *  入队和出队是 O(log n)。正在运行的任务(cfs_rq.curr)不在树中，被切换出去时再按新的 vruntime 插回。
+ *  min_vruntime 单调增加，跟踪树中和正在运行的任务中最小的 vruntime:
+ *      睡眠醒来的任务的 vruntime 至少是 min_vruntime 减去半个调度周期，既能较快地运行(交互任务)，
+ *      又不能靠长时间睡眠积累 CPU 时间;
+ *      fork 出的新任务从 min_vruntime 加上一个时间片开始，不能靠不断 fork 抢占 CPU。
+ *  调度周期内每个就绪任务按权重分得一个时间片，时钟中断时当前任务用完时间片，
+ *  或者比最左的任务多跑了一个时间片，就请求重新调度; 被唤醒的任务的 vruntime 比当前任务小一个粒度以上时抢占。
+ *
+ *  时间的单位是 sched_clock() 的单位(TSC 周期，没有 TSC 时按滴答计的微秒)，调度参数以滴答给出，
+ *  乘以 sched_clock_per_tick 换算。调用时都已关中断。
+ *
+ *  每个 CPU 一个就绪队列，任务属于 p->processor 的队列。各队列的 min_vruntime 互不相关，
+ *  任务迁移到其他 CPU 时把 vruntime 按两边 min_vruntime 的差调整(migrate_task_fair)，保持它与队列中其他任务的相对位置。
+ */
+
+#include <linux/sched.h>
+#include <linux/kernel.h>
+#include <linux/rbtree.h>
+#include <asm/system.h>
+#include <asm/div64.h>
+
+#define SCHED_LATENCY_TICKS     4       // 调度周期: 就绪任务不多时，每个任务在一个周期内至少运行一次
+#define SCHED_MIN_GRAN_TICKS    1       // 时间片的最小值，就绪任务多时调度周期按它延长
+#define SCHED_WAKEUP_GRAN_TICKS 1       // 被唤醒的任务的 vruntime 至少比当前任务小这么多才抢占
+
+// nice -20..19 对应的权重，相邻两级相差约 1.25 倍，即 nice 每差 1 级 CPU 时间相差约 10%(与 Linux 相同)
+static const unsigned long prio_to_weight[MAX_NICE - MIN_NICE + 1] = {
+ /* -20 */     88761,     71755,     56483,     46273,     36291,
+ /* -15 */     29154,     23254,     18705,     14949,     11916,
+ /* -10 */      9548,      7620,      6100,      4904,      3906,
+ /*  -5 */      3121,      2501,      1991,      1586,      1277,
+ /*   0 */      1024,       820,       655,       526,       423,
+ /*   5 */       335,       272,       215,       172,       137,
+ /*  10 */       110,        87,        70,        56,        45,
+ /*  15 */        36,        29,        23,        18,        15,
+};
+
+// 公平调度类的就绪队列，每个 CPU 一个
+static struct cfs_rq {
+    struct rb_root tasks_timeline;      // 按 vruntime 排序的就绪任务(不包括 curr)
+    struct rb_node *rb_leftmost;        // 树中最左(vruntime 最小)的节点
+    struct task_struct *curr;           // 正在运行的本类任务，没有时为 NULL
+    unsigned long load;                 // 就绪任务(包括 curr)的权重之和
+    unsigned long nr_running;           // 就绪任务数(包括 curr)
+    unsigned long long min_vruntime;
+} cfs_rqs[NR_CPUS];
+
+// vruntime 会回绕，比较时取差值的符号
+#define vruntime_before(a, b) ((long long) ((a) - (b)) < 0)
+#define task_of(node) rb_entry(node, struct task_struct, run_node)
+#define cfs_rq_of(p) (&cfs_rqs[(p)->processor])
+
+// 实际时间 delta 折算成权重为 weight 的任务的虚拟时间
+static inline unsigned long long calc_delta_fair(unsigned long long delta, unsigned long weight) {
+    if (weight == NICE_0_LOAD)
+        return delta;
+    return div_u64(delta * NICE_0_LOAD, weight);
+}
+
+// 调度周期，有 nr 个就绪任务
+static unsigned long long sched_period(unsigned long nr) {
+    if (nr > SCHED_LATENCY_TICKS / SCHED_MIN_GRAN_TICKS)
+        return nr * SCHED_MIN_GRAN_TICKS * sched_clock_per_tick;
+    return SCHED_LATENCY_TICKS * sched_clock_per_tick;
+}
+
+// 任务 p 在一个调度周期中分得的时间片(实际时间)。queued 表示 p 已经计入 cfs_rq
+static unsigned long long sched_slice(struct cfs_rq *cfs_rq, struct task_struct *p, int queued) {
+    unsigned long load = cfs_rq->load, nr = cfs_rq->nr_running;
+
+    if (!queued) {
+        load += p->weight;
+        nr++;
+    }
+    return div_u64(sched_period(nr) * p->weight, load);
+}
+
+static void update_min_vruntime(struct cfs_rq *cfs_rq) {
+    unsigned long long vruntime = cfs_rq->min_vruntime;
+    struct task_struct *left;
+
+    if (cfs_rq->curr)
+        vruntime = cfs_rq->curr->vruntime;
+    if (cfs_rq->rb_leftmost) {
+        left = task_of(cfs_rq->rb_leftmost);
+        if (!cfs_rq->curr || vruntime_before(left->vruntime, vruntime))
+            vruntime = left->vruntime;
+    }
+    if (vruntime_before(cfs_rq->min_vruntime, vruntime))
+        cfs_rq->min_vruntime = vruntime;
+}
+
+// 把正在运行的任务从上次累计到现在的运行时间记入 sum_exec_runtime 和 vruntime
+static void update_curr(struct cfs_rq *cfs_rq) {
+    struct task_struct *curr = cfs_rq->curr;
+    unsigned long long now, delta;
+
+    if (!curr)
+        return;
+    now = sched_clock();
+    delta = now - curr->exec_start;
+    if ((long long) delta <= 0)
+        return;
+    curr->exec_start = now;
+    curr->sum_exec_runtime += delta;
+    curr->vruntime += calc_delta_fair(delta, curr->weight);
+    update_min_vruntime(cfs_rq);
+}
+
+// 按 vruntime 把任务 p 插入红黑树，相同的排在后面
+static void __enqueue_entity(struct cfs_rq *cfs_rq, struct task_struct *p) {
+    struct rb_node **link = &cfs_rq->tasks_timeline.rb_node, *parent = NULL;
+    int leftmost = 1;
+
+    while (*link) {
+        parent = *link;
+        if (vruntime_before(p->vruntime, task_of(parent)->vruntime)) {
+            link = &parent->rb_left;
+        } else {
+            link = &parent->rb_right;
+            leftmost = 0;
+        }
+    }
+    if (leftmost)
+        cfs_rq->rb_leftmost = &p->run_node;
+    rb_link_node(&p->run_node, parent, link);
+    rb_insert_color(&p->run_node, &cfs_rq->tasks_timeline);
+}
+
+static void __dequeue_entity(struct cfs_rq *cfs_rq, struct task_struct *p) {
+    if (cfs_rq->rb_leftmost == &p->run_node)
+        cfs_rq->rb_leftmost = rb_next(&p->run_node);
+    rb_erase(&p->run_node, &cfs_rq->tasks_timeline);
+}
+
+// 确定加入就绪队列的任务的 vruntime: initial 为 fork 出的新任务，否则是睡眠醒来的任务
+static void place_entity(struct cfs_rq *cfs_rq, struct task_struct *p, int initial) {
+    unsigned long long vruntime = cfs_rq->min_vruntime;
+
+    if (initial)
+        vruntime += calc_delta_fair(sched_slice(cfs_rq, p, 0), p->weight);
+    else
+        vruntime -= SCHED_LATENCY_TICKS * sched_clock_per_tick / 2;
+    if (vruntime_before(p->vruntime, vruntime))
+        p->vruntime = vruntime;
+}
+
+static void enqueue_task_fair(struct task_struct *p, int wakeup) {
+    struct cfs_rq *cfs_rq = cfs_rq_of(p);
+
+    update_curr(cfs_rq);
+    if (wakeup)
+        place_entity(cfs_rq, p, 0);
+    __enqueue_entity(cfs_rq, p);
+    cfs_rq->load += p->weight;
+    cfs_rq->nr_running++;
+}
+
+static void dequeue_task_fair(struct task_struct *p) {
+    struct cfs_rq *cfs_rq = cfs_rq_of(p);
+
+    update_curr(cfs_rq);
+    if (p == cfs_rq->curr)
+        cfs_rq->curr = NULL;
+    else
+        __dequeue_entity(cfs_rq, p);
+    cfs_rq->load -= p->weight;
+    cfs_rq->nr_running--;
+}
+
+// 被唤醒的任务 p 的 vruntime 比它所在 CPU 的当前任务小一个唤醒粒度以上时抢占
+static void check_preempt_wakeup(struct task_struct *p) {
+    struct cfs_rq *cfs_rq = cfs_rq_of(p);
+    struct task_struct *curr = cfs_rq->curr;
+    unsigned long long gran;
+
+    if (!curr)
+        return;
+    update_curr(cfs_rq);
+    gran = calc_delta_fair(SCHED_WAKEUP_GRAN_TICKS * sched_clock_per_tick, p->weight);
+    if ((long long) (curr->vruntime - p->vruntime) > (long long) gran)
+        resched_task(curr);
+}
+
+// 把树中的任务 p 取出作为正在运行的任务
+static void set_next_entity(struct cfs_rq *cfs_rq, struct task_struct *p) {
+    __dequeue_entity(cfs_rq, p);
+    cfs_rq->curr = p;
+    p->exec_start = sched_clock();
+    p->prev_sum_exec_runtime = p->sum_exec_runtime;
+}
+
+// 从本 CPU 的队列中取出 vruntime 最小的任务作为正在运行的任务
+static struct task_struct *pick_next_task_fair(void) {
+    struct cfs_rq *cfs_rq = &cfs_rqs[smp_processor_id()];
+    struct task_struct *p;
+
+    if (!cfs_rq->rb_leftmost)
+        return NULL;
+    p = task_of(cfs_rq->rb_leftmost);
+    set_next_entity(cfs_rq, p);
+    return p;
+}
+
+// 仍然就绪的当前任务按新的 vruntime 插回树中
+static void put_prev_task_fair(struct task_struct *p) {
+    struct cfs_rq *cfs_rq = cfs_rq_of(p);
+
+    update_curr(cfs_rq);
+    __enqueue_entity(cfs_rq, p);
+    cfs_rq->curr = NULL;
+}
+
+// 时钟中断: 当前任务用完了时间片，或者比最左的任务多跑了一个时间片，则请求重新调度
+static void task_tick_fair(struct task_struct *curr) {
+    struct cfs_rq *cfs_rq = cfs_rq_of(curr);
+    unsigned long long ideal, delta_exec;
+
+    update_curr(cfs_rq);
+    if (cfs_rq->nr_running <= 1 || curr != cfs_rq->curr)
+        return;
+    ideal = sched_slice(cfs_rq, curr, 1);
+    delta_exec = curr->sum_exec_runtime - curr->prev_sum_exec_runtime;
+    if (delta_exec > ideal) {
+        resched_task(curr);
+        return;
+    }
+    if (delta_exec < SCHED_MIN_GRAN_TICKS * sched_clock_per_tick || !cfs_rq->rb_leftmost)
+        return;
+    if ((long long) (curr->vruntime - task_of(cfs_rq->rb_leftmost)->vruntime) > (long long) ideal)
+        resched_task(curr);
+}
+
+// fork 出的新任务: vruntime(复制自父进程)至少从 min_vruntime 之后一个时间片开始
+static void task_new_fair(struct task_struct *p) {
+    struct cfs_rq *cfs_rq = cfs_rq_of(p);
+
+    update_curr(cfs_rq);
+    place_entity(cfs_rq, p, 1);
+}
+
+// 正在运行的任务从实时调度类换过来，已经作为唤醒的任务插入树中
+static void set_curr_task_fair(struct task_struct *p) {
+    set_next_entity(cfs_rq_of(p), p);
+}
+
+// 迁移到 CPU cpu: vruntime 换算成相对于新队列 min_vruntime 的值，
+// 否则从 min_vruntime 较大的队列迁过来的任务要等很久才能运行，反方向的则会长时间独占 CPU
+static void migrate_task_fair(struct task_struct *p, int cpu) {
+    p->vruntime = p->vruntime - cfs_rq_of(p)->min_vruntime + cfs_rqs[cpu].min_vruntime;
+}
+
+// 负载均衡: 从 CPU cpu 的队列中选出一个在等待运行的任务(不是正在运行的任务)迁移到其他 CPU，没有时返回 NULL。
+// 选最左的任务: 它本来就是在那里下一个运行的任务，迁移后马上能在新的 CPU 上运行
+struct task_struct *pick_migrate_task_fair(int cpu) {
+    struct cfs_rq *cfs_rq = &cfs_rqs[cpu];
+
+    if (!cfs_rq->rb_leftmost)
+        return NULL;
+    return task_of(cfs_rq->rb_leftmost);
+}
+
+const struct sched_class fair_sched_class = {
+    NULL,
+    enqueue_task_fair,
+    dequeue_task_fair,
+    check_preempt_wakeup,
+    pick_next_task_fair,
+    put_prev_task_fair,
+    task_tick_fair,
+    task_new_fair,
+    set_curr_task_fair,
+    migrate_task_fair,
+};
+
+// 修改任务 p 的 nice 值(超出范围的取边界值)，权重随之改变。p 在就绪队列中时更新队列的总权重
+void set_user_nice(struct task_struct *p, int nice) {
+    struct cfs_rq *cfs_rq;
+    unsigned long flags;
+    int queued;
+
+    if (nice < MIN_NICE)
+        nice = MIN_NICE;
+    else if (nice > MAX_NICE)
+        nice = MAX_NICE;
+    save_flags(flags);
+    cli();
+    cfs_rq = cfs_rq_of(p);
+    queued = p->on_rq && p->sched_class == &fair_sched_class;
+    if (p == cfs_rq->curr)
+        update_curr(cfs_rq);            // 到现在为止的运行时间按原来的权重计算
+    if (queued)
+        cfs_rq->load -= p->weight;
+    p->nice = nice;
+    p->weight = prio_to_weight[nice - MIN_NICE];
+    if (queued)
+        cfs_rq->load += p->weight;
+    if (p == cpu_rq(p->processor)->curr)
+        resched_task(p);
+    restore_flags(flags);
+}
@@ -0,0 +1,196 @@
+/*
+ *  实时调度类
+ *
+ *  SCHED_FIFO 和 SCHED_RR 的任务有静态的实时优先级 1..99，总是先于普通任务(公平调度类)运行。
+ *  被唤醒时抢占普通任务和优先级更低的实时任务: 立即请求重新调度，不等时间片用完。
+ *  每个优先级一个双向循环链表，位图中对应的位表示链表非空，
+ *  选择下一个任务只需找到位图中第一个置位的位，与就绪任务数无关。
+ *  正在运行的任务仍然在链表头，被更高优先级的任务抢占后还是最先运行:
+ *      SCHED_FIFO 一直运行到睡眠或被更高优先级的任务抢占;
+ *      SCHED_RR 每次运行 priority 个滴答(counter 递减)，用完后移到链表尾，让同一优先级的其他任务运行。
+ *
+ *  失控保护: 死循环的实时任务会使普通任务(包括 shell)永远得不到 CPU，连 kill 它的机会都没有。
+ *  所以每 RT_PERIOD_TICKS 个滴答中实时任务最多运行 RT_RUNTIME_TICKS 个滴答，超出后本类被节流
+ *  (pick_next_task 返回 NULL)，普通任务得以运行，直到周期定时器到期。
+ *  周期从节流解除后实时任务第一次在时钟中断时运行开始计算，没有实时任务运行时定时器不挂入。
+ *  每个 CPU 一个就绪队列，节流也按 CPU 分别统计。实时任务只在唤醒和 fork 时选择 CPU，不参与负载均衡。
+ *  调用时都已关中断。
+ */
+
+#include <linux/sched.h>
+#include <linux/kernel.h>
+#include <linux/timer.h>
+
+#define RT_PERIOD_TICKS     HZ                  // 节流的统计周期 1s
+#define RT_RUNTIME_TICKS    (HZ * 95 / 100)     // 每个周期中实时任务最多运行 0.95s
+
+#define RT_BITMAP_SIZE ((MAX_RT_PRIO + 31) / 32)
+
+static void rt_period_timeout(unsigned long data);
+
+// 实时调度类的就绪队列，每个 CPU 一个
+static struct rt_rq {
+    unsigned long bitmap[RT_BITMAP_SIZE];       // 第 i 位表示 queue[i] 非空
+    struct task_struct *queue[MAX_RT_PRIO];     // queue[i] 是实时优先级为 MAX_RT_PRIO-1-i 的就绪任务链表
+    unsigned long nr_running;                   // 就绪任务数(包括正在运行的任务)
+    unsigned long rt_time;                      // 本周期中实时任务已经运行的滴答数
+    int throttled;                              // 超出了 RT_RUNTIME_TICKS，本周期内不再选择实时任务
+    struct timer_list period_timer;             // 周期结束时清零 rt_time，解除节流，data 是 CPU 号
+} rt_rqs[NR_CPUS];
+
+#define rt_rq_of(p) (&rt_rqs[(p)->processor])
+
+// 优先级越高下标越小，位图中第一个置位的位就是优先级最高的非空链表
+#define rt_index(p) (MAX_RT_PRIO - 1 - (p)->rt_priority)
+
+// 位图中第一个置位的位，全为 0 时返回 -1
+static inline int rt_find_first_bit(struct rt_rq *rt_rq) {
+    unsigned long bit;
+    int i;
+
+    for (i = 0; i < RT_BITMAP_SIZE; i++) {
+        if (rt_rq->bitmap[i]) {
+            __asm__("bsfl %1, %0" : "=r" (bit) : "rm" (rt_rq->bitmap[i]));
+            return i * 32 + (int) bit;
+        }
+    }
+    return -1;
+}
+
+// 把任务 p 加到它的优先级的链表尾
+static void __enqueue_rt_entity(struct rt_rq *rt_rq, struct task_struct *p) {
+    int idx = rt_index(p);
+    struct task_struct *head = rt_rq->queue[idx];
+
+    if (!head) {
+        p->run_next = p->run_prev = p;
+        rt_rq->queue[idx] = p;
+        rt_rq->bitmap[idx >> 5] |= 1ul << (idx & 31);
+        return;
+    }
+    p->run_next = head;
+    p->run_prev = head->run_prev;
+    head->run_prev->run_next = p;
+    head->run_prev = p;
+}
+
+static void __dequeue_rt_entity(struct rt_rq *rt_rq, struct task_struct *p) {
+    int idx = rt_index(p);
+
+    if (p->run_next == p) {
+        rt_rq->queue[idx] = NULL;
+        rt_rq->bitmap[idx >> 5] &= ~(1ul << (idx & 31));
+    } else {
+        p->run_prev->run_next = p->run_next;
+        p->run_next->run_prev = p->run_prev;
+        if (rt_rq->queue[idx] == p)
+            rt_rq->queue[idx] = p->run_next;
+    }
+    p->run_next = p->run_prev = NULL;
+}
+
+// 加入链表尾: 被唤醒的任务排在同一优先级已经就绪的任务之后
+static void enqueue_task_rt(struct task_struct *p, int wakeup) {
+    (void) wakeup;
+    __enqueue_rt_entity(rt_rq_of(p), p);
+    rt_rq_of(p)->nr_running++;
+}
+
+static void dequeue_task_rt(struct task_struct *p) {
+    __dequeue_rt_entity(rt_rq_of(p), p);
+    rt_rq_of(p)->nr_running--;
+}
+
+// 被唤醒的任务比它所在 CPU 的当前任务优先级更高时抢占，相同优先级不抢占
+static void check_preempt_curr_rt(struct task_struct *p) {
+    struct task_struct *curr = cpu_rq(p->processor)->curr;
+
+    if (p->rt_priority > curr->rt_priority)
+        resched_task(curr);
+}
+
+// 本 CPU 优先级最高的链表头。被节流时不选择，让普通任务运行
+static struct task_struct *pick_next_task_rt(void) {
+    struct rt_rq *rt_rq = &rt_rqs[smp_processor_id()];
+    int idx;
+
+    if (rt_rq->throttled || (idx = rt_find_first_bit(rt_rq)) < 0)
+        return NULL;
+    return rt_rq->queue[idx];
+}
+
+// 被抢占的任务留在链表头
+static void put_prev_task_rt(struct task_struct *p) {
+    (void) p;
+}
+
+// 时钟中断: 累计本周期的实时运行时间，超出时节流; SCHED_RR 的时间片用完时移到链表尾
+static void task_tick_rt(struct task_struct *p) {
+    static int warned = 0;
+    struct rt_rq *rt_rq = rt_rq_of(p);
+
+    if (!rt_rq->period_timer.function) {    // 第一次使用时初始化本 CPU 的周期定时器
+        init_timer(&rt_rq->period_timer);
+        rt_rq->period_timer.function = rt_period_timeout;
+        rt_rq->period_timer.data = (unsigned long) p->processor;
+    }
+    if (!timer_pending(&rt_rq->period_timer))
+        mod_timer(&rt_rq->period_timer, (unsigned long) jiffies + RT_PERIOD_TICKS);
+    if (++rt_rq->rt_time >= RT_RUNTIME_TICKS && !rt_rq->throttled) {
+        rt_rq->throttled = 1;
+        resched_task(p);
+        if (!warned) {
+            warned = 1;
+            printk("sched: RT throttling activated\n");
+        }
+    }
+    if (p->policy != SCHED_RR || --p->counter > 0)
+        return;
+    p->counter = p->priority;
+    if (p->run_next != p) {                 // 同一优先级还有其他就绪任务
+        __dequeue_rt_entity(rt_rq, p);
+        __enqueue_rt_entity(rt_rq, p);
+        resched_task(p);
+    }
+}
+
+// fork 出的实时任务继承父进程的策略和优先级，counter 已经在 fork 中置为 priority
+static void task_new_rt(struct task_struct *p) {
+    (void) p;
+}
+
+// 正在运行的任务换到本类时已经加入链表，没有其他状态
+static void set_curr_task_rt(struct task_struct *p) {
+    (void) p;
+}
+
+// 迁移到其他 CPU 时没有需要换算的状态，链表由出队/入队维护
+static void migrate_task_rt(struct task_struct *p, int cpu) {
+    (void) p;
+    (void) cpu;
+}
+
+// 周期结束: 清零 CPU data 的实时运行时间，解除节流。有就绪的实时任务时让它们重新抢占普通任务
+static void rt_period_timeout(unsigned long data) {
+    struct rt_rq *rt_rq = &rt_rqs[data];
+
+    rt_rq->rt_time = 0;
+    if (rt_rq->throttled) {
+        rt_rq->throttled = 0;
+        if (rt_rq->nr_running)
+            resched_task(cpu_rq(data)->curr);
+    }
+}
+
+const struct sched_class rt_sched_class = {
+    &fair_sched_class,
+    enqueue_task_rt,
+    dequeue_task_rt,
+    check_preempt_curr_rt,
+    pick_next_task_rt,
+    put_prev_task_rt,
+    task_tick_rt,
+    task_new_rt,
+    set_curr_task_rt,
+    migrate_task_rt,
+};
@@ -0,0 +1,107 @@
+/*
+ *  调度统计的读取和输出
+ *
+ *  统计在 schedule() 和 wake_up_process() 中维护(kernel/sched.c)，单位是时间戳计数器的周期。
+ *  schedstat(pid, st) 取一个任务(pid 为 0 时是当前任务)或整个系统(SCHEDSTAT_ALL)的累计值;
+ *  st 为 NULL 时把所有任务的统计和系统的唤醒延迟直方图输出到串口，时间换算成毫秒。
+ */
+
+#include <errno.h>
+#include <sys/schedstat.h>
+#include <linux/sched.h>
+#include <linux/kernel.h>
+#include <asm/system.h>
+#include <asm/segment.h>
+#include <asm/div64.h>
+#include <serial_debug.h>
+
+// 周期数换算成毫秒
+static unsigned long cycles_to_ms(unsigned long long cycles) {
+    return div64_32(cycles, tsc_khz);
+}
+
+static void schedstat_print(char *name, int pid, struct schedstat *st) {
+    s_printk("%s %d: run %u ms, delay %u ms, sleep %u ms, %u runs, %u/%u switches, %u wakeups\n",
+        name, pid, cycles_to_ms(st->run_time), cycles_to_ms(st->run_delay),
+        cycles_to_ms(st->sleep_time), st->pcount, st->nvcsw, st->nivcsw, st->nr_wakeups);
+}
+
+// 把所有任务的调度统计输出到串口
+void schedstat_dump(void) {
+    struct schedstat st;
+    unsigned long flags;
+    int i;
+
+    if (!tsc_khz) {
+        s_printk("schedstat: no TSC\n");
+        return;
+    }
+    s_printk("schedstat: tsc %u kHz, switches are voluntary/involuntary\n", tsc_khz);
+    for (i = 0; i < NR_TASKS; i++) {
+        if (!task[i])
+            continue;
+        save_flags(flags);
+        cli();
+        st = task[i]->sched_info.stat;
+        restore_flags(flags);
+        schedstat_print("  task", task[i]->pid, &st);
+    }
+    save_flags(flags);
+    cli();
+    st = sched_total;
+    restore_flags(flags);
+    schedstat_print("  total", 0, &st);
+    s_printk("  wakeup latency:\n");
+    for (i = 0; i < SCHED_HIST_SIZE; i++) {
+        if (!st.wakeup_hist[i])
+            continue;
+        if (i == SCHED_HIST_SIZE - 1)
+            s_printk("    >= %u us: %u\n", 1u << (i - 1), st.wakeup_hist[i]);
+        else
+            s_printk("    <  %u us: %u\n", 1u << i, st.wakeup_hist[i]);
+    }
+}
+
+// 取调度统计，当前任务的运行时间包括正在运行的这一段
+int sys_schedstat(int pid, struct schedstat *st) {
+    struct task_struct *p = NULL;
+    struct schedstat tmp;
+    unsigned long long now;
+    unsigned long flags, i;
+
+    if (!st) {
+        schedstat_dump();
+        return 0;
+    }
+    if (pid == SCHEDSTAT_ALL) {
+        save_flags(flags);
+        cli();
+        tmp = sched_total;
+        restore_flags(flags);
+    } else {
+        if (!pid) {
+            p = current;
+        } else {
+            for (i = 0; i < NR_TASKS; i++)
+                if (task[i] && task[i]->pid == pid) {
+                    p = task[i];
+                    break;
+                }
+            if (!p)
+                return -ESRCH;
+        }
+        save_flags(flags);
+        cli();
+        tmp = p->sched_info.stat;
+        if (p == current && tsc_khz) {
+            rdtscll(now);
+            tmp.run_time += now - p->sched_info.last_arrival;
+        }
+        restore_flags(flags);
+    }
+    tmp.tsc_khz = tsc_khz;
+    verify_area(st, sizeof(*st));
+    for (i = 0; i < sizeof(tmp) / sizeof(unsigned long); i++)
+        put_fs_long(((unsigned long *) &tmp)[i], (unsigned long *) st + i);
+    return 0;
+}
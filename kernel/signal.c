@@ -6,8 +6,6 @@
 
 #define DEBUG
 
-void do_exit(int error_code);
-
 void dump_sigaction(struct sigaction *action) {
     s_printk("Sigaction dump\n");
     s_printk("addr = 0x%x, sa_mask = 0x%x, sa_handler = 0x%x, sa_restorer = 0x%x\n",
@@ -0,0 +1,492 @@
+/*
+ *  多处理器支持
+ *
+ *  启动: 引导处理器(BSP，CPU 0)运行到 main() 时，其他处理器(应用处理器 AP)处于等待 INIT/STARTUP 的状态。
+ *  smp_scan_config() 先查找 BIOS 提供的 MP 配置表，没有时查找 ACPI 的 MADT，得到各处理器的本地 APIC ID。
+ *  smp_boot_cpus() 打开本 CPU 的本地 APIC，把实模式的启动代码(trampoline.s)复制到 1MB 以下的一页，
+ *  为每个 AP 分配空闲任务(任务结构和内核栈)和任务状态段，然后依次发送 INIT、STARTUP 处理器间中断。
+ *  AP 从 trampoline_data 开始在实模式下运行，进入保护模式并打开分页(使用与 BSP 相同的页目录、GDT 和 IDT)，
+ *  在空闲任务的栈上调用 start_secondary()，最后进入空闲循环，从其他 CPU 的就绪队列中取任务运行。
+ *
+ *  中断: 8259A 仍然只把中断送给 BSP(经 BSP 本地 APIC 的 LINT0，ExtINT 方式)，jiffies 和定时器只在 CPU 0 处理;
+ *  AP 的时钟中断来自各自的本地 APIC 定时器，周期与 8253 相同(用 8253 的滴答测定)。
+ *
+ *  互斥: 从 Linux 0.11 继承来的内核代码靠"内核态不被抢占、关中断"保证互斥，只对单处理器成立。
+ *  这里用一把大内核锁(kernel_flag)把内核整体串行化: 进入内核(系统调用、中断、异常)时获取，
+ *  返回时释放，同一时刻只有一个 CPU 在执行内核代码，原来的关中断临界区在持锁的 CPU 上仍然有效，
+ *  用户态程序则在各 CPU 上并行运行。同一个任务可以嵌套获取(中断打断了持锁的内核代码)，深度在 lock_depth 中;
+ *  睡眠的任务在 schedule() 中把锁连同 CPU 一起交给下一个任务，空闲时在 hlt 期间释放。
+ *
+ *  TLB: 修改页表后其他 CPU 上可能还有旧的 TLB 项，smp_flush_tlb() 发送处理器间中断让它们刷新并等待完成。
+ *  发送方持有大内核锁，在锁上自旋(关中断)的 CPU 收不到中断，所以等锁时也检查 flush_cpumask。
+ */
+
+#include <string.h>
+#include <linux/sched.h>
+#include <linux/kernel.h>
+#include <linux/head.h>
+#include <linux/mm.h>
+#include <asm/system.h>
+#include <asm/io.h>
+#include <asm/apic.h>
+#include <asm/spinlock.h>
+#include <asm/div64.h>
+
+extern void apic_timer_interrupt(void);
+extern void reschedule_interrupt(void);
+extern void invalidate_interrupt(void);
+extern void spurious_interrupt(void);
+extern char trampoline_data[], trampoline_end[], tramp_gdt_descr[];
+
+int smp_num_cpus = 1;
+volatile unsigned long cpu_online_map = 1;
+unsigned long cpu_apicid[NR_CPUS];
+
+// 大内核锁，引导时由 CPU 0 持有(任务 0 的 lock_depth 为 1)，main() 进入用户态之前释放
+spinlock_t kernel_flag = {1};
+
+static volatile unsigned long flush_cpumask;    // 需要刷新 TLB、还没有完成的 CPU
+
+static int smp_found_cpus = 0;                  // 配置表中可用的处理器数
+static unsigned long found_apicid[NR_CPUS];
+static int smp_imcr = 0;                        // 有 IMCR，需要把 8259A 的输出从 CPU 的 INTR 引脚切换到 APIC
+static unsigned long apic_timer_count;          // 本地 APIC 定时器每个滴答的计数值
+
+// 内核空间最后 4MB(页目录项 255)的页表: 最后一项映射本地 APIC，1021-1022 项是读配置表用的临时窗口
+// (配置表可能在 16MB 以上没有映射的物理内存中)
+static unsigned long smp_pg_table[1024] __attribute__((aligned(PAGE_SIZE)));
+#define SMP_PGDIR       255
+#define MAP_WINDOW      1021
+
+// AP 的实模式启动代码，STARTUP 中断的向量号是它的页号，必须在 1MB 以下
+static char trampoline_page[PAGE_SIZE] __attribute__((aligned(PAGE_SIZE)));
+
+// trampoline.s 进入保护模式后使用的参数
+struct desc_ptr {
+    unsigned short limit;
+    unsigned long base;
+} __attribute__((packed)) ap_idt_descr;
+unsigned long ap_cr0, ap_cr4;
+struct {
+    long *a;
+    short b;
+} ap_stack = {NULL, 0x10};
+
+#define cpu_set_online(cpu) \
+    __asm__ volatile("lock ; btsl %1, %0" : "+m" (cpu_online_map) : "Ir" (cpu))
+#define cpu_clear_flush(cpu) \
+    __asm__ volatile("lock ; btrl %1, %0" : "+m" (flush_cpumask) : "Ir" (cpu))
+#define local_flush_tlb() \
+    __asm__ volatile("mov %%cr3, %%eax ; mov %%eax, %%cr3" ::: "eax", "memory")
+
+// 本 CPU 被要求刷新 TLB 时刷新并清除请求
+static inline void flush_tlb_pending(int cpu) {
+    if (flush_cpumask & (1ul << cpu)) {
+        local_flush_tlb();
+        cpu_clear_flush(cpu);
+    }
+}
+
+void lock_kernel(void) {
+    struct task_struct *p = current;
+    unsigned long flags;
+
+    if (p->lock_depth) {                // 本 CPU 已经持有(被中断的内核代码属于同一任务)
+        p->lock_depth++;
+        return;
+    }
+    for (;;) {
+        save_flags(flags);
+        cli();
+        if (spin_trylock(&kernel_flag)) {
+            p->lock_depth = 1;
+            restore_flags(flags);
+            return;
+        }
+        restore_flags(flags);
+        while (kernel_flag.lock) {
+            flush_tlb_pending(p->processor);
+            cpu_relax();
+        }
+    }
+}
+
+void unlock_kernel(void) {
+    struct task_struct *p = current;
+    unsigned long flags;
+
+    save_flags(flags);
+    cli();
+    if (!--p->lock_depth)
+        spin_unlock(&kernel_flag);
+    restore_flags(flags);
+}
+
+// 空闲时完全释放大内核锁，返回原来的嵌套深度，调用时已关中断
+int release_kernel_lock(void) {
+    int depth = current->lock_depth;
+
+    if (depth) {
+        current->lock_depth = 0;
+        spin_unlock(&kernel_flag);
+    }
+    return depth;
+}
+
+void reacquire_kernel_lock(int depth) {
+    if (!depth)
+        return;
+    lock_kernel();
+    current->lock_depth = depth;
+}
+
+// 延迟 us 微秒。有 TSC 时按测定的频率计算，否则每次读写 0x80 端口约 1 微秒
+static void udelay(unsigned long us) {
+    unsigned long long t0, t, cycles;
+
+    if (!tsc_khz) {
+        while (us--)
+            outb(0, 0x80);
+        return;
+    }
+    cycles = div_u64((unsigned long long) tsc_khz * us, 1000);
+    rdtscll(t0);
+    do {
+        cpu_relax();
+        rdtscll(t);
+    } while (t - t0 < cycles);
+}
+
+// 把物理地址 phys 开始的两页映射到临时窗口，返回对应的线性地址。配置表的每一项都不超过一页
+static void *map_phys(unsigned long phys) {
+    unsigned long base = phys & 0xfffff000, addr = (SMP_PGDIR << 22) + (MAP_WINDOW << 12);
+
+    smp_pg_table[MAP_WINDOW] = base | 3;
+    smp_pg_table[MAP_WINDOW + 1] = (base + PAGE_SIZE) | 3;
+    __asm__ volatile("invlpg (%0)" :: "r" (addr) : "memory");
+    __asm__ volatile("invlpg (%0)" :: "r" (addr + PAGE_SIZE) : "memory");
+    return (void *) (addr + (phys & 0xfff));
+}
+
+static int checksum(unsigned char *p, unsigned long len) {
+    unsigned char sum = 0;
+
+    while (len--)
+        sum = (unsigned char) (sum + *p++);
+    return sum;
+}
+
+// 在 [base, base+len) 中按 16 字节边界查找签名 sig，长度 size 的结构校验和为 0。返回物理地址，找不到返回 0
+static unsigned long scan_sig(unsigned long base, unsigned long len, const char *sig, int siglen, unsigned long size) {
+    unsigned long addr, n;
+    unsigned char *p;
+
+    for (addr = base; addr < base + len; addr += 16) {
+        p = map_phys(addr);
+        if (strncmp((char *) p, sig, siglen))
+            continue;
+        n = size ? size : (unsigned long) p[8] * 16;     // 浮动指针结构的长度在第 8 字节
+        if (n && !checksum(p, n))
+            return addr;
+    }
+    return 0;
+}
+
+static void found_cpu(unsigned long apicid) {
+    if (smp_found_cpus < NR_CPUS)
+        found_apicid[smp_found_cpus++] = apicid;
+}
+
+/*
+ * MP 配置表(Intel MultiProcessor Specification 1.4)
+ * 浮动指针结构 "_MP_" 在扩展 BIOS 数据区的第一个 1KB 或 BIOS ROM(0xF0000-0xFFFFF)中:
+ *  4: 配置表的物理地址; 8: 长度(16 字节为单位); 11: 特性字节 1，非 0 表示使用默认配置(两个处理器);
+ *  12: 特性字节 2，位 7 表示有 IMCR。
+ * 配置表 "PCMP": 34: 表项数; 36: 本地 APIC 的物理地址; 44 字节之后是表项，
+ * 处理器表项(类型 0)20 字节: 1: 本地 APIC ID，3: 位 0 表示可用; 其他表项都是 8 字节
+ */
+static int mp_scan_config(unsigned long *lapic) {
+    unsigned long mpf, mpc, entry;
+    unsigned char *p;
+    int i, count;
+
+    if (!(mpf = scan_sig(0x9fc00, 0x400, "_MP_", 4, 0)) && !(mpf = scan_sig(0xf0000, 0x10000, "_MP_", 4, 0)))
+        return 0;
+    p = map_phys(mpf);
+    mpc = *(unsigned long *) (p + 4);
+    smp_imcr = p[12] & 0x80;
+    if (p[11]) {                        // 默认配置
+        found_cpu(0);
+        found_cpu(1);
+        return 1;
+    }
+    if (!mpc)
+        return 0;
+    p = map_phys(mpc);
+    if (strncmp((char *) p, "PCMP", 4))
+        return 0;
+    count = *(unsigned short *) (p + 34);
+    *lapic = *(unsigned long *) (p + 36);
+    for (i = 0, entry = mpc + 44; i < count; i++) {
+        p = map_phys(entry);
+        if (p[0]) {
+            entry += 8;
+            continue;
+        }
+        if (p[3] & 1)
+            found_cpu(p[1]);
+        entry += 20;
+    }
+    return 1;
+}
+
+/*
+ * ACPI MADT(多 APIC 描述表)
+ * "RSD PTR " 在扩展 BIOS 数据区的第一个 1KB 或 0xE0000-0xFFFFF 中，前 20 字节校验和为 0，16: RSDT 的物理地址。
+ * 各表都以 36 字节的表头开始(0: 签名，4: 长度)，RSDT 之后是 32 位的表地址。
+ * MADT("APIC"): 36: 本地 APIC 的物理地址，44 字节之后是变长表项(0: 类型，1: 长度)，
+ * 类型 0 是处理器的本地 APIC: 3: APIC ID，4: 位 0 表示可用
+ */
+static int acpi_scan_config(unsigned long *lapic) {
+    unsigned long rsdp, rsdt, madt, len, i, entry, end;
+    unsigned char *p;
+
+    if (!(rsdp = scan_sig(0x9fc00, 0x400, "RSD PTR ", 8, 20)) && !(rsdp = scan_sig(0xe0000, 0x20000, "RSD PTR ", 8, 20)))
+        return 0;
+    rsdt = *(unsigned long *) ((unsigned char *) map_phys(rsdp) + 16);
+    p = map_phys(rsdt);
+    if (strncmp((char *) p, "RSDT", 4))
+        return 0;
+    len = *(unsigned long *) (p + 4);
+    for (i = 36; i + 4 <= len; i += 4) {
+        madt = *(unsigned long *) ((unsigned char *) map_phys(rsdt + i));
+        p = map_phys(madt);
+        if (strncmp((char *) p, "APIC", 4))
+            continue;
+        end = madt + *(unsigned long *) (p + 4);
+        *lapic = *(unsigned long *) (p + 36);
+        for (entry = madt + 44; entry + 2 <= end; entry += p[1]) {
+            p = map_phys(entry);
+            if (p[1] < 2)               // 损坏的表项
+                break;
+            if (p[0] == 0 && (*(unsigned long *) (p + 4) & 1))
+                found_cpu(p[3]);
+        }
+        return 1;
+    }
+    return 0;
+}
+
+// 查找处理器列表，并把本地 APIC 映射到 APIC_BASE。必须在 buffer_init() 覆盖扩展 BIOS 数据区之前调用，
+// 在第一次 fork 之前调用(进程的页目录从 pg_dir 复制内核空间的目录项)
+void smp_scan_config(void) {
+    unsigned long lapic = 0xfee00000;
+
+    if (!(x86_capability & X86_FEATURE_APIC))
+        return;
+    memset(smp_pg_table, 0, sizeof(smp_pg_table));
+    pg_dir[SMP_PGDIR] = (unsigned long) smp_pg_table | 3;
+    if (!mp_scan_config(&lapic) && !acpi_scan_config(&lapic)) {
+        pg_dir[SMP_PGDIR] = 0;
+        return;
+    }
+    smp_pg_table[MAP_WINDOW] = smp_pg_table[MAP_WINDOW + 1] = 0;
+    smp_pg_table[1023] = (lapic & 0xfffff000) | 0x1b;      // 禁止缓存、写透、可写、存在
+    __asm__ volatile("invlpg (%0)" :: "r" (APIC_BASE) : "memory");
+    printk("SMP: %d CPUs found\n", smp_found_cpus);
+}
+
+// 打开本 CPU 的本地 APIC。只有 BSP 接收 8259A 的中断(LINT0)和 NMI(LINT1)
+static void setup_local_apic(int bsp) {
+    apic_write(APIC_TPR, 0);
+    apic_write(APIC_SVR, APIC_SVR_ENABLE | SPURIOUS_APIC_VECTOR);
+    apic_write(APIC_LVTT, APIC_LVT_MASKED | LOCAL_TIMER_VECTOR);
+    apic_write(APIC_LVT0, bsp ? APIC_DM_EXTINT : APIC_LVT_MASKED);
+    apic_write(APIC_LVT1, bsp ? APIC_DM_NMI : APIC_LVT_MASKED);
+    apic_write(APIC_LVTERR, APIC_LVT_MASKED);
+    apic_write(APIC_ESR, 0);
+    apic_write(APIC_EOI, 0);
+}
+
+// 用 8253 的滴答测定本地 APIC 定时器(16 分频)每个滴答的计数值，调用时已开中断
+#define CALIBRATE_TICKS 10
+
+static unsigned long calibrate_apic_timer(void) {
+    long t;
+
+    apic_write(APIC_TDCR, APIC_TDR_DIV_16);
+    t = jiffies;
+    while (jiffies == t)                // 从滴答的边界开始
+        ;
+    apic_write(APIC_TMICT, 0xffffffff);
+    t = jiffies;
+    while (jiffies - t < CALIBRATE_TICKS)
+        ;
+    return (0xffffffff - apic_read(APIC_TMCCT)) / CALIBRATE_TICKS;
+}
+
+static void apic_wait_icr_idle(void) {
+    while (apic_read(APIC_ICR) & APIC_ICR_BUSY)
+        cpu_relax();
+}
+
+// 发送处理器间中断，调用时已关中断(ICR2 和 ICR 要一起写)
+static void send_ipi(unsigned long apicid, unsigned long cmd) {
+    apic_wait_icr_idle();
+    apic_write(APIC_ICR2, apicid << 24);
+    apic_write(APIC_ICR, cmd);
+}
+
+// AP 的空闲任务: 复制任务 0，在 CPU cpu 上运行，不在任何就绪队列中
+static struct task_struct *alloc_idle_task(int cpu) {
+    struct task_struct *p;
+
+    if (!(p = (struct task_struct *) get_free_page()))
+        return NULL;
+    *p = *task[0];
+    p->processor = cpu;
+    p->on_rq = 0;
+    p->need_resched = 0;
+    p->lock_depth = 0;
+    p->preempt_count = 0;
+    p->utime = p->stime = 0;
+    p->sum_exec_runtime = p->prev_sum_exec_runtime = 0;
+    p->tss.esp0 = PAGE_SIZE + (long) p;
+    init_timer(&p->alarm_timer);
+    memset(&p->sched_info, 0, sizeof(p->sched_info));
+    return p;
+}
+
+// 启动 CPU cpu(本地 APIC ID 为 apicid)，成功返回 1
+static int boot_cpu(int cpu, unsigned long apicid) {
+    struct task_struct *idle;
+    unsigned long flags;
+    long timeout;
+    int i;
+
+    if (!(idle = alloc_idle_task(cpu)))
+        return 0;
+    init_tss[cpu].esp0 = idle->tss.esp0;
+    init_tss[cpu].ss0 = 0x10;
+    init_tss[cpu].trace_bitmap = 0x80000000;
+    set_tss_desc(gdt + FIRST_TSS_ENTRY + 2 * cpu, &init_tss[cpu]);
+    cpu_rq(cpu)->curr = cpu_rq(cpu)->idle = idle;
+    cpu_apicid[cpu] = apicid;
+    ap_stack.a = (long *) idle->tss.esp0;
+
+    // INIT(电平触发，先置位再撤销)，等 10ms，再发两次 STARTUP
+    save_flags(flags);
+    cli();
+    apic_write(APIC_ESR, 0);
+    send_ipi(apicid, APIC_INT_LEVELTRIG | APIC_INT_ASSERT | APIC_DM_INIT);
+    udelay(200);
+    send_ipi(apicid, APIC_INT_LEVELTRIG | APIC_DM_INIT);
+    udelay(10000);
+    for (i = 0; i < 2; i++) {
+        send_ipi(apicid, APIC_DM_STARTUP | ((unsigned long) trampoline_page >> 12));
+        udelay(200);
+    }
+    apic_wait_icr_idle();
+    restore_flags(flags);
+
+    timeout = jiffies + HZ;
+    while (!(cpu_online_map & (1ul << cpu)) && jiffies - timeout < 0)
+        cpu_relax();
+    if (cpu_online_map & (1ul << cpu))
+        return 1;
+    printk("SMP: CPU %d (APIC %d) not responding\n", cpu, apicid);
+    cpu_rq(cpu)->curr = cpu_rq(cpu)->idle = NULL;
+    free_page((unsigned long) idle);
+    return 0;
+}
+
+// 启动所有 AP，在 mem_init() 之后、进入用户态之前调用(持有大内核锁，已开中断)
+void smp_boot_cpus(void) {
+    struct desc_ptr gdt_descr;
+    unsigned long bsp_id;
+    int i, cpu;
+
+    if (smp_found_cpus < 2)
+        return;
+    if (smp_imcr) {                     // PIC 方式切换到对称 I/O 方式
+        outb(0x70, 0x22);
+        outb(0x01, 0x23);
+    }
+    bsp_id = apic_read(APIC_ID) >> 24;
+    cpu_apicid[0] = bsp_id;
+    setup_local_apic(1);
+    set_intr_gate(LOCAL_TIMER_VECTOR, &apic_timer_interrupt);
+    set_intr_gate(RESCHEDULE_VECTOR, &reschedule_interrupt);
+    set_intr_gate(INVALIDATE_TLB_VECTOR, &invalidate_interrupt);
+    set_intr_gate(SPURIOUS_APIC_VECTOR, &spurious_interrupt);
+    apic_timer_count = calibrate_apic_timer();
+
+    // 启动代码和它使用的 GDT 描述符，AP 与 BSP 使用相同的 GDT、IDT 和控制寄存器
+    memcpy(trampoline_page, trampoline_data, trampoline_end - trampoline_data);
+    __asm__ volatile("sgdt %0" : "=m" (gdt_descr));
+    memcpy(trampoline_page + (tramp_gdt_descr - trampoline_data), &gdt_descr, 6);
+    __asm__ volatile("sidt %0" : "=m" (ap_idt_descr));
+    __asm__ volatile("mov %%cr0, %0" : "=r" (ap_cr0));
+    __asm__ volatile("mov %%cr4, %0" : "=r" (ap_cr4));
+
+    for (i = 0, cpu = 1; i < smp_found_cpus && cpu < NR_CPUS; i++) {
+        if (found_apicid[i] == bsp_id)
+            continue;
+        if (boot_cpu(cpu, found_apicid[i])) {
+            smp_num_cpus++;
+            cpu++;
+        }
+    }
+    printk("SMP: %d CPUs online\n", smp_num_cpus);
+}
+
+// AP 在 trampoline.s 中进入保护模式后，在空闲任务的栈上调用
+void start_secondary(void) {
+    int cpu = current->processor;
+
+    __asm__("pushfl; andl $0xffffbfff, (%esp); popfl");    // 清除 NT
+    ltr(cpu);
+    lldt(0);
+    setup_local_apic(0);
+    apic_write(APIC_TDCR, APIC_TDR_DIV_16);
+    apic_write(APIC_TMICT, apic_timer_count);
+    apic_write(APIC_LVTT, APIC_LVT_TIMER_PERIODIC | LOCAL_TIMER_VECTOR);
+    cpu_set_online(cpu);
+    lock_kernel();
+    for (;;) {
+        cpu_idle();
+        schedule();
+    }
+}
+
+// 让 CPU cpu 重新调度
+void smp_send_reschedule(int cpu) {
+    unsigned long flags;
+
+    save_flags(flags);
+    cli();
+    send_ipi(cpu_apicid[cpu], APIC_DM_FIXED | RESCHEDULE_VECTOR);
+    restore_flags(flags);
+}
+
+// 让其他 CPU 刷新 TLB 并等待完成，调用者持有大内核锁(同一时刻只有一个 CPU 在等待)
+void smp_flush_tlb(void) {
+    unsigned long flags, mask = cpu_online_map & ~(1ul << smp_processor_id());
+
+    if (!mask)
+        return;
+    flush_cpumask = mask;
+    save_flags(flags);
+    cli();
+    apic_wait_icr_idle();
+    apic_write(APIC_ICR, APIC_DEST_ALLBUT | APIC_DM_FIXED | INVALIDATE_TLB_VECTOR);
+    restore_flags(flags);
+    while (flush_cpumask)
+        cpu_relax();
+}
+
+// 刷新 TLB 的处理器间中断，在 system_call.s 中被调用
+void smp_invalidate_interrupt(void) {
+    flush_tlb_pending(smp_processor_id());
+    apic_write(APIC_EOI, 0);
+}
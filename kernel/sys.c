@@ -1,19 +1,131 @@
+#include <errno.h>
 #include <unistd.h>
+#include <sys/resource.h>
 #include <linux/head.h>
 #include <linux/sched.h>
+#include <linux/kernel.h>
+#include <linux/mm.h>
+#include <asm/segment.h>
 #include <serial_debug.h>
 
-extern int sys_alarm(long seconds);
-
 int stub_syscall(void) {
     return 0;
 }
 
+// 睡眠 seconds 秒，被信号唤醒时提前返回，返回没有睡完的秒数。
+// 原来借用 alarm 实现，会覆盖进程的报警并发送 SIGALRM，现在使用单独的定时器
 int sys_sleep(long seconds) {
+    long left;
     // s_printk("sys_sleep entered seconds = %d\n", seconds);
 
-    sys_alarm(seconds);
+    if (seconds <= 0)
+        return 0;
     current->state = TASK_INTERRUPTIBLE;
-    schedule();
+    left = schedule_timeout(HZ * seconds);
+    return (int) ((left + HZ - 1) / HZ);
+}
+
+// 设置数据段末尾(堆顶) brk，返回新的 brk；参数为 0 或不合法时不做修改，返回当前的 brk。
+// 扩大时只调整代码段和数据段的限长，不分配内存，新页面在第一次访问时由 do_no_page()
+// 映射清零的页面；缩小时释放超出部分的页面。brk 不能低于 end_data(堆的起始处)。
+// 任务 0 的线性地址就是物理地址，640KB 以上是显存和 BIOS，不允许扩展；
+// vfork 的子进程借用父进程的地址空间，也不允许修改。
+int sys_brk(unsigned long end_data_seg) {
+    unsigned long old_limit, new_limit;
+
+    if (current == task[0] || (current->flags & PF_VFORK))
+        return (int)current->brk;
+    if (end_data_seg < current->end_data || end_data_seg > TASK_SIZE)
+        return (int)current->brk;
+    new_limit = (end_data_seg + 0xfff) & 0xfffff000;
+    old_limit = get_limit(0x17);
+    if (new_limit < old_limit)
+        unmap_page_range(get_base(current->ldt[2]) + new_limit, old_limit - new_limit);
+    if (new_limit != old_limit) {
+        set_limit(current->ldt[1], new_limit);
+        set_limit(current->ldt[2], new_limit);
+    }
+    current->brk = end_data_seg;
+    return (int)current->brk;
+}
+
+// 取当前进程(RUSAGE_SELF)或已等待过的子进程(RUSAGE_CHILDREN)的资源使用情况。
+// 各项都是进程结构中随缺页和时钟中断维护的计数，O(1)
+int sys_getrusage(int who, struct rusage *ru) {
+    unsigned long rss = 0;
+
+    if (who != RUSAGE_SELF && who != RUSAGE_CHILDREN)
+        return -EINVAL;
+    verify_area(ru, sizeof(*ru));
+    if (who == RUSAGE_SELF) {
+        if ((unsigned long) current->tss.cr3 >= LOW_MEM)
+            rss = pgd_rss(current->tss.cr3);
+        put_fs_long((unsigned long) current->utime, (unsigned long *) &ru->ru_utime);
+        put_fs_long((unsigned long) current->stime, (unsigned long *) &ru->ru_stime);
+        put_fs_long(current->min_flt, (unsigned long *) &ru->ru_minflt);
+        put_fs_long(current->maj_flt, (unsigned long *) &ru->ru_majflt);
+    } else {
+        put_fs_long((unsigned long) current->cutime, (unsigned long *) &ru->ru_utime);
+        put_fs_long((unsigned long) current->cstime, (unsigned long *) &ru->ru_stime);
+        put_fs_long(current->cmin_flt, (unsigned long *) &ru->ru_minflt);
+        put_fs_long(current->cmaj_flt, (unsigned long *) &ru->ru_majflt);
+    }
+    put_fs_long(rss, (unsigned long *) &ru->ru_rss);
     return 0;
-}
\ No newline at end of file
+}
+
+// 任务 p 是否属于 setpriority/getpriority 的 which 和 who 指定的范围(who 为 0 时指当前进程、进程组或用户)
+static int prio_match(struct task_struct *p, int which, int who) {
+    switch (which) {
+        case PRIO_PROCESS:
+            return p->pid == (who ? who : current->pid);
+        case PRIO_PGRP:
+            return p->pgrp == (who ? who : current->pgrp);
+        case PRIO_USER:
+            return p->uid == (who ? (unsigned short) who : current->uid);
+    }
+    return 0;
+}
+
+// 设置 which 和 who 指定的所有进程的 nice 值。只能修改有效用户相同的进程，只有超级用户能降低 nice 值
+int sys_setpriority(int which, int who, int niceval) {
+    struct task_struct **p;
+    int error = -ESRCH;
+
+    if (which < PRIO_PROCESS || which > PRIO_USER)
+        return -EINVAL;
+    if (niceval < MIN_NICE)
+        niceval = MIN_NICE;
+    else if (niceval > MAX_NICE)
+        niceval = MAX_NICE;
+    for (p = &LAST_TASK; p > &FIRST_TASK; --p) {
+        if (!*p || !prio_match(*p, which, who))
+            continue;
+        if ((*p)->uid != current->euid && (*p)->euid != current->euid && !suser()) {
+            error = -EPERM;
+            continue;
+        }
+        if (niceval < (*p)->nice && !suser()) {
+            error = -EACCES;
+            continue;
+        }
+        set_user_nice(*p, niceval);
+        if (error == -ESRCH)
+            error = 0;
+    }
+    return error;
+}
+
+// 取 which 和 who 指定的进程中最小的 nice 值。为了不与错误号混淆，返回 20 - nice(1..40)，由库函数换算
+int sys_getpriority(int which, int who) {
+    struct task_struct **p;
+    int max_prio = -ESRCH;
+
+    if (which < PRIO_PROCESS || which > PRIO_USER)
+        return -EINVAL;
+    for (p = &LAST_TASK; p > &FIRST_TASK; --p) {
+        if (*p && prio_match(*p, which, who) && 20 - (*p)->nice > max_prio)
+            max_prio = 20 - (*p)->nice;
+    }
+    return max_prio;
+}
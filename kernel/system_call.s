@@ -6,6 +6,12 @@
  * 这些中断会在内核态或用户态随机发生，若在这些中断过程中也处理信号识别的话，
  * 就有可能与系统调用中断和时钟中断过程中对信号的识别处理过程相冲突，违反了内核代码非抢占原则。
  * 因此系统既无必要在这些“其他”中断中处理信号，也不允许这样做。
+ * 现在键盘和硬盘中断也经过 ret_from_intr 退出: 只在中断了用户态程序时才检查 need_resched 和信号，
+ * 这时没有内核代码被打断，与时钟中断的处理相同。这样中断处理程序唤醒的高优先级任务不必等到下一个滴答。
+ *
+ * 多处理器: 系统调用和中断进入内核时获取大内核锁(lock_kernel)，从 restore_all 返回前释放(kernel/smp.c)，
+ * 原来"内核态不被抢占、关中断即互斥"的代码在多个 CPU 上仍然成立。当前任务由 esp 所在页得到，不再读全局变量。
+ * 应用处理器的时钟中断来自本地 APIC 定时器(apic_timer_interrupt)，处理器之间的中断用于重新调度和刷新 TLB。
  *
  * Stack layout in 'ret_from_system_call':
  *
@@ -24,7 +30,8 @@
  */
 
 # 定义入口点
-.global timer_interrupt, system_call, sys_fork, hd_interrupt
+.global timer_interrupt, system_call, sys_fork, sys_vfork, sys_spawn, hd_interrupt, ret_from_fork, ret_from_intr
+.global apic_timer_interrupt, reschedule_interrupt, invalidate_interrupt, spurious_interrupt
 
 # 堆栈中各个寄存器的偏移位置
 EAX = 0x00
@@ -40,7 +47,7 @@ EFLAGS = 0x24
 OLDESP = 0x28			 # 当特权级发生变化时栈会切换，用户栈指针被保存在内核态中。
 OLDSS = 0x2C
 
-nr_system_calls = 72 + 3 # sys_debug
+nr_system_calls = 72 + 3 + 2 + 2 + 4 + 2 + 1 + 2 + 3 # sys_debug, vfork, spawn, mmap, munmap, shm*, getrusage, meminfo, schedstat, set/getpriority, sched_*
 
 # 以下是任务结构（task_struct）中变量偏移值，参见 sched.h
 state = 0				# 进程状态码
@@ -50,6 +57,16 @@ signal	= 12    		# 是信号位图，每个bit代表一种信号，信号值=位
 sigaction = 16			# MUST be 16 (=len of sigaction),
 						# 信号执行属性结构数组的偏移量，对应信号将要执行的操作和标志信息。
 blocked = (33*16)   	# 受阻塞信号位图的偏移量
+need_resched = (33*16+4)	# 需要重新调度
+
+# 本地 APIC 的 EOI 寄存器，见 include/asm/apic.h
+APIC_EOI = 0x3ffff0b0
+
+# 取当前任务: 任务结构与内核栈在同一页，esp 所在页的开头就是当前任务
+.macro GET_CURRENT reg
+	movl %esp, \reg
+	andl $0xfffff000, \reg
+.endm
 
 
 ### 错误的系统调用号
@@ -85,25 +102,28 @@ system_call:
 # 注意，在 linux 0.11 中内核给任务分配的代码段和数据段是重叠的，它们的段地址和段限长相同
 	movl $0x17, %edx
 	mov %dx, %fs
+	pushl %eax								# 获取大内核锁，在 restore_all 释放
+	call lock_kernel
+	popl %eax
 	call *sys_call_table(, %eax, 4)			# 调用地址 = [system_call_table + %eax * 4], sys_call_table[]是一个指针数组，定义在include/linux/sys.h中
 	pushl %eax								# 把系统调用返回值入栈
 # 接下来查看当前任务的运行状态。如果上面 c 函数的操作或其它情况而使进程的状态从执行态变成其它状态
 # 如果不在就绪状态(state != 0)就去执行调度程序。
-# 如果该任务在就绪状态，但其时间片已用完(counter = 0),则也去执行调度程序。
+# 如果该任务在就绪状态，但其时间片已用完或唤醒了优先级更高的任务(need_resched),则也去执行调度程序。
 # 例如当后台进程组中的进程执行控制终端读写操作时，那么默认条件下该后台进程组所有进程会收到 SIGTTIN 或 SIGTTOU 信号，
 # 导致进程组中所有进程处于停止状态。而当前进程则会立刻返回。
-	movl current, %eax						# 取当前任务数据结构地址 -> eax
+	GET_CURRENT %eax						# 取当前任务数据结构地址 -> eax
 	cmpl $0, state(%eax)					# 如果不在就绪状态，就去调度程序
 	jne reschedule
-	cmpl $0, counter(%eax)					# 时间片已用完，则去调度程序
-	je reschedule
+	cmpl $0, need_resched(%eax)				# 需要重新调度，则去调度程序
+	jne reschedule
 
 # 由于在执行 jmp schedule 之前把返回地址 ret_from_syscall 入栈，因此执行完 schedule() 后最终会返回到 ret_from_syscall 继续执行
 # 从系统调用c函数返回后，对信号进行识别处理其它中断服务程序退出时也将跳转到这里进行处理后才退出中断过程
 # 例如后面的处理器出错中断 int 16.
 ret_from_syscall:
 	# 首先判别当前任务是否是初始任务task0,如果是则不比对其进行信号量方面的处理，直接返回。
-	movl current, %eax
+	GET_CURRENT %eax
 	cmpl task, %eax
 	je 3f
 	# 通过对原调用程序代码选择符的检查来判断调用程序是否是用户任务。如果不是则直接退出中断。
@@ -131,7 +151,9 @@ ret_from_syscall:
 	pushl %ecx                      # 信号值入栈作为调用do_signal的参数之一
 	call do_signal                  # 调用C函数信号处理程序(kernel/signal.c)
 	popl %eax                       # 弹出入栈的信号值
-3:	popl %eax						# eax 中含有上面入栈系统调用的返回值
+restore_all:
+3:	call unlock_kernel				# 释放大内核锁(嵌套时只减少深度)
+	popl %eax						# eax 中含有上面入栈系统调用的返回值
 	popl %ebx
 	popl %ecx
 	popl %edx
@@ -140,6 +162,31 @@ ret_from_syscall:
 	pop %ds
 	iret									# 中断返回意味着进程0从内核态转换成用户态
 
+### 硬件中断(键盘、硬盘)的公共出口，栈上的现场与系统调用相同
+# 中断了内核代码时直接返回，内核只在抢占点(cond_resched)让出 CPU。
+# 中断了用户态程序时，中断处理程序可能唤醒了优先级更高的任务(need_resched)，先去调度，再处理信号。
+.align 2
+ret_from_intr:
+	testl $3, CS(%esp)				# 被中断代码的特权级为 0
+	je restore_all
+	GET_CURRENT %eax
+	cmpl $0, need_resched(%eax)
+	jne reschedule
+	jmp ret_from_syscall
+
+### 新进程第一次被调度时 switch_to 跳到这里(栈上的现场由 fork.c 中 copy_thread() 构造)
+# 弹出 switch_to 恢复的寄存器，开中断(schedule() 在关中断时切换)，然后像系统调用一样返回用户态
+.align 2
+ret_from_fork:
+	pop %gs
+	pop %fs
+	popl %ebp
+	popl %edi
+	popl %esi
+	popl %ebx
+	sti
+	jmp ret_from_syscall
+
 ### int32 - (int 0x20) 时钟中断处理程序。中断频率被设置为 100Hz。
 # 定时芯片 8253/8254 是在 kernel/sched.c 中初始化的。因此这里 jiffies 每 10ms 加 1.
 # 这段代码将 jiffies 增 1，发送结束中断指令给 8259控制器，然后用当前特权级作为
@@ -162,6 +209,7 @@ timer_interrupt:
 # 由于初始化中断芯片时没有采用自动EOI，所以这里需要发指令结束该硬件中断
 	movb $0x20, %al         # EOI to interrupt controller #1
 	outb %al, $0x20			# 操作命令字OCW2送0x20端口
+	call lock_kernel
 # 下面从栈中取出执行系统调用代码的选择符（cs段寄存器值）中的当前特权级别（0或3）并压入堆栈,
 # 作为do_timer的参数， do_timer() 函数执行任务切换、计时等工作，在kernel/sched.c
 	movl CS(%esp), %eax
@@ -171,11 +219,19 @@ timer_interrupt:
 	addl $4, %esp			# task switching to accounting ...
 	jmp ret_from_syscall
 
+# copy_process() 的 clone_flags 参数，与 sched.h 中定义相同
+CLONE_VFORK = 0x01
+CLONE_SPAWN = 0x02
+
 ### sys_fork()调用，用于创建子进程，是system_call功能2.
 # 首先调用C函数find_empty_process()，取得一个进程号PID。若返回负数则说明目前任务数组
 # 已满。然后调用copy_process()复制进程。
+# sys_vfork/sys_spawn 与 sys_fork 共用下面的代码，只是用 ebx 传入不同的 clone_flags。
+# ebx 在C函数中会被保存，而用户的 ebx 已经保存在栈中，返回时会恢复。
 .align 2
 sys_fork:
+	xorl %ebx, %ebx			# clone_flags = 0, 完整复制地址空间
+do_fork:
 	call find_empty_process	# 在 fork.c 中
 	testl %eax, %eax		# 在eax中返回进程号pid，若返回负数则退出
 	js 1f
@@ -183,11 +239,25 @@ sys_fork:
 	pushl %esi
 	pushl %edi
 	pushl %ebp
+	pushl %ebx				# clone_flags
 	pushl %eax
 	call copy_process		# 在 fork.c 中
-	addl $20, %esp			# 丢弃这里所有压栈内容
+	addl $24, %esp			# 丢弃这里所有压栈内容
 1: 	ret
 
+### sys_vfork(), 子进程借用父进程的地址空间，父进程睡眠到子进程退出
+.align 2
+sys_vfork:
+	movl $CLONE_VFORK, %ebx
+	jmp do_fork
+
+### sys_spawn(entry, arg), 子进程从 entry 开始执行，使用新的用户栈
+# 参数 entry、arg 已作为 ebx、ecx 保存在栈中，由 copy_process() 取用
+.align 2
+sys_spawn:
+	movl $CLONE_SPAWN, %ebx
+	jmp do_fork
+
 ### int46 - (int 0x2e)硬盘中断处理程序，响应硬件中断请求IRQ4。
 # 当请求的硬盘操作完成或出错就会发出此中断信号。
 # 首先向8259A中断控制从芯片发送结束硬件中断指令(EOI),然后取变量do_hd中的函数指针
@@ -195,17 +265,19 @@ sys_fork:
 # 赋值指向unexpected_hd_interrupt(),用于显示出错信息。随后向8259A主芯片送EOI指令，
 # 并调用edx中指针指向的函数：read_intr(), write_intr()或 unexpected_hd_interrupt().
 hd_interrupt:
-	pushl %eax
-	pushl %ecx
-	pushl %edx
-	push %ds
+	push %ds				# 与系统调用相同的现场，从 ret_from_intr 退出
 	push %es
 	push %fs
+	pushl %edx
+	pushl %ecx
+	pushl %ebx
+	pushl %eax
 	movl $0x10,%eax			# ds，es指向内核数据段
 	mov %ax,%ds
 	mov %ax,%es
 	movl $0x17,%eax			# fs 置为指向局部数据段（程序的数据段）
 	mov %ax,%fs
+	call lock_kernel
 # 由于初始化中断控制芯片时没有采用自动EOI，所以这里需要发指令结束该硬件中断
 	movb $0x20, %al
 	outb %al, $0xA0			# EOI to interrupt controller #1
@@ -221,10 +293,72 @@ hd_interrupt:
 	movl $unexpected_hd_interrupt, %edx
 1:	outb %al, $0x20							# 送主8259A中断控制器EOI命令(结束硬件中断)
 	call *%edx 								# "interesting" way of handling intr.
-	pop %fs                     			# 上句调用 do_hd 指向C函数
+	jmp ret_from_intr						# 上句调用 do_hd 指向C函数
+### int 0x30 - 本地 APIC 定时器中断，应用处理器的时钟中断(kernel/smp.c 中设置为周期方式，HZ 次每秒)。
+# 与 timer_interrupt 相同，但不增加 jiffies、不处理定时器，只做本 CPU 的调度和计时
+.align 2
+apic_timer_interrupt:
+	push %ds
+	push %es
+	push %fs
+	push %edx
+	push %ecx
+	push %ebx
+	push %eax
+	movl $0x10, %eax
+	mov %ax, %ds
+	mov %ax, %es
+	movl $0x17, %eax
+	mov %ax, %fs
+	movl $0, APIC_EOI		# 本地 APIC 的 EOI
+	call lock_kernel
+	movl CS(%esp), %eax
+	andl $3, %eax
+	pushl %eax
+	call do_local_timer		# 'do_local_timer(long CPL)'
+	addl $4, %esp
+	jmp ret_from_syscall
+
+### int 0x31 - 其他 CPU 唤醒了本 CPU 上的任务，请求重新调度(need_resched 已经置位)。
+# 中断本身不做事情: 从 ret_from_intr 返回用户态前会检查 need_resched; 空闲时则从 hlt 醒来
+.align 2
+reschedule_interrupt:
+	push %ds
+	push %es
+	push %fs
+	pushl %edx
+	pushl %ecx
+	pushl %ebx
+	pushl %eax
+	movl $0x10, %eax
+	mov %ax, %ds
+	mov %ax, %es
+	movl $0x17, %eax
+	mov %ax, %fs
+	movl $0, APIC_EOI
+	call lock_kernel
+	jmp ret_from_intr
+
+### int 0x32 - 刷新 TLB。发送方持有大内核锁并等待各 CPU 完成，所以这里不能获取锁
+.align 2
+invalidate_interrupt:
+	pushl %eax
+	pushl %ecx
+	pushl %edx
+	push %ds
+	push %es
+	movl $0x10, %eax
+	mov %ax, %ds
+	mov %ax, %es
+	call smp_invalidate_interrupt	# 在 kernel/smp.c 中，也负责 EOI
 	pop %es
 	pop %ds
 	popl %edx
 	popl %ecx
 	popl %eax
-	iret
\ No newline at end of file
+	iret
+
+### int 0xff - 本地 APIC 的伪中断，不需要 EOI
+.align 2
+spurious_interrupt:
+	iret
@@ -0,0 +1,177 @@
+/*
+ *  内核定时器(分层时间轮)
+ *
+ *  原来 add_timer() 只有声明，报警由 schedule() 每次检查所有任务的 alarm 实现。
+ *  现在定时器挂在 5 级时间轮上，挂入和取消都是 O(1):
+ *      tv1: 256 个槽，每槽 1 个滴答，存放 256 个滴答之内到期的定时器;
+ *      tv2-tv5: 各 64 个槽，每级的一个槽覆盖上一级的全部范围(256、256*64、... 个滴答)。
+ *  定时器按 expires 与 timer_jiffies 的差放入相应一级，槽号取 expires 中该级对应的位。
+ *  run_timers() 每个滴答处理 tv1 的一个槽; tv1 转完一圈时把 tv2 的下一个槽重新分配到 tv1(必要时逐级向上)，
+ *  这样每个定时器最多被移动 4 次。
+ *
+ *  时间轮在时钟中断(关中断)中处理，进程上下文中的挂入和取消要关中断。
+ *  CPU 0 空闲时可能停止了周期时钟，挂入定时器后要检查是否需要唤醒它(见 sched.c)。
+ */
+
+#include <linux/sched.h>
+#include <linux/kernel.h>
+#include <linux/timer.h>
+#include <asm/system.h>
+
+#define TVN_BITS 6
+#define TVR_BITS 8
+#define TVN_SIZE (1 << TVN_BITS)
+#define TVR_SIZE (1 << TVR_BITS)
+#define TVN_MASK (TVN_SIZE - 1)
+#define TVR_MASK (TVR_SIZE - 1)
+
+static struct timer_list *tv1[TVR_SIZE];
+static struct timer_list *tv2[TVN_SIZE], *tv3[TVN_SIZE], *tv4[TVN_SIZE], *tv5[TVN_SIZE];
+static unsigned long timer_jiffies = 0;         // 时间轮处理到的时刻，下一个要处理的是 tv1 中这一时刻的槽
+
+// 第 n 级(tv2 为 0)中时刻 timer_jiffies 对应的槽号
+#define INDEX(n) ((timer_jiffies >> (TVR_BITS + (n) * TVN_BITS)) & TVN_MASK)
+
+// 按到期时刻把定时器挂入相应的槽(头部)，调用时已关中断
+static void internal_add_timer(struct timer_list *timer) {
+    unsigned long expires = timer->expires, idx = expires - timer_jiffies;
+    struct timer_list **vec;
+
+    if ((long) idx < 0)                         // 已经过期，下一个滴答处理
+        vec = tv1 + (timer_jiffies & TVR_MASK);
+    else if (idx < TVR_SIZE)
+        vec = tv1 + (expires & TVR_MASK);
+    else if (idx < 1ul << (TVR_BITS + TVN_BITS))
+        vec = tv2 + ((expires >> TVR_BITS) & TVN_MASK);
+    else if (idx < 1ul << (TVR_BITS + 2 * TVN_BITS))
+        vec = tv3 + ((expires >> (TVR_BITS + TVN_BITS)) & TVN_MASK);
+    else if (idx < 1ul << (TVR_BITS + 3 * TVN_BITS))
+        vec = tv4 + ((expires >> (TVR_BITS + 2 * TVN_BITS)) & TVN_MASK);
+    else
+        vec = tv5 + ((expires >> (TVR_BITS + 3 * TVN_BITS)) & TVN_MASK);
+    if ((timer->next = *vec))
+        (*vec)->pprev = &timer->next;
+    *vec = timer;
+    timer->pprev = vec;
+}
+
+// 从所在的槽中摘下定时器，调用时已关中断
+static inline void detach_timer(struct timer_list *timer) {
+    if (timer->next)
+        timer->next->pprev = timer->pprev;
+    *timer->pprev = timer->next;
+    timer->next = NULL;
+    timer->pprev = NULL;
+}
+
+void add_timer(struct timer_list *timer) {
+    unsigned long flags;
+
+    save_flags(flags);
+    cli();
+    if (timer_pending(timer))
+        panic("add_timer: timer already pending");
+    internal_add_timer(timer);
+    tick_nohz_timer_added(timer->expires);
+    restore_flags(flags);
+}
+
+int del_timer(struct timer_list *timer) {
+    unsigned long flags;
+    int ret = 0;
+
+    save_flags(flags);
+    cli();
+    if (timer_pending(timer)) {
+        detach_timer(timer);
+        ret = 1;
+    }
+    restore_flags(flags);
+    return ret;
+}
+
+int mod_timer(struct timer_list *timer, unsigned long expires) {
+    unsigned long flags;
+    int ret = 0;
+
+    save_flags(flags);
+    cli();
+    if (timer_pending(timer)) {
+        detach_timer(timer);
+        ret = 1;
+    }
+    timer->expires = expires;
+    internal_add_timer(timer);
+    tick_nohz_timer_added(expires);
+    restore_flags(flags);
+    return ret;
+}
+
+// 把高一级的槽 tv[idx] 中的定时器重新分配到低级，返回 idx。idx 为 0 时上一级也转完了一圈
+static unsigned long cascade(struct timer_list **tv, unsigned long idx) {
+    struct timer_list *timer = tv[idx], *next;
+
+    tv[idx] = NULL;
+    while (timer) {
+        next = timer->next;
+        internal_add_timer(timer);
+        timer = next;
+    }
+    return idx;
+}
+
+// 处理到 jiffies 为止到期的定时器，在时钟中断中由 do_timer() 调用
+void run_timers(void) {
+    struct timer_list *timer, **vec;
+    void (*fn)(unsigned long);
+    unsigned long data;
+
+    while ((long) ((unsigned long) jiffies - timer_jiffies) >= 0) {
+        if (!(timer_jiffies & TVR_MASK) && !cascade(tv2, INDEX(0)) &&
+                !cascade(tv3, INDEX(1)) && !cascade(tv4, INDEX(2)))
+            cascade(tv5, INDEX(3));
+        vec = tv1 + (timer_jiffies & TVR_MASK);
+        // 函数中可能重新挂入定时器(到期时刻不早于下一个滴答)，所以每次都从槽头取
+        while ((timer = *vec)) {
+            fn = timer->function;
+            data = timer->data;
+            detach_timer(timer);
+            fn(data);
+        }
+        timer_jiffies++;
+    }
+}
+
+// 从下一个滴答起，到第一个有定时器到期的滴答的滴答数，最多 max。空闲时停止周期时钟用(见 sched.c)。
+// 只查看 tv1 的槽; 遇到 tv1 转完一圈的滴答时就停在那里，因为那时才把 tv2 的定时器分配下来
+unsigned long next_timer_interrupt(unsigned long max) {
+    unsigned long n, t;
+
+    if (timer_jiffies != (unsigned long) jiffies + 1)        // 还有没处理的滴答
+        return 1;
+    for (n = 1, t = timer_jiffies; n < max; n++, t++)
+        if (tv1[t & TVR_MASK] || !(t & TVR_MASK))
+            return n;
+    return max;
+}
+
+static void process_timeout(unsigned long data) {
+    wake_up_process((struct task_struct *) data);
+}
+
+// 睡眠 timeout 个滴答，或者被提前唤醒(信号、wake_up)。调用前由调用者设置 current->state，
+// 这样在设置状态之后、睡眠之前发生的唤醒不会丢失。返回剩余的滴答数，到期返回 0
+long schedule_timeout(long timeout) {
+    struct timer_list timer;
+    unsigned long expires = (unsigned long) (jiffies + timeout);
+
+    init_timer(&timer);
+    timer.expires = expires;
+    timer.function = process_timeout;
+    timer.data = (unsigned long) current;
+    add_timer(&timer);
+    schedule();
+    del_timer(&timer);
+    timeout = (long) (expires - (unsigned long) jiffies);
+    return timeout < 0 ? 0 : timeout;
+}
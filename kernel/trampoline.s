@@ -0,0 +1,54 @@
+# 应用处理器(AP)的启动代码，见 kernel/smp.c
+#
+# trampoline_data 到 trampoline_end 之间的代码被复制到 1MB 以下按页对齐的地方，
+# AP 收到 STARTUP 处理器间中断后在实模式下从那里开始执行(cs = 页号 << 8，ip = 0)。
+# 这段代码与位置无关: 只用相对于 trampoline_data 的偏移访问数据。
+# 加载与 BSP 相同的 GDT(描述符由 smp_boot_cpus() 填入 tramp_gdt_descr)，进入保护模式，
+# 然后跳到内核中的 startup_ap 继续。
+
+.global trampoline_data, trampoline_end, tramp_gdt_descr, startup_ap
+
+.text
+.code16
+trampoline_data:
+	cli
+	movw %cs, %ax
+	movw %ax, %ds
+	lgdtl tramp_gdt_descr - trampoline_data
+	movl %cr0, %eax
+	orl $1, %eax					# PE
+	movl %eax, %cr0
+	.byte 0x66, 0xea				# ljmpl $0x08, $startup_ap
+	.long startup_ap
+	.word 0x08
+
+tramp_gdt_descr:
+	.word 0							# gdt 限长
+	.long 0							# gdt 基地址
+trampoline_end:
+
+.code32
+# 保护模式，分页还没有打开。与 head.s 相同: 先装段寄存器，再用 BSP 的 cr4(先不含 PGE)、页目录(物理地址 0)
+# 和 cr0 打开分页，最后置 PGE。栈是本 CPU 空闲任务的内核栈(ap_stack)
+startup_ap:
+	movl $0x10, %eax
+	mov %ax, %ds
+	mov %ax, %es
+	mov %ax, %fs
+	mov %ax, %gs
+	mov %ax, %ss
+	movl ap_cr4, %eax
+	andl $~0x80, %eax				# 去掉 CR4.PGE
+	movl %eax, %cr4
+	xorl %eax, %eax
+	movl %eax, %cr3
+	movl ap_cr0, %eax
+	movl %eax, %cr0
+	jmp 1f
+1:	movl ap_cr4, %eax
+	movl %eax, %cr4
+	lss ap_stack, %esp
+	lidt ap_idt_descr
+	call start_secondary			# 不会返回
+2:	hlt
+	jmp 2b
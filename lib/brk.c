@@ -0,0 +1,45 @@
+#define __LIBRARY__
+#include <unistd.h>
+#include <errno.h>
+
+static char * curbrk = NULL;            // 当前的 brk，第一次使用时向内核查询
+
+// 系统调用 brk 返回新的(失败时为原来的) brk，不是错误码
+static inline char * do_brk(char * end) {
+    long __res;
+    __asm__ volatile("int $0x80"
+            : "=a" (__res)
+            : "0" (__NR_brk), "b" ((long)(end)));
+    return (char *) __res;
+}
+
+// 把数据段末尾设置为 end_data_segment，成功返回 0
+int brk(void * end_data_segment) {
+    curbrk = do_brk((char *) end_data_segment);
+    if (curbrk != (char *) end_data_segment) {
+        errno = ENOMEM;
+        return -1;
+    }
+    return 0;
+}
+
+// 数据段增加 increment 字节，返回原来的 brk，失败返回 (void *) -1
+void * sbrk(ptrdiff_t increment) {
+    char * old;
+
+    if (!curbrk)
+        curbrk = do_brk(NULL);
+    old = curbrk;
+    if (!increment)
+        return old;
+    if ((curbrk = do_brk(old + increment)) == old + increment)
+        return old;
+    // spawn 出来的子进程的 brk 与从父进程继承来的 curbrk 不同，按内核返回的 brk 重试一次
+    if (curbrk != old) {
+        old = curbrk;
+        if ((curbrk = do_brk(old + increment)) == old + increment)
+            return old;
+    }
+    errno = ENOMEM;
+    return (void *) -1;
+}
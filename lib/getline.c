@@ -9,19 +9,17 @@ _syscall3(int ,user_tty_read, int, channel, char *, buf, int, nr)
 static inline _syscall1(int, sys_debug, char *, str)
 
 char getchar() {
-    char _buf[2048];
-    user_tty_read(0, _buf, 1);
-    return _buf[0];
+    char c;
+    user_tty_read(0, &c, 1);
+    return c;
 }
 
 int getline(char *str) {
-    char _buf[2048];
-    char ch;
+    char ch = 0;
     char *p = str;
     int len = 0;
     while(ch != '\n' && ch != EOF) {
-        user_tty_read(0, &_buf[0], 1);
-        ch = _buf[0];
+        user_tty_read(0, &ch, 1);
         *p++ = ch;
         len++;
     }
@@ -0,0 +1,119 @@
+/*
+ *  用户空间内存分配 malloc/free
+ *
+ *  小块(连同 4 字节头部不超过 2048 字节)按 2 的幂分成 8 级: 16, 32, ..., 2048 字节。
+ *  每级一个空闲链表，相当于每线程的缓存(本系统的进程只有一个执行流，不需要加锁)，
+ *  常见情况下分配和释放只是链表头的一次取出/放入，不需要系统调用。
+ *  空闲链表为空时，一次从堆中切出一页(SPAN_SIZE)该级的块挂到链表上。
+ *
+ *  每块前 4 个字节是头部: 小块是级号(0-7)，大块是块的总长度(页面的整数倍)，
+ *  free() 据此找到所属的链表。空闲块的链表指针保存在头部之后，头部始终不变。
+ *
+ *  大块按页对齐长度直接从堆中分配，释放后挂在大块空闲链表上，按首次适配重用(不分割不合并)。
+ *
+ *  堆通过 sbrk() 每次扩展 HEAP_GROW 字节，内核并不立即分配内存，第一次访问时才由缺页处理
+ *  映射清零的页面。
+ */
+
+#include <unistd.h>
+#include <linux/lib.h>
+
+#define NR_CLASSES 8
+#define MIN_SHIFT 4                                     // 最小的块 16 字节
+#define MAX_SMALL (1 << (MIN_SHIFT + NR_CLASSES - 1))   // 最大的小块 2048 字节
+#define HDR_SIZE sizeof(unsigned long)
+#define SPAN_SIZE 4096
+#define HEAP_GROW 16384
+
+struct block {
+    unsigned long hdr;                  // 级号或大块长度
+    struct block * next;                // 空闲时指向链表中的下一块，使用时是数据的开始
+};
+
+static struct block * free_lists[NR_CLASSES];
+static struct block * large_list = NULL;
+static char * heap_cur = NULL, * heap_end = NULL;      // 堆中尚未切分的部分
+
+// 从堆中取 size 字节(页面的整数倍)，不够时用 sbrk() 扩展堆
+static char * heap_alloc(unsigned long size) {
+    unsigned long grow;
+    char * p;
+
+    if ((unsigned long)(heap_end - heap_cur) < size) {
+        grow = (size + HEAP_GROW - 1) & ~(unsigned long)(HEAP_GROW - 1);
+        if ((p = sbrk((ptrdiff_t) grow)) == (char *) -1)
+            return NULL;
+        if (p != heap_end)              // 堆不连续(其他代码也调用了 sbrk)，丢弃剩余部分
+            heap_cur = p;
+        heap_end = p + grow;
+    }
+    p = heap_cur;
+    heap_cur += size;
+    return p;
+}
+
+// 切出一页第 c 级的块挂到空闲链表上，返回链表头
+static struct block * refill(unsigned long c) {
+    unsigned long size = 1UL << (c + MIN_SHIFT), n;
+    char * span;
+    struct block * b;
+
+    if (!(span = heap_alloc(SPAN_SIZE)))
+        return NULL;
+    for (n = SPAN_SIZE / size; n-- > 0; ) {
+        b = (struct block *)(span + n * size);
+        b->hdr = c;
+        b->next = free_lists[c];
+        free_lists[c] = b;
+    }
+    return free_lists[c];
+}
+
+static void * large_alloc(unsigned long size) {
+    struct block ** pp, * b;
+
+    size = (size + HDR_SIZE + SPAN_SIZE - 1) & ~(unsigned long)(SPAN_SIZE - 1);
+    for (pp = &large_list; (b = *pp); pp = &b->next)
+        if (b->hdr >= size) {
+            *pp = b->next;
+            return &b->next;
+        }
+    if (!(b = (struct block *) heap_alloc(size)))
+        return NULL;
+    b->hdr = size;
+    return &b->next;
+}
+
+void * malloc(unsigned int size) {
+    unsigned long idx, c;
+    struct block * b;
+
+    if (size > MAX_SMALL - HDR_SIZE)
+        return large_alloc(size);
+    // 级号 = idx 的有效位数，idx 为 16 字节单位的块数减 1
+    idx = (size + HDR_SIZE - 1) >> MIN_SHIFT;
+    c = 0;
+    if (idx) {
+        __asm__("bsrl %1, %0" : "=r" (c) : "r" (idx));
+        c++;
+    }
+    if (!(b = free_lists[c]) && !(b = refill(c)))
+        return NULL;
+    free_lists[c] = b->next;
+    return &b->next;
+}
+
+void free(void * ptr) {
+    struct block * b;
+
+    if (!ptr)
+        return;
+    b = (struct block *)((char *) ptr - HDR_SIZE);
+    if (b->hdr < NR_CLASSES) {
+        b->next = free_lists[b->hdr];
+        free_lists[b->hdr] = b;
+        return;
+    }
+    b->next = large_list;
+    large_list = b;
+}
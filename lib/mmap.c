@@ -0,0 +1,26 @@
+#define __LIBRARY__
+#include <unistd.h>
+#include <sys/mman.h>
+
+// 参数多于 3 个，放在参数块中传给内核。返回的地址是正数，负数是错误号
+void * mmap(void * addr, size_t len, int prot, int flags, int fd, off_t offset) {
+    struct mmap_arg_struct arg;
+    long __res;
+
+    arg.addr = (unsigned long) addr;
+    arg.len = len;
+    arg.prot = (unsigned long) prot;
+    arg.flags = (unsigned long) flags;
+    arg.fd = (unsigned long) fd;
+    arg.offset = (unsigned long) offset;
+    __asm__ volatile("int $0x80"
+            : "=a" (__res)
+            : "0" (__NR_mmap), "b" ((long) &arg)
+            : "memory");
+    if (__res >= 0)
+        return (void *) __res;
+    errno = (int) -__res;
+    return MAP_FAILED;
+}
+
+_syscall2(int, munmap, void *, addr, size_t, len)
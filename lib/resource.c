@@ -0,0 +1,28 @@
+#define __LIBRARY__
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/meminfo.h>
+#include <sys/schedstat.h>
+#include <sched.h>
+
+_syscall2(int, getrusage, int, who, struct rusage *, usage)
+_syscall1(int, meminfo, struct meminfo *, info)
+_syscall2(int, schedstat, int, pid, struct schedstat *, st)
+_syscall1(int, nice, int, increment)
+_syscall3(int, setpriority, int, which, int, who, int, prio)
+_syscall3(int, sched_setscheduler, int, pid, int, policy, const struct sched_param *, param)
+_syscall1(int, sched_getscheduler, int, pid)
+_syscall2(int, sched_getparam, int, pid, struct sched_param *, param)
+
+// 内核返回 20 - nice(1..40)，换算回 nice 值
+int getpriority(int which, int who) {
+    long __res;
+
+    __asm__ volatile("int $0x80\n\t"
+            : "=a" (__res)
+            : "0" (__NR_getpriority), "b" ((long) which), "c" ((long) who));
+    if (__res >= 0)
+        return 20 - (int) __res;
+    errno = (int) -__res;
+    return -1;
+}
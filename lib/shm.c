@@ -0,0 +1,20 @@
+#define __LIBRARY__
+#include <unistd.h>
+#include <sys/shm.h>
+
+_syscall3(int, shmget, key_t, key, size_t, size, int, shmflg)
+_syscall1(int, shmdt, const void *, shmaddr)
+_syscall3(int, shmctl, int, shmid, int, cmd, struct shmid_ds *, buf)
+
+// 返回连接的地址，出错返回 (void *) -1
+void * shmat(int shmid, const void * shmaddr, int shmflg) {
+    long __res;
+
+    __asm__ volatile("int $0x80"
+            : "=a" (__res)
+            : "0" (__NR_shmat), "b" ((long) shmid), "c" ((long) shmaddr), "d" ((long) shmflg));
+    if (__res >= 0)
+        return (void *) __res;
+    errno = (int) -__res;
+    return (void *) -1;
+}
@@ -0,0 +1,5 @@
+#define __LIBRARY__
+#include <unistd.h>
+
+// 创建从 entry(arg) 开始执行的子进程，子进程使用新的用户栈
+_syscall2(pid_t, spawn, void *, entry, long, arg)
@@ -0,0 +1,21 @@
+/*
+ * vfork() 的库函数
+ * 子进程与父进程共用同一个用户栈，子进程从本函数返回后再调用其它函数会覆盖栈中
+ * 本函数的返回地址，父进程恢复运行后就无法正确返回。因此先把返回地址弹出到 ecx
+ * (系统调用会保存并恢复 ecx，子进程也从 TSS 得到相同的 ecx)，再跳转回去。
+ */
+.global vfork
+
+__NR_vfork = 75				# 与 unistd.h 中相同
+
+.align 2
+vfork:
+	popl %ecx				# 返回地址 -> ecx
+	movl $__NR_vfork, %eax
+	int $0x80
+	testl %eax, %eax
+	jns 1f
+	negl %eax				# 出错，设置 errno 并返回 -1
+	movl %eax, errno
+	movl $-1, %eax
+1:	jmp *%ecx
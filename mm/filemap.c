@@ -0,0 +1,193 @@
+/*
+ *  页面缓存和文件映射的缺页处理
+ *
+ *  mmap() 映射的文件页面按 (设备号, i 节点号, 文件页号) 保存在页面缓存中，
+ *  同一文件同一页的所有映射(不论是哪个进程、MAP_SHARED 还是 MAP_PRIVATE)都映射同一个物理页面。
+ *  缺页时先查页面缓存，命中则直接映射(次缺页 min_flt)；否则分配一页，
+ *  用 bmap() 找到文件的 4 个逻辑块，经缓冲区读入后复制到页面中(主缺页 maj_flt)。
+ *  之后 fault-around 窗口内已在页面缓存中的相邻页面也一并映射，不在缓存中的页面不预读。
+ *
+ *  页面缓存本身持有页面的一个引用，因此:
+ *      - MAP_PRIVATE 映射只读，写时 un_wp_page() 看到引用计数大于 1，复制出私有页面(写时复制);
+ *      - MAP_SHARED 可写映射直接可写，所有映射者看到同一个页面。fork 后共享页表被分离时
+ *        页表项也被设为只读，此时 do_wp_page() 直接恢复可写，而不是复制页面。
+ *  MAP_SHARED 映射被修改(页表项 D 位置位)的页面在 munmap() 或进程退出时写回缓冲区，
+ *  由缓冲区的正常机制写到磁盘。只写回文件中已存在的逻辑块，映射不会扩展文件的长度。
+ *  在写回之前缓冲区中的数据是旧的，因此 read() 读文件时先查页面缓存，命中则从页面复制，
+ *  read() 总能看到映射写入的数据。截断文件时 invalidate_inode_pages() 丢弃截断部分的页面。
+ *  (本内核的 write() 还不能写普通文件；将来加入时也要经由 filemap_get_page() 更新缓存页面。)
+ *
+ *  缓存页面不在 LRU 链表上，不会被换出。引用计数只剩页面缓存(没有进程映射)的页面是干净的，
+ *  内存不足时 try_to_free_pages() 首先调用 shrink_page_cache() 释放它们。
+ */
+
+#include <string.h>
+#include <linux/sched.h>
+#include <linux/kernel.h>
+#include <linux/mm.h>
+#include <linux/fs.h>
+
+#define PAGE_HASH_SIZE 64               // 散列表项数(2 的幂)
+#define BLOCKS_PER_PAGE (PAGE_SIZE / BLOCK_SIZE)
+
+#define page_hash(dev, ino, index) \
+    page_hash_table[((dev) ^ ((ino) << 3) ^ (index)) & (PAGE_HASH_SIZE - 1)]
+
+static struct page *page_hash_table[PAGE_HASH_SIZE];
+unsigned long nr_cache_pages = 0;       // 页面缓存中的页面数
+
+static struct page * find_page(unsigned short dev, unsigned short ino, unsigned long index) {
+    struct page *page;
+
+    for (page = page_hash(dev, ino, index); page; page = page->hash_next)
+        if (page->dev == dev && page->ino == ino && page->index == index)
+            return page;
+    return NULL;
+}
+
+// 把页面放入页面缓存，页面缓存持有一个引用
+static void add_to_page_cache(struct page *page, struct m_inode *inode, unsigned long index) {
+    struct page **p = &page_hash(inode->i_dev, inode->i_num, index);
+
+    page->flags |= PG_cache;
+    page->dev = inode->i_dev;
+    page->ino = inode->i_num;
+    page->index = index;
+    page->hash_next = *p;
+    *p = page;
+    get_page(page);
+    nr_cache_pages++;
+}
+
+// 从页面缓存中删除页面，释放页面缓存的引用(仍被映射的页面成为映射者的私有页面)
+static void remove_from_page_cache(struct page *page) {
+    struct page **p = &page_hash(page->dev, page->ino, page->index);
+
+    for (; *p; p = &(*p)->hash_next)
+        if (*p == page) {
+            *p = page->hash_next;
+            break;
+        }
+    page->hash_next = NULL;
+    page->flags &= (unsigned short)~PG_cache;
+    nr_cache_pages--;
+    free_page(page_address(page));
+}
+
+// 读入文件第 index 页到物理页面 page(已清零)，空洞和文件末尾以后的部分保持为 0
+static void read_page(struct m_inode *inode, unsigned long index, unsigned long page) {
+    struct buffer_head *bh;
+    unsigned long pos;
+    int i, nr;
+
+    for (i = 0; i < BLOCKS_PER_PAGE; i++, page += BLOCK_SIZE) {
+        pos = index * PAGE_SIZE + (unsigned long)i * BLOCK_SIZE;
+        if (pos >= inode->i_size)
+            break;
+        if (!(nr = bmap(inode, (int)(pos / BLOCK_SIZE))))
+            continue;
+        if (!(bh = bread(inode->i_dev, nr)))
+            continue;
+        if (inode->i_size - pos < BLOCK_SIZE)
+            memcpy((void *)page, bh->b_data, (int)(inode->i_size - pos));
+        else
+            memcpy((void *)page, bh->b_data, BLOCK_SIZE);
+        brelse(bh);
+    }
+}
+
+// 把页面写回文件第 index 页所在的缓冲块并置脏，只写已存在的逻辑块和文件长度以内的部分
+void filemap_sync_page(struct m_inode *inode, unsigned long index, unsigned long page) {
+    struct buffer_head *bh;
+    unsigned long pos;
+    int i, nr;
+
+    for (i = 0; i < BLOCKS_PER_PAGE; i++, page += BLOCK_SIZE) {
+        pos = index * PAGE_SIZE + (unsigned long)i * BLOCK_SIZE;
+        if (pos >= inode->i_size)
+            break;
+        if (!(nr = bmap(inode, (int)(pos / BLOCK_SIZE))))
+            continue;
+        if (!(bh = bread(inode->i_dev, nr)))
+            continue;
+        if (inode->i_size - pos < BLOCK_SIZE)
+            memcpy(bh->b_data, (void *)page, (int)(inode->i_size - pos));
+        else
+            memcpy(bh->b_data, (void *)page, BLOCK_SIZE);
+        bh->b_dirt = 1;
+        brelse(bh);
+    }
+}
+
+// 文件 inode 第 index 页在页面缓存中时返回该页面(已增加引用，用完后 free_page())，否则返回 0。
+// 不读盘也不分配页面。file_read() 经由它读取被映射的文件页面(见 fs/file_dev.c)
+unsigned long filemap_get_page(struct m_inode *inode, unsigned long index) {
+    struct page *page;
+
+    if (!(page = find_page(inode->i_dev, inode->i_num, index)))
+        return 0;
+    get_page(page);
+    return page_address(page);
+}
+
+// 文件映射区 vma 中线性地址 address 处的页面在已缓存时返回该页面(已为映射增加引用)，否则返回 0。
+// 供 fault-around 预先映射相邻的文件页面(见 memory.c 的 do_fault_around())
+unsigned long filemap_cached_page(struct vm_area_struct *vma, unsigned long address) {
+    return filemap_get_page(vma->vm_inode,
+            vma->vm_pgoff + ((address - current->start_code - vma->vm_start) >> 12));
+}
+
+// 文件映射区 vma 中线性地址 address 处的缺页: 返回要映射的物理页面(已为映射增加引用)，内存不足返回 0
+unsigned long filemap_nopage(struct vm_area_struct *vma, unsigned long address) {
+    struct m_inode *inode = vma->vm_inode;
+    struct page *page;
+    unsigned long index, new_page;
+
+    index = vma->vm_pgoff + ((address - current->start_code - vma->vm_start) >> 12);
+    if ((page = find_page(inode->i_dev, inode->i_num, index))) {
+        get_page(page);
+        current->min_flt++;
+        return page_address(page);
+    }
+    if (!(new_page = get_free_page()))
+        return 0;
+    read_page(inode, index, new_page);
+    current->maj_flt++;
+    // 读盘期间其他进程可能已经读入了同一页
+    if ((page = find_page(inode->i_dev, inode->i_num, index))) {
+        free_page(new_page);
+        get_page(page);
+        return page_address(page);
+    }
+    add_to_page_cache(phys_to_page(new_page), inode, index);
+    return new_page;
+}
+
+// 释放最多 count 个没有被映射的缓存页面，返回释放的页面数
+int shrink_page_cache(int count) {
+    struct page *page, *next;
+    int i, freed = 0;
+
+    for (i = 0; i < PAGE_HASH_SIZE && freed < count; i++)
+        for (page = page_hash_table[i]; page && freed < count; page = next) {
+            next = page->hash_next;
+            if (page_count(page) == 1) {
+                remove_from_page_cache(page);
+                freed++;
+            }
+        }
+    return freed;
+}
+
+// 文件内容被截断时，从页面缓存中删除该文件的所有页面
+void invalidate_inode_pages(struct m_inode *inode) {
+    struct page *page, *next;
+    int i;
+
+    for (i = 0; i < PAGE_HASH_SIZE; i++)
+        for (page = page_hash_table[i]; page; page = next) {
+            next = page->hash_next;
+            if (page->dev == inode->i_dev && page->ino == inode->i_num)
+                remove_from_page_cache(page);
+        }
+}
@@ -0,0 +1,259 @@
+/*
+ *  相同页面合并(KSM, Kernel Samepage Merging)
+ *
+ *  fork 出来的进程在写时复制之后，常常有许多内容完全相同的私有页面(清零的缓冲区、
+ *  复制的表格等)。扫描程序由时钟中断每 KSM_INTERVAL 个滴答驱动一次，每次扫描
+ *  ksm_pages_to_scan 个用户页面，把内容相同的页面合并成一个只读的共享页面，
+ *  增加其引用计数并释放其余页面。之后任何一方写该页面都会引起写保护异常，
+ *  由 un_wp_page() 复制出私有页面(即写时复制)。
+ *
+ *  - 稳定表(stable): 已合并的页面，按内容散列值直接映射。表本身持有页面的一个引用，
+ *    这样即使只剩一个进程在使用，un_wp_page() 也会复制而不会修改合并页面的内容;
+ *    引用计数只剩表本身时在一遍扫描结束后释放;
+ *  - 不稳定表(unstable): 本遍扫描中见过的候选页面，只记录散列值、物理页面、所属任务和线性地址，
+ *    使用前重新检查任务(进程号)和页表项，每遍扫描结束时清空。
+ *
+ *  页表项的脏位(D)用来过滤经常被写的页面: 扫描到 D 置位的匿名私有页面时清除 D 并跳过，
+ *  只有从上次扫描以来没有被写过的页面才作为合并候选。页面缓存(MAP_SHARED 的文件映射)
+ *  和共享内存的页面既不合并，也不清除 D，否则 munmap 或进程退出时会丢失对文件的修改。
+ *
+ *  比较内容之前先清除页表项的 R/W 位并刷新所有 CPU 的 TLB，之后 D 仍为 0 才比较，
+ *  这样其他 CPU 上运行的进程不会在比较和替换之间修改页面。被替换的页面在刷新 TLB 之后才释放。
+ *
+ *  扫描在时钟中断中进行，并且只在中断了用户态程序时进行，此时没有内核路径正在修改页表。
+ *  睡眠中的内核路径不会受影响: 换出中的页面带有额外的引用计数(不是候选)，换入只处理不存在的
+ *  页表项，内核写只读页面时(CR0.WP 已置位)同样经过写时复制。
+ */
+
+#include <linux/sched.h>
+#include <linux/kernel.h>
+#include <linux/head.h>
+#include <linux/mm.h>
+#include <serial_debug.h>
+
+// 合并时修改的是其他进程的页表，它们可能正在其他 CPU 上运行，多处理器时让其他 CPU 也刷新
+#define invalidate() do { \
+    __asm__ volatile("mov %%eax, %%cr3"::"a" (current->tss.cr3)); \
+    if (smp_num_cpus > 1) \
+        smp_flush_tlb(); \
+} while (0)
+
+#define KSM_STABLE_SIZE 256             // 稳定表项数(2 的幂)
+#define KSM_UNSTABLE_SIZE 256           // 不稳定表项数(2 的幂)
+#define KSM_MAX_SCAN_PTES 4096          // 每次最多检查的页表项(和跳过的目录项)数，限制时钟中断中的耗时
+
+struct ksm_stable_item {
+    unsigned long hash;
+    struct page *page;                  // 合并后的页面，NULL 表示空闲
+};
+
+struct ksm_rmap_item {
+    unsigned long hash;
+    unsigned long page;                 // 候选页面的物理地址，0 表示空闲
+    unsigned long address;              // 映射该页面的线性地址
+    int nr;                             // 映射该页面的任务号和进程号，任务退出后该项失效
+    long pid;
+};
+
+static struct ksm_stable_item stable_table[KSM_STABLE_SIZE];
+static struct ksm_rmap_item unstable_table[KSM_UNSTABLE_SIZE];
+
+static int ksm_scan_nr = 1;                             // 扫描游标: 任务号，从任务 1 开始
+static unsigned long ksm_scan_address = USER_BASE;      // 和该任务中的线性地址
+
+int ksm_pages_to_scan = 32;             // 每次扫描的候选页面数，0 表示关闭
+unsigned long ksm_full_scans = 0;       // 完成的整遍扫描次数
+unsigned long ksm_merged = 0;           // 累计合并(释放)的页面数
+
+// 页面内容散列值
+static unsigned long ksm_hash(unsigned long page) {
+    unsigned long *p = (unsigned long *) page, h = 0;
+    int i;
+
+    for (i = 0; i < PAGE_SIZE / 4; i++)
+        h = ((h << 5) | (h >> 27)) ^ p[i];
+    return h;
+}
+
+static int pages_identical(unsigned long a, unsigned long b) {
+    unsigned long *p = (unsigned long *) a, *q = (unsigned long *) b;
+    int i;
+
+    for (i = 0; i < PAGE_SIZE / 4; i++)
+        if (p[i] != q[i])
+            return 0;
+    return 1;
+}
+
+// 取任务 p 中线性地址 address 处可以修改的页表项: 页表存在、不与其他进程共享并且页面存在
+static unsigned long * ksm_pte(struct task_struct *p, unsigned long address) {
+    unsigned long dir = *PAGE_DIR_OFFSET(p, address);
+
+    if ((dir & 3) != 3 || (dir & PAGE_PSE))
+        return NULL;
+    if (page_count(phys_to_page(dir & 0xfffff000)) != 1)
+        return NULL;
+    return (unsigned long *)(dir & 0xfffff000) + ((address >> 12) & 0x3ff);
+}
+
+// 匿名私有页面: 主内存区中只被映射一次的普通页面。页面缓存和共享内存的页面不算，
+// 它们的脏位由 sync_vma_range() 等用来决定是否写回，不能被扫描程序清除
+static int ksm_anon_page(unsigned long *pte) {
+    struct page *page;
+
+    if (!(*pte & 1) || (*pte & 0xfffff000) < LOW_MEM)
+        return 0;
+    page = phys_to_page(*pte & 0xfffff000);
+    if ((page->flags & (PG_reserved | PG_ksm | PG_cache | PG_shm)) || page_count(page) != 1)
+        return 0;
+    return 1;
+}
+
+// 候选页面: 匿名私有页面，且自上次扫描以来没有被写过
+static int ksm_candidate(unsigned long *pte) {
+    return ksm_anon_page(pte) && !(*pte & 0x40);
+}
+
+// 比较之前冻结页面: 原子地清除页表项 pte(和 rpte)的 R/W 位并刷新所有 CPU 的 TLB，此后只能经过写保护异常修改页面。
+// 清除之前通过旧的 TLB 项写过的页面 D 已置位，返回 0 放弃合并(页表项保持只读，下次写时由 un_wp_page() 恢复可写)
+static int ksm_freeze(unsigned long *pte, unsigned long *rpte) {
+    pte_clear_bits(pte, 2);
+    if (rpte)
+        pte_clear_bits(rpte, 2);
+    invalidate();
+    return !(*pte & 0x40) && !(rpte && (*rpte & 0x40));
+}
+
+// 把页表项 pte(已冻结)改为映射合并页面 kpage(只读)。其他 CPU 可能还在通过旧的 TLB 项读原来的页面，
+// 刷新 TLB 之后才释放它
+static void ksm_replace(unsigned long *pte, struct page *kpage) {
+    unsigned long old = *pte & 0xfffff000;
+
+    get_page(kpage);
+    *pte = page_address(kpage) | (*pte & 0xfff & ~(2ul | 0x40ul));
+    invalidate();
+    free_page(old);
+    ksm_merged++;
+}
+
+// 在稳定表中放入新的合并页面，原来占用该项的页面不再接受合并(释放表的引用)
+static void stable_insert(unsigned long hash, struct page *kpage) {
+    struct ksm_stable_item *item = stable_table + (hash & (KSM_STABLE_SIZE - 1));
+
+    if (item->page) {
+        item->page->flags &= (unsigned short)~PG_ksm;
+        free_page(page_address(item->page));
+    }
+    lru_cache_del(kpage);               // 合并页面不参与换出
+    kpage->flags |= PG_ksm;
+    get_page(kpage);                    // 稳定表的引用
+    item->hash = hash;
+    item->page = kpage;
+}
+
+// 处理任务 ksm_scan_nr 中的一个候选页面
+static void ksm_scan_page(unsigned long *pte, unsigned long address) {
+    struct task_struct *p = task[ksm_scan_nr], *rp;
+    struct ksm_stable_item *stable;
+    struct ksm_rmap_item *rmap;
+    unsigned long page = *pte & 0xfffff000, hash, *rpte;
+    struct page *kpage;
+
+    hash = ksm_hash(page);
+    stable = stable_table + (hash & (KSM_STABLE_SIZE - 1));
+    if (stable->page && stable->hash == hash && ksm_freeze(pte, NULL) &&
+            pages_identical(page_address(stable->page), page)) {
+        ksm_replace(pte, stable->page);
+        return;
+    }
+    rmap = unstable_table + (hash & (KSM_UNSTABLE_SIZE - 1));
+    rp = rmap->page ? task[rmap->nr] : NULL;
+    if (rp && rp->pid == rmap->pid && rmap->hash == hash &&
+            (rpte = ksm_pte(rp, rmap->address)) && rpte != pte && ksm_candidate(rpte) &&
+            (*rpte & 0xfffff000) == rmap->page && ksm_freeze(pte, rpte) &&
+            pages_identical(rmap->page, page)) {
+        // 两个页面相同: 保留不稳定表中的页面(已冻结为只读)作为合并页面
+        kpage = phys_to_page(rmap->page);
+        stable_insert(hash, kpage);
+        ksm_replace(pte, kpage);
+        rmap->page = 0;
+        return;
+    }
+    rmap->hash = hash;
+    rmap->page = page;
+    rmap->address = address;
+    rmap->nr = ksm_scan_nr;
+    rmap->pid = p->pid;
+}
+
+// 一遍扫描结束: 清空不稳定表，释放只剩稳定表引用的合并页面
+static void ksm_end_pass(void) {
+    int i;
+
+    for (i = 0; i < KSM_UNSTABLE_SIZE; i++)
+        unstable_table[i].page = 0;
+    for (i = 0; i < KSM_STABLE_SIZE; i++) {
+        if (!stable_table[i].page || page_count(stable_table[i].page) > 1)
+            continue;
+        stable_table[i].page->flags &= (unsigned short)~PG_ksm;
+        free_page(page_address(stable_table[i].page));
+        stable_table[i].page = NULL;
+    }
+    ksm_full_scans++;
+}
+
+// 扫描下一批页面，由 do_timer() 在中断用户态程序时调用
+// 游标依次走过任务 1 到 NR_TASKS-1 的用户空间([USER_BASE, USER_BASE + brk))，跳过不存在的页目录项。
+// 各任务的页目录和页表都在内核空间，不需要切换页目录就可以访问。
+// 使用内核页目录的任务(已退出)和 vfork 的子进程(与父进程共用页目录)没有自己的页面，直接跳过
+void ksm_scan(void) {
+    struct task_struct *p;
+    unsigned long *pte;
+    int scanned = 0, checked = 0, flush = 0;
+
+    // 跳过任务和页目录项也计入 checked，没有任何用户页面时也能结束
+    for (; scanned < ksm_pages_to_scan && checked < KSM_MAX_SCAN_PTES; checked++) {
+        if (ksm_scan_nr >= NR_TASKS) {      // 游标越过最后一个任务时回到任务 1
+            ksm_scan_nr = 1;
+            ksm_end_pass();
+        }
+        p = task[ksm_scan_nr];
+        if (!p || p->tss.cr3 == (long) pg_dir || (p->flags & PF_VFORK) ||
+                ksm_scan_address - USER_BASE >= ((p->brk + 0xfff) & 0xfffff000)) {
+            ksm_scan_nr++;
+            ksm_scan_address = USER_BASE;
+            continue;
+        }
+        if (!(pte = ksm_pte(p, ksm_scan_address))) {
+            ksm_scan_address = (ksm_scan_address + 0x400000) & 0xffc00000;
+            continue;
+        }
+        if (ksm_candidate(pte)) {               // 比较和合并时自己刷新 TLB
+            scanned++;
+            ksm_scan_page(pte, ksm_scan_address);
+        } else if ((*pte & 0x40) && ksm_anon_page(pte)) {   // 最近被写过，清除脏位，下次扫描再看
+            pte_clear_bits(pte, 0x40);
+            flush = 1;
+        }
+        ksm_scan_address += PAGE_SIZE;
+    }
+    if (flush)
+        invalidate();
+}
+
+// 显示合并统计，调试使用
+// pages_shared: 合并页面数; pages_sharing: 因合并而节省的页面数(映射合并页面的页表项数 - 合并页面数)
+void ksm_stat(void) {
+    unsigned long shared = 0, sharing = 0;
+    int i;
+
+    for (i = 0; i < KSM_STABLE_SIZE; i++) {
+        if (!stable_table[i].page)
+            continue;
+        shared++;
+        if (page_count(stable_table[i].page) > 2)
+            sharing += page_count(stable_table[i].page) - 2UL;
+    }
+    printk("ksm: pages_shared %d, pages_sharing %d, %d merged, %d full scans\n",
+        shared, sharing, ksm_merged, ksm_full_scans);
+}
@@ -22,32 +22,47 @@
  */
 
 #include <linux/kernel.h>
+#include <linux/sched.h>
 #include <linux/head.h>
 #include <serial_debug.h>
 #include <linux/mm.h>
+#include <sys/mman.h>
+#include <sys/meminfo.h>
+#include <asm/segment.h>
 
 #define DEBUG
 
-#define LOW_MEM 0x100000ul                      // 内存低1MB，是系统代码所在
-#define PAGING_MEMORY (15*1024*1024)            // 分页内存15MB，主内存区最多15M
-#define PAGING_PAGES (PAGING_MEMORY >> 12)      // 分页后物理内存页数(3840)
-#define MAP_NR(addr) (((addr) - LOW_MEM) >> 12) // 计算物理地址映射的页号
-#define USED 100                                // 页面被占用标志
-
-// 从 from 复制 1 页内存到 to 处( 4K 字节)
-#define copy_page(from, to) \
-    __asm__("cld ; rep ; movsl"::"S" (from),"D" (to),"c" (1024))
-
-#define invalidate() \
-    __asm__ volatile("mov %%eax, %%cr3"::"a" (0))
+// 重新加载当前任务的页目录，刷新页变换高速缓冲(全局的内核页除外)。
+// 被修改的页表可能属于正在其他 CPU 上运行的任务(共享的页表、vfork)，多处理器时让其他 CPU 也刷新
+#define invalidate() do { \
+    __asm__ volatile("mov %%eax, %%cr3"::"a" (current->tss.cr3)); \
+    if (smp_num_cpus > 1) \
+        smp_flush_tlb(); \
+} while (0)
 
 static unsigned long HIGH_MEMORY = 0;
+static unsigned long PAGING_PAGES = 0;          // 分页后物理内存页数((HIGH_MEMORY - 1MB) / 4KB), 由 mem_init() 设置
+
+// 缺页时一次映射的页面数(fault-around 窗口，2 的幂，1 表示关闭)。
+// 窗口按其大小对齐，不跨越页表和进程段限长。可以根据下面的统计和各进程的
+// min_flt/maj_flt 调整：被预先映射但直到释放都没有被访问过的页面计入 fault_around_wasted。
+// 预先映射的页表项带有 PAGE_PREFAULT 标记，正常缺页和内核为进程准备的页面(例如 spawn 的栈)不计入。
+int fault_around_pages = 4;
+unsigned long fault_around_mapped = 0;          // 预先映射的页面数
+unsigned long fault_around_wasted = 0;          // 释放时访问位(A)仍为 0 的页面数
 void un_wp_page(unsigned long * table_entry);
-
-// 物理内存映射字节图( 1 字节代表 1 页内存)。每个页面对应的字节用于标志页面当前被引用（占用）次数。
-// 它最大可以映射 15MB 内存空间。
-// 对于不能用做主内存页面的位置(缓冲区)均都预先被设置成USED（100）.
-static unsigned char mem_map[PAGING_PAGES] = {0,};
+static int unshare_page_table(unsigned long *dir);
+static int wp_shared_page(unsigned long *pte, unsigned long address);
+
+// 物理页面描述数组，每个页面一项(struct page)，count 为页面当前被引用（占用）次数。
+// 数组大小随物理内存大小而定，由 mem_init() 放在主内存区的开始处。
+// 对于不能用做主内存页面的位置(缓冲区)均都预先被设置成 PG_reserved.
+// 空闲页面通过 next 链接在 free_list 上，分配和释放都是 O(1) 的。
+struct page *mem_map;
+static struct page *free_list = NULL;           // 空闲页面链表
+unsigned long nr_free_pages = 0;                // 空闲页面数
+unsigned long nr_shared_pages = 0;              // 引用计数大于 1 的页面数
+unsigned long nr_pgtable_pages = 0;             // 进程的页表和页目录页面数
 
 static inline void oom() {
     panic("Out Of Memory!! QWQ\n");
@@ -55,117 +70,187 @@ static inline void oom() {
 
 // 物理内存初始化
 // 该函数对1MB以上的内存区域以页面为单位进行管理前的初始化设置工作。一个页面长度
-// 为4KB bytes.该函数把1MB以上所有物理内存划分成一个个页面，并使用一个页面映射字节
+// 为4KB bytes.该函数把1MB以上所有物理内存划分成一个个页面，并使用一个页面描述结构
 // 数组mem_map[]来管理所有这些页面。对于具有16MB内存容量的机器，该数组共有3840
 // 项((16MB-1MB)/4KB)，即可管理3840个物理页面。每当一个物理内存页面被占用时就把
-// mem_map[]中对应的字节值增1；若释放一个物理页面，就把对应字节值减1。若字节值为0，
-// 则表示对应页面空闲；若字节值大于或等于1，则表示对应页面被占用或被不同程序共享占用。
-// 在该版本的Linux内核中，最多能管理16MB的物理内存，大于16MB的内存将弃之不用。
-// 对于具有16MB内存的PC机系统，在没有设置虚拟盘RAMDISK的情况下start_mem通常是4MB，
-// end_mem是16MB。因此此时主内存区范围是4MB-16MB,共有3072个物理页面可供分配。而
-// 范围0-1MB内存空间用于内核系统（其实内核只使用0-640Kb，剩下的部分被部分高速缓冲和
-// 设备内存占用）。
+// mem_map[]中对应的 count 增1；若释放一个物理页面，就把对应 count 减1。若 count 为0，
+// 则表示对应页面空闲(在空闲链表中)；若大于或等于1，则表示对应页面被占用或被不同程序共享占用。
+// head.s 只映射了 16MB 物理内存，内核段限长为 1GB(USER_BASE 以下的内核空间)。因此 end_mem
+// 超过 16MB 时，先在主内存区开始处为 16MB 以上的每 4MB 内存分配一个页表，
+// 继续按线性地址等于物理地址的方式映射。最多管理 1GB - 4MB 物理内存(见 init/main.c 的 MAX_MEMORY)。
+// 若 CPU 支持 4MB 页，则与 head.s 一样直接使用(全局的) 4MB 页，不需要页表。
+// 然后 mem_map[] 也放在主内存区开始处，共 (end_mem - 1MB) / 4KB 项。
+// 页表和 mem_map 所占的页面与缓冲区一样被设置成 PG_reserved。
 // 参数start_mem是可用做页面分配的主内存区起始地址（已去除RANDISK所占内存空间）。
 // end_mem是实际物理内存最大地址。而地址范围start_mem到end_mem是主内存区。
 void mem_init(unsigned long start_mem, unsigned long end_mem) {
-    unsigned long i;
-    HIGH_MEMORY = end_mem;                          // 设置内存最高端（16MB）
-    for (i = 0; i < PAGING_PAGES; i ++)             // 首先将 1MB 到 16MB 所有内存页对应的内存映射字节数组项置为已占用状态
-        mem_map[i] = USED;
-
-    i = (unsigned long)MAP_NR(start_mem);           // 主内存区起始位置对应的项号
-    end_mem -= start_mem;
-    end_mem >>= 12;                                 // 主内存区页面数
-    while(end_mem-- > 0) {
-        mem_map[i++] = 0;                           // 主内存区页面对应页面字节值清零
+    unsigned long i, addr, *pg_tbl;
+
+    start_mem = (start_mem + 0xfff) & 0xfffff000;
+    end_mem &= 0xfffff000;
+    for (addr = 0x1000000; addr < end_mem; addr += 0x400000) {
+        if (x86_capability & X86_FEATURE_PSE) {
+            pg_dir[addr >> 22] = addr | PAGE_PSE | 7 |
+                ((x86_capability & X86_FEATURE_PGE) ? PAGE_GLOBAL : 0);
+            continue;
+        }
+        pg_tbl = (unsigned long *) start_mem;
+        start_mem += 4096;
+        for (i = 0; i < 1024; i++)
+            pg_tbl[i] = (addr + (i << 12)) | 7;
+        pg_dir[addr >> 22] = ((unsigned long) pg_tbl) | 7;
     }
+    invalidate();
+
+    HIGH_MEMORY = end_mem;                          // 设置内存最高端
+    PAGING_PAGES = MAP_NR(end_mem);
+    mem_map = (struct page *) start_mem;
+    start_mem += PAGING_PAGES * sizeof(struct page);
+    start_mem = (start_mem + 0xfff) & 0xfffff000;
+    for (i = 0; i < PAGING_PAGES; i ++) {           // 首先将 1MB 到 end_mem 所有内存页置为保留页面
+        mem_map[i].count = 0;
+        mem_map[i].flags = PG_reserved;
+        mem_map[i].next = mem_map[i].prev = NULL;
+        mem_map[i].index = 0;
+    }
+
+    // 主内存区页面清除保留标志并加入空闲链表。从高地址向低地址加入，
+    // 因此链表头是最低地址的页面
+    i = (unsigned long)MAP_NR(end_mem);
+    while (i-- > MAP_NR(start_mem)) {
+        mem_map[i].flags = 0;
+        mem_map[i].next = free_list;
+        free_list = mem_map + i;
+        nr_free_pages++;
+    }
+    page_ops_init();
+    zram_init();
     return;
 }
 
-// 计算内存空闲页面数并显示
-// 调试使用
-void calc_mem(void) {
-    int i, j, k, free = 0;
-    long *pg_tbl;
+// 刷新全部 TLB，包括全局页。
+// 内核空间的 4MB 页设置了 G 位，重新加载 cr3 不会刷新它们；
+// 只有修改内核空间映射时(例如 mm_test.c 中的实验)才需要调用本函数。
+void flush_tlb_all(void) {
+    unsigned long cr4;
 
-    for (i = 0; i < PAGING_PAGES; i++) {
-        if (!mem_map[i]) free++;
-    }
-    printk("%d pages free (of %d in total)\n", free, PAGING_PAGES);
-
-    for(i = 2; i < 1024; i++) {
-        if (pg_dir[i] & 1) {
-            pg_tbl = (long *)(0xfffff000 & pg_dir[i]);
-            for (j = k = 0; j < 1024; j++) {
-                if (pg_tbl[j] & 1) {
-                    k++;
-                }
-            }
-            printk("PageDir[%d] uses %d pages\n", i, k);
-        }
+    if (!(x86_capability & X86_FEATURE_PGE)) {
+        invalidate();
+        return;
     }
-    return;
+    __asm__ volatile("mov %%cr4, %0" : "=r" (cr4));
+    __asm__ volatile("mov %0, %%cr4" :: "r" (cr4 & ~0x80ul));    // 清除 PGE 会刷新所有 TLB 项
+    __asm__ volatile("mov %0, %%cr4" :: "r" (cr4));
+}
+
+// 显示内存使用情况，调试使用
+// 各项都是随分配和释放维护的计数，不扫描 mem_map 和页表
+void calc_mem(void) {
+    printk("%d pages free (of %d in total)\n", (int)nr_free_pages, (int)PAGING_PAGES);
+    printk("%d cached, %d shared, %d page tables; current: rss %d, %d minor, %d major faults\n",
+        nr_cache_pages, nr_shared_pages, nr_pgtable_pages,
+        (unsigned long) current->tss.cr3 >= LOW_MEM ? pgd_rss(current->tss.cr3) : 0,
+        current->min_flt, current->maj_flt);
+    printk("fault-around: window %d, %d pages mapped, %d never used\n",
+        fault_around_pages, fault_around_mapped, fault_around_wasted);
+    swap_stat();
+    ksm_stat();
 }
 
-// 获取第一个（按顺序来说最后一个）空闲的内存物理页, 并标记为已使用，如果没有空闲页，返回 0
-// 遍历 mem_map，直到遇到某个物理页映射为没有被占用状态
-// 输入:
-// %1(ax=0) - 0;
-// %2(LOW_MEM)内存字节位图管理的起始位置;
-// %3(cx=PAGING_PAGES);
-// %4(edi=mem_map+PAGING_PAGES-1).
-// 上面%4寄存器实际指向mem_map[]内存字节位图的最后一个字节。
-// 本函数从位图末端开始向前扫描所有页面标志（页面总数PAGING_PAGE），
-// 若有页面空闲（内存位图字节为0）则返回页面地址。注意！本函数只是指出在主内存区的一页空闲物理内存页面，
+// 取系统内存使用情况，O(1)
+int sys_meminfo(struct meminfo *info) {
+    verify_area(info, sizeof(*info));
+    put_fs_long(PAGING_PAGES, &info->total_pages);
+    put_fs_long(nr_free_pages, &info->free_pages);
+    put_fs_long(nr_cache_pages, &info->cached_pages);
+    put_fs_long(nr_shared_pages, &info->shared_pages);
+    put_fs_long(nr_pgtable_pages, &info->pgtable_pages);
+    put_fs_long(nr_active_pages, &info->active_pages);
+    put_fs_long(nr_inactive_pages, &info->inactive_pages);
+    put_fs_long((unsigned long) nr_swap_pages, &info->swap_free_pages);
+    return 0;
+}
+
+// 获取一页空闲的物理内存页, 并标记为已使用(count = 1)，如果没有空闲页，返回 0
+// 从空闲链表头取下一页，然后把该页面清零，返回页面的物理地址。
+// 注意！本函数只是指出在主内存区的一页空闲物理内存页面，
 // 但并没有映射到某个进程的地址空间中去。后面的put_page()函数即用于把指定页面映射到某个进程地址空间中。
 // 当然对于内核使用本函数并不需要再使用put_page()进行映射，
-// 因为内核代码和数据空间（16MB）已经对等地映射到物理地址空间。
+// 因为内核代码和数据空间已经对等地映射到物理地址空间。
 unsigned long get_free_page(void) {
-    register unsigned long __res asm("ax");
-
-    // std : 置位DF位, 向低地址减小
-    // repne: repeat not equal
-    // scasb: 意思是 al - di, 每比较一次di自动变化
-    __asm__ volatile("std ; repne; scasb\n\t"   // std 置位方向位, al(0) 与对应每个页面的(di)内容比较
-        "jne 1f\n\t"                            // 如果没有等于0的字节，则跳转结束（返回0）
-        "movb $1,1(%%edi)\n\t"                  // 1 => [1+edi], 将对应页面内存映像比特位置1
-        "sall $12,%%ecx\n\t"                    // 页面数*4K = 相对页面起始地址
-        "addl %2,%%ecx\n\t"                     // 再加上低端内存地址，得到页面实际物理起始地址
-        "movl %%ecx,%%edx\n\t"                  // 将页面实际起始地址 => edx
-        "movl $1024,%%ecx\n\t"                  // 1024 => ecx
-        "leal 4092(%%edx),%%edi\n\t"            // 4096+edx => edi （该页面的末端）
-        "rep ; stosl\n\t"                       // 将edi所指内存清零 （反方向，即将该页面清零）
-        "movl %%edx,%%eax\n"                    // 将页面起始地址 => eax（返回值）
-        "1: cld"                                // cld相对应的指令是std,操作方向标志位DF,内存地址是增大（DF=0，向高地址增加）还是减小（DF=1，向低地址减小）
-        :"=a" (__res)
-        :"0" (0),"i" (LOW_MEM),"c" (PAGING_PAGES),
-        "D" (mem_map+PAGING_PAGES-1)
-        );
-    return __res;                               // 返回空闲物理页面地址(若无空闲页面则返回0).
+    struct page *page;
+    unsigned long addr;
+
+    if (!(page = free_list))
+        return 0;
+    free_list = page->next;
+    nr_free_pages--;
+    page->next = NULL;
+    page->count = 1;
+    addr = page_address(page);
+    clear_page(addr);                           // 将页面清零
+    return addr;                                // 返回空闲物理页面地址
 }
 
 // 释放一页物理页，用于函数 free_page_tables()
-// 将mem_map中相应状态减1
+// 将页面引用计数减1，减到 0 时放回空闲链表
 // addr - 物理地址
 void free_page(unsigned long addr) {
+    struct page *page;
+
     if (addr < LOW_MEM) return;
     if (addr >= HIGH_MEMORY) return;
 
-    addr = MAP_NR(addr);                // 计算出页号
-    if (mem_map[addr]--) return;        // 如果页使用状态大于0，则减1返回
-    mem_map[addr] = 0;                  // 如果页面字节原本就是0，表示该物理页面本来就空闲，说明内核代码出问题
-    panic("Trying to free free page");
+    page = phys_to_page(addr);
+    if (page->flags & PG_reserved)      // 保留页面不计数
+        return;
+    if (!page->count)                   // 如果页面原本就是空闲的，说明内核代码出问题
+        panic("Trying to free free page");
+    if (--page->count) {                // 仍被其它地方使用
+        if (page->count == 1)
+            nr_shared_pages--;
+        return;
+    }
+    lru_cache_del(page);
+    page->next = free_list;
+    free_list = page;
+    nr_free_pages++;
+}
+
+// 分配一页作为页表或页目录
+static unsigned long get_pgtable_page(void) {
+    unsigned long page;
+
+    if ((page = get_free_page()))
+        nr_pgtable_pages++;
+    return page;
+}
+
+// 释放页表或页目录页面的一个引用(fork 后共享的页表有多个引用)
+static void free_pgtable_page(unsigned long addr) {
+    if (page_count(phys_to_page(addr)) == 1)
+        nr_pgtable_pages--;
+    free_page(addr);
+}
+
+// 页面的反向映射记录的是任务 tsk 的页目录时清除它(见 swap.c 的 page_pte)。
+// 页目录释放以后可能被重新分配作其他用途，仍被其他进程使用的页面以后不能再通过它查找页表项
+static inline void rmap_forget(unsigned long addr, struct task_struct *tsk) {
+    if (addr >= LOW_MEM && addr < HIGH_MEMORY &&
+            phys_to_page(addr)->pgd == (unsigned long *) tsk->tss.cr3)
+        phys_to_page(addr)->pgd = NULL;
 }
 
 // 释放页表连续内存块，exit() 需要该函数
-// 根据指定线性地址和限长(页表个数), 释放对应内存页表指定的内存块并置表项空闲
-// 页目录于物理地址0开始，1024项 * 4 字节 = 4K 字节
+// 根据指定线性地址和限长(页表个数), 释放任务 tsk 的页目录中对应内存页表指定的内存块并置表项空闲
+// 页目录本身由 free_page_dir() 释放
 // 每个页目录项指定一个页表，内核页表从物理地址 0x1000 处开始(页目录后), 共4个页表。每个页表 1024项 * 4 字节 = 4K 字节
 // 各进程（除在内核代码中的进程0和1）的页表所占据的页面在进程被创建时由内核为其在主内存区申请得到
 // 每个页表项对应1页物理内存，因此一页最多映射 4MB 物理内存
+// tsk - 页目录所属的任务
 // from - 起始线性基地址
 // size - 释放内存字节长度
-int free_page_tables(unsigned long from, unsigned long size) {
+int free_page_tables(struct task_struct *tsk, unsigned long from, unsigned long size) {
     unsigned long *pg_tbl;
     unsigned long *dir, nr;
 
@@ -181,33 +266,75 @@ int free_page_tables(unsigned long from, unsigned long size) {
     size = (size + 0x3fffff) >> 22;                     // 如size = 4.01Mb, 计算结果size = 2
 
     // 计算给出线性基地址对应的起始目录项
-    // 对应的目录项号 = from >> 22，因为每个项占 4 个字节，并且由于页目录表从物理地址0开始存放
-    // 因此 实际目录项指针 = 目录项号 << 2 ，也即（from >> 20）
+    // 对应的目录项号 = from >> 22，因为每个项占 4 个字节，
+    // 因此 实际目录项指针 = 页目录地址 + 目录项号 << 2 ，也即 tss.cr3 +（from >> 20）
     // & oxffc 确保目录项指针范围有效，即屏蔽目录项指针最后 2 位，因为只移动了 20 位，因此最后 2 位是页表项索引的内容，应屏蔽
-    dir = (unsigned long *)((from >> 20) & 0xffc);       // _pg_dir = 0
+    dir = PAGE_DIR_OFFSET(tsk, from);
 
     // 此时 size 是释放的页表个数，即页目录项数
     for (; size-->0; dir++) {
+        cond_resched();                                  // 每个页表之间是一个抢占点，前面的页表已经释放完
         if (!(*dir & 1))                                 // 该目录未被使用
             continue;
 
         pg_tbl = (unsigned long *)(*dir & 0xfffff000);   // 取页表地址
+        // 页表仍被其他进程共享(fork 后尚未分离)，此时页表中的页面并没有为本进程增加
+        // 引用计数，因此只需递减页表页面本身的引用计数即可
+        if (page_count(phys_to_page((unsigned long)pg_tbl)) > 1) {
+            for (nr = 0; nr < 1024; nr++)
+                if (pg_tbl[nr] & 1)
+                    rmap_forget(pg_tbl[nr] & 0xfffff000, tsk);
+            free_pgtable_page((unsigned long)pg_tbl);
+            *dir = 0;
+            continue;
+        }
         for (nr = 0; nr < 1024; nr++) {
             if (*pg_tbl & 1) {
+                if ((*pg_tbl & (PAGE_PREFAULT | 0x20)) == PAGE_PREFAULT)   // 预先映射后从未被访问过
+                    fault_around_wasted++;
+                rmap_forget(0xfffff000 & *pg_tbl, tsk);  // 页面可能仍被其他进程使用(写时复制前)
                 free_page(0xfffff000 & *pg_tbl);         // 释放此页
-            }
+            } else if (*pg_tbl)                          // 已被换出的页面，释放交换页面
+                swap_free(*pg_tbl);
             *pg_tbl = 0;
             pg_tbl++;
         }
 
-        free_page(0xfffff000 & *dir);                   // 释放该页表所占内存页面
+        free_pgtable_page(0xfffff000 & *dir);           // 释放该页表所占内存页面
         *dir = 0;
     }
 
+    if ((unsigned long) tsk->tss.cr3 >= LOW_MEM)   // 只在释放整个地址空间(退出、fork 失败)时调用
+        pgd_rss(tsk->tss.cr3) = 0;
     invalidate();       // 刷新页变换高速缓冲
     return 0;
 }
 
+// 释放线性地址 [from, from + size) 中映射的页面和交换页面，页表本身保留
+// sys_brk() 缩小数据段时使用。from 和 size 都是页面的整数倍
+void unmap_page_range(unsigned long from, unsigned long size) {
+    unsigned long *dir, *pte, end = from + size;
+
+    while (from < end) {
+        dir = PAGE_DIR_OFFSET(current, from);
+        if (!(*dir & 1) || (*dir & PAGE_PSE)) {
+            from = (from + 0x400000) & 0xffc00000;
+            continue;
+        }
+        if (!(*dir & 2) && unshare_page_table(dir))     // 与其他进程共享的页表先分离
+            oom();
+        pte = (unsigned long *)(*dir & 0xfffff000) + ((from >> 12) & 0x3ff);
+        if (*pte & 1) {
+            free_page(*pte & 0xfffff000);
+            add_rss((unsigned long *) current->tss.cr3, -1);
+        } else if (*pte)
+            swap_free(*pte);
+        *pte = 0;
+        from += PAGE_SIZE;
+    }
+    invalidate();
+}
+
 // 把一物理内存页面映射到线性地址空间指定处
 // 或者说是把线性地址空间中指定地址address出的页面映射到主内存区页面 page 上。
 // 主要工作是在相关页面目录项和页表项中设置指定页面的信息。若成功则返回物理页面地址。
@@ -217,35 +344,39 @@ int free_page_tables(unsigned long from, unsigned long size) {
 // 因此当修改了一个无效的页表项时不需要刷新。在次就表现为不用调用Invalidate()函数。
 // 参数page是分配的主内存区中某一页面(页帧，页框)的指针;address是线性地址。
 // 在处理缺页异常 do_no_page() 中会调此函数
+// tsk - 页目录所属的任务，通常是当前任务(spawn 时是新建的子进程)
 // page - 分配的主内存中某一页（页帧，页框）的指针
 // address - 线性地址
-unsigned long put_page(unsigned long page, unsigned long address) {
+unsigned long put_page(struct task_struct *tsk, unsigned long page, unsigned long address) {
     unsigned long *pg_tbl, tmp;
 
     // 首先判断参数给定物理内存页面page的有效性。如果该页面位置低于LOW_MEM（1MB）
     // 或超出系统实际含有内存高端HIGH_MEMORY，则发出警告。LOW_MEM是主内存区可能
     // 有的最小起始位置。当系统物理内存小于或等于6MB时，主内存区起始于LOW_MEM处。
-    // 再查看一下该page页面是否已经申请的页面，即判断其在内存页面映射字节图mem_map[]
+    // 再查看一下该page页面是否已经申请的页面，即判断其在内存页面描述数组mem_map[]
     // 中相应字节是否已经置位。若没有则需发出警告。
     if (page < LOW_MEM || page >= HIGH_MEMORY)
         printk("Trying to put page %x at %x\n", page, address);
 
-    if (mem_map[MAP_NR(page)] != 1)     // 该page页面是否是已经申请的页面，如果没有发出警告
+    if (page_count(phys_to_page(page)) != 1)     // 该page页面是否是已经申请的页面，如果没有发出警告
         printk("mem_map disagrees with %x at %x\n", page, address);
 
     // 然后根据参数指定的线性地址 address 计算其在也目录表中对应的目录项指针，并从中取得二级页表地址。
     // 如果该目录项有效(P=1),即指定的页表在内存中，则从中取得指定页表地址放到page_table 变量中。
     // 否则就申请一空闲页面给页表使用，并在对应目录项中置相应标志(7 - User、U/S、R/W).
     // 然后将该页表地址放到 page_table 变量中。
-    pg_tbl = (unsigned long *)((address >> 20) & 0xffc);
+    pg_tbl = PAGE_DIR_OFFSET(tsk, address);
 
     // printk("Params: pg_tbl = %x, entry = %x\n", pg_tbl, (address >> 12) & 0x3ff);
     if((*pg_tbl) & 1) {   // 如果该目录项有效（P=1）, 即指定的页表在内存中
         // printk("Page table now available\n");
+        // 页表与其他进程共享(目录项只读)，修改页表项之前先分离出本进程私有的页表
+        if (!(*pg_tbl & 2) && unshare_page_table(pg_tbl))
+            return 0;
         pg_tbl = (unsigned long *)(*pg_tbl & 0xfffff000);
     }
     else {               // 否则申请一空闲页面给页表使用，并在相应目录项置相应标志，然后把页表地址放到pg_tbl变量中
-        if (!(tmp = get_free_page())) {
+        if (!(tmp = get_pgtable_page())) {
             printk("NO FREE PAGE!");
             return 0;
         }
@@ -261,6 +392,8 @@ unsigned long put_page(unsigned long page, unsigned long address) {
     // 该页表项在页表中的索引值等于线性地址 位21-位12 组成的 10bit 值，每个页表共可有 1024 项（0 -- 0x3ff）
     pg_tbl[(address >> 12) & 0x3ff] = page | 7;
     // invalidate();    // 不需要刷新页变换高速缓冲
+    lru_cache_add(tsk, page, address);
+    add_rss((unsigned long *) tsk->tss.cr3, 1);
     return page;
 }
 
@@ -274,7 +407,7 @@ unsigned long put_page(unsigned long page, unsigned long address) {
 void get_empty_page(unsigned long address) {
     unsigned long tmp;
     // 如果不能取得有一空闲页面，或者不能将所取页面放置到指定地址处，则显示内存不够信息。
-    if (!(tmp = get_free_page()) || !put_page(tmp, address)) {
+    if (!(tmp = get_free_page()) || !put_page(current, tmp, address)) {
         free_page(tmp);
         oom();
     }
@@ -289,6 +422,7 @@ void get_empty_page(unsigned long address) {
 void write_verify(unsigned long address) {
     unsigned long page;
 
+    check_free_pages();
     // 检查页目录项是否存在
     // 首先取指定线性地址对应的页目录项，根据目录项中的存在位P判断目录项对应的
     // 页表是否存在(存在位P=12),若不存在(P=0)则返回。这样处理是因为对于不存在的
@@ -297,23 +431,102 @@ void write_verify(unsigned long address) {
     // 一个物理页面。
     // 接着程序从目录项中取页表地址，加上指定页面在页表中的页表项偏移值，得对应
     // 地址的页表项指针。在该表项中包含这给定线性地址对应的物理页面。
-    // dir = (unsigned long *)((address >> 20) & 0xffc)
+    // dir = PAGE_DIR_OFFSET(current, address)
     // pag = *(dir)
-    if(!( (page = *((unsigned long *)((address >> 20) & 0xffc)) ) & 1)) {
+    if(!( (page = *PAGE_DIR_OFFSET(current, address)) & 1)) {
         return ;
     }
+    // 内核空间的 4MB 页总是可写的
+    if (page & PAGE_PSE)
+        return;
+    // 目录项只读说明页表仍与父/子进程共享，先分离页表，再检查页表项
+    if (!(page & 2)) {
+        if (unshare_page_table(PAGE_DIR_OFFSET(current, address)))
+            oom();
+        page = *PAGE_DIR_OFFSET(current, address);
+    }
 
     // 取页表首地址
     page &= 0xfffff000;
     page += ((address >> 10) & 0xffc);      // 因为pape 是 unsigned long类型，每项4个字节，相当于 >>12 然后 << 2
     // 然后判断该页表项中的位1(R/W)、位0(P)标志。如果该页面不可写(R/W=0)且存在，
     // 那么就执行共享检验和复制页面操作(写时复制)。否则什么也不做，直接退出。
-    if((*(unsigned long *)page & 3) == 1) {   // 页表P = 1, R/W = 0
+    // 不可写的映射区不复制，随后内核的写操作会引起写保护异常，由 do_wp_page() 终止进程
+    if((*(unsigned long *)page & 3) == 1 && !wp_shared_page((unsigned long *)page, address)) {   // 页表P = 1, R/W = 0
         un_wp_page((unsigned long *)page);
+        lru_cache_add(current, *(unsigned long *)page & 0xfffff000, address);
     }
     return;
 }
 
+// 写只读页面时检查所在的映射区:
+//  - 不可写的映射区(SHM_RDONLY 连接的共享内存段、只读的文件映射)返回 -1，不能写时复制，
+//    do_wp_page() 以 SIGSEGV 终止进程;
+//  - 可写的共享映射区中的页面缓存页面或共享内存页面直接置为可写，返回 1;
+//  - 其余返回 0，由调用者写时复制。fork 后分离共享页表时这些页表项也被设为只读
+static int wp_shared_page(unsigned long *pte, unsigned long address) {
+    struct vm_area_struct *vma;
+    unsigned long page = *pte & 0xfffff000;
+
+    vma = find_vma(current, address - current->start_code);
+    if (vma && !(vma->vm_prot & PROT_WRITE))
+        return -1;
+    if (!vma || !(vma->vm_flags & MAP_SHARED) ||
+            page < LOW_MEM || !(phys_to_page(page)->flags & (PG_cache | PG_shm)))
+        return 0;
+    *pte |= 2;
+    invalidate();
+    return 1;
+}
+
+// 分离共享页表。fork 时父子进程共享用户空间的页表(见 copy_page_tables)，目录项只读。
+// 当某个进程要修改该页表映射的内存(或页表本身)时调用本函数:
+// 若页表只剩本进程在使用，直接把目录项置为可写即可；
+// 否则申请一页新页表，把原页表项复制过来，并像原来的 fork 一样把页面设为只读、
+// 增加页面引用计数(页面本身的写时复制仍交给 un_wp_page 处理)。
+// dir - 页目录项地址
+// 返回: 0 成功，-1 内存不足
+static int unshare_page_table(unsigned long *dir) {
+    unsigned long *old_table, *new_table;
+    unsigned long this_page, nr;
+
+    old_table = (unsigned long *)(0xfffff000 & *dir);
+    if (page_count(phys_to_page((unsigned long)old_table)) == 1) {     // 共享者都已分离或退出
+        *dir |= 2;
+        invalidate();
+        return 0;
+    }
+    if (!(new_table = (unsigned long *)get_pgtable_page()))
+        return -1;
+    // get_free_page 可能引起调度，期间其他共享者可能已分离或退出
+    if (page_count(phys_to_page((unsigned long)old_table)) == 1) {
+        free_pgtable_page((unsigned long)new_table);
+        *dir |= 2;
+        invalidate();
+        return 0;
+    }
+    for (nr = 0; nr < 1024; nr++) {
+        this_page = old_table[nr];
+        if (!this_page)
+            continue;
+        if (!(1 & this_page)) {                                 // 交换项，两个页表都引用该交换页面
+            new_table[nr] = this_page;
+            swap_duplicate(this_page);
+            continue;
+        }
+        this_page &= (unsigned long)~2;
+        new_table[nr] = this_page & ~(unsigned long)PAGE_PREFAULT;   // 预先映射的标记只留在原页表中，只计一次
+        if (this_page > LOW_MEM) {
+            old_table[nr] = this_page;                          // 其余共享者也只读
+            get_page(phys_to_page(this_page));
+        }
+    }
+    free_pgtable_page((unsigned long)old_table);                // 仍有其他共享者，只减少引用计数
+    *dir = ((unsigned long)new_table) | 7;
+    invalidate();
+    return 0;
+}
+
 // 取消写保护页面函数。用于页异常中断过程中写保护异常的处理(写时复制)。
 // 在内核创建进程时，新进程与父进程被设置成共享代码和数据内存页面，并且所有这些
 // 页面均被设置成只读页面。而当新进程或原进程需要向内存页面写数据时，CPU就会检测
@@ -337,7 +550,7 @@ void un_wp_page(unsigned long *table_entry) {
 #ifdef DEBUG
     s_printk("old_page = 0x%x\n", old_page);
 #endif
-    if (old_page >= LOW_MEM && mem_map[MAP_NR(old_page)] == 1) {    // 页面没有被共享
+    if (old_page >= LOW_MEM && page_count(phys_to_page(old_page)) == 1) {    // 页面没有被共享
 #ifdef DEBUG
         s_printk("Above 1MB\n");
 #endif
@@ -347,15 +560,14 @@ void un_wp_page(unsigned long *table_entry) {
     }
 
     // 否则就需要在主内存区申请一页空闲页面给执行写操作的进程单独使用，取消页面
-    // 共享。如果原页面大于内存低端(则意味着mem_map[]>1,页面是共享的)，则将原页
-    // 面的页面映射字节数组递减1。然后将指定页表项内容更新为新页面地址，并置可读
+    // 共享。如果原页面大于内存低端(则意味着 count > 1,页面是共享的)，则将原页
+    // 面的引用计数递减1(free_page 不会释放仍被共享的页面)。然后将指定页表项内容更新为新页面地址，并置可读
     // 写等标志（U/S、R/W、P）。在刷新页变换高速缓冲之后，最后将原页面内容复制
     // 到新页面上。
     if (!(new_page = get_free_page()))
         oom();
 
-    if (old_page >= LOW_MEM)
-        mem_map[MAP_NR(old_page)]--;
+    free_page(old_page);
 
     *table_entry = new_page | 7;
     invalidate();
@@ -380,10 +592,12 @@ void un_wp_page(unsigned long *table_entry) {
 // address - 页面线性地址
 // 写共享页面时，需复制页面（写时复制）
 void do_wp_page(unsigned long error_code, unsigned long address) {
+    unsigned long *dir, *pte;
 #ifdef DEBUG
     s_printk("Page Fault(Write) at [0x%x], errono %d\n", address, error_code);
 #endif
     error_code = error_code; // 纯粹为了消除警告
+    check_free_pages();      // 可能睡眠，必须在取页表项指针之前
     // 调用上面函数 un_wp_page() 来处理取消页面保护。但首先需要为其准备好参数。
     // 参数是 线性地址address 指定页面在页表中的 页表项物理地址，
     // 其计算方法是：
@@ -393,8 +607,8 @@ void do_wp_page(unsigned long error_code, unsigned long address) {
     // 地址。与操作&0xffc用于限制地址范围在一个页面内。又因为只移动了10位，因此
     // 最后2位是线性地址低12位中的最高2位，也应屏蔽掉。因此求线性地址中页表项在
     // 页表中偏移地址直观一些的表示方法是(((address>>12)&ox3ff)<<2).
-    // 2.(0xfffff000 & *((address>>20) &0xffc)):用于取目录项中页表的地址值；其中，
-    // ((address>>20) &0xffc)用于取线性地址中的目录索引项在目录表中的偏移地址。
+    // 2.(0xfffff000 & *PAGE_DIR_OFFSET(current, address)):用于取目录项中页表的地址值；其中，
+    // ((address>>20) &0xffc)用于取线性地址中的目录索引项在目录表中的偏移地址，加上当前进程的页目录地址(tss.cr3)。
     // 因为address>>22是目录项索引值，但每项4个字节，因此乘以4后：(address>>22)<<2
     // = (address>>20)就是指定在目录表中的偏移地址。&0xffc用于屏蔽目录项索引值中
     // 最后2位。因为只移动了20位，因此最后2位是页表索引的内容，应该屏蔽掉。而
@@ -403,14 +617,104 @@ void do_wp_page(unsigned long error_code, unsigned long address) {
     // (0xfffff000 & *(unsigned log *) (((address>>22) & 0x3ff)<<2)).
     // 3.由1中页表项中偏移地址加上2中目录表项内容中对应页表的物理地址即可得到页
     // 表项的指针(物理地址)。这里对共享的页面进行复制。
-    un_wp_page((unsigned long *)
-		(((address>>10) & 0xffc) + (0xfffff000 &
-		*((unsigned long *) ((address>>20) &0xffc)))));
+    // 写共享页表引起的异常: 目录项 R/W=0。先为本进程复制一份私有页表，
+    // 若对应页表项本身可写(fork 前就可写且未被共享)，则分离页表后直接返回即可。
+    dir = PAGE_DIR_OFFSET(current, address);
+    if (!(*dir & 2)) {
+        if (unshare_page_table(dir))
+            oom();
+    }
+    pte = (unsigned long *)(((address>>10) & 0xffc) + (0xfffff000 & *dir));
+    // 可写的共享映射只需恢复可写，不可写的映射区(例如 SHM_RDONLY 连接的段)是非法写，其余写时复制
+    if ((*pte & 3) == 1) {
+        switch (wp_shared_page(pte, address)) {
+        case -1:
+            printk("do_wp_page: write to read-only mapping at %x, pid %d killed\n",
+                address, current->pid);
+            do_exit(SIGSEGV);
+            break;
+        case 0:
+            un_wp_page(pte);
+            lru_cache_add(current, *pte & 0xfffff000, address);
+            current->min_flt++;
+            break;
+        }
+    }
 #ifdef DEBUG
     mm_print_pageinfo(address);
 #endif
 }
 
+// fault-around: 在缺页地址 address 所在的对齐窗口内，把其余尚未映射的页面(页表项为 0)
+// 一并映射为清零的页面，减少顺序访问(栈增长、堆的首次访问)时的缺页次数。
+// 窗口内属于文件映射区的页面只在已经在页面缓存中时才映射(与缺页时的权限相同)，不读盘；
+// 共享内存段和没有缓存的文件页面留给以后的缺页处理。
+// 调用时 address 所在页面已经映射，页表存在且不再与其他进程共享。
+// 窗口限制在当前进程的段限长以内；空闲页面不多(不高于回收水位)时直接停止，不当作内存不足，
+// 避免为预先映射的页面触发回收。
+static void do_fault_around(unsigned long address) {
+    unsigned long *pg_tbl, start, end, base, page;
+    struct vm_area_struct *vma;
+
+    if (fault_around_pages <= 1)
+        return;
+    base = get_base(current->ldt[2]);
+    end = base + get_limit(0x17);
+    if (address < base || address >= end)
+        return;
+    start = address & ~((unsigned long)fault_around_pages * PAGE_SIZE - 1);
+    if (start < base)
+        start = base;
+    if (end > start + (unsigned long)fault_around_pages * PAGE_SIZE)
+        end = start + (unsigned long)fault_around_pages * PAGE_SIZE;
+    pg_tbl = (unsigned long *)(0xfffff000 & *PAGE_DIR_OFFSET(current, address));
+    for (; start < end; start += PAGE_SIZE) {
+        if (start == address || pg_tbl[(start >> 12) & 0x3ff])
+            continue;
+        if ((vma = find_vma(current, start - current->start_code))) {   // 映射区的页面不能用清零页面代替
+            if (!(vma->vm_flags & VM_SHM) && (page = filemap_cached_page(vma, start))) {
+                put_shared_page(page, start,
+                    (vma->vm_flags & MAP_SHARED) && (vma->vm_prot & PROT_WRITE));
+                pg_tbl[(start >> 12) & 0x3ff] |= PAGE_PREFAULT;
+                fault_around_mapped++;
+            }
+            continue;
+        }
+        if (nr_free_pages <= FREE_PAGES_LOW || !(page = get_free_page()))
+            break;
+        pg_tbl[(start >> 12) & 0x3ff] = page | 7 | PAGE_PREFAULT;
+        lru_cache_add(current, page, start);
+        add_rss((unsigned long *) current->tss.cr3, 1);
+        fault_around_mapped++;
+    }
+}
+
+// 把映射区的页面 page(页面缓存或共享内存段的页面，已为本次映射增加引用)映射到线性地址 address 处。
+// 这些页面不加入 LRU 链表；writable 为 0 时只读映射，写时复制。
+// 读文件时可能睡眠，期间该页表项已被映射(vfork 的子进程与父进程共用页表)时放弃 page。
+void put_shared_page(unsigned long page, unsigned long address, int writable) {
+    unsigned long *dir, *pg_tbl, tmp;
+
+    dir = PAGE_DIR_OFFSET(current, address);
+    if (!(*dir & 1)) {
+        if (!(tmp = get_pgtable_page()))
+            oom();
+        if (!(*dir & 1))
+            *dir = tmp | 7;
+        else
+            free_pgtable_page(tmp);
+    }
+    if (!(*dir & 2) && unshare_page_table(dir))
+        oom();
+    pg_tbl = (unsigned long *)(*dir & 0xfffff000) + ((address >> 12) & 0x3ff);
+    if (*pg_tbl) {
+        free_page(page);
+        return;
+    }
+    *pg_tbl = page | (writable ? 7 : 5);
+    add_rss((unsigned long *) current->tss.cr3, 1);
+}
+
 // TODO: 未完成
 // 执行缺页处理
 // 访问不存在页面的处理函数，在页异常中断处理过程中调用，在 page.s 中调用
@@ -419,26 +723,90 @@ void do_wp_page(unsigned long error_code, unsigned long address) {
 // 该函数首先尝试与已加载的相同文件进行页面共享，或者只是由于进程动态申请内
 // 存页面而只需映射一页物理内存即可。若共享操作不成功，那么只能从相应文件中读入
 // 所缺的数据页面到指定线性地址处。
+// 页表项不为 0 说明页面已被换出，此时从交换设备读回页面(主缺页 maj_flt)。
+// 地址属于文件映射区(mmap)时从页面缓存取得文件页面，见 filemap.c；属于共享内存段时见 shm.c。
 void do_no_page(unsigned long error_code, unsigned long address) {
     // unsigned long tmp;
-    unsigned long page;
+    unsigned long page, *dir, *pte;
+    struct vm_area_struct *vma;
 #ifdef DEBUG
     s_printk("Page Fault at [0x%x], errono %d\n", address, error_code);
 #endif
+    check_free_pages();
     address &= 0xfffff000;
+    dir = PAGE_DIR_OFFSET(current, address);
+    if ((*dir & 1) && !(*dir & PAGE_PSE)) {
+        pte = (unsigned long *)(0xfffff000 & *dir) + ((address >> 12) & 0x3ff);
+        if (*pte & 1)               // 等待回收时其他路径已经映射了该页面
+            return;
+        if (*pte) {
+            // 换入要修改页表项，先分离与其他进程共享的页表
+            if (!(*dir & 2)) {
+                if (unshare_page_table(dir))
+                    oom();
+                pte = (unsigned long *)(0xfffff000 & *dir) + ((address >> 12) & 0x3ff);
+            }
+            swap_in(pte, address);
+            return;
+        }
+    }
+    if ((vma = find_vma(current, address - current->start_code))) {
+        if (vma->vm_flags & VM_SHM)
+            page = shm_nopage(vma, address);
+        else
+            page = filemap_nopage(vma, address);
+        if (!page)
+            oom();
+        put_shared_page(page, address,
+            (vma->vm_flags & MAP_SHARED) && (vma->vm_prot & PROT_WRITE));
+        if (!(vma->vm_flags & VM_SHM))
+            do_fault_around(address);
+        return;
+    }
     if (!(page = get_free_page()))
         oom();
 
     // 最后把引起缺页异常的一页物理页面映射到指定线性地址address处。
     // 若操作成功就返回。否则就释放内存页，显示内存不够。
-    if (put_page(page, address)) {
+    if (put_page(current, page, address)) {
         // mm_print_pageinfo(address);
+        current->min_flt++;
+        do_fault_around(address);
         return;
     }
     free_page(page);
     oom();
 }
 
+// 为新进程 p 分配页目录，保存在 p->tss.cr3 中。USER_BASE 以下的内核空间目录项从 pg_dir 复制，
+// 所有进程共享内核的页表和 4MB 页(内核空间的映射在 mem_init() 之后不再改变)。
+// 用户空间的目录项为空，由 copy_page_tables() 填写。成功返回 0，内存不足返回 -1
+int new_page_dir(struct task_struct *p) {
+    unsigned long *dir;
+    int i;
+
+    if (!(dir = (unsigned long *) get_pgtable_page()))
+        return -1;
+    for (i = 0; i < (int)(USER_BASE >> 22); i++)
+        dir[i] = pg_dir[i];
+    pgd_rss(dir) = 0;
+    p->tss.cr3 = (long) dir;
+    return 0;
+}
+
+// 释放进程 p 的页目录，用户空间的页表应已由 free_page_tables() 释放。
+// p 改用内核页目录 pg_dir；p 是当前进程(退出时)则先切换到 pg_dir，再释放原来的页目录
+void free_page_dir(struct task_struct *p) {
+    unsigned long dir = (unsigned long) p->tss.cr3;
+
+    if (dir == (unsigned long) pg_dir)
+        return;
+    p->tss.cr3 = (long) pg_dir;
+    if (p == current)
+        invalidate();
+    free_pgtable_page(dir);
+}
+
 // 复制页目录表项和页表项
 // 注意！我们并不是复制任何内存块，内存块的地址需要是 4Mb 的倍数，
 // 正好一个页目录项对应的内存长度，不管怎么样，它仅被 fork() 使用。
@@ -447,6 +815,8 @@ void do_no_page(unsigned long error_code, unsigned long address) {
 // 表，原物理内存区将被共享。此后两个进程（父进程和其子进程）将共享内存区，直到
 // 有一个进程执行谢操作时，内核才会为写操作进程分配新的内存页(写时复制机制)。
 // 对于进程 0 和 1，只拷贝前 160 页共640Kb
+// 源是当前进程的页目录，目的是新进程 p 的页目录(已由 new_page_dir() 分配)。
+// p - 新进程
 // from , to 线性地址
 // size - 需要复制（共享）的内存长度，单位是字节
 // 页目录项存在于页目录表中，用以管理页表;页表项存在于页表中，用以管理页面。
@@ -460,8 +830,8 @@ void do_no_page(unsigned long error_code, unsigned long address) {
             进程1页表
 
 
-    0       64M  段限制长640k   128M              192M            256M             4G-1
-    |--------|------------------|-----------------|---------------|---------------|
+    0       640K          1G(USER_BASE)  段限制长640k                               4G-1
+    |--------|--------------|------------------|-------------------------------------|  进程1的线性空间
 
 
    0x00 内核                     0xfffff(1M)                           0xffe000 0xfff000 0xffffff(16M-1)
@@ -481,7 +851,7 @@ void do_no_page(unsigned long error_code, unsigned long address) {
       [_________________________________________]
 
 */
-int copy_page_tables(unsigned long from, unsigned long to, unsigned long size) {
+int copy_page_tables(struct task_struct *p, unsigned long from, unsigned long to, unsigned long size) {
 #ifdef DEBUG
     s_printk("copy_page_tables(0x%x, 0x%x, 0x%x)\n", from, to, size);
 #endif
@@ -500,16 +870,14 @@ int copy_page_tables(unsigned long from, unsigned long to, unsigned long size) {
     if ((from & 0x3fffff) || (to & 0x3fffff)) {
         panic("copy_page_tables called with wrong alignment");
     }
-    // 每个页目录表项是4字节, 相当于: (from>>22) * 4
+    // 每个页目录表项是4字节, 相当于: 页目录地址 + (from>>22) * 4
     // 例子:
-    // to: 64M  (00000100 00000000 00000000 00000000)2
-    // to_dir就是(00000000 00000000 00000000 01000000)2
-    // 而to_dir的高10为0，中10位0，低12位为(0001000000)2
-    // 这个二进制数就是十进制的64，这表示第 0 个页偏移64位。第0个页就是页目录表所在的页,
-    // 这个页偏移 64 位其实就是第 16 个页表项的地址
-    // 操作系统想把 from 指向的那个页表的各个页表项丢到第 16 项页目标表项指向的页表上面去。
-    from_dir = 0 + (unsigned long *) ((from >> 20) & 0xffc);    /* _pg_dir = 0 */
-    to_dir = 0 + (unsigned long *) ((to >> 20) & 0xffc);        // 64M 计算得 0x40 = 64
+    // to: 1G   (01000000 00000000 00000000 00000000)2
+    // (to >> 20) & 0xffc 就是(00000000 00000000 00000100 00000000)2 = 0x400
+    // 这表示 p 的页目录偏移 0x400 字节，即第 256 个页目录项的地址
+    // 操作系统想把 from 指向的那个页表的各个页表项丢到 p 的第 256 项页目标表项指向的页表上面去。
+    from_dir = PAGE_DIR_OFFSET(current, from);
+    to_dir = PAGE_DIR_OFFSET(p, to);
     size = ((unsigned)(size + 0x3fffff)) >> 22;                 // 把不足一个4MB(一个页表所能控制的内存长度）的size取整为一个4MB, 640kb 计算得 1
 
     // s_printk("from_dir = 0x%x, *from_dir = 0x%x\n", from_dir, *from_dir);
@@ -520,6 +888,7 @@ int copy_page_tables(unsigned long from, unsigned long to, unsigned long size) {
     // 并且开始页表项复制操作。如果目的目录指定的页表已经存在(P=1)，则出错死机。
     // 如果源目录项无效，即指定的页表不存在(P=1),则继续循环处理下一个页目录项。
     for (; size-- > 0; from_dir++, to_dir++)  {
+        cond_resched();                                         // 每个页表之间是一个抢占点，与分配页表页面时可能回收页面一样
         // 若目的目录项指定的页表已经存在，则出错死机
         if (1 & *to_dir) {                                      // 最后 1 位属性位是 P 位
             panic("copy_page_tables: already exist");
@@ -529,6 +898,19 @@ int copy_page_tables(unsigned long from, unsigned long to, unsigned long size) {
             continue;
         }
 
+        // 用户空间(from != 0)的页表不再立即复制，而是父子进程共享同一个页表页面：
+        // 两个目录项都复位 R/W 位，并增加页表页面的引用计数。之后任何一方对该 4MB
+        // 范围内的写操作都会引起写保护异常，在 do_wp_page() 中才真正复制页表
+        // (unshare_page_table)。这样 fork 之后立即 exit 或只读访问的子进程就省去了
+        // 逐项复制 1024 个页表项和修改 mem_map 的开销。
+        // 内核空间(任务0)的页表不在主内存区，没有引用计数，仍按原方式复制。
+        if (from) {
+            *from_dir &= (unsigned long)~2;
+            *to_dir = *from_dir;
+            get_page(phys_to_page(0xfffff000 & *from_dir));
+            continue;
+        }
+
         // 取空闲页面保存目的目录项对应的页表
         // 在验证了当前源目录项和目的项正常之后，我们取源目录项中页表地址 from_page_table。
         // 为了保存目的目录项对应的页表，需要在主内存区中申请 1 页空闲内存页。
@@ -536,7 +918,7 @@ int copy_page_tables(unsigned long from, unsigned long to, unsigned long size) {
         // 可能是内存不够, 于是返回-1值退出。
         from_page_table = (unsigned long *)(0xfffff000 & *from_dir);     // 把 *from_dir 的高20位取出来, 源目录项中页表的地址
         // s_printk("from_page_table = 0x%x, *from_page_table = 0x%x\n", from_page_table, *from_page_table);
-        if (!(to_page_table = (unsigned long *)get_free_page())) {      // 例: to_page_table = 0xffe000, 0xfff000 在 copy_process 中使用
+        if (!(to_page_table = (unsigned long *)get_pgtable_page())) {      // 例: to_page_table = 0xffe000, 0xfff000 在 copy_process 中使用
             return -1;                                                  //     为进程 1 管理结构
         }
         // s_printk("to_page_table = 0x%x, *to_page_table = 0x%x\n", to_page_table, *to_page_table);
@@ -550,6 +932,16 @@ int copy_page_tables(unsigned long from, unsigned long to, unsigned long size) {
         *to_dir = ((unsigned long) to_page_table) | 7;          // 设置标志
         // s_printk("to_dir = 0x%x, *to_dir = 0x%x\n", to_dir, *to_dir);
         nr = (from == 0) ? 0xA0 : 1024;                         // 若内核空间，则仅需复制头160页（640KB）
+        // 内核空间使用 4MB 页(PS=1)时没有页表，按 4MB 页的物理地址逐项生成只读的页表项
+        if (*from_dir & PAGE_PSE) {
+            for (this_page = 0; this_page < nr; this_page++) {
+                to_page_table[this_page] = ((*from_dir & 0xffc00000) + (this_page << 12)) | 5;
+                if (to_page_table[this_page] > LOW_MEM)
+                    get_page(phys_to_page(to_page_table[this_page]));
+            }
+            add_rss((unsigned long *) p->tss.cr3, (long) nr);
+            continue;
+        }
         // 此时对于当前页表，开始循环复制指定的 nr 个内存页面表项。先取出源页表的内容，
         // 如果当前源页表没有使用，则不用复制该表项，继续处理下一项。
         // 否则复位表项中 R/W 标志(位1置0)，即让页表对应的内存页面只读。
@@ -560,6 +952,7 @@ int copy_page_tables(unsigned long from, unsigned long to, unsigned long size) {
                 continue;
             this_page &= (unsigned long)~2;                     // 置为可读, 进程A创建进程B后继续执行,B的压栈写操作引发页写保护 page_fault
             *to_page_table = this_page;
+            add_rss((unsigned long *) p->tss.cr3, 1);
 
             // 如果该页表所指物理页面的地址在1MB以上，则需要设置内存页面映射数
             // 组 mem_map[]，于是计算页面号，并以它为索引在页面映射数组相应项中
@@ -576,10 +969,13 @@ int copy_page_tables(unsigned long from, unsigned long to, unsigned long size) {
             // 即进行写时复制(copy on write)操作。
             if(this_page > LOW_MEM) {                           // 主内存中
                 *from_page_table = this_page;                   // 令源页表项也只读
-                mem_map[MAP_NR(this_page)]++;
+                get_page(phys_to_page(this_page));
             }
         }
     }
+    // 共享页表时子进程的驻留页面与父进程相同(fork 总是复制整个用户空间)
+    if (from)
+        add_rss((unsigned long *) p->tss.cr3, (long) pgd_rss(current->tss.cr3));
     invalidate();        // 刷新页变换高速缓冲
     return 0;
 }
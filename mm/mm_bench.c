@@ -0,0 +1,114 @@
+/*
+ *  整页复制/清零的性能测试
+ *
+ *  用时间戳计数器测量 rep movsl/stosl 版本与 SSE2 版本(见 page_ops.c)的平均耗时(时钟周期/页):
+ *      1. clear_page: 清零 BENCH_PAGES 个页面;
+ *      2. copy_page: 复制 BENCH_PAGES 个页面;
+ *      3. 写时复制缺页: 在内核空间(USER_BASE 以下)一个没有使用的页目录项处映射 BENCH_PAGES 个只读的
+ *         共享页面(引用计数为 2，相当于 fork 之后)，内核逐页写入，每次写都经过 do_wp_page() -> un_wp_page()
+ *         复制页面。这一项包括异常处理本身的开销(memory.c 定义了 DEBUG 时还包括串口调试输出)。
+ *  前两项先运行一遍预热缓存，再计时。在 main() 中 mem_init() 之后、move_to_user_mode() 之前调用 mm_bench()。
+ */
+
+#include <linux/sched.h>
+#include <linux/kernel.h>
+#include <linux/head.h>
+#include <linux/mm.h>
+#include <asm/system.h>
+#include <asm/div64.h>
+
+#define invalidate() \
+    __asm__ volatile("mov %%eax, %%cr3"::"a" (current->tss.cr3))
+
+#define BENCH_PAGES 64
+
+static unsigned long bench_pages[2][BENCH_PAGES];
+
+static unsigned long bench_clear(void (*clear)(unsigned long)) {
+    unsigned long long t0, t1;
+    int i;
+
+    for (i = 0; i < BENCH_PAGES; i++)
+        clear(bench_pages[0][i]);
+    rdtscll(t0);
+    for (i = 0; i < BENCH_PAGES; i++)
+        clear(bench_pages[0][i]);
+    rdtscll(t1);
+    return div64_32(t1 - t0, BENCH_PAGES);
+}
+
+static unsigned long bench_copy(void (*copy)(unsigned long, unsigned long)) {
+    unsigned long long t0, t1;
+    int i;
+
+    for (i = 0; i < BENCH_PAGES; i++)
+        copy(bench_pages[0][i], bench_pages[1][i]);
+    rdtscll(t0);
+    for (i = 0; i < BENCH_PAGES; i++)
+        copy(bench_pages[0][i], bench_pages[1][i]);
+    rdtscll(t1);
+    return div64_32(t1 - t0, BENCH_PAGES);
+}
+
+// 写时复制缺页的平均耗时，使用当前的 copy_page() 实现。addr 处的页目录项没有使用
+static unsigned long bench_cow(unsigned long addr) {
+    unsigned long long t0, t1;
+    unsigned long page, *pte;
+    int i;
+
+    for (i = 0; i < BENCH_PAGES; i++) {
+        if (!(page = get_free_page()) || !put_page(current, page, addr + ((unsigned long)i << 12)))
+            panic("mm_bench: out of memory");
+        get_page(phys_to_page(page));       // 模拟 fork 之后与另一个进程共享
+        pte = (unsigned long *)(pg_dir[addr >> 22] & 0xfffff000) + i;
+        *pte &= ~2ul;
+        bench_pages[0][i] = page;
+    }
+    invalidate();
+    rdtscll(t0);
+    for (i = 0; i < BENCH_PAGES; i++)
+        *(volatile unsigned long *)(addr + ((unsigned long)i << 12)) = 1;
+    rdtscll(t1);
+    for (i = 0; i < BENCH_PAGES; i++)
+        free_page(bench_pages[0][i]);
+    free_page_tables(current, addr, 0x400000);
+    return div64_32(t1 - t0, BENCH_PAGES);
+}
+
+void mm_bench(void) {
+    unsigned long rep, sse2, saved = (unsigned long) sse2_page_ops, addr;
+    int i, j;
+
+    if (!(x86_capability & X86_FEATURE_TSC)) {
+        printk("mm_bench: no TSC\n");
+        return;
+    }
+    for (i = 0; i < 2; i++)
+        for (j = 0; j < BENCH_PAGES; j++)
+            if (!(bench_pages[i][j] = get_free_page()))
+                panic("mm_bench: out of memory");
+
+    rep = bench_clear(clear_page_rep);
+    sse2 = saved ? bench_clear(clear_page_sse2) : 0;
+    printk("clear_page: rep stosl %d cycles/page, sse2 %d cycles/page\n", rep, sse2);
+    rep = bench_copy(copy_page_rep);
+    sse2 = saved ? bench_copy(copy_page_sse2) : 0;
+    printk("copy_page: rep movsl %d cycles/page, sse2 %d cycles/page\n", rep, sse2);
+
+    for (i = 0; i < 2; i++)
+        for (j = 0; j < BENCH_PAGES; j++)
+            free_page(bench_pages[i][j]);
+
+    // 从 MAX_MEMORY(USER_BASE - 4MB) 往下找一个没有使用的页目录项，不用留给 SMP 的最后一项
+    for (addr = USER_BASE - 2 * 0x400000; addr >= 0x1000000 && pg_dir[addr >> 22]; addr -= 0x400000)
+        ;
+    if (addr < 0x1000000) {
+        printk("cow fault: no free page directory entry\n");
+        return;
+    }
+    sse2_page_ops = 0;
+    rep = bench_cow(addr);
+    sse2_page_ops = (int) saved;
+    sse2 = saved ? bench_cow(addr) : 0;
+    printk("cow fault: rep movsl %d cycles/fault, sse2 %d cycles/fault\n", rep, sse2);
+}
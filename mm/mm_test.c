@@ -4,13 +4,14 @@
  */
 
 #include <linux/kernel.h>
+#include <linux/sched.h>
+#include <linux/head.h>
 #include <linux/mm.h>
 #include <serial_debug.h>
 
-#define invalidate() \
-    __asm__ volatile("mov %%eax, %%cr3"::"a" (0))
+// 这里修改的是内核空间(全局页)的映射，需要刷新全部 TLB
+#define invalidate() flush_tlb_all()
 
-unsigned long put_page(unsigned long page, unsigned long address);
 
 void testoom() {
     for(int i = 0; i < 20 * 1024 * 1024; i += 4096)
@@ -36,12 +37,16 @@ unsigned long *linear_to_pte(unsigned long addr) {
     // get the Page Directory Entry first
     // This variable will be used to refer to pte later
     // (for saving memory XD)
-    unsigned long *pde = (unsigned long *)((addr >> 20) & 0xffc);
+    // (in the page directory of the current task)
+    unsigned long *pde = PAGE_DIR_OFFSET(current, addr);
     // Page dir not exist
-    // Or the address is not inside the page table address range(<=4KB)
-    if(!(*pde & 1) || (unsigned long)pde > 0x1000) {
+    if(!(*pde & 1)) {
         return 0;
     }
+    // 4MB page: the PDE itself maps the address
+    if(*pde & PAGE_PSE) {
+        return pde;
+    }
     // Now it is page table address :P
     pde = (unsigned long *)(*pde & 0xfffff000);
     // Page table address + page_table index = PTE
@@ -77,6 +82,7 @@ void mm_read_only(unsigned long addr) {
 
 void mm_print_pageinfo(unsigned long addr) {
     unsigned long *pte = linear_to_pte(addr);
+    if (!pte) return;
     s_printk("Linear addr: 0x%x, PTE addr = 0x%x. Flags[ ", addr, pte);
     if(*pte & 0x1) s_printk("P ");
     if(*pte & 0x2) s_printk("R/W ");
@@ -0,0 +1,180 @@
+/*
+ *  文件映射 mmap()/munmap()
+ *
+ *  每个进程最多 NR_MMAP 个映射区(文件映射和共享内存段，见 shm.c)，记录在 task_struct 的 mmap[] 中。
+ *  映射区放在当前 brk 之上(页面对齐)，同时把 brk 和 end_data 移到映射区末尾，这样段限长覆盖映射区，
+ *  而以后的 brk() 不能缩小到映射区以内。堆从映射区之上继续增长。
+ *
+ *  映射时只记录映射区，不读文件。访问映射区中不存在的页面时 do_no_page() 调用
+ *  filemap_nopage() 从页面缓存取得页面(见 filemap.c)。
+ *  munmap() 释放的地址空间不归还，以后访问该范围得到清零的页面。
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <linux/sched.h>
+#include <linux/kernel.h>
+#include <linux/mm.h>
+#include <linux/fs.h>
+#include <asm/segment.h>
+
+#define PAGE_ALIGN(addr) (((addr) + PAGE_SIZE - 1) & 0xfffff000)
+
+extern int sys_brk(unsigned long end_data_seg);
+
+// 查找进程 p 中包含逻辑地址 addr 的映射区
+struct vm_area_struct * find_vma(struct task_struct *p, unsigned long addr) {
+    struct vm_area_struct *vma;
+
+    for (vma = p->mmap; vma < p->mmap + NR_MMAP; vma++)
+        if (vma->vm_flags && addr >= vma->vm_start && addr < vma->vm_end)
+            return vma;
+    return NULL;
+}
+
+// 取当前进程的一个空闲映射区项，没有时返回 NULL
+struct vm_area_struct * get_vma_slot(void) {
+    struct vm_area_struct *vma;
+
+    for (vma = current->mmap; vma < current->mmap + NR_MMAP; vma++)
+        if (!vma->vm_flags)
+            return vma;
+    return NULL;
+}
+
+// 为 len 字节的映射区分配地址空间: addr 为 0 时放在当前 brk 之上，否则必须是 brk 之上页面对齐的地址。
+// 把 brk 和 end_data 移到映射区末尾，返回映射区开始地址，失败返回 0
+unsigned long get_unmapped_area(unsigned long addr, unsigned long len) {
+    unsigned long end;
+
+    if (!addr)
+        addr = PAGE_ALIGN(current->brk);
+    else if ((addr & 0xfff) || addr < PAGE_ALIGN(current->brk))
+        return 0;
+    end = addr + PAGE_ALIGN(len);
+    if (end <= addr || end > TASK_SIZE || (unsigned long)sys_brk(end) != end)
+        return 0;
+    current->end_data = end;
+    return addr;
+}
+
+// 把 MAP_SHARED 映射区中 [from, to) 范围内被修改过的页面写回文件
+static void sync_vma_range(struct vm_area_struct *vma, unsigned long from, unsigned long to) {
+    unsigned long base = get_base(current->ldt[2]), dir, pte, addr;
+
+    if (!(vma->vm_flags & MAP_SHARED))
+        return;
+    for (addr = from; addr < to; addr += PAGE_SIZE) {
+        dir = *PAGE_DIR_OFFSET(current, base + addr);
+        if (!(dir & 1) || (dir & PAGE_PSE))
+            continue;
+        pte = ((unsigned long *)(dir & 0xfffff000))[((base + addr) >> 12) & 0x3ff];
+        if ((pte & 0x41) != 0x41 || !(phys_to_page(pte & 0xfffff000)->flags & PG_cache))
+            continue;
+        filemap_sync_page(vma->vm_inode, vma->vm_pgoff + ((addr - vma->vm_start) >> 12),
+            pte & 0xfffff000);
+    }
+}
+
+// 取消映射区中 [from, to) 范围的映射: 写回修改过的共享页面，释放页面
+static void unmap_vma_range(struct vm_area_struct *vma, unsigned long from, unsigned long to) {
+    sync_vma_range(vma, from, to);
+    unmap_page_range(get_base(current->ldt[2]) + from, to - from);
+}
+
+// 映射文件，参数通过用户空间的 struct mmap_arg_struct 传入
+// 返回映射区的逻辑地址，出错返回负的错误号
+int sys_mmap(struct mmap_arg_struct *arg) {
+    struct vm_area_struct *vma;
+    struct file *file;
+    struct m_inode *inode;
+    unsigned long len, prot, flags, fd, offset, start;
+
+    len = get_fs_long((char *) &arg->len);
+    prot = get_fs_long((char *) &arg->prot);
+    flags = get_fs_long((char *) &arg->flags);
+    fd = get_fs_long((char *) &arg->fd);
+    offset = get_fs_long((char *) &arg->offset);
+
+    if (current == task[0] || (current->flags & PF_VFORK))
+        return -EINVAL;
+    if (!len || (offset & 0xfff) || (flags & MAP_FIXED))
+        return -EINVAL;
+    if ((flags & MAP_TYPE) != MAP_SHARED && (flags & MAP_TYPE) != MAP_PRIVATE)
+        return -EINVAL;
+    if (fd >= NR_OPEN || !(file = current->filp[fd]) || !(inode = file->f_inode))
+        return -EBADF;
+    if (!S_ISREG(inode->i_mode))
+        return -EACCES;
+    if ((flags & MAP_SHARED) && (prot & PROT_WRITE) && (file->f_flags & O_ACCMODE) == O_RDONLY)
+        return -EACCES;
+    if (!(vma = get_vma_slot()) || !(start = get_unmapped_area(0, len)))
+        return -ENOMEM;
+    vma->vm_start = start;
+    vma->vm_end = start + PAGE_ALIGN(len);
+    vma->vm_pgoff = offset >> 12;
+    vma->vm_flags = (unsigned short)(flags & MAP_TYPE);
+    vma->vm_prot = (unsigned short)prot;
+    vma->vm_inode = inode;
+    inode->i_count++;
+    return (int)start;
+}
+
+// 取消 [addr, addr + len) 范围内的文件映射，可以只取消映射区的一部分。共享内存段由 shmdt() 取消
+int sys_munmap(unsigned long addr, unsigned long len) {
+    struct vm_area_struct *vma, *new_vma;
+    unsigned long end = addr + PAGE_ALIGN(len);
+
+    if ((addr & 0xfff) || !len || end < addr)
+        return -EINVAL;
+    for (vma = current->mmap; vma < current->mmap + NR_MMAP; vma++) {
+        if (!vma->vm_inode || end <= vma->vm_start || addr >= vma->vm_end)
+            continue;
+        if (addr > vma->vm_start && end < vma->vm_end) {
+            // 取消中间的一部分，映射区分成两个
+            if (!(new_vma = get_vma_slot()))
+                return -ENOMEM;
+            *new_vma = *vma;
+            new_vma->vm_start = end;
+            new_vma->vm_pgoff += (end - vma->vm_start) >> 12;
+            vma->vm_inode->i_count++;
+            unmap_vma_range(vma, addr, end);
+            vma->vm_end = addr;
+        } else if (addr > vma->vm_start) {          // 取消后一部分
+            unmap_vma_range(vma, addr, vma->vm_end);
+            vma->vm_end = addr;
+        } else if (end < vma->vm_end) {             // 取消前一部分
+            unmap_vma_range(vma, vma->vm_start, end);
+            vma->vm_pgoff += (end - vma->vm_start) >> 12;
+            vma->vm_start = end;
+        } else {                                    // 整个映射区
+            unmap_vma_range(vma, vma->vm_start, vma->vm_end);
+            iput(vma->vm_inode);
+            vma->vm_inode = NULL;
+            vma->vm_flags = 0;
+        }
+    }
+    return 0;
+}
+
+// 进程退出时释放所有映射区: 写回修改过的共享页面，放回 i 节点，脱离共享内存段。
+// 页面由 free_page_tables() 释放。vfork 的子进程借用父进程的页表，不写回页面
+void exit_mmap(void) {
+    struct vm_area_struct *vma;
+
+    for (vma = current->mmap; vma < current->mmap + NR_MMAP; vma++) {
+        if (!vma->vm_flags)
+            continue;
+        if (vma->vm_flags & VM_SHM) {
+            shm_close(vma);
+        } else {
+            if (!(current->flags & PF_VFORK))
+                sync_vma_range(vma, vma->vm_start, vma->vm_end);
+            iput(vma->vm_inode);
+            vma->vm_inode = NULL;
+        }
+        vma->vm_flags = 0;
+    }
+}
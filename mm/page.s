@@ -18,12 +18,15 @@ page_fault:
     movl %cr2, %edx             # 取引起页面异常的线性地址
     pushl %edx                  # 将该线性地址和出错码压入栈中，作为将调用函数的参数
     pushl %eax
+    call lock_kernel            # 获取大内核锁(kernel/smp.c)，返回前释放
+    movl (%esp), %eax           # 恢复出错码
     testl $1, %eax              # 测试页存在标志P（位0），如果不是缺页引起的异常则跳转
     jne 1f
     call do_no_page            # 调用缺页处理函数 mm/memory.c 中
     jmp 2f
 1:  call do_wp_page            # 调用写保护处理函数 mm/mmemory.c 中
 2:  addl $8, %esp               # 丢弃压入栈中的两个参数
+    call unlock_kernel
 
     pop %fs
     pop %es
@@ -0,0 +1,138 @@
+/*
+ *  整页的复制和清零
+ *
+ *  写时复制(un_wp_page)和分配页面(get_free_page)都要处理整页，原来分别是 rep movsl 和 rep stosl。
+ *  CPU 支持 SSE2 时改用 128 位的非临时(non-temporal)存储 movntdq: 数据不经过缓存直接写到内存，
+ *  复制或清零一页不会把 4KB 的有用数据挤出缓存，每 64 字节一组展开 4 条指令，最后用 sfence
+ *  保证写入对其他访问可见。页面总是 4KB 对齐，可以使用对齐的 movdqa。
+ *
+ *  使用 xmm 寄存器前要像使用协处理器一样处理好状态 (kernel_fpu_begin/kernel_fpu_end):
+ *      - 任务切换会置位 CR0.TS，这时执行 SSE 指令会引起设备不存在异常(int 7)，
+ *        所以先 clts，用完后恢复原来的 CR0;
+ *      - 用到的 xmm0-xmm3 先保存在栈上，用完恢复，不破坏任何任务的寄存器内容;
+ *      - 期间禁止抢占(preempt_disable)，保证不会在抢占点切换到别的任务;
+ *        中断处理程序不使用 xmm 寄存器，因此中间不需要关中断。
+ *  page_ops_init() 检测 cpuid 的 SSE2 和 FXSR 标志，并设置 CR4.OSFXSR(位9)，
+ *  否则 SSE 指令会引起无效操作码异常。CR0.EM 置位(没有协处理器)时不使用 SSE2。
+ */
+
+#include <linux/kernel.h>
+#include <linux/head.h>
+#include <linux/mm.h>
+#include <linux/sched.h>
+
+int sse2_page_ops = 0;                  // 使用 SSE2 版本，由 page_ops_init() 设置
+
+struct xmm_save {
+    unsigned char regs[4][16];          // xmm0-xmm3
+    unsigned long cr0;
+};
+
+static inline void kernel_fpu_begin(struct xmm_save *save) {
+    preempt_disable();
+    __asm__ volatile("mov %%cr0, %0 ; clts" : "=r" (save->cr0));
+    __asm__ volatile(
+        "movdqu %%xmm0, 0(%0)\n\t"
+        "movdqu %%xmm1, 16(%0)\n\t"
+        "movdqu %%xmm2, 32(%0)\n\t"
+        "movdqu %%xmm3, 48(%0)"
+        :: "r" (save->regs) : "memory");
+}
+
+static inline void kernel_fpu_end(struct xmm_save *save) {
+    __asm__ volatile(
+        "sfence\n\t"
+        "movdqu 0(%0), %%xmm0\n\t"
+        "movdqu 16(%0), %%xmm1\n\t"
+        "movdqu 32(%0), %%xmm2\n\t"
+        "movdqu 48(%0), %%xmm3"
+        :: "r" (save->regs) : "memory");
+    __asm__ volatile("mov %0, %%cr0" :: "r" (save->cr0));
+    preempt_enable_no_resched();        // 不在这里调度: 调用者(写时复制等)复制完还要修改页表项
+}
+
+// rep movsl/stosl 版本，不支持 SSE2 时使用，也用于 mm_bench.c 的对比
+void copy_page_rep(unsigned long from, unsigned long to) {
+    int d0, d1, d2;
+
+    __asm__ volatile("cld ; rep ; movsl"
+        : "=&c" (d0), "=&S" (d1), "=&D" (d2)
+        : "0" (1024), "1" (from), "2" (to)
+        : "memory");
+}
+
+void clear_page_rep(unsigned long page) {
+    int d0, d1;
+
+    __asm__ volatile("cld ; rep ; stosl"
+        : "=&c" (d0), "=&D" (d1)
+        : "a" (0), "0" (1024), "1" (page)
+        : "memory");
+}
+
+void copy_page_sse2(unsigned long from, unsigned long to) {
+    struct xmm_save save;
+    int i;
+
+    kernel_fpu_begin(&save);
+    for (i = 0; i < PAGE_SIZE / 64; i++, from += 64, to += 64)
+        __asm__ volatile(
+            "prefetchnta 256(%0)\n\t"
+            "movdqa 0(%0), %%xmm0\n\t"
+            "movdqa 16(%0), %%xmm1\n\t"
+            "movdqa 32(%0), %%xmm2\n\t"
+            "movdqa 48(%0), %%xmm3\n\t"
+            "movntdq %%xmm0, 0(%1)\n\t"
+            "movntdq %%xmm1, 16(%1)\n\t"
+            "movntdq %%xmm2, 32(%1)\n\t"
+            "movntdq %%xmm3, 48(%1)"
+            :: "r" (from), "r" (to) : "memory");
+    kernel_fpu_end(&save);
+}
+
+void clear_page_sse2(unsigned long page) {
+    struct xmm_save save;
+    int i;
+
+    kernel_fpu_begin(&save);
+    __asm__ volatile("pxor %%xmm0, %%xmm0" ::);
+    for (i = 0; i < PAGE_SIZE / 64; i++, page += 64)
+        __asm__ volatile(
+            "movntdq %%xmm0, 0(%0)\n\t"
+            "movntdq %%xmm0, 16(%0)\n\t"
+            "movntdq %%xmm0, 32(%0)\n\t"
+            "movntdq %%xmm0, 48(%0)"
+            :: "r" (page) : "memory");
+    kernel_fpu_end(&save);
+}
+
+// 从 from 复制一页到 to
+void copy_page(unsigned long from, unsigned long to) {
+    if (sse2_page_ops)
+        copy_page_sse2(from, to);
+    else
+        copy_page_rep(from, to);
+}
+
+// 把一页清零
+void clear_page(unsigned long page) {
+    if (sse2_page_ops)
+        clear_page_sse2(page);
+    else
+        clear_page_rep(page);
+}
+
+void page_ops_init(void) {
+    unsigned long cr0, cr4;
+
+    if ((x86_capability & (X86_FEATURE_FXSR | X86_FEATURE_SSE2)) !=
+            (X86_FEATURE_FXSR | X86_FEATURE_SSE2))
+        return;
+    __asm__ volatile("mov %%cr0, %0" : "=r" (cr0));
+    if (cr0 & 4)                        // CR0.EM
+        return;
+    __asm__ volatile("mov %%cr4, %0" : "=r" (cr4));
+    __asm__ volatile("mov %0, %%cr4" :: "r" (cr4 | 0x200));
+    sse2_page_ops = 1;
+    printk("Using SSE2 page copy/clear\n");
+}
@@ -0,0 +1,200 @@
+/*
+ *  共享内存段 shmget/shmat/shmdt/shmctl
+ *
+ *  段是一组物理页面，段本身持有每个页面的一个引用。shmat() 在进程空间中分配一个映射区
+ *  (见 mmap.c，vm_flags 带 VM_SHM，vm_pgoff 为段号)，并用 put_shared_page() 把段的页面
+ *  直接映射进来，每个映射增加一次页面引用计数。多个进程连接同一个段时映射的是同一组物理页面，
+ *  写入的数据对其他进程立即可见，不需要经过内核复制。
+ *
+ *  段的页面在第一次连接时分配(清零)，不在 LRU 链表上，不会被换出，也不参与页面合并
+ *  (引用计数总是大于 1)。fork 后共享页表被分离时页表项被设为只读，写时由 do_wp_page()
+ *  恢复可写而不是复制。以 SHM_RDONLY 连接的映射区不可写，进程写该段时被 SIGSEGV 终止。
+ *
+ *  IPC_RMID 之后段不能再被查找和连接，最后一个进程脱离(或退出)时释放页面。
+ */
+
+#include <errno.h>
+#include <sys/shm.h>
+#include <sys/mman.h>
+#include <linux/sched.h>
+#include <linux/kernel.h>
+#include <linux/mm.h>
+#include <asm/segment.h>
+
+struct shm_segment {
+    key_t key;                          // 键值，IPC_PRIVATE 的段不能被查找
+    unsigned long size;                 // 段长度(字节)，0 表示空闲项
+    unsigned long npages;               // 页面数
+    unsigned long *pages;               // 页面物理地址数组(占一页)，0 表示尚未分配
+    unsigned long nattch;               // 当前连接数(映射区数)
+    int removed;                        // 已经 IPC_RMID，等待最后一个进程脱离
+    pid_t cpid, lpid;
+};
+
+static struct shm_segment shm_segs[SHMMNI];
+
+// 释放段的页面和页面数组，仍被映射的页面在各进程解除映射时才真正释放
+static void shm_destroy(struct shm_segment *shp) {
+    unsigned long i;
+
+    for (i = 0; i < shp->npages; i++) {
+        if (!shp->pages[i])
+            continue;
+        phys_to_page(shp->pages[i])->flags &= (unsigned short)~PG_shm;
+        free_page(shp->pages[i]);
+    }
+    free_page((unsigned long) shp->pages);
+    shp->pages = NULL;
+    shp->size = 0;
+}
+
+// 取段的第 idx 页，尚未分配时分配一页清零的页面，内存不足返回 0
+static unsigned long shm_page(struct shm_segment *shp, unsigned long idx) {
+    unsigned long page;
+
+    if (!(page = shp->pages[idx])) {
+        if (!(page = get_free_page()))
+            return 0;
+        phys_to_page(page)->flags |= PG_shm;
+        shp->pages[idx] = page;
+    }
+    return page;
+}
+
+// 取键值为 key 的段号，不存在且 shmflg 含 IPC_CREAT(或 key 为 IPC_PRIVATE)时创建长度为 size 的新段
+int sys_shmget(key_t key, unsigned long size, int shmflg) {
+    struct shm_segment *shp;
+    int id;
+
+    if (key != IPC_PRIVATE) {
+        for (id = 0; id < SHMMNI; id++) {
+            shp = shm_segs + id;
+            if (!shp->size || shp->removed || shp->key != key)
+                continue;
+            if ((shmflg & IPC_CREAT) && (shmflg & IPC_EXCL))
+                return -EEXIST;
+            if (size > shp->size)
+                return -EINVAL;
+            return id;
+        }
+        if (!(shmflg & IPC_CREAT))
+            return -ENOENT;
+    }
+    if (!size || size > SHMMAX)
+        return -EINVAL;
+    for (id = 0; id < SHMMNI; id++)
+        if (!shm_segs[id].size)
+            break;
+    if (id == SHMMNI)
+        return -ENOSPC;
+    shp = shm_segs + id;
+    if (!(shp->pages = (unsigned long *) get_free_page()))
+        return -ENOMEM;
+    shp->key = key;
+    shp->size = size;
+    shp->npages = (size + PAGE_SIZE - 1) >> 12;
+    shp->nattch = 0;
+    shp->removed = 0;
+    shp->cpid = current->pid;
+    shp->lpid = 0;
+    return id;
+}
+
+// 把段 shmid 连接到逻辑地址 shmaddr(为 0 时由内核在 brk 之上选择)处，返回连接的地址
+int sys_shmat(int shmid, unsigned long shmaddr, int shmflg) {
+    struct shm_segment *shp;
+    struct vm_area_struct *vma;
+    unsigned long addr, base, page, i;
+    int writable = !(shmflg & SHM_RDONLY);
+
+    if (current == task[0] || (current->flags & PF_VFORK))
+        return -EINVAL;
+    if (shmid < 0 || shmid >= SHMMNI || !(shp = shm_segs + shmid)->size || shp->removed)
+        return -EINVAL;
+    if (!(vma = get_vma_slot()))
+        return -ENOMEM;
+    if (!(addr = get_unmapped_area(shmaddr, shp->size)))
+        return shmaddr ? -EINVAL : -ENOMEM;
+    vma->vm_start = addr;
+    vma->vm_end = addr + (shp->npages << 12);
+    vma->vm_pgoff = (unsigned long) shmid;
+    vma->vm_flags = MAP_SHARED | VM_SHM;
+    vma->vm_prot = (unsigned short)(writable ? PROT_READ | PROT_WRITE : PROT_READ);
+    vma->vm_inode = NULL;
+    shp->nattch++;
+    shp->lpid = current->pid;
+    // 立即映射所有页面，之后访问该段不再缺页。内存不足时其余页面留给 shm_nopage()
+    base = get_base(current->ldt[2]);
+    for (i = 0; i < shp->npages; i++) {
+        if (!(page = shm_page(shp, i)))
+            break;
+        get_page(phys_to_page(page));
+        put_shared_page(page, base + addr + (i << 12), writable);
+    }
+    return (int) addr;
+}
+
+// 脱离连接在逻辑地址 shmaddr 处的段
+int sys_shmdt(unsigned long shmaddr) {
+    struct vm_area_struct *vma;
+
+    for (vma = current->mmap; vma < current->mmap + NR_MMAP; vma++) {
+        if (!(vma->vm_flags & VM_SHM) || vma->vm_start != shmaddr)
+            continue;
+        unmap_page_range(get_base(current->ldt[2]) + vma->vm_start, vma->vm_end - vma->vm_start);
+        shm_close(vma);
+        vma->vm_flags = 0;
+        return 0;
+    }
+    return -EINVAL;
+}
+
+int sys_shmctl(int shmid, int cmd, struct shmid_ds *buf) {
+    struct shm_segment *shp;
+
+    if (shmid < 0 || shmid >= SHMMNI || !(shp = shm_segs + shmid)->size)
+        return -EINVAL;
+    switch (cmd) {
+        case IPC_STAT:
+            verify_area(buf, sizeof(*buf));
+            put_fs_long((unsigned long) shp->key, (unsigned long *) &buf->shm_key);
+            put_fs_long(shp->size, (unsigned long *) &buf->shm_segsz);
+            put_fs_long((unsigned long) shp->cpid, (unsigned long *) &buf->shm_cpid);
+            put_fs_long((unsigned long) shp->lpid, (unsigned long *) &buf->shm_lpid);
+            put_fs_long(shp->nattch, &buf->shm_nattch);
+            return 0;
+        case IPC_RMID:
+            shp->removed = 1;
+            shp->key = IPC_PRIVATE;
+            if (!shp->nattch)
+                shm_destroy(shp);
+            return 0;
+    }
+    return -EINVAL;
+}
+
+// 共享内存映射区 vma 中线性地址 address 处的缺页: 返回段的页面(已为映射增加引用)，内存不足返回 0
+unsigned long shm_nopage(struct vm_area_struct *vma, unsigned long address) {
+    struct shm_segment *shp = shm_segs + vma->vm_pgoff;
+    unsigned long page;
+
+    if (!(page = shm_page(shp, (address - current->start_code - vma->vm_start) >> 12)))
+        return 0;
+    get_page(phys_to_page(page));
+    current->min_flt++;
+    return page;
+}
+
+// fork 复制了映射区
+void shm_open(struct vm_area_struct *vma) {
+    shm_segs[vma->vm_pgoff].nattch++;
+}
+
+// 映射区被取消(shmdt 或进程退出)，页面的映射由调用者解除
+void shm_close(struct vm_area_struct *vma) {
+    struct shm_segment *shp = shm_segs + vma->vm_pgoff;
+
+    shp->lpid = current->pid;
+    if (!--shp->nattch && shp->removed)
+        shm_destroy(shp);
+}
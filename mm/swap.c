@@ -0,0 +1,422 @@
+/*
+ *  页面回收与交换
+ *
+ *  用户空间的页面(进程通过缺页、写时复制映射的主内存页面)按最近使用情况
+ *  挂在两个 LRU 链表上: active 链表和 inactive 链表。页面描述结构的 next/prev
+ *  用于链接，index 和 pgd 记录页面所映射的线性地址和映射它的进程的页目录(用于找回页表项，
+ *  即简单的反向映射)。进程释放页目录时清除指向它的 pgd，这样的页面暂不回收。
+ *
+ *  当空闲页面数低于 FREE_PAGES_LOW 时，在安全点(缺页处理、fork 等可以睡眠的地方)
+ *  调用 try_to_free_pages() 回收页面:
+ *      1. active 链表头部的页面移到 inactive 链表，并清除其页表项的访问位(A);
+ *      2. 扫描 inactive 链表，访问位又被置位的页面说明最近用过，放回 active 链表;
+ *      3. 其余页面写到交换设备上，页表项改为交换项，释放物理页面。
+ *  之后进程再访问该页面时产生缺页异常，do_no_page() 调用 swap_in() 读回页面。
+ *
+ *  交换项(不存在的页表项)格式:
+ *
+ *      31               12              7      1    0
+ *      --------------------------------------------------
+ *      |   交换页面号     |      0       |  type  | P=0 |
+ *      --------------------------------------------------
+ *
+ *  type 0 为交换设备(硬盘分区)，type 1 为压缩内存(zram，见 zram.c)。回收时先尝试 zram，
+ *  zram 不能保存(不可压缩或内存池已满)时才写交换设备。两种类型的页面号都从 1 开始，
+ *  因此交换项永远不为 0，与从未映射的页表项(0)区分开。
+ *
+ *  交换设备的第 1 页是位图，置位的位表示对应页面可以使用，最后 10 个字节是签名
+ *  "SWAP-SPACE"(与 Linux 0.12 的 mkswap 格式相同)。
+ */
+
+#include <string.h>
+#include <linux/sched.h>
+#include <linux/kernel.h>
+#include <linux/head.h>
+#include <linux/mm.h>
+#include <linux/fs.h>
+#include <asm/system.h>
+#include <asm/div64.h>
+#include <serial_debug.h>
+
+// 换出时修改的是其他进程的页表，它们可能正在其他 CPU 上运行，多处理器时让其他 CPU 也刷新
+#define invalidate() do { \
+    __asm__ volatile("mov %%eax, %%cr3"::"a" (current->tss.cr3)); \
+    if (smp_num_cpus > 1) \
+        smp_flush_tlb(); \
+} while (0)
+
+#define SWAP_MAP_BAD 0xff               // 不可用(坏的或超出交换区)的交换页面
+#define SWAP_MAP_MAX 0xfe               // 交换页面引用计数的上限
+
+int SWAP_DEV = 0;                       // 交换设备号，由 main() 从引导扇区读出
+
+// 交换页面引用计数，0 表示空闲。fork 共享页表后再分离时，同一个交换项会出现在多个页表中
+static unsigned char swap_map[SWAP_MAX_PAGES];
+static int lowest_bit = 0, highest_bit = 0;     // 可用交换页面的范围，[lowest_bit, highest_bit]
+int nr_swap_pages = 0;                          // 空闲交换页面数
+
+// LRU 链表，以一个不对应任何物理页面的 struct page 作为循环双向链表的表头
+static struct page active_list = { 0, 0, &active_list, &active_list, 0, NULL, 0, 0, NULL };
+static struct page inactive_list = { 0, 0, &inactive_list, &inactive_list, 0, NULL, 0, 0, NULL };
+unsigned long nr_active_pages = 0, nr_inactive_pages = 0;
+
+unsigned long swap_out_pages = 0;               // 换出的页面数
+unsigned long swap_in_pages = 0;                // 换入的页面数
+
+// 换入缺页的耗时(时间戳计数器周期数)，分 zram 和交换设备统计
+static unsigned long long zram_fault_cycles = 0, disk_fault_cycles = 0;
+static unsigned long zram_faults = 0, disk_faults = 0;
+
+static inline void list_del(struct page *page) {
+    page->prev->next = page->next;
+    page->next->prev = page->prev;
+    page->next = page->prev = NULL;
+}
+
+static inline void list_add_tail(struct page *page, struct page *head) {
+    page->next = head;
+    page->prev = head->prev;
+    head->prev->next = page;
+    head->prev = page;
+}
+
+static inline void activate_page(struct page *page) {
+    list_del(page);
+    if (!(page->flags & PG_active)) {
+        nr_inactive_pages--;
+        nr_active_pages++;
+        page->flags |= PG_active;
+    }
+    list_add_tail(page, &active_list);
+}
+
+static inline void deactivate_page(struct page *page) {
+    list_del(page);
+    if (page->flags & PG_active) {
+        nr_active_pages--;
+        nr_inactive_pages++;
+        page->flags &= (unsigned short)~PG_active;
+    }
+    list_add_tail(page, &inactive_list);
+}
+
+// 把映射在任务 tsk 的线性地址 address 处的物理页面 addr 加入 LRU(active 链表尾)
+// 已在 LRU 中的页面只更新其反向映射(例如写时复制后页面只剩一个使用者)
+void lru_cache_add(struct task_struct *tsk, unsigned long addr, unsigned long address) {
+    struct page *page;
+
+    if (addr < LOW_MEM)
+        return;
+    page = phys_to_page(addr);
+    if (page->flags & PG_reserved)
+        return;
+    page->index = address & 0xfffff000;
+    page->pgd = (unsigned long *) tsk->tss.cr3;
+    if (page->flags & PG_lru)
+        return;
+    page->flags |= PG_lru | PG_active;
+    list_add_tail(page, &active_list);
+    nr_active_pages++;
+}
+
+// 页面被释放(引用计数为 0)时由 free_page() 调用，从 LRU 中删除
+void lru_cache_del(struct page *page) {
+    if (!(page->flags & PG_lru))
+        return;
+    list_del(page);
+    if (page->flags & PG_active)
+        nr_active_pages--;
+    else
+        nr_inactive_pages--;
+    page->flags &= (unsigned short)~(PG_lru | PG_active);
+}
+
+// 根据页面记录的页目录和线性地址找到映射它的页表项
+// 只处理用户空间中、页表不与其他进程共享(目录项可写)并且确实映射着该页面的情况，
+// 否则返回 NULL，这样的页面暂不回收(例如 fork 后仍共享的页面，或者记录的地址已经过时)。
+static unsigned long * page_pte(struct page *page) {
+    unsigned long dir, *pte;
+
+    if (!page->pgd || page->index < USER_BASE)
+        return NULL;
+    dir = page->pgd[page->index >> 22];
+    if ((dir & 3) != 3 || (dir & PAGE_PSE))
+        return NULL;
+    if (page_count(phys_to_page(dir & 0xfffff000)) != 1)
+        return NULL;
+    pte = (unsigned long *)(dir & 0xfffff000) + ((page->index >> 12) & 0x3ff);
+    if (!(*pte & 1) || (*pte & 0xfffff000) != page_address(page))
+        return NULL;
+    return pte;
+}
+
+// 取得一个空闲交换页面，返回其页面号，没有空闲交换页面时返回 0
+static int get_swap_page(void) {
+    int nr;
+
+    if (!nr_swap_pages)
+        return 0;
+    for (nr = lowest_bit; nr <= highest_bit; nr++)
+        if (!swap_map[nr]) {
+            swap_map[nr] = 1;
+            nr_swap_pages--;
+            lowest_bit = nr + 1;
+            return nr;
+        }
+    return 0;
+}
+
+// 增加交换项的引用计数(页表项被复制到另一个页表中)
+void swap_duplicate(unsigned long entry) {
+    unsigned long nr = SWP_OFFSET(entry);
+
+    if (SWP_TYPE(entry) == SWP_TYPE_ZRAM) {
+        zram_duplicate(nr);
+        return;
+    }
+    if (SWP_TYPE(entry) != SWP_TYPE_DISK || !nr || nr >= SWAP_MAX_PAGES ||
+            swap_map[nr] == SWAP_MAP_BAD || !swap_map[nr]) {
+        printk("swap_duplicate: bad swap entry %x\n", entry);
+        return;
+    }
+    if (swap_map[nr] < SWAP_MAP_MAX)
+        swap_map[nr]++;
+    else
+        printk("swap_duplicate: swap page %d overflow\n", nr);
+}
+
+// 减少交换项的引用计数，为 0 时交换页面空闲
+void swap_free(unsigned long entry) {
+    unsigned long nr = SWP_OFFSET(entry);
+
+    if (SWP_TYPE(entry) == SWP_TYPE_ZRAM) {
+        zram_free(nr);
+        return;
+    }
+    if (SWP_TYPE(entry) != SWP_TYPE_DISK || !nr || nr >= SWAP_MAX_PAGES ||
+            swap_map[nr] == SWAP_MAP_BAD || !swap_map[nr]) {
+        printk("swap_free: bad swap entry %x\n", entry);
+        return;
+    }
+    if (--swap_map[nr])
+        return;
+    nr_swap_pages++;
+    if ((int)nr < lowest_bit)
+        lowest_bit = (int)nr;
+}
+
+#define read_swap_page(nr, buffer) ll_rw_page(READ, SWAP_DEV, (nr), (buffer))
+#define write_swap_page(nr, buffer) ll_rw_page(WRITE, SWAP_DEV, (nr), (buffer))
+
+// 尝试换出 inactive 链表上的一个页面。成功返回 1
+// 页表项先原子地改成只读并清除脏位(D)，刷新所有 CPU 的 TLB，之后进程写页面会引起写保护异常，
+// 内核写页面同样如此(CR0.WP 已置位)。其他 CPU 在刷新之前通过旧的 TLB 项写页面会置位 D。
+// 首先压缩保存到 zram，这一步不会睡眠，压缩后 D 仍为 0 就可以直接修改页表项并释放页面。
+// 写交换设备的过程中进程会睡眠等待写盘完成，为此:
+//  - 写盘前先增加页面的引用计数，页面不会被释放或重新分配，写时复制会复制页面(页面已被"共享");
+//  - 写盘完成后重新从页目录查找页表项，只有页表项没有变化(忽略访问位)时才真正换出，
+//    否则放弃本次换出，释放交换页面。
+// 放弃换出时页表项保持只读，进程下次写时由 un_wp_page() 恢复可写。
+static int try_to_swap_out(struct page *page) {
+    unsigned long *pte, addr, entry;
+    int nr;
+
+    if (page_count(page) != 1 || !(pte = page_pte(page)))
+        return 0;
+    addr = page_address(page);
+    pte_clear_bits(pte, 2ul | 0x40ul);
+    invalidate();
+    if ((nr = zram_store(addr))) {
+        if (*pte & 0x40) {                  // 刷新 TLB 之前又被写过，压缩的内容可能不是最新的
+            zram_free((unsigned long) nr);
+            return 0;
+        }
+        *pte = SWP_ENTRY(SWP_TYPE_ZRAM, nr);
+        invalidate();
+        add_rss(page->pgd, -1);
+        free_page(addr);
+        swap_out_pages++;
+        return 1;
+    }
+    entry = *pte;
+    if ((entry & 0x40) || !(nr = get_swap_page()))
+        return 0;
+    get_page(page);
+    if (!write_swap_page(nr, (char *) addr)) {
+        swap_map[nr] = SWAP_MAP_BAD;        // 写不进去的交换页面不再使用(已从空闲数中减去)
+        free_page(addr);
+        return 0;
+    }
+    pte = page_pte(page);
+    if (pte && page_count(page) == 2 && (*pte & ~0x20ul) == (entry & ~0x20ul)) {
+        *pte = SWP_ENTRY(SWP_TYPE_DISK, nr);
+        invalidate();
+        add_rss(page->pgd, -1);
+        free_page(addr);                    // 页表项不再引用该页面
+        swap_out_pages++;
+        nr = -1;
+    } else
+        swap_free(SWP_ENTRY(SWP_TYPE_DISK, nr));
+    free_page(addr);                        // 释放写盘期间的引用，页面回到空闲链表
+    return nr < 0;
+}
+
+// 从 active 链表头部取 count 个页面: 访问位置位的页面清除访问位后放回 active 尾部，
+// 其余移到 inactive 链表
+static void refill_inactive(int count) {
+    struct page *page;
+    unsigned long *pte;
+    int flush = 0;
+
+    while (count-- > 0 && (page = active_list.next) != &active_list) {
+        if ((pte = page_pte(page)) && (*pte & 0x20)) {
+            pte_clear_bits(pte, 0x20);
+            flush = 1;
+            activate_page(page);
+        } else
+            deactivate_page(page);
+    }
+    if (flush)
+        invalidate();
+}
+
+// 回收最多 count 个页面，返回实际回收的页面数。首先释放未被映射的页面缓存页面，再换出 LRU 页面
+// 只能在可以睡眠的进程上下文中调用。任务 0 不能睡眠，所以不做回收。
+int try_to_free_pages(int count) {
+    struct page *page;
+    unsigned long *pte;
+    unsigned long scan;
+    int freed;
+
+    // 先释放没有被映射的页面缓存页面，它们是干净的，不需要写出
+    if ((freed = shrink_page_cache(count)) >= count)
+        return freed;
+    if ((!nr_swap_pages && !zram_pool_limit) || current == task[0])
+        return freed;
+    scan = (nr_active_pages + nr_inactive_pages) * 2;
+    while (freed < count && scan-- > 0) {
+        cond_resched();                     // 压缩或写盘每个页面都很慢，每个页面之前是一个抢占点
+        if (nr_inactive_pages < nr_active_pages)
+            refill_inactive(SWAP_CLUSTER);
+        if ((page = inactive_list.next) == &inactive_list)
+            break;
+        // 先把页面移到链表尾部，这样即使下面睡眠期间链表发生变化，下一次仍从链表头继续
+        list_del(page);
+        list_add_tail(page, &inactive_list);
+        if ((pte = page_pte(page)) && (*pte & 0x20)) {
+            pte_clear_bits(pte, 0x20);
+            invalidate();
+            activate_page(page);
+            continue;
+        }
+        freed += try_to_swap_out(page);
+    }
+    return freed;
+}
+
+// 空闲页面不足时回收到 FREE_PAGES_HIGH。在缺页处理、fork 等可以睡眠的地方调用
+void check_free_pages(void) {
+    if (nr_free_pages < FREE_PAGES_LOW)
+        try_to_free_pages(FREE_PAGES_HIGH - (int)nr_free_pages);
+}
+
+// 换入页面。pte 是线性地址 address 对应的页表项，其内容是交换项。
+// zram 中的页面直接解压；读盘时进程会睡眠，读完后若页表项已经变化(不应该发生)就放弃读入的页面。
+// 读盘出错时页面内容不可用，不能映射给进程: 保留交换项，以 SIGSEGV 终止进程。
+void swap_in(unsigned long *pte, unsigned long address) {
+    unsigned long page, entry = *pte;
+    unsigned long long t0 = 0, t1 = 0;
+    int uptodate = 1;
+
+    if ((SWP_TYPE(entry) != SWP_TYPE_DISK && SWP_TYPE(entry) != SWP_TYPE_ZRAM) ||
+            !SWP_OFFSET(entry) || SWP_OFFSET(entry) >= SWAP_MAX_PAGES) {
+        printk("swap_in: bad swap entry %x at %x\n", entry, address);
+        *pte = 0;
+        return;
+    }
+    if (!(page = get_free_page()))
+        panic("swap_in: Out Of Memory");
+    if (x86_capability & X86_FEATURE_TSC)
+        rdtscll(t0);
+    if (SWP_TYPE(entry) == SWP_TYPE_ZRAM)
+        zram_load(SWP_OFFSET(entry), page);
+    else
+        uptodate = read_swap_page((int)SWP_OFFSET(entry), (char *) page);
+    if (x86_capability & X86_FEATURE_TSC)
+        rdtscll(t1);
+    if (*pte != entry) {
+        free_page(page);
+        return;
+    }
+    if (!uptodate) {
+        printk("swap_in: read error at %x, swap page %d, pid %d killed\n",
+            address, SWP_OFFSET(entry), current->pid);
+        free_page(page);
+        do_exit(SIGSEGV);
+    }
+    if (SWP_TYPE(entry) == SWP_TYPE_ZRAM) {
+        zram_fault_cycles += t1 - t0;
+        zram_faults++;
+    } else {
+        disk_fault_cycles += t1 - t0;
+        disk_faults++;
+    }
+    *pte = page | 7;
+    swap_free(entry);
+    lru_cache_add(current, page, address);
+    add_rss((unsigned long *) current->tss.cr3, 1);
+    current->maj_flt++;
+    swap_in_pages++;
+}
+
+// 读入交换区头部并初始化 swap_map，在 sys_setup() 中挂载根文件系统之前调用
+void init_swapping(void) {
+    unsigned char *header;
+    int i, j;
+
+    if (!SWAP_DEV)
+        return;
+    if (!(header = (unsigned char *) get_free_page()))
+        return;
+    if (!read_swap_page(0, (char *) header)) {
+        printk("Unable to read swap-space header\n\r");
+        free_page((unsigned long) header);
+        return;
+    }
+    if (strncmp("SWAP-SPACE", (char *) header + 4086, 10)) {
+        printk("Unable to find swap-space signature\n\r");
+        free_page((unsigned long) header);
+        return;
+    }
+    memset(header + 4086, 0, 10);
+    swap_map[0] = SWAP_MAP_BAD;
+    lowest_bit = highest_bit = 0;
+    for (i = 1, j = 0; i < SWAP_MAX_PAGES; i++) {
+        if (!((header[i >> 3] >> (i & 7)) & 1)) {
+            swap_map[i] = SWAP_MAP_BAD;
+            continue;
+        }
+        swap_map[i] = 0;
+        if (!lowest_bit)
+            lowest_bit = i;
+        highest_bit = i;
+        j++;
+    }
+    free_page((unsigned long) header);
+    if (!j) {
+        printk("Empty swap-file\n");
+        return;
+    }
+    nr_swap_pages = j;
+    printk("Swap device ok: %d pages (%dkB) swap-space\n\r", j, j * 4);
+}
+
+// 显示 LRU 和交换统计，调试使用
+void swap_stat(void) {
+    printk("lru: %d active, %d inactive; swap: %d free, %d out, %d in\n",
+        nr_active_pages, nr_inactive_pages, nr_swap_pages, swap_out_pages, swap_in_pages);
+    zram_stat();
+    printk("swap-in latency: zram %d faults, avg %d cycles; disk %d faults, avg %d cycles\n",
+        zram_faults, div64_32(zram_fault_cycles, zram_faults),
+        disk_faults, div64_32(disk_fault_cycles, disk_faults));
+}
@@ -0,0 +1,343 @@
+/*
+ *  压缩内存交换(zram)
+ *
+ *  回收页面时首先尝试把页面压缩后保存在内存池中(交换项类型 SWP_TYPE_ZRAM)，
+ *  压缩失败或内存池已满时才写到交换设备上。换入时在 do_no_page() 中解压，不需要等待硬盘。
+ *
+ *  - 全 0 或由同一个 32 位值填满的页面只记录该值，不占用内存池;
+ *  - 其余页面用下面的 LZ 压缩算法(LZ4 风格的字节格式)压缩，压缩后超过 3/4 页的视为不可压缩;
+ *  - 内存池按 zbud 方式管理: 每个池页面最多存放两个对象，一个从页面开始处存放(first)，
+ *    另一个从页面末尾向前存放(last)。池页面的 struct page 中 index 低 16 位是 first 的长度、
+ *    高 16 位是 last 的长度，只用了一半的池页面通过 next/prev 链接在 unbuddied 链表上。
+ *
+ *  交换项中的页面号是 zram_slots[] 的下标，从 1 开始。
+ */
+
+#include <string.h>
+#include <linux/sched.h>
+#include <linux/kernel.h>
+#include <linux/head.h>
+#include <linux/mm.h>
+#include <serial_debug.h>
+
+#define ZRAM_MAX_SIZE (PAGE_SIZE * 3 / 4)       // 压缩后的最大长度
+
+#define MINMATCH 4                              // 最短匹配长度
+#define HASH_BITS 12
+#define HASH_SIZE (1 << HASH_BITS)
+
+#define ZBUD_FIRST(page) ((page)->index & 0xffff)
+#define ZBUD_LAST(page) ((page)->index >> 16)
+
+// 一个被压缩保存的页面
+struct zram_slot {
+    unsigned long handle;       // 池中对象的位置(池页面地址 | 0:first 1:last)，同值页面时为填充值
+    unsigned short size;        // 压缩后的长度，0 表示同值页面
+    unsigned char count;        // 引用计数，0 表示空闲
+    unsigned char pad;
+};
+
+static struct zram_slot zram_slots[ZRAM_MAX_PAGES];
+static int zram_lowest = 1;                     // 可能空闲的最小槽号
+
+static struct page unbuddied = { 0, 0, &unbuddied, &unbuddied, 0, NULL, 0, 0, NULL };
+
+static unsigned short hash_table[HASH_SIZE];    // 压缩用的哈希表，保存位置 + 1
+static unsigned char zbuffer[PAGE_SIZE];        // 压缩输出缓冲区
+
+unsigned long zram_pool_limit = 0;              // 内存池最多使用的页面数，由 zram_init() 设置
+unsigned long zram_pool_pages = 0;              // 内存池当前使用的页面数
+unsigned long zram_stored = 0;                  // 当前保存的页面数
+unsigned long zram_same = 0;                    // 其中同值页面数
+unsigned long zram_compr_bytes = 0;             // 压缩后的总字节数
+unsigned long zram_rejected = 0;                // 不可压缩或内存池已满而交给硬盘的页面数
+
+static inline unsigned long read32(const unsigned char *p) {
+    return *(const unsigned long *) p;
+}
+
+static inline unsigned long lz_hash(unsigned long v) {
+    return (v * 2654435761ul) >> (32 - HASH_BITS);
+}
+
+// 输出长度的扩展字节: 每个 255 表示继续
+static inline int lz_put_len(unsigned char *dst, int op, int max, int len) {
+    for (; len >= 255; len -= 255) {
+        if (op >= max)
+            return -1;
+        dst[op++] = 255;
+    }
+    if (op >= max)
+        return -1;
+    dst[op++] = (unsigned char) len;
+    return op;
+}
+
+// 输出一个序列: 标记字节(高 4 位字面量长度，低 4 位匹配长度 - 4)、
+// 字面量长度扩展、字面量、2 字节偏移、匹配长度扩展。mlen 为 0 表示最后一个序列(没有匹配)
+static int lz_put_seq(unsigned char *dst, int op, int max, const unsigned char *lit,
+        int llen, int offset, int mlen) {
+    unsigned char *token;
+    int ml = mlen ? mlen - MINMATCH : 0;
+
+    if (op >= max)
+        return -1;
+    token = dst + op++;
+    *token = (unsigned char)(((llen < 15 ? llen : 15) << 4) | (ml < 15 ? ml : 15));
+    if (llen >= 15 && (op = lz_put_len(dst, op, max, llen - 15)) < 0)
+        return -1;
+    if (op + llen > max)
+        return -1;
+    memcpy(dst + op, lit, llen);
+    op += llen;
+    if (!mlen)
+        return op;
+    if (op + 2 > max)
+        return -1;
+    dst[op++] = (unsigned char) offset;
+    dst[op++] = (unsigned char)(offset >> 8);
+    if (ml >= 15 && (op = lz_put_len(dst, op, max, ml - 15)) < 0)
+        return -1;
+    return op;
+}
+
+// 压缩一页 src 到 dst，返回压缩后的长度，超过 max 时返回 0
+static int lz_compress(const unsigned char *src, unsigned char *dst, int max) {
+    int ip = 0, anchor = 0, op = 0, ref, len;
+    unsigned long seq, h;
+
+    memset(hash_table, 0, sizeof(hash_table));
+    while (ip + MINMATCH <= PAGE_SIZE) {
+        seq = read32(src + ip);
+        h = lz_hash(seq);
+        ref = hash_table[h] - 1;
+        hash_table[h] = (unsigned short)(ip + 1);
+        if (ref < 0 || read32(src + ref) != seq) {
+            ip++;
+            continue;
+        }
+        for (len = MINMATCH; ip + len < PAGE_SIZE && src[ref + len] == src[ip + len]; len++)
+            /* nothing */ ;
+        if ((op = lz_put_seq(dst, op, max, src + anchor, ip - anchor, ip - ref, len)) < 0)
+            return 0;
+        ip += len;
+        anchor = ip;
+    }
+    if ((op = lz_put_seq(dst, op, max, src + anchor, PAGE_SIZE - anchor, 0, 0)) < 0)
+        return 0;
+    return op;
+}
+
+// 解压 size 字节的 src 到 dst(一页)，数据损坏时返回 -1
+static int lz_decompress(const unsigned char *src, int size, unsigned char *dst) {
+    int ip = 0, op = 0, len, offset;
+    unsigned char token, c;
+
+    while (ip < size) {
+        token = src[ip++];
+        len = token >> 4;
+        if (len == 15)
+            do {
+                if (ip >= size)
+                    return -1;
+                c = src[ip++];
+                len += c;
+            } while (c == 255);
+        if (ip + len > size || op + len > PAGE_SIZE)
+            return -1;
+        memcpy(dst + op, src + ip, len);
+        ip += len;
+        op += len;
+        if (ip >= size)
+            break;                              // 最后一个序列只有字面量
+        if (ip + 2 > size)
+            return -1;
+        offset = src[ip] | (src[ip + 1] << 8);
+        ip += 2;
+        len = token & 15;
+        if (len == 15)
+            do {
+                if (ip >= size)
+                    return -1;
+                c = src[ip++];
+                len += c;
+            } while (c == 255);
+        len += MINMATCH;
+        if (!offset || offset > op || op + len > PAGE_SIZE)
+            return -1;
+        for (; len > 0; len--, op++)            // 匹配可能与输出重叠，逐字节复制
+            dst[op] = dst[op - offset];
+    }
+    return op == PAGE_SIZE ? 0 : -1;
+}
+
+static inline void unbuddied_del(struct page *page) {
+    page->prev->next = page->next;
+    page->next->prev = page->prev;
+    page->next = page->prev = NULL;
+}
+
+static inline void unbuddied_add(struct page *page) {
+    page->next = unbuddied.next;
+    page->prev = &unbuddied;
+    unbuddied.next->prev = page;
+    unbuddied.next = page;
+}
+
+// 在内存池中分配 size 字节，返回句柄，失败返回 0
+static unsigned long zbud_alloc(int size) {
+    struct page *page;
+    unsigned long addr;
+
+    for (page = unbuddied.next; page != &unbuddied; page = page->next) {
+        if (PAGE_SIZE - ZBUD_FIRST(page) - ZBUD_LAST(page) < (unsigned long) size)
+            continue;
+        unbuddied_del(page);
+        if (!ZBUD_FIRST(page)) {
+            page->index |= (unsigned long) size;
+            return page_address(page);
+        }
+        page->index |= (unsigned long) size << 16;
+        return page_address(page) | 1;
+    }
+    if (zram_pool_pages >= zram_pool_limit || !(addr = get_free_page()))
+        return 0;
+    zram_pool_pages++;
+    page = phys_to_page(addr);
+    page->index = (unsigned long) size;
+    unbuddied_add(page);
+    return addr;
+}
+
+static inline unsigned char * zbud_map(unsigned long handle) {
+    struct page *page = phys_to_page(handle & 0xfffff000);
+
+    if (handle & 1)
+        return (unsigned char *)((handle & 0xfffff000) + PAGE_SIZE - ZBUD_LAST(page));
+    return (unsigned char *)(handle & 0xfffff000);
+}
+
+static void zbud_free(unsigned long handle) {
+    struct page *page = phys_to_page(handle & 0xfffff000);
+    int full = ZBUD_FIRST(page) && ZBUD_LAST(page);
+
+    if (handle & 1)
+        page->index &= 0xffff;
+    else
+        page->index &= 0xffff0000;
+    if (!page->index) {                         // 两个对象都已释放
+        if (!full)
+            unbuddied_del(page);
+        free_page(handle & 0xfffff000);
+        zram_pool_pages--;
+    } else if (full)
+        unbuddied_add(page);
+}
+
+static int get_zram_slot(void) {
+    int nr;
+
+    for (nr = zram_lowest; nr < ZRAM_MAX_PAGES; nr++)
+        if (!zram_slots[nr].count) {
+            zram_lowest = nr + 1;
+            return nr;
+        }
+    return 0;
+}
+
+// 压缩保存物理页面 page，返回槽号，不能保存时返回 0(由调用者写到交换设备)
+// 不会睡眠
+int zram_store(unsigned long page) {
+    unsigned long *p = (unsigned long *) page, handle;
+    int nr, i, size;
+
+    if (!zram_pool_limit || !(nr = get_zram_slot()))
+        return 0;
+    for (i = 1; i < PAGE_SIZE / 4 && p[i] == p[0]; i++)
+        /* nothing */ ;
+    if (i == PAGE_SIZE / 4) {
+        zram_slots[nr].handle = p[0];
+        zram_slots[nr].size = 0;
+        zram_same++;
+    } else {
+        if (!(size = lz_compress((unsigned char *) page, zbuffer, ZRAM_MAX_SIZE)) ||
+                !(handle = zbud_alloc(size))) {
+            zram_rejected++;
+            return 0;
+        }
+        memcpy(zbud_map(handle), zbuffer, size);
+        zram_slots[nr].handle = handle;
+        zram_slots[nr].size = (unsigned short) size;
+        zram_compr_bytes += (unsigned long) size;
+    }
+    zram_slots[nr].count = 1;
+    zram_stored++;
+    return nr;
+}
+
+static inline int bad_slot(unsigned long nr) {
+    return !nr || nr >= ZRAM_MAX_PAGES || !zram_slots[nr].count;
+}
+
+// 把槽 nr 中的页面解压到物理页面 page
+void zram_load(unsigned long nr, unsigned long page) {
+    struct zram_slot *slot = zram_slots + nr;
+    unsigned long *p = (unsigned long *) page;
+    int i;
+
+    if (bad_slot(nr))
+        panic("zram_load: bad slot");
+    if (!slot->size) {
+        for (i = 0; i < PAGE_SIZE / 4; i++)
+            p[i] = slot->handle;
+        return;
+    }
+    if (lz_decompress(zbud_map(slot->handle), slot->size, (unsigned char *) page))
+        panic("zram_load: corrupted page");
+}
+
+void zram_duplicate(unsigned long nr) {
+    if (bad_slot(nr)) {
+        printk("zram_duplicate: bad slot %d\n", nr);
+        return;
+    }
+    if (zram_slots[nr].count < 0xff)
+        zram_slots[nr].count++;
+    else
+        printk("zram_duplicate: slot %d overflow\n", nr);
+}
+
+void zram_free(unsigned long nr) {
+    struct zram_slot *slot = zram_slots + nr;
+
+    if (bad_slot(nr)) {
+        printk("zram_free: bad slot %d\n", nr);
+        return;
+    }
+    if (--slot->count)
+        return;
+    if (slot->size) {
+        zbud_free(slot->handle);
+        zram_compr_bytes -= slot->size;
+    } else
+        zram_same--;
+    zram_stored--;
+    if ((int) nr < zram_lowest)
+        zram_lowest = (int) nr;
+}
+
+// 内存池最多使用主内存区的 1/4，由 mem_init() 调用
+void zram_init(void) {
+    zram_pool_limit = nr_free_pages / 4;
+}
+
+// 显示 zram 统计，调试使用。压缩率为压缩保存的页面数与所用内存池页面数之比(百分数)
+void zram_stat(void) {
+    unsigned long ratio = 0;
+
+    if (zram_pool_pages)
+        ratio = (zram_stored - zram_same) * 100 / zram_pool_pages;
+    printk("zram: %d pages (%d same-filled), %d bytes in %d/%d pool pages, ratio %d%%, %d rejected\n",
+        zram_stored, zram_same, zram_compr_bytes, zram_pool_pages, zram_pool_limit,
+        ratio, zram_rejected);
+}